@@ -0,0 +1,79 @@
+#ifndef AUDIO_FILE_TYPE_H
+#define AUDIO_FILE_TYPE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "WavFormat.h"
+
+enum AudioFileType {
+    AUDIO_FILE_UNKNOWN,
+    AUDIO_FILE_WAV,
+    AUDIO_FILE_MP3
+};
+
+// Bytes detectAudioFileType() needs from the start of a file
+static const uint32_t AUDIO_FILE_SIGNATURE_SIZE = 12;
+
+// MPEG audio frame header of layer III (version, layer, bitrate and sample rate valid)
+static inline bool isMp3FrameHeader(const uint8_t* h) {
+    return h[0] == 0xFF && (h[1] & 0xE0) == 0xE0 && ((h[1] >> 3) & 3) != 1 && ((h[1] >> 1) & 3) == 1 &&
+           (h[2] >> 4) != 0 && (h[2] >> 4) != 15 && ((h[2] >> 2) & 3) != 3;
+}
+
+// Tells the container apart by its signature, not by the file name
+static inline AudioFileType detectAudioFileType(const uint8_t* head, uint32_t len) {
+    if (len >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WAVE", 4) == 0) return AUDIO_FILE_WAV;
+    if (len >= 3 && memcmp(head, "ID3", 3) == 0) return AUDIO_FILE_MP3;
+    if (len >= 4 && isMp3FrameHeader(head)) return AUDIO_FILE_MP3;
+    return AUDIO_FILE_UNKNOWN;
+}
+
+// Skips an ID3v2 tag and reads the first frame header into format, with the average byte rate
+// taken from that frame (exact for constant bitrate files, an estimate for VBR).
+// Reader is the same as for parseWavHeader(). dataLength is left 0, the caller knows the file size.
+template <typename Reader>
+bool parseMp3Header(Reader& reader, WavFormat& format) {
+    static const uint16_t BITRATES_V1[15] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 };
+    static const uint16_t BITRATES_V2[15] = { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 };
+    static const uint16_t SAMPLE_RATES[3] = { 44100, 48000, 32000 };
+    static const uint32_t MAX_SYNC_SEARCH = 4096; // Padding allowed between the tag and the first frame
+
+    uint8_t h[10];
+    if (reader.read(h, 4) != 4) return false;
+    uint32_t offset = 4;
+    if (memcmp(h, "ID3", 3) == 0) {
+        if (reader.read(h + 4, 6) != 6) return false;
+        // Tag size is stored in 7 bit bytes, a footer adds another 10 bytes
+        uint32_t tagSize = ((uint32_t)(h[6] & 0x7F) << 21) | ((uint32_t)(h[7] & 0x7F) << 14) | ((h[8] & 0x7F) << 7) | (h[9] & 0x7F);
+        if (h[5] & 0x10) tagSize += 10;
+        if (tagSize && !reader.skip(tagSize)) return false;
+        offset = 10 + tagSize;
+        if (reader.read(h, 4) != 4) return false;
+        offset += 4;
+    }
+    uint32_t searched = 0;
+    while (!isMp3FrameHeader(h)) {
+        if (++searched > MAX_SYNC_SEARCH) return false;
+        memmove(h, h + 1, 3);
+        if (reader.read(h + 3, 1) != 1) return false;
+        offset++;
+    }
+
+    uint8_t version = (h[1] >> 3) & 3; // 3 = MPEG 1, 2 = MPEG 2, 0 = MPEG 2.5
+    uint32_t bitrate = (version == 3 ? BITRATES_V1 : BITRATES_V2)[h[2] >> 4] * 1000;
+    uint32_t sampleRate = SAMPLE_RATES[(h[2] >> 2) & 3];
+    if (version == 2) sampleRate /= 2;
+    if (version == 0) sampleRate /= 4;
+
+    format = WavFormat();
+    format.formatTag = WavFormat::FORMAT_MPEG_LAYER3;
+    format.channels = (h[3] >> 6) == 3 ? 1 : 2;
+    format.sampleRate = sampleRate;
+    format.bitsPerSample = 16; // Decoded output
+    format.blockAlign = 1;
+    format.byteRate = bitrate / 8;
+    format.dataOffset = offset - 4;
+    return true;
+}
+
+#endif
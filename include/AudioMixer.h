@@ -0,0 +1,44 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <stdint.h>
+
+// Fixed-point helpers for mixing blocks of interleaved 16 bit samples.
+// Gains are Q15, 32768 is unity.
+namespace AudioMixer {
+
+static const int32_t UNITY_GAIN = 32768;
+
+static inline int16_t saturate16(int32_t value) {
+    if (value > 32767) return 32767;
+    if (value < -32768) return -32768;
+    return (int16_t)value;
+}
+
+static inline int32_t gainToQ15(float gain) {
+    if (gain <= 0.0f) return 0;
+    if (gain >= 1.0f) return UNITY_GAIN;
+    return (int32_t)(gain * UNITY_GAIN + 0.5f);
+}
+
+static inline void clear(int32_t* accumulator, uint32_t samples) {
+    for (uint32_t i = 0; i < samples; i++) accumulator[i] = 0;
+}
+
+// accumulator += source * gain, the 32 bit accumulator cannot overflow for any sane voice count
+static inline void accumulate(int32_t* accumulator, const int16_t* source, uint32_t samples, int32_t gainQ15) {
+    if (gainQ15 == UNITY_GAIN) {
+        for (uint32_t i = 0; i < samples; i++) accumulator[i] += source[i];
+    } else if (gainQ15 > 0) {
+        for (uint32_t i = 0; i < samples; i++) accumulator[i] += (source[i] * gainQ15) >> 15;
+    }
+}
+
+// Clips the sum back to 16 bit
+static inline void saturate(int16_t* dest, const int32_t* accumulator, uint32_t samples) {
+    for (uint32_t i = 0; i < samples; i++) dest[i] = saturate16(accumulator[i]);
+}
+
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef CALL_ENGINE_H
+#define CALL_ENGINE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include "WavFormat.h"
+
+// Address of the other phone, IPv4 in network byte order and the UDP port
+struct CallPeer {
+    uint32_t address = 0;
+    uint16_t port = 0;
+
+    bool operator==(const CallPeer& other) const {
+        return address == other.address && port == other.port;
+    }
+};
+
+// Phone-to-phone calls over UDP, signaling and audio on one port. The engine only builds and
+// parses packets and keeps the call state; sockets, timers and audio belong to the caller,
+// which passes its millisecond clock to every method.
+//
+// Every packet starts with a HEADER_SIZE byte header, little endian:
+//   'H' 'P' version type, call id (32 bit), sequence (16 bit), hold time (16 bit, ms),
+//   timestamp (32 bit, samples), send time (32 bit, ms), echoed send time (32 bit, ms)
+// INVITE carries the caller's number, AUDIO one frame of 16 bit mono samples.
+// INVITE and ANSWER are repeated until the other side reacts. A phone that receives audio or
+// an answer for a call it does not know replies HANGUP, so a lost HANGUP heals itself.
+// Audio packets echo the newest send time of the other side and how long it was held,
+// which gives the round trip time without synchronized clocks.
+class CallEngine {
+public:
+    enum State {
+        IDLE,
+        OUTGOING,  // INVITE sent, waiting for the other phone
+        RINGBACK,  // The other phone rings
+        INCOMING,  // This phone rings
+        CONNECTED
+    };
+
+    enum EndReason {
+        HUNG_UP,        // By this phone
+        REMOTE_HANGUP,
+        BUSY,
+        UNREACHABLE,    // No reaction to the INVITE
+        NO_ANSWER,
+        MEDIA_TIMEOUT   // Audio stopped arriving
+    };
+
+    enum PacketType { INVITE = 1, RING, ANSWER, HANGUP, BUSY_HERE, AUDIO };
+
+    static const uint8_t VERSION = 1;
+    static const uint32_t HEADER_SIZE = 24;
+    static const uint32_t MAX_NUMBER = 15;
+    static const uint32_t RETRANSMIT_MS = 250;
+    static const uint32_t RETRANSMITS = 8;
+    static const uint32_t RING_TIMEOUT_MS = 60000;
+    static const uint32_t MEDIA_TIMEOUT_MS = 3000;
+
+    typedef std::function<bool(const CallPeer&, const uint8_t*, size_t)> Send;
+    // One frame: sequence, timestamp in samples, the samples, the sender's clock when it was sent
+    typedef std::function<void(uint16_t, uint32_t, const int16_t*, uint32_t)> AudioCallback;
+    typedef std::function<void(State, State)> StateCallback;
+
+    CallEngine(uint16_t frameSamples, uint32_t seed, Send send)
+        : frameSamples(frameSamples), send(send), random(seed | 1) {
+    }
+
+    void onAudio(AudioCallback callback) { audioCallback = callback; }
+    void onStateChanged(StateCallback callback) { stateCallback = callback; }
+
+    bool call(const CallPeer& to, const char* callerNumber, uint32_t nowMs) {
+        if (state != IDLE) return false;
+        startCall(to, nextCallId());
+        copyNumber(localNumber, callerNumber);
+        remoteNumber[0] = 0;
+        setState(OUTGOING, nowMs);
+        sendInvite(nowMs);
+        return true;
+    }
+
+    bool answer(uint32_t nowMs) {
+        if (state != INCOMING) return false;
+        setState(CONNECTED, nowMs);
+        sendControl(ANSWER, nowMs);
+        return true;
+    }
+
+    // Turns an incoming call away as busy
+    bool reject(uint32_t nowMs) {
+        if (state != INCOMING) return false;
+        sendControl(BUSY_HERE, nowMs);
+        end(HUNG_UP, nowMs);
+        return true;
+    }
+
+    void hangup(uint32_t nowMs) {
+        if (state == IDLE) return;
+        sendControl(HANGUP, nowMs);
+        end(HUNG_UP, nowMs);
+    }
+
+    void receive(const CallPeer& from, const uint8_t* data, size_t len, uint32_t nowMs) {
+        if (len < HEADER_SIZE || data[0] != 'H' || data[1] != 'P' || data[2] != VERSION) {
+            invalidPackets++;
+            return;
+        }
+        receivedPackets++;
+        uint8_t type = data[3];
+        uint32_t id = wavRead32(data + 4);
+        bool current = state != IDLE && id == callId && from == peer;
+
+        if (type == INVITE) {
+            if (current) {
+                // Our RING or ANSWER got lost
+                sendControl(state == CONNECTED ? ANSWER : RING, nowMs);
+            } else if (state == IDLE) {
+                startCall(from, id);
+                copyNumber(remoteNumber, (const char*)data + HEADER_SIZE, len - HEADER_SIZE);
+                sendControl(RING, nowMs);
+                setState(INCOMING, nowMs);
+            } else {
+                reply(from, id, BUSY_HERE, nowMs);
+            }
+            return;
+        }
+        if (!current) {
+            // Leftovers of an ended call, tell the other side to stop
+            if ((type == AUDIO || type == ANSWER) && nowMs - lastStrayReplyMs >= RETRANSMIT_MS) {
+                lastStrayReplyMs = nowMs;
+                reply(from, id, HANGUP, nowMs);
+            }
+            return;
+        }
+        lastHeardMs = nowMs;
+        if (type == RING) {
+            if (state == OUTGOING) setState(RINGBACK, nowMs);
+        } else if (type == ANSWER) {
+            if (state == OUTGOING || state == RINGBACK) setState(CONNECTED, nowMs);
+        } else if (type == HANGUP) {
+            end(REMOTE_HANGUP, nowMs);
+        } else if (type == BUSY_HERE) {
+            if (state == OUTGOING || state == RINGBACK) end(BUSY, nowMs);
+        } else if (type == AUDIO && state == CONNECTED) {
+            answerConfirmed = true;
+            receiveAudio(data, len, nowMs);
+        }
+    }
+
+    // Sends one frame of frameSamples samples, only while connected
+    bool sendAudio(const int16_t* samples, uint32_t nowMs) {
+        if (state != CONNECTED) return false;
+        uint8_t packet[HEADER_SIZE + MAX_FRAME_BYTES];
+        uint32_t bytes = frameSamples * sizeof(int16_t);
+        if (bytes > MAX_FRAME_BYTES) return false;
+        buildHeader(packet, AUDIO, callId, nowMs);
+        wavWrite16(packet + 8, audioSeq++);
+        wavWrite32(packet + 12, audioTimestamp);
+        audioTimestamp += frameSamples;
+        // Both the ESP32 and PCs are little endian like the packet
+        memcpy(packet + HEADER_SIZE, samples, bytes);
+        return transmit(peer, packet, HEADER_SIZE + bytes);
+    }
+
+    // Retransmissions and timeouts, call it every few milliseconds
+    void poll(uint32_t nowMs) {
+        if (state == OUTGOING && nowMs - lastSentMs >= RETRANSMIT_MS) {
+            if (retransmits++ >= RETRANSMITS) {
+                end(UNREACHABLE, nowMs);
+                return;
+            }
+            sendInvite(nowMs);
+        } else if ((state == RINGBACK || state == INCOMING) && nowMs - stateSinceMs >= RING_TIMEOUT_MS) {
+            sendControl(HANGUP, nowMs);
+            end(NO_ANSWER, nowMs);
+        } else if (state == CONNECTED) {
+            if (!answerConfirmed && callee && nowMs - lastSentMs >= RETRANSMIT_MS && retransmits++ < RETRANSMITS) {
+                sendControl(ANSWER, nowMs);
+            }
+            if (nowMs - lastHeardMs >= MEDIA_TIMEOUT_MS) {
+                sendControl(HANGUP, nowMs);
+                end(MEDIA_TIMEOUT, nowMs);
+            }
+        }
+    }
+
+    State getState() const { return state; }
+    EndReason getEndReason() const { return endReason; }
+    const CallPeer& getPeer() const { return peer; }
+    const char* getRemoteNumber() const { return remoteNumber; }
+    uint16_t getFrameSamples() const { return frameSamples; }
+    // Smoothed round trip time, 0 until audio flowed both ways
+    uint32_t getRttMs() const { return rttMs; }
+    uint32_t getSentPackets() const { return sentPackets; }
+    uint32_t getReceivedPackets() const { return receivedPackets; }
+    uint32_t getInvalidPackets() const { return invalidPackets; }
+
+    static const char* getStateName(State state) {
+        static const char* names[] = { "idle", "outgoing", "ringback", "incoming", "connected" };
+        return names[state];
+    }
+
+    static const char* getEndReasonName(EndReason reason) {
+        static const char* names[] = { "hung up", "remote hangup", "busy", "unreachable", "no answer", "media timeout" };
+        return names[reason];
+    }
+
+private:
+    static const uint32_t MAX_FRAME_BYTES = 1024;
+    static const uint16_t NO_ECHO = 0xFFFF;
+
+    uint16_t frameSamples;
+    Send send;
+    AudioCallback audioCallback;
+    StateCallback stateCallback;
+    uint32_t random;
+    State state = IDLE;
+    EndReason endReason = HUNG_UP;
+    CallPeer peer;
+    uint32_t callId = 0;
+    bool callee = false;
+    char localNumber[MAX_NUMBER + 1] = "";
+    char remoteNumber[MAX_NUMBER + 1] = "";
+    uint32_t stateSinceMs = 0;
+    uint32_t lastSentMs = 0;
+    uint32_t lastHeardMs = 0;
+    uint32_t lastStrayReplyMs = 0;
+    uint32_t retransmits = 0;
+    bool answerConfirmed = false;
+    uint16_t audioSeq = 0;
+    uint32_t audioTimestamp = 0;
+    uint32_t peerSentMs = 0;     // Newest send time of the other side, echoed back
+    uint32_t peerHeardMs = 0;
+    bool havePeerSent = false;
+    uint32_t rttMs = 0;
+    uint32_t sentPackets = 0;
+    uint32_t receivedPackets = 0;
+    uint32_t invalidPackets = 0;
+
+    // xorshift32, call ids only need to differ between calls
+    uint32_t nextCallId() {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        return random;
+    }
+
+    void startCall(const CallPeer& to, uint32_t id) {
+        peer = to;
+        callId = id;
+        retransmits = 0;
+        answerConfirmed = false;
+        audioSeq = (uint16_t)nextCallId();
+        audioTimestamp = nextCallId();
+        havePeerSent = false;
+        rttMs = 0;
+    }
+
+    void setState(State newState, uint32_t nowMs) {
+        State oldState = state;
+        state = newState;
+        stateSinceMs = nowMs;
+        lastHeardMs = nowMs;
+        retransmits = 0;
+        if (newState == INCOMING) callee = true;
+        else if (newState == OUTGOING) callee = false;
+        if (stateCallback) stateCallback(oldState, newState);
+    }
+
+    void end(EndReason reason, uint32_t nowMs) {
+        endReason = reason;
+        setState(IDLE, nowMs);
+    }
+
+    static void copyNumber(char* target, const char* source, size_t len = MAX_NUMBER) {
+        size_t n = 0;
+        while (n < len && n < MAX_NUMBER && source[n]) {
+            target[n] = source[n];
+            n++;
+        }
+        target[n] = 0;
+    }
+
+    void buildHeader(uint8_t* packet, uint8_t type, uint32_t id, uint32_t nowMs) {
+        packet[0] = 'H';
+        packet[1] = 'P';
+        packet[2] = VERSION;
+        packet[3] = type;
+        wavWrite32(packet + 4, id);
+        wavWrite16(packet + 8, 0);
+        wavWrite32(packet + 12, 0);
+        wavWrite32(packet + 16, nowMs);
+        if (havePeerSent) {
+            uint32_t held = nowMs - peerHeardMs;
+            wavWrite16(packet + 10, held < NO_ECHO ? (uint16_t)held : NO_ECHO);
+            wavWrite32(packet + 20, peerSentMs);
+        } else {
+            wavWrite16(packet + 10, NO_ECHO);
+            wavWrite32(packet + 20, 0);
+        }
+    }
+
+    bool transmit(const CallPeer& to, const uint8_t* packet, size_t len) {
+        sentPackets++;
+        return send(to, packet, len);
+    }
+
+    void sendControl(uint8_t type, uint32_t nowMs) {
+        uint8_t packet[HEADER_SIZE];
+        buildHeader(packet, type, callId, nowMs);
+        lastSentMs = nowMs;
+        transmit(peer, packet, HEADER_SIZE);
+    }
+
+    void sendInvite(uint32_t nowMs) {
+        uint8_t packet[HEADER_SIZE + MAX_NUMBER];
+        buildHeader(packet, INVITE, callId, nowMs);
+        size_t len = strlen(localNumber);
+        memcpy(packet + HEADER_SIZE, localNumber, len);
+        lastSentMs = nowMs;
+        transmit(peer, packet, HEADER_SIZE + len);
+    }
+
+    void reply(const CallPeer& to, uint32_t id, uint8_t type, uint32_t nowMs) {
+        uint8_t packet[HEADER_SIZE];
+        buildHeader(packet, type, id, nowMs);
+        transmit(to, packet, HEADER_SIZE);
+    }
+
+    void receiveAudio(const uint8_t* data, size_t len, uint32_t nowMs) {
+        uint32_t sentMs = wavRead32(data + 16);
+        uint16_t held = wavRead16(data + 10);
+        if (held != NO_ECHO) {
+            uint32_t rtt = nowMs - wavRead32(data + 20) - held;
+            if (rtt < RING_TIMEOUT_MS) {
+                rttMs = rttMs == 0 ? rtt : (rttMs * 7 + rtt) / 8;
+            }
+        }
+        peerSentMs = sentMs;
+        peerHeardMs = nowMs;
+        havePeerSent = true;
+        if (len != HEADER_SIZE + frameSamples * sizeof(int16_t) || !audioCallback) return;
+        // The payload is not aligned for int16_t access
+        int16_t samples[MAX_FRAME_BYTES / sizeof(int16_t)];
+        memcpy(samples, data + HEADER_SIZE, len - HEADER_SIZE);
+        audioCallback(wavRead16(data + 8), wavRead32(data + 12), samples, sentMs);
+    }
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef CONFERENCE_BRIDGE_H
+#define CONFERENCE_BRIDGE_H
+
+#include <stdint.h>
+#include <functional>
+#include "CallEngine.h"
+#include "JitterBuffer.h"
+#include "ConferenceMixer.h"
+
+// Party line for phones that call it like any other phone (see CallEngine.h). Every call is
+// answered at once and gets its own engine and jitter buffer. tick() runs once per frame on the
+// bridge's clock: it takes one frame from every connected participant, mixes them and sends
+// each participant everyone else. The owner passes packets in and measures tick() for CPU load.
+class ConferenceBridge {
+public:
+    // Participant index and whether it joined or left
+    typedef std::function<void(uint16_t, bool)> MemberCallback;
+
+    ConferenceBridge(uint16_t maxParticipants, uint16_t frameSamples, uint32_t sampleRate, uint16_t jitterSlots,
+                     uint32_t seed, CallEngine::Send send)
+        : maxParticipants(maxParticipants), frameSamples(frameSamples), mixer(maxParticipants, frameSamples),
+          overflow(frameSamples, seed ^ 0x5A5A5A5A, send) {
+        participants = new Participant[maxParticipants];
+        mixBuffer = new int16_t[frameSamples];
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            Participant& participant = participants[p];
+            participant.engine = new CallEngine(frameSamples, seed + p * 7919, send);
+            participant.jitter = new JitterBuffer(frameSamples, jitterSlots, sampleRate);
+            JitterBuffer* jitter = participant.jitter;
+            participant.engine->onAudio([this, jitter](uint16_t seq, uint32_t timestamp, const int16_t* samples, uint32_t sentMs) {
+                jitter->push(seq, timestamp, samples, nowForPush, sentMs);
+            });
+            participant.engine->onStateChanged([this, p](CallEngine::State oldState, CallEngine::State newState) {
+                if (newState == CallEngine::CONNECTED) {
+                    participants[p].jitter->reset();
+                    if (memberCallback) memberCallback(p, true);
+                } else if (oldState == CallEngine::CONNECTED && memberCallback) {
+                    memberCallback(p, false);
+                }
+            });
+        }
+    }
+
+    ~ConferenceBridge() {
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            delete participants[p].engine;
+            delete participants[p].jitter;
+        }
+        delete[] participants;
+        delete[] mixBuffer;
+    }
+
+    ConferenceBridge(const ConferenceBridge&) = delete;
+    ConferenceBridge& operator=(const ConferenceBridge&) = delete;
+
+    bool isAllocated() const {
+        if (!mixer.isAllocated()) return false;
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            if (!participants[p].jitter->isAllocated()) return false;
+        }
+        return true;
+    }
+
+    void onMember(MemberCallback callback) { memberCallback = callback; }
+
+    // Heap a bridge of this size takes, allocator overhead aside. Lets the owner fit the
+    // participants to the free heap before allocating.
+    static uint32_t bytesFor(uint16_t maxParticipants, uint16_t frameSamples, uint16_t jitterSlots) {
+        uint32_t participant = sizeof(Participant) + sizeof(CallEngine) + sizeof(JitterBuffer) +
+                               sizeof(int16_t) * frameSamples * (jitterSlots + 2) + 8 * jitterSlots + sizeof(bool);
+        return sizeof(ConferenceBridge) + sizeof(int32_t) * frameSamples + sizeof(int16_t) * frameSamples + maxParticipants * participant;
+    }
+
+    // A call to the bridge starts with an INVITE, anything else belongs to a call it knows
+    static bool isInvite(const uint8_t* data, size_t len) {
+        return len >= CallEngine::HEADER_SIZE && data[3] == CallEngine::INVITE;
+    }
+
+    void receive(const CallPeer& from, const uint8_t* data, size_t len, uint32_t nowMs) {
+        nowForPush = nowMs;
+        int32_t slot = find(from);
+        bool invite = isInvite(data, len);
+        if (slot < 0 && invite) slot = findFree();
+        if (slot < 0) {
+            // Full, or leftovers of a call that ended: the spare engine answers busy or hangup
+            overflow.receive(from, data, len, nowMs);
+            overflow.reject(nowMs);
+            return;
+        }
+        CallEngine* engine = participants[slot].engine;
+        engine->receive(from, data, len, nowMs);
+        if (engine->getState() == CallEngine::INCOMING) {
+            engine->answer(nowMs);
+        }
+    }
+
+    // Retransmissions and timeouts of all calls, call it every few milliseconds
+    void poll(uint32_t nowMs) {
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            participants[p].engine->poll(nowMs);
+        }
+    }
+
+    // One frame period: collect, mix and send. Returns the participants mixed.
+    uint16_t tick(uint32_t nowMs) {
+        uint16_t count = 0;
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            bool connected = participants[p].engine->getState() == CallEngine::CONNECTED;
+            mixer.setActive(p, connected);
+            if (!connected) continue;
+            if (participants[p].jitter->pop(mixer.getInput(p), nullptr) == JitterBuffer::CONCEALED) concealed++;
+            count++;
+        }
+        if (count == 0) return 0;
+        mixer.mix();
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            if (participants[p].engine->getState() != CallEngine::CONNECTED) continue;
+            mixer.render(p, mixBuffer);
+            participants[p].engine->sendAudio(mixBuffer, nowMs);
+        }
+        frames++;
+        return count;
+    }
+
+    // Ends every call, e.g. when the bridge is switched off
+    void hangupAll(uint32_t nowMs) {
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            participants[p].engine->hangup(nowMs);
+        }
+    }
+
+    uint16_t getParticipantCount() const {
+        uint16_t count = 0;
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            if (participants[p].engine->getState() == CallEngine::CONNECTED) count++;
+        }
+        return count;
+    }
+
+    uint16_t getMaxParticipants() const { return maxParticipants; }
+    const CallEngine& getEngine(uint16_t participant) const { return *participants[participant].engine; }
+    const JitterBuffer& getJitterBuffer(uint16_t participant) const { return *participants[participant].jitter; }
+    uint32_t getFrames() const { return frames; }
+    uint32_t getConcealedFrames() const { return concealed; }
+
+private:
+    struct Participant {
+        CallEngine* engine;
+        JitterBuffer* jitter;
+    };
+
+    uint16_t maxParticipants;
+    uint16_t frameSamples;
+    ConferenceMixer mixer;
+    CallEngine overflow;
+    Participant* participants;
+    int16_t* mixBuffer;
+    MemberCallback memberCallback;
+    uint32_t nowForPush = 0; // Arrival time for the jitter buffers, set by receive()
+    uint32_t frames = 0;
+    uint32_t concealed = 0;
+
+    int32_t find(const CallPeer& from) const {
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            const CallEngine* engine = participants[p].engine;
+            if (engine->getState() != CallEngine::IDLE && engine->getPeer() == from) return p;
+        }
+        return -1;
+    }
+
+    int32_t findFree() const {
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            if (participants[p].engine->getState() == CallEngine::IDLE) return p;
+        }
+        return -1;
+    }
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef CONFERENCE_MIXER_H
+#define CONFERENCE_MIXER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "AudioMixer.h"
+
+// Mixes one frame per participant so that everyone hears everyone else. The active inputs
+// are summed once and each participant's mix is the sum minus its own frame, so a round
+// costs two passes per participant instead of one pass per pair. All buffers are allocated
+// by the constructor.
+class ConferenceMixer {
+public:
+    ConferenceMixer(uint16_t maxParticipants, uint16_t frameSamples)
+        : maxParticipants(maxParticipants), frameSamples(frameSamples) {
+        inputs = (int16_t*)malloc(sizeof(int16_t) * frameSamples * maxParticipants);
+        sum = (int32_t*)malloc(sizeof(int32_t) * frameSamples);
+        active = (bool*)calloc(maxParticipants, sizeof(bool));
+    }
+
+    ~ConferenceMixer() {
+        free(inputs);
+        free(sum);
+        free(active);
+    }
+
+    ConferenceMixer(const ConferenceMixer&) = delete;
+    ConferenceMixer& operator=(const ConferenceMixer&) = delete;
+
+    bool isAllocated() const { return inputs && sum && active; }
+
+    // Where the participant's next frame goes, fill it before mix()
+    int16_t* getInput(uint16_t participant) {
+        return inputs + participant * frameSamples;
+    }
+
+    // Inactive participants neither contribute nor get a mix
+    void setActive(uint16_t participant, bool isActive) {
+        active[participant] = isActive;
+    }
+
+    // Sums the frames of all active participants
+    void mix() {
+        AudioMixer::clear(sum, frameSamples);
+        for (uint16_t p = 0; p < maxParticipants; p++) {
+            if (active[p]) AudioMixer::accumulate(sum, getInput(p), frameSamples, AudioMixer::UNITY_GAIN);
+        }
+    }
+
+    // Everyone but the participant, clipped to 16 bit
+    void render(uint16_t participant, int16_t* out) {
+        const int16_t* own = getInput(participant);
+        if (!active[participant]) {
+            AudioMixer::saturate(out, sum, frameSamples);
+            return;
+        }
+        for (uint16_t i = 0; i < frameSamples; i++) {
+            out[i] = AudioMixer::saturate16(sum[i] - own[i]);
+        }
+    }
+
+    uint16_t getMaxParticipants() const { return maxParticipants; }
+    uint16_t getFrameSamples() const { return frameSamples; }
+
+private:
+    uint16_t maxParticipants;
+    uint16_t frameSamples;
+    int16_t* inputs;
+    int32_t* sum;
+    bool* active;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef DELAYED_SOURCE_H
+#define DELAYED_SOURCE_H
+
+#include <stdint.h>
+#include <functional>
+
+// Wraps a file source and waits before every open() and read(), to simulate slow SD cards in
+// latency benchmarks. The wait is a callback: delayMicroseconds() on the device, a simulated
+// clock on the host. Counts the calls, so a benchmark can tell how many trips to the card a
+// playback start needs.
+// Inner needs: bool open(const char*), uint32_t read(void*, uint32_t), bool seek(int32_t, int),
+// bool close(), bool isOpen(), uint32_t getSize() and uint32_t getPos().
+template <typename Inner>
+class DelayedSource {
+public:
+    typedef std::function<void(uint32_t)> Wait;
+
+    DelayedSource(Inner* inner, Wait wait) : inner(inner), wait(wait), openDelayUs(0), readDelayUs(0), opens(0), reads(0) {}
+
+    void setDelays(uint32_t openUs, uint32_t readUs) {
+        openDelayUs = openUs;
+        readDelayUs = readUs;
+    }
+
+    bool open(const char* filename) {
+        opens++;
+        if (openDelayUs) wait(openDelayUs);
+        return inner->open(filename);
+    }
+
+    uint32_t read(void* data, uint32_t len) {
+        reads++;
+        if (readDelayUs) wait(readDelayUs);
+        return inner->read(data, len);
+    }
+
+    bool seek(int32_t pos, int dir) { return inner->seek(pos, dir); }
+    bool close() { return inner->close(); }
+    bool isOpen() { return inner->isOpen(); }
+    uint32_t getSize() { return inner->getSize(); }
+    uint32_t getPos() { return inner->getPos(); }
+
+    uint32_t getOpens() const { return opens; }
+    uint32_t getReads() const { return reads; }
+
+    void resetCounts() {
+        opens = 0;
+        reads = 0;
+    }
+
+private:
+    Inner* inner;
+    Wait wait;
+    uint32_t openDelayUs;
+    uint32_t readDelayUs;
+    uint32_t opens;
+    uint32_t reads;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef DIAL_MATCH_H
+#define DIAL_MATCH_H
+
+#include <stdint.h>
+#include <string.h>
+#include "DialTrie.h"
+#include "DialPlan.h"
+
+// Collects from every source of numbers whether it answers the digits dialled so far and
+// whether a longer number could still reach it. The digits are complete, and the call can
+// start before the dial timeout, only if some source answers them and none can extend them.
+// A file "12" therefore waits while the mailbox is "123".
+class DialMatch {
+public:
+    static const size_t MIN_DIGITS = 2; // Shorter numbers always wait for the dial timeout
+
+    explicit DialMatch(const char* digits) : digits(digits), length(strlen(digits)), accepted(false), extendable(false) {}
+
+    const char* getDigits() const {
+        return digits;
+    }
+
+    void add(bool accepts, bool canExtend) {
+        accepted = accepted || accepts;
+        extendable = extendable || canExtend;
+    }
+
+    // A single number like the mailbox, empty ones are ignored
+    void addNumber(const char* number) {
+        size_t n = strlen(number);
+        if (n == 0 || n < length || memcmp(number, digits, length) != 0) return;
+        add(n == length, n > length);
+    }
+
+    void addTrie(const DialTrie& trie) {
+        DialTrie::Match match = trie.match(digits);
+        add(match == DialTrie::UNIQUE || match == DialTrie::AMBIGUOUS, match == DialTrie::PREFIX || match == DialTrie::AMBIGUOUS);
+    }
+
+    // state is the dial plan state the digits led to
+    void addPlan(const DialPlan& plan, int32_t state) {
+        add(plan.ruleAt(state) != DialPlan::NO_RULE, plan.canExtend(state));
+    }
+
+    bool isAccepted() const {
+        return accepted;
+    }
+
+    bool isComplete() const {
+        return length >= MIN_DIGITS && accepted && !extendable;
+    }
+
+private:
+    const char* digits;
+    size_t length;
+    bool accepted;
+    bool extendable;
+};
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef DIAL_PLAN_H
+#define DIAL_PLAN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Operator style routing rules, compiled into a DFA over the digits 0-9.
+//
+// One rule per line: <pattern> <action> <target>, '#' starts a comment.
+//   pattern  digits, 'x' for any digit, '[2-5]' or '[135]' for a set, '*' for any number of digits
+//   action   play (target is a file), random (a folder to pick from), ivr (a menu folder)
+// The first rule in the file wins when several match. Lookup costs one table read per digit.
+// Rules with many 'x' and '*' can multiply the states, compile() refuses plans above a limit.
+class DialPlan {
+public:
+    enum Action { PLAY, RANDOM, IVR };
+
+    static const size_t MAX_STATES = 1024; // About 45 bytes each once compiled
+
+    struct Rule {
+        std::string pattern;
+        Action action;
+        std::string target;
+    };
+
+    static const int32_t NO_RULE = -1;
+    static const int32_t DEAD = 0; // State after digits no rule starts with
+
+    // Parses one line, false with error set if it is not a valid rule. Blank lines and comments are fine.
+    bool addLine(const char* line, const char** error) {
+        *error = nullptr;
+        std::string fields[3];
+        int count = 0;
+        const char* p = line;
+        while (*p && *p != '#' && count <= 3) {
+            while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+            if (!*p || *p == '#') break;
+            const char* start = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#') p++;
+            if (count < 3) fields[count] = std::string(start, p - start);
+            count++;
+        }
+        if (count == 0) return true;
+        if (count != 3) {
+            *error = "Expected: <pattern> <action> <target>";
+            return false;
+        }
+        Action action;
+        if (fields[1] == "play") action = PLAY;
+        else if (fields[1] == "random") action = RANDOM;
+        else if (fields[1] == "ivr") action = IVR;
+        else {
+            *error = "Unknown action, use play, random or ivr";
+            return false;
+        }
+        return addRule(fields[0].c_str(), action, fields[2].c_str(), error);
+    }
+
+    bool addRule(const char* pattern, Action action, const char* target, const char** error) {
+        std::vector<Element> elements;
+        if (!parsePattern(pattern, elements)) {
+            *error = "Invalid pattern";
+            return false;
+        }
+        rules.push_back({ pattern, action, target });
+        patterns.push_back(elements);
+        compiled = false;
+        return true;
+    }
+
+    void clear() {
+        rules.clear();
+        patterns.clear();
+        transitions.clear();
+        accepting.clear();
+        extendable.clear();
+        compiled = false;
+    }
+
+    // Subset construction over all rules, call after the last addRule(). False if the DFA
+    // would need more than maxStates states, the plan then matches nothing.
+    bool compile(size_t maxStates = MAX_STATES) {
+        compiled = false;
+        transitions.clear();
+        accepting.clear();
+        extendable.clear();
+        std::map<std::vector<uint32_t>, int32_t> known;
+        std::vector<std::vector<uint32_t>> pending;
+
+        // State 0 is the dead state, state 1 the start
+        addState(std::vector<uint32_t>(), known, pending);
+        std::vector<uint32_t> start;
+        for (uint32_t rule = 0; rule < patterns.size(); rule++) {
+            addClosed(start, rule, 0);
+        }
+        normalize(start);
+        addState(start, known, pending);
+
+        std::vector<uint32_t> next;
+        for (size_t state = 0; state < pending.size(); state++) {
+            for (int digit = 0; digit < 10; digit++) {
+                next.clear();
+                for (uint32_t position : pending[state]) {
+                    uint32_t rule = position >> POSITION_BITS;
+                    uint32_t index = position & POSITION_MASK;
+                    const std::vector<Element>& elements = patterns[rule];
+                    if (index >= elements.size() || !(elements[index].digits & (1 << digit))) continue;
+                    // '*' stays where it is, everything else moves on
+                    addClosed(next, rule, elements[index].repeat ? index : index + 1);
+                }
+                normalize(next);
+                int32_t target = addState(next, known, pending);
+                if (pending.size() > maxStates) {
+                    transitions.clear();
+                    accepting.clear();
+                    extendable.clear();
+                    return false;
+                }
+                transitions[state * 10 + digit] = target;
+            }
+        }
+        for (size_t state = 0; state < pending.size(); state++) {
+            bool canExtend = false;
+            for (int digit = 0; digit < 10; digit++) {
+                if (transitions[state * 10 + digit] != DEAD) canExtend = true;
+            }
+            extendable[state] = canExtend;
+        }
+        compiled = true;
+        return true;
+    }
+
+    int32_t startState() const {
+        return compiled && !rules.empty() ? START : DEAD;
+    }
+
+    // States from before the plan was compiled again step to DEAD
+    int32_t step(int32_t state, int digit) const {
+        if (!isState(state) || digit < 0 || digit > 9) return DEAD;
+        return transitions[state * 10 + digit];
+    }
+
+    // Rule that matches exactly the digits that led to state, NO_RULE if none
+    int32_t ruleAt(int32_t state) const {
+        return isState(state) ? accepting[state] : NO_RULE;
+    }
+
+    // Whether more digits could still lead to a (different) match
+    bool canExtend(int32_t state) const {
+        return isState(state) && extendable[state];
+    }
+
+    // Walks the whole number, for callers that do not track the state digit by digit
+    int32_t stateFor(const char* digits) const {
+        int32_t state = startState();
+        for (const char* p = digits; *p && state != DEAD; p++) {
+            state = step(state, *p - '0');
+        }
+        return state;
+    }
+
+    int32_t match(const char* digits) const {
+        return ruleAt(stateFor(digits));
+    }
+
+    const Rule& getRule(int32_t index) const {
+        return rules[index];
+    }
+
+    size_t getRuleCount() const {
+        return rules.size();
+    }
+
+    size_t getStateCount() const {
+        return accepting.size();
+    }
+
+    // Bytes held by the compiled tables
+    size_t getTableBytes() const {
+        return transitions.size() * sizeof(int32_t) + accepting.size() * sizeof(int32_t) + extendable.size();
+    }
+
+private:
+    static const int32_t START = 1;
+    static const uint32_t POSITION_BITS = 8; // Patterns up to 255 elements
+    static const uint32_t POSITION_MASK = (1 << POSITION_BITS) - 1;
+    static const uint16_t ALL_DIGITS = 0x3FF;
+
+    struct Element {
+        uint16_t digits; // Bit per accepted digit
+        bool repeat;     // '*': zero or more digits
+    };
+
+    std::vector<Rule> rules;
+    std::vector<std::vector<Element>> patterns;
+    std::vector<int32_t> transitions; // 10 per state
+    std::vector<int32_t> accepting;   // Rule per state
+    std::vector<uint8_t> extendable;
+    bool compiled = false;
+
+    bool isState(int32_t state) const {
+        return state > DEAD && (size_t)state < accepting.size();
+    }
+
+    static bool parsePattern(const char* pattern, std::vector<Element>& elements) {
+        for (const char* p = pattern; *p; p++) {
+            Element element = { 0, false };
+            if (*p >= '0' && *p <= '9') {
+                element.digits = 1 << (*p - '0');
+            } else if (*p == 'x' || *p == 'X') {
+                element.digits = ALL_DIGITS;
+            } else if (*p == '*') {
+                element.digits = ALL_DIGITS;
+                element.repeat = true;
+            } else if (*p == '[') {
+                p++;
+                while (*p && *p != ']') {
+                    if (*p < '0' || *p > '9') return false;
+                    int from = *p - '0';
+                    int to = from;
+                    if (p[1] == '-') {
+                        if (p[2] < '0' || p[2] > '9' || p[2] < *p) return false;
+                        to = p[2] - '0';
+                        p += 2;
+                    }
+                    for (int d = from; d <= to; d++) element.digits |= 1 << d;
+                    p++;
+                }
+                if (*p != ']' || element.digits == 0) return false;
+            } else {
+                return false;
+            }
+            elements.push_back(element);
+        }
+        return !elements.empty() && elements.size() <= POSITION_MASK;
+    }
+
+    // Adds a position and, across '*' (which may match nothing), the ones after it
+    void addClosed(std::vector<uint32_t>& set, uint32_t rule, uint32_t index) const {
+        const std::vector<Element>& elements = patterns[rule];
+        while (true) {
+            set.push_back((rule << POSITION_BITS) | index);
+            if (index >= elements.size() || !elements[index].repeat) return;
+            index++;
+        }
+    }
+
+    static void normalize(std::vector<uint32_t>& set) {
+        std::sort(set.begin(), set.end());
+        set.erase(std::unique(set.begin(), set.end()), set.end());
+    }
+
+    int32_t addState(const std::vector<uint32_t>& set, std::map<std::vector<uint32_t>, int32_t>& known,
+                     std::vector<std::vector<uint32_t>>& pending) {
+        auto it = known.find(set);
+        if (it != known.end()) return it->second;
+        int32_t state = (int32_t)pending.size();
+        known[set] = state;
+        pending.push_back(set);
+        transitions.resize(pending.size() * 10, (int32_t)DEAD);
+        extendable.resize(pending.size(), 0);
+        // Positions are sorted by rule, the first finished one has priority
+        int32_t rule = NO_RULE;
+        for (uint32_t position : set) {
+            uint32_t index = position & POSITION_MASK;
+            if (index == patterns[position >> POSITION_BITS].size()) {
+                rule = (int32_t)(position >> POSITION_BITS);
+                break;
+            }
+        }
+        accepting.push_back(rule);
+        return state;
+    }
+};
+
+#endif
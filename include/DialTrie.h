@@ -0,0 +1,144 @@
+#ifndef DIAL_TRIE_H
+#define DIAL_TRIE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Digit trie over the dialable numbers. Tells after every digit whether the number
+// dialled so far can still grow, so unambiguous numbers need not wait for the dial timeout.
+// Numbers are added and removed one by one, freed nodes are reused.
+class DialTrie {
+public:
+    enum Match {
+        NO_MATCH,  // No number starts with these digits
+        PREFIX,    // Only longer numbers start with these digits
+        AMBIGUOUS, // A number, but longer numbers start with it too
+        UNIQUE     // A number that no other number extends, complete now
+    };
+
+    DialTrie() {
+        clear();
+    }
+
+    void clear() {
+        nodes.clear();
+        freeNodes.clear();
+        nodes.push_back(Node());
+    }
+
+    // Numbers with anything but the digits 0-9 cannot be dialled and are rejected
+    bool insert(const char* number) {
+        if (!isDialable(number) || contains(number)) return false;
+        size_t length = strlen(number);
+        if (length > freeNodes.size() && nodes.size() + length - freeNodes.size() > INT16_MAX) return false;
+        int32_t node = ROOT;
+        nodes[node].numbers++;
+        for (const char* p = number; *p; p++) {
+            int digit = *p - '0';
+            int32_t child = nodes[node].children[digit];
+            if (child == NONE) {
+                child = allocate();
+                nodes[node].children[digit] = (int16_t)child;
+            }
+            node = child;
+            nodes[node].numbers++;
+        }
+        nodes[node].terminal = true;
+        return true;
+    }
+
+    bool remove(const char* number) {
+        if (!isDialable(number) || !contains(number)) return false;
+        int32_t node = ROOT;
+        nodes[node].numbers--;
+        for (const char* p = number; *p; p++) {
+            int digit = *p - '0';
+            int32_t child = nodes[node].children[digit];
+            if (--nodes[child].numbers == 0) {
+                // Nothing else passes through here, drop the whole branch
+                nodes[node].children[digit] = NONE;
+                release(child);
+                return true;
+            }
+            node = child;
+        }
+        nodes[node].terminal = false;
+        return true;
+    }
+
+    bool contains(const char* number) const {
+        int32_t node = find(number);
+        return node != NONE && nodes[node].terminal;
+    }
+
+    Match match(const char* digits) const {
+        int32_t node = find(digits);
+        if (node == NONE || nodes[node].numbers == 0) return NO_MATCH;
+        if (!nodes[node].terminal) return PREFIX;
+        return nodes[node].numbers == 1 ? UNIQUE : AMBIGUOUS;
+    }
+
+    uint32_t size() const {
+        return nodes[ROOT].numbers;
+    }
+
+    // Nodes in use, for memory statistics
+    uint32_t getNodeCount() const {
+        return (uint32_t)(nodes.size() - freeNodes.size());
+    }
+
+private:
+    static const int32_t ROOT = 0;
+    static const int16_t NONE = -1; // Node indices are 16 bit to keep nodes small
+
+    struct Node {
+        int16_t children[10];
+        uint16_t numbers = 0; // Numbers ending in or below this node
+        bool terminal = false;
+
+        Node() {
+            for (int i = 0; i < 10; i++) children[i] = NONE;
+        }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int32_t> freeNodes;
+
+    static bool isDialable(const char* number) {
+        if (!*number) return false;
+        for (const char* p = number; *p; p++) {
+            if (*p < '0' || *p > '9') return false;
+        }
+        return true;
+    }
+
+    int32_t find(const char* digits) const {
+        int32_t node = ROOT;
+        for (const char* p = digits; *p && node != NONE; p++) {
+            if (*p < '0' || *p > '9') return NONE;
+            node = nodes[node].children[*p - '0'];
+        }
+        return node;
+    }
+
+    int32_t allocate() {
+        if (!freeNodes.empty()) {
+            int32_t node = freeNodes.back();
+            freeNodes.pop_back();
+            nodes[node] = Node();
+            return node;
+        }
+        nodes.push_back(Node());
+        return (int32_t)nodes.size() - 1;
+    }
+
+    void release(int32_t node) {
+        for (int i = 0; i < 10; i++) {
+            if (nodes[node].children[i] != NONE) release(nodes[node].children[i]);
+        }
+        freeNodes.push_back(node);
+    }
+};
+
+#endif
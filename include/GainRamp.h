@@ -0,0 +1,77 @@
+#ifndef GAIN_RAMP_H
+#define GAIN_RAMP_H
+
+#include <stdint.h>
+
+// Q15 gain stage that glides linearly to a new target instead of jumping, which avoids
+// zipper clicks when the volume changes in the middle of a sample
+class GainRamp {
+public:
+    static const int32_t UNITY_GAIN = 32768;
+    static const int32_t MAX_GAIN = 65535; // Just below 2.0, keeps sample * gain within 32 bit
+
+    static int32_t gainToQ15(float gain) {
+        if (gain <= 0.0f) return 0;
+        int32_t q15 = (int32_t)(gain * UNITY_GAIN + 0.5f);
+        return q15 > MAX_GAIN ? MAX_GAIN : q15;
+    }
+
+    // Reaches the target after rampSamples frames, 0 applies it immediately
+    void setTarget(int32_t targetQ15, uint32_t rampSamples) {
+        if (targetQ15 < 0) targetQ15 = 0;
+        if (targetQ15 > MAX_GAIN) targetQ15 = MAX_GAIN;
+        target = targetQ15 << FRACTION_BITS;
+        if (rampSamples == 0) {
+            current = target;
+            remaining = 0;
+            step = 0;
+        } else {
+            remaining = rampSamples;
+            step = (target - current) / (int32_t)rampSamples;
+        }
+    }
+
+    int32_t getGainQ15() const {
+        return current >> FRACTION_BITS;
+    }
+
+    bool isRamping() const {
+        return remaining > 0;
+    }
+
+    // Scales interleaved frames in place
+    void process(int16_t* samples, uint32_t frames, uint8_t channels) {
+        uint32_t i = 0;
+        // Per-frame gain while ramping
+        for (; i < frames && remaining > 0; i++) {
+            current += step;
+            if (--remaining == 0) current = target;
+            applyFrame(samples + i * channels, channels, current >> FRACTION_BITS);
+        }
+        // Constant gain for the rest of the block
+        int32_t gain = current >> FRACTION_BITS;
+        if (gain == UNITY_GAIN) return;
+        for (; i < frames; i++) {
+            applyFrame(samples + i * channels, channels, gain);
+        }
+    }
+
+private:
+    static const int FRACTION_BITS = 8; // Extra precision so slow ramps still move
+
+    int32_t current = UNITY_GAIN << FRACTION_BITS;
+    int32_t target = UNITY_GAIN << FRACTION_BITS;
+    int32_t step = 0;
+    uint32_t remaining = 0;
+
+    static void applyFrame(int16_t* frame, uint8_t channels, int32_t gain) {
+        for (uint8_t c = 0; c < channels; c++) {
+            int32_t value = (frame[c] * gain) >> 15;
+            if (value > 32767) value = 32767;
+            if (value < -32768) value = -32768;
+            frame[c] = (int16_t)value;
+        }
+    }
+};
+
+#endif
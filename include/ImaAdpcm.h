@@ -0,0 +1,120 @@
+#ifndef IMA_ADPCM_H
+#define IMA_ADPCM_H
+
+#include <stdint.h>
+
+// IMA ADPCM (WAV format tag 0x11) as written by common audio tools: 4 bits per sample,
+// every block starts with a 4 byte header per channel (first sample, step index),
+// followed by 4 byte groups of 8 nibbles per channel, low nibble first.
+
+static const int16_t IMA_STEP_TABLE[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t IMA_INDEX_TABLE[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// Predictor state of one channel
+struct ImaAdpcmState {
+    int32_t predictor = 0;
+    int32_t index = 0;
+
+    int16_t decode(uint8_t nibble) {
+        int32_t step = IMA_STEP_TABLE[index];
+        int32_t diff = step >> 3;
+        if (nibble & 1) diff += step >> 2;
+        if (nibble & 2) diff += step >> 1;
+        if (nibble & 4) diff += step;
+        predictor += (nibble & 8) ? -diff : diff;
+        if (predictor > 32767) predictor = 32767;
+        if (predictor < -32768) predictor = -32768;
+        advance(nibble);
+        return (int16_t)predictor;
+    }
+
+    // Picks the nibble that brings the predictor closest to sample and updates the state
+    // exactly like decode() will, so encoder and decoder never drift apart
+    uint8_t encode(int16_t sample) {
+        int32_t step = IMA_STEP_TABLE[index];
+        int32_t delta = sample - predictor;
+        uint8_t nibble = 0;
+        if (delta < 0) {
+            nibble = 8;
+            delta = -delta;
+        }
+        if (delta >= step) {
+            nibble |= 4;
+            delta -= step;
+        }
+        if (delta >= step >> 1) {
+            nibble |= 2;
+            delta -= step >> 1;
+        }
+        if (delta >= step >> 2) nibble |= 1;
+        decode(nibble);
+        return nibble;
+    }
+
+private:
+    void advance(uint8_t nibble) {
+        index += IMA_INDEX_TABLE[nibble];
+        if (index < 0) index = 0;
+        if (index > 88) index = 88;
+    }
+};
+
+static inline uint32_t imaSamplesPerBlock(uint16_t blockAlign, uint16_t channels) {
+    if (channels == 0 || blockAlign < 4 * channels) return 0;
+    return (uint32_t)(blockAlign - 4 * channels) * 2 / channels + 1;
+}
+
+// Decodes one block into interleaved 16 bit samples, returns the number of frames
+static inline uint32_t imaDecodeBlock(const uint8_t* block, uint16_t blockAlign, uint16_t channels, int16_t* out) {
+    uint32_t frames = imaSamplesPerBlock(blockAlign, channels);
+    if (frames == 0 || channels > 2) return 0;
+    ImaAdpcmState state[2];
+    for (uint16_t c = 0; c < channels; c++) {
+        const uint8_t* header = block + 4 * c;
+        state[c].predictor = (int16_t)(header[0] | (header[1] << 8));
+        state[c].index = header[2] > 88 ? 88 : header[2];
+        out[c] = (int16_t)state[c].predictor;
+    }
+    const uint8_t* data = block + 4 * channels;
+    // Each group holds 8 samples per channel, 4 bytes per channel in turn
+    for (uint32_t frame = 1; frame < frames; frame += 8) {
+        for (uint16_t c = 0; c < channels; c++) {
+            for (uint32_t i = 0; i < 8; i++) {
+                uint8_t byte = data[i >> 1];
+                uint8_t nibble = (i & 1) ? byte >> 4 : byte & 0x0F;
+                out[(frame + i) * channels + c] = state[c].decode(nibble);
+            }
+            data += 4;
+        }
+    }
+    return frames;
+}
+
+// Encodes imaSamplesPerBlock(blockAlign, 1) mono samples into one block. The state carries
+// the step index from block to block, which keeps the quantizer settled across block edges.
+static inline void imaEncodeBlock(ImaAdpcmState& state, const int16_t* samples, uint16_t blockAlign, uint8_t* block) {
+    uint32_t frames = imaSamplesPerBlock(blockAlign, 1);
+    state.predictor = samples[0];
+    block[0] = (uint8_t)(samples[0] & 0xFF);
+    block[1] = (uint8_t)((samples[0] >> 8) & 0xFF);
+    block[2] = (uint8_t)state.index;
+    block[3] = 0;
+    uint8_t* data = block + 4;
+    for (uint32_t i = 1; i < frames; i += 2) {
+        uint8_t low = state.encode(samples[i]);
+        uint8_t high = state.encode(samples[i + 1]);
+        *data++ = (uint8_t)(low | (high << 4));
+    }
+}
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Playout buffer for fixed size audio frames that arrive over UDP late, twice, out of order
+// or not at all. The consumer pops one frame per frame period and missing frames are concealed.
+// The target delay follows the arrival jitter (RFC 3550 estimate): the buffer grows by waiting
+// when it runs empty and shrinks by skipping a frame once it stayed above the target for a while.
+// Storage is allocated once by the constructor.
+class JitterBuffer {
+public:
+    enum Result {
+        PLAYED,    // The frame that was due
+        CONCEALED, // Replacement for a missing frame
+        SILENCE    // Nothing received yet, or concealment has faded out
+    };
+
+    struct Stats {
+        uint32_t received;
+        uint32_t duplicates;
+        uint32_t late;      // Arrived after its frame was concealed
+        uint32_t lost;      // Concealed while later frames were waiting
+        uint32_t underruns; // Concealed because nothing was buffered, adds a frame of delay
+        uint32_t skipped;   // Dropped to bring the delay back to the target
+        uint32_t resyncs;   // Sequence jumped too far, playout restarted
+    };
+
+    static const uint16_t CONCEAL_FRAMES = 3; // Repeats fading to silence
+    static const uint16_t SHRINK_FRAMES = 50; // Frames above the target before one is skipped
+
+    // slots is rounded up to a power of two and bounds the delay
+    JitterBuffer(uint16_t frameSamples, uint16_t minSlots, uint32_t sampleRate)
+        : frameSamples(frameSamples), sampleRate(sampleRate) {
+        slots = 1;
+        while (slots < minSlots) slots <<= 1;
+        mask = slots - 1;
+        samples = (int16_t*)malloc(sizeof(int16_t) * frameSamples * (slots + 1));
+        meta = (Slot*)malloc(sizeof(Slot) * slots);
+        lastFrame = samples ? samples + frameSamples * slots : nullptr;
+        fadeSamples = frameSamples / 4;
+        boostDecayFrames = sampleRate * 10 / frameSamples; // A late frame raises the target for 10 s
+        reset();
+    }
+
+    ~JitterBuffer() {
+        free(samples);
+        free(meta);
+    }
+
+    JitterBuffer(const JitterBuffer&) = delete;
+    JitterBuffer& operator=(const JitterBuffer&) = delete;
+
+    bool isAllocated() const { return samples && meta; }
+
+    // Forgets everything, for the start of a call
+    void reset() {
+        if (meta) memset(meta, 0, sizeof(Slot) * slots);
+        if (lastFrame) memset(lastFrame, 0, sizeof(int16_t) * frameSamples);
+        memset(&stats, 0, sizeof(stats));
+        started = false;
+        priming = true;
+        nextSeq = 0;
+        newestSeq = 0;
+        jitter16 = 0;
+        haveTransit = false;
+        lateBoost = 0;
+        boostFrames = 0;
+        overFrames = 0;
+        concealRun = 0;
+        blendNext = false;
+    }
+
+    // timestamp counts samples like RTP, arrivalMs is the receiver's clock. tag comes back from pop().
+    bool push(uint16_t seq, uint32_t timestamp, const int16_t* frame, uint32_t arrivalMs, uint32_t tag) {
+        if (!isAllocated()) return false;
+        if (!started) {
+            started = true;
+            nextSeq = seq;
+            newestSeq = seq;
+        }
+        int16_t ahead = (int16_t)(seq - nextSeq);
+        if (ahead < 0 && ahead > -(int16_t)slots) {
+            // Its turn has passed, a longer delay would have caught it
+            stats.late++;
+            if (lateBoost < slots / 2) lateBoost++;
+            boostFrames = 0;
+            return false;
+        }
+        if (ahead < 0 || ahead >= (int16_t)slots) {
+            // The sender restarted or a long gap, start over from this frame
+            memset(meta, 0, sizeof(Slot) * slots);
+            nextSeq = seq;
+            newestSeq = seq;
+            priming = true;
+            haveTransit = false;
+            stats.resyncs++;
+        }
+        Slot& slot = meta[seq & mask];
+        if (slot.filled && slot.seq == seq) {
+            stats.duplicates++;
+            return false;
+        }
+        slot.filled = true;
+        slot.seq = seq;
+        slot.tag = tag;
+        memcpy(samples + (seq & mask) * frameSamples, frame, sizeof(int16_t) * frameSamples);
+        if ((int16_t)(seq - newestSeq) > 0) newestSeq = seq;
+
+        // Interarrival jitter in samples, times 16 to keep the fraction
+        int32_t transit = (int32_t)((uint64_t)arrivalMs * sampleRate / 1000) - (int32_t)timestamp;
+        if (haveTransit) {
+            int32_t d = transit - lastTransit;
+            if (d < 0) d = -d;
+            jitter16 += d - ((jitter16 + 8) >> 4);
+        }
+        lastTransit = transit;
+        haveTransit = true;
+        stats.received++;
+        return true;
+    }
+
+    // Fills one frame, call it once per frame period. tag is only set for PLAYED.
+    Result pop(int16_t* out, uint32_t* tag) {
+        if (!isAllocated() || !started || (priming && getDepth() < getTargetFrames())) {
+            memset(out, 0, sizeof(int16_t) * frameSamples);
+            return SILENCE;
+        }
+        priming = false;
+        if (lateBoost > 0 && ++boostFrames >= boostDecayFrames) {
+            lateBoost--;
+            boostFrames = 0;
+        }
+
+        Slot& slot = meta[nextSeq & mask];
+        if (slot.filled && slot.seq == nextSeq) {
+            const int16_t* frame = samples + (nextSeq & mask) * frameSamples;
+            if (blendNext) {
+                blend(frame, out);
+            } else {
+                memcpy(out, frame, sizeof(int16_t) * frameSamples);
+            }
+            memcpy(lastFrame, frame, sizeof(int16_t) * frameSamples);
+            if (tag) *tag = slot.tag;
+            slot.filled = false;
+            nextSeq++;
+            concealRun = 0;
+            blendNext = false;
+            shrink();
+            return PLAYED;
+        }
+
+        if (getDepth() > 0) {
+            // Later frames are here, this one is not coming in time
+            stats.lost++;
+            nextSeq++;
+        } else {
+            // Wait for it, which makes the delay one frame longer
+            stats.underruns++;
+        }
+        overFrames = 0;
+        blendNext = true;
+        return conceal(out);
+    }
+
+    // Frames waiting from the next one due to the newest received
+    uint16_t getDepth() const {
+        if (!started) return 0;
+        int16_t depth = (int16_t)(newestSeq - nextSeq) + 1;
+        return depth > 0 ? (uint16_t)depth : 0;
+    }
+
+    uint16_t getTargetFrames() const {
+        // Four mean deviations cover nearly all arrivals, plus the frame being played
+        uint32_t jitterFrames = ((uint32_t)jitter16 * 4 / 16 + frameSamples - 1) / frameSamples;
+        uint32_t target = 1 + jitterFrames + lateBoost;
+        return target < slots ? (uint16_t)target : (uint16_t)(slots - 1);
+    }
+
+    uint32_t getJitterMs() const {
+        return (uint32_t)((uint64_t)jitter16 * 1000 / 16 / sampleRate);
+    }
+
+    uint32_t getDelayMs() const {
+        return (uint32_t)getDepth() * frameSamples * 1000 / sampleRate;
+    }
+
+    uint16_t getFrameSamples() const { return frameSamples; }
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Slot {
+        bool filled;
+        uint16_t seq;
+        uint32_t tag;
+    };
+
+    uint16_t frameSamples;
+    uint32_t sampleRate;
+    uint16_t slots;
+    uint16_t mask;
+    int16_t* samples = nullptr;   // slots frames, then the last played frame
+    Slot* meta = nullptr;
+    int16_t* lastFrame = nullptr;
+    uint16_t fadeSamples;
+    uint32_t boostDecayFrames;
+    Stats stats;
+    bool started;
+    bool priming;         // Collecting the target delay before the first frame plays
+    uint16_t nextSeq;
+    uint16_t newestSeq;
+    int32_t jitter16;
+    int32_t lastTransit;
+    bool haveTransit;
+    uint16_t lateBoost;   // Extra target frames after late arrivals
+    uint32_t boostFrames;
+    uint16_t overFrames;
+    uint16_t concealRun;
+    bool blendNext;       // Crossfade into the next frame after a gap or skip
+
+    // Repeats the last frame, fading out over CONCEAL_FRAMES frames
+    Result conceal(int16_t* out) {
+        if (concealRun >= CONCEAL_FRAMES) {
+            memset(out, 0, sizeof(int16_t) * frameSamples);
+            return SILENCE;
+        }
+        int32_t total = CONCEAL_FRAMES * frameSamples;
+        int32_t done = concealRun * frameSamples;
+        for (uint16_t i = 0; i < frameSamples; i++) {
+            out[i] = (int16_t)(lastFrame[i] * (total - done - i) / total);
+        }
+        concealRun++;
+        return CONCEALED;
+    }
+
+    // Crossfades from where concealment would continue into the new frame
+    void blend(const int16_t* frame, int16_t* out) {
+        int32_t total = CONCEAL_FRAMES * frameSamples;
+        int32_t remaining = concealRun < CONCEAL_FRAMES ? total - concealRun * frameSamples : 0;
+        for (uint16_t i = 0; i < frameSamples; i++) {
+            if (i < fadeSamples) {
+                int32_t previous = remaining > (int32_t)i ? lastFrame[i] * (remaining - i) / total : 0;
+                out[i] = (int16_t)((frame[i] * i + previous * (fadeSamples - i)) / fadeSamples);
+            } else {
+                out[i] = frame[i];
+            }
+        }
+    }
+
+    // Skips a frame once the queue has stayed above the target long enough
+    void shrink() {
+        if (getDepth() <= getTargetFrames() + 1) {
+            overFrames = 0;
+            return;
+        }
+        if (++overFrames < SHRINK_FRAMES) return;
+        overFrames = 0;
+        Slot& slot = meta[nextSeq & mask];
+        if (slot.filled && slot.seq == nextSeq) {
+            slot.filled = false;
+            nextSeq++;
+            stats.skipped++;
+            blendNext = true;
+        }
+    }
+};
+
+#endif
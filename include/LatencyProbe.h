@@ -0,0 +1,97 @@
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+// Measures the time from a completed dial to the first audible sample, split into the stages
+// in between, and keeps a histogram of each. The caller passes the time in microseconds, so
+// the probe runs against micros() on the device and against a simulated clock on the host.
+class LatencyProbe {
+public:
+    enum Stage { Dialled, Calling, Opened, Begun, FirstSample, STAGE_COUNT };
+    static const int BUCKET_COUNT = 10;
+
+    LatencyProbe() : state(IDLE), nextStage(Calling) {
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            timestamps[i] = 0;
+            for (int b = 0; b < BUCKET_COUNT; b++) histogram[i][b] = 0;
+        }
+    }
+
+    // Stages are only recorded in order after Dialled started a measurement
+    void mark(Stage stage, uint32_t nowUs) {
+        if (stage == Dialled) {
+            timestamps[Dialled] = nowUs;
+            nextStage = Calling;
+            state = RUNNING;
+        } else if (state == RUNNING && stage == nextStage) {
+            timestamps[stage] = nowUs;
+            if (stage == Begun) {
+                state = WAITING_FOR_SAMPLE;
+            } else {
+                nextStage = (Stage)(stage + 1);
+            }
+        }
+    }
+
+    // Called by the I2S feeder for every frame it hands to the DMA
+    void onFrame(int16_t left, int16_t right, uint32_t nowUs) {
+        if (state == WAITING_FOR_SAMPLE && (abs(left) > SILENCE_THRESHOLD || abs(right) > SILENCE_THRESHOLD)) {
+            timestamps[FirstSample] = nowUs;
+            state = COMPLETE;
+        }
+    }
+
+    // Adds a finished measurement to the histogram, true if there was one. Its stage times stay
+    // readable through getStageUs() until the next one finishes.
+    bool collect() {
+        if (state != COMPLETE) return false;
+        state = IDLE;
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            histogram[i][bucketFor(getStageUs((Stage)i))]++;
+        }
+        return true;
+    }
+
+    // Time from the previous stage to this one, for Dialled the total up to the first sample
+    uint32_t getStageUs(Stage stage) const {
+        if (stage == Dialled) return timestamps[FirstSample] - timestamps[Dialled];
+        return timestamps[stage] - timestamps[stage - 1];
+    }
+
+    uint32_t getCount(Stage stage, int bucket) const {
+        return histogram[stage][bucket];
+    }
+
+    // Upper end of a bucket, the last one has none
+    static uint32_t getBucketLimitMs(int bucket) {
+        static const uint32_t limits[BUCKET_COUNT] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 0xFFFFFFFF };
+        return limits[bucket];
+    }
+
+    static const char* getStageName(Stage stage) {
+        static const char* names[STAGE_COUNT] = { "dialled", "calling", "opened", "begun", "firstSample" };
+        return names[stage];
+    }
+
+private:
+    enum State { IDLE, RUNNING, WAITING_FOR_SAMPLE, COMPLETE };
+    static const int16_t SILENCE_THRESHOLD = 256;
+
+    std::atomic<State> state;
+    Stage nextStage;
+    uint32_t timestamps[STAGE_COUNT];
+    uint32_t histogram[STAGE_COUNT][BUCKET_COUNT];
+
+    static int bucketFor(uint32_t micros) {
+        uint32_t ms = micros / 1000;
+        for (int b = 0; b < BUCKET_COUNT - 1; b++) {
+            if (ms < getBucketLimitMs(b)) return b;
+        }
+        return BUCKET_COUNT - 1;
+    }
+};
+
+#endif
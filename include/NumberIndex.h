@@ -0,0 +1,214 @@
+#ifndef NUMBER_INDEX_H
+#define NUMBER_INDEX_H
+
+#include <stdint.h>
+#include <string.h>
+#include "WavFormat.h"
+
+// Binary copy of a /numbers scan, so boot reads one file front to back instead of opening
+// every sample for its header. Little endian:
+//   header  "HPNI", version (32 bit), signature (32 bit) of the directory it was built from
+//   entries file size (32 bit), the WavFormat fields, then the lengths (8 bit each) and bytes
+//           of number, description and file name
+//   trailer entry count (32 bit), FNV-1a checksum of the entries (32 bit), "HPNE"
+// A file that does not end in a valid trailer is a torn write and gets rebuilt.
+class NumberIndex {
+public:
+    static const uint32_t VERSION = 2; // 2: the signature covers sizes and times
+    static const uint32_t HEADER_SIZE = 12;
+    static const uint32_t TRAILER_SIZE = 12;
+    static const uint32_t FIXED_ENTRY_SIZE = 29;
+    static const uint32_t MAX_TEXT = 255;
+    static const uint32_t MAX_ENTRY_SIZE = FIXED_ENTRY_SIZE + 3 * MAX_TEXT;
+
+    struct Entry {
+        const char* number;
+        const char* description;
+        const char* fileName; // Without the folder
+        uint32_t fileSize;
+        WavFormat format;
+    };
+
+    enum LoadResult { LOADED, STALE, CORRUPT };
+
+    // Fingerprint of a directory listing. FAT keeps no usable modification time or size for
+    // directories, so the directory entries of the files stand in for them: name, size and
+    // modification time, so a file replaced under the same name changes it too. The order does
+    // not matter, so the owner can follow its own changes with add() and remove() instead of
+    // listing the folder again.
+    class Signature {
+    public:
+        void add(const char* name, uint32_t size, uint32_t modified) {
+            sum += hashFile(name, size, modified);
+            count++;
+        }
+
+        void remove(const char* name, uint32_t size, uint32_t modified) {
+            sum -= hashFile(name, size, modified);
+            count--;
+        }
+
+        uint32_t value() const {
+            uint8_t bytes[8];
+            wavWrite32(bytes, sum);
+            wavWrite32(bytes + 4, count);
+            return fnv(FNV_OFFSET, bytes, 8);
+        }
+
+        uint32_t getCount() const { return count; }
+
+    private:
+        uint32_t sum = 0;
+        uint32_t count = 0;
+
+        static uint32_t hashFile(const char* name, uint32_t size, uint32_t modified) {
+            uint8_t bytes[8];
+            wavWrite32(bytes, size);
+            wavWrite32(bytes + 4, modified);
+            return fnv(fnv(FNV_OFFSET, name, strlen(name)), bytes, 8);
+        }
+    };
+
+    // Writes an index, Writer needs uint32_t write(const void* data, uint32_t len)
+    template <typename Writer>
+    class Builder {
+    public:
+        Builder(Writer& writer, uint32_t signature) : writer(writer) {
+            uint8_t header[HEADER_SIZE];
+            memcpy(header, "HPNI", 4);
+            wavWrite32(header + 4, VERSION);
+            wavWrite32(header + 8, signature);
+            put(header, HEADER_SIZE, false);
+        }
+
+        // False if a text is too long for the index or the write failed
+        bool add(const Entry& entry) {
+            uint32_t lengths[3] = { (uint32_t)strlen(entry.number), (uint32_t)strlen(entry.description), (uint32_t)strlen(entry.fileName) };
+            if (lengths[0] > MAX_TEXT || lengths[1] > MAX_TEXT || lengths[2] > MAX_TEXT) return false;
+            uint8_t fixed[FIXED_ENTRY_SIZE];
+            const WavFormat& format = entry.format;
+            wavWrite32(fixed, entry.fileSize);
+            wavWrite16(fixed + 4, format.formatTag);
+            wavWrite16(fixed + 6, format.channels);
+            wavWrite32(fixed + 8, format.sampleRate);
+            wavWrite16(fixed + 12, format.bitsPerSample);
+            wavWrite16(fixed + 14, format.blockAlign);
+            wavWrite32(fixed + 16, format.dataOffset);
+            wavWrite32(fixed + 20, format.dataLength);
+            wavWrite16(fixed + 24, (uint16_t)format.byteRate); // Only set for MP3, at most 40000
+            fixed[26] = (uint8_t)lengths[0];
+            fixed[27] = (uint8_t)lengths[1];
+            fixed[28] = (uint8_t)lengths[2];
+            put(fixed, FIXED_ENTRY_SIZE, true);
+            put(entry.number, lengths[0], true);
+            put(entry.description, lengths[1], true);
+            put(entry.fileName, lengths[2], true);
+            count++;
+            return ok;
+        }
+
+        // Writes the trailer, returns true if every write succeeded
+        bool finish() {
+            uint8_t trailer[TRAILER_SIZE];
+            wavWrite32(trailer, count);
+            wavWrite32(trailer + 4, checksum);
+            memcpy(trailer + 8, "HPNE", 4);
+            put(trailer, TRAILER_SIZE, false);
+            return ok;
+        }
+
+        uint32_t getCount() const { return count; }
+
+    private:
+        Writer& writer;
+        uint32_t checksum = FNV_OFFSET;
+        uint32_t count = 0;
+        bool ok = true;
+
+        void put(const void* data, uint32_t len, bool summed) {
+            if (len == 0) return;
+            if (summed) checksum = fnv(checksum, data, len);
+            if (writer.write(data, len) != len) ok = false;
+        }
+    };
+
+    // Streams the entries of an index built from the given signature into callback(const Entry&).
+    // The entries are only valid if LOADED comes back, the caller drops them otherwise.
+    // Reader needs uint32_t read(void* dest, uint32_t len).
+    template <typename Reader, typename Callback>
+    static LoadResult load(Reader& reader, uint32_t signature, Callback callback) {
+        uint8_t buffer[2 * MAX_ENTRY_SIZE];
+        uint32_t filled = reader.read(buffer, HEADER_SIZE);
+        if (filled != HEADER_SIZE || memcmp(buffer, "HPNI", 4) != 0 || wavRead32(buffer + 4) != VERSION) return CORRUPT;
+        if (wavRead32(buffer + 8) != signature) return STALE;
+
+        uint32_t checksum = FNV_OFFSET;
+        uint32_t count = 0;
+        uint32_t pos = 0;
+        filled = 0;
+        bool end = false;
+        char texts[3][MAX_TEXT + 1];
+        while (true) {
+            // Keep at least one entry and the trailer in the buffer
+            if (!end && filled - pos < MAX_ENTRY_SIZE + TRAILER_SIZE) {
+                memmove(buffer, buffer + pos, filled - pos);
+                filled -= pos;
+                pos = 0;
+                while (!end && filled < sizeof(buffer)) {
+                    uint32_t got = reader.read(buffer + filled, sizeof(buffer) - filled);
+                    filled += got;
+                    if (got == 0) end = true;
+                }
+            }
+            uint32_t left = filled - pos;
+            if (left < TRAILER_SIZE) return CORRUPT;
+            if (end && left == TRAILER_SIZE) break;
+            if (left < FIXED_ENTRY_SIZE + TRAILER_SIZE) return CORRUPT;
+
+            const uint8_t* fixed = buffer + pos;
+            uint32_t textBytes = (uint32_t)fixed[26] + fixed[27] + fixed[28];
+            uint32_t entrySize = FIXED_ENTRY_SIZE + textBytes;
+            if (left < entrySize + TRAILER_SIZE) return CORRUPT;
+            Entry entry;
+            entry.fileSize = wavRead32(fixed);
+            entry.format.formatTag = wavRead16(fixed + 4);
+            entry.format.channels = wavRead16(fixed + 6);
+            entry.format.sampleRate = wavRead32(fixed + 8);
+            entry.format.bitsPerSample = wavRead16(fixed + 12);
+            entry.format.blockAlign = wavRead16(fixed + 14);
+            entry.format.dataOffset = wavRead32(fixed + 16);
+            entry.format.dataLength = wavRead32(fixed + 20);
+            entry.format.byteRate = wavRead16(fixed + 24);
+            const uint8_t* text = fixed + FIXED_ENTRY_SIZE;
+            for (int i = 0; i < 3; i++) {
+                memcpy(texts[i], text, fixed[26 + i]);
+                texts[i][fixed[26 + i]] = 0;
+                text += fixed[26 + i];
+            }
+            entry.number = texts[0];
+            entry.description = texts[1];
+            entry.fileName = texts[2];
+            checksum = fnv(checksum, fixed, entrySize);
+            count++;
+            pos += entrySize;
+            callback(entry);
+        }
+
+        const uint8_t* trailer = buffer + pos;
+        if (memcmp(trailer + 8, "HPNE", 4) != 0 || wavRead32(trailer) != count || wavRead32(trailer + 4) != checksum) return CORRUPT;
+        return LOADED;
+    }
+
+private:
+    static const uint32_t FNV_OFFSET = 2166136261u;
+
+    static uint32_t fnv(uint32_t hash, const void* data, uint32_t len) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (uint32_t i = 0; i < len; i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+};
+
+#endif
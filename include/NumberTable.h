@@ -0,0 +1,207 @@
+#ifndef NUMBER_TABLE_H
+#define NUMBER_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "WavFormat.h"
+
+// The numbers on the SD card, sorted by number in one array of fixed size records. The texts
+// of a record lie back to back in a shared arena as "number\0description\0", so the whole table
+// is two allocations however many numbers there are. File names are <number>_<description>
+// with .wav or .mp3, so only the extension is kept and the name is put together when asked for.
+// Lookups are a binary search, the i-th number is an index. Replaced and erased texts stay in
+// the arena as garbage until it makes up half of it, then the arena is rebuilt.
+class NumberTable {
+public:
+    static const uint32_t MAX_TEXT = 255;
+    static const uint32_t MAX_FILE_NAME = 2 * MAX_TEXT + 5;
+
+    struct Record {
+        uint32_t text; // Arena offset of the number, the description follows it
+        uint32_t fileSize;
+        WavFormat format;
+        uint8_t numberLength;
+        uint8_t descriptionLength;
+        bool mp3; // Extension of the file
+    };
+
+    NumberTable() : garbage(0) {}
+
+    void clear() {
+        records.clear();
+        arena.clear();
+        garbage = 0;
+    }
+
+    void swap(NumberTable& other) {
+        records.swap(other.records);
+        arena.swap(other.arena);
+        std::swap(garbage, other.garbage);
+    }
+
+    // Adds a number to the end without keeping the order, for bulk loads that call sort()
+    // afterwards. False if a text is longer than MAX_TEXT or the file name is not the number and
+    // description. The texts must not point into the table.
+    bool append(const char* number, const char* description, const char* fileName, uint32_t fileSize, const WavFormat& format) {
+        Record record;
+        if (!store(record, number, description, fileName)) return false;
+        record.fileSize = fileSize;
+        record.format = format;
+        records.push_back(record);
+        return true;
+    }
+
+    // Restores the order after append(). Of numbers appended twice the last one stays, like the
+    // last file of a scan wins. Returns the entries dropped as duplicates.
+    uint32_t sort() {
+        Less less = { this };
+        if (!std::is_sorted(records.begin(), records.end(), less)) {
+            std::stable_sort(records.begin(), records.end(), less);
+        }
+        uint32_t dropped = 0;
+        size_t out = 0;
+        for (size_t i = 0; i < records.size(); i++) {
+            if (i + 1 < records.size() && !less(records[i], records[i + 1])) {
+                garbage += textSize(records[i]); // A later copy follows
+                dropped++;
+                continue;
+            }
+            records[out++] = records[i];
+        }
+        records.resize(out);
+        return dropped;
+    }
+
+    // Adds a number or replaces it, keeping the order
+    bool put(const char* number, const char* description, const char* fileName, uint32_t fileSize, const WavFormat& format) {
+        Record record;
+        if (!store(record, number, description, fileName)) return false;
+        record.fileSize = fileSize;
+        record.format = format;
+        size_t i = lowerBound(number);
+        if (i < records.size() && strcmp(getNumber(records[i]), number) == 0) {
+            garbage += textSize(records[i]);
+            records[i] = record;
+        } else {
+            records.insert(records.begin() + i, record);
+        }
+        compactIfWasteful();
+        return true;
+    }
+
+    bool erase(const char* number) {
+        size_t i = lowerBound(number);
+        if (i == records.size() || strcmp(getNumber(records[i]), number) != 0) return false;
+        garbage += textSize(records[i]);
+        records.erase(records.begin() + i);
+        compactIfWasteful();
+        return true;
+    }
+
+    // The record of a number or null. Only valid until the table changes.
+    const Record* find(const char* number) const {
+        size_t i = lowerBound(number);
+        if (i < records.size() && strcmp(getNumber(records[i]), number) == 0) return &records[i];
+        return nullptr;
+    }
+
+    // Index of the first number not less than the given one, numbers with a prefix follow it
+    size_t lowerBound(const char* number) const {
+        size_t low = 0, high = records.size();
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (strcmp(getNumber(records[middle]), number) < 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    size_t size() const { return records.size(); }
+    bool empty() const { return records.empty(); }
+    // In number order
+    const Record& at(size_t i) const { return records[i]; }
+
+    const char* getNumber(const Record& record) const { return &arena[record.text]; }
+    const char* getDescription(const Record& record) const { return &arena[record.text + record.numberLength + 1]; }
+
+    // Writes the file name, without the folder, into a buffer of MAX_FILE_NAME + 1 bytes
+    const char* getFileName(const Record& record, char* buffer) const {
+        memcpy(buffer, getNumber(record), record.numberLength);
+        buffer[record.numberLength] = '_';
+        memcpy(buffer + record.numberLength + 1, getDescription(record), record.descriptionLength);
+        memcpy(buffer + record.numberLength + 1 + record.descriptionLength, record.mp3 ? ".mp3" : ".wav", 5);
+        return buffer;
+    }
+
+    // Gives back what bulk loading reserved beyond its needs
+    void shrink() {
+        compact();
+        records.shrink_to_fit();
+    }
+
+    // Bytes allocated by the table, records and arena
+    size_t getHeapBytes() const {
+        return records.capacity() * sizeof(Record) + arena.capacity();
+    }
+
+    size_t getGarbageBytes() const { return garbage; }
+
+private:
+    std::vector<Record> records;
+    std::vector<char> arena;
+    size_t garbage; // Arena bytes no record points to
+
+    struct Less {
+        const NumberTable* table;
+        bool operator()(const Record& a, const Record& b) const {
+            return strcmp(table->getNumber(a), table->getNumber(b)) < 0;
+        }
+    };
+
+    static uint32_t textSize(const Record& record) {
+        return (uint32_t)record.numberLength + record.descriptionLength + 2;
+    }
+
+    bool store(Record& record, const char* number, const char* description, const char* fileName) {
+        size_t numberLength = strlen(number), descriptionLength = strlen(description);
+        if (numberLength > MAX_TEXT || descriptionLength > MAX_TEXT || strlen(fileName) != numberLength + descriptionLength + 5 ||
+            memcmp(fileName, number, numberLength) != 0 || fileName[numberLength] != '_' ||
+            memcmp(fileName + numberLength + 1, description, descriptionLength) != 0) {
+            return false;
+        }
+        const char* extension = fileName + numberLength + 1 + descriptionLength;
+        if (strcmp(extension, ".wav") != 0 && strcmp(extension, ".mp3") != 0) return false;
+        record.text = (uint32_t)arena.size();
+        record.numberLength = (uint8_t)numberLength;
+        record.descriptionLength = (uint8_t)descriptionLength;
+        record.mp3 = extension[1] == 'm';
+        arena.insert(arena.end(), number, number + numberLength + 1);
+        arena.insert(arena.end(), description, description + descriptionLength + 1);
+        return true;
+    }
+
+    void compactIfWasteful() {
+        if (garbage > 1024 && garbage * 2 > arena.size()) compact();
+    }
+
+    // Copies the live texts into a fresh arena of exactly their size
+    void compact() {
+        std::vector<char> packed;
+        packed.reserve(arena.size() - garbage);
+        for (Record& record : records) {
+            uint32_t size = textSize(record);
+            uint32_t text = (uint32_t)packed.size();
+            packed.insert(packed.end(), arena.begin() + record.text, arena.begin() + record.text + size);
+            record.text = text;
+        }
+        arena.swap(packed);
+        garbage = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef PEER_TABLE_H
+#define PEER_TABLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CallEngine.h"
+
+// Phones found through service discovery and until when each announcement holds. Lookups only
+// read the table; the owner asks the network again when needsQuery() says so: periodically,
+// and early (but not more than every MIN_QUERY_GAP_MS) after a lookup found nothing.
+//
+// Phones announce the _highphone._udp service on their call port with these TXT keys, on the
+// phone through mDNS and on a PC through a stand-in (tools/hpdiscover):
+//   num=12,40-49    numbers the phone answers, single numbers or ranges of equal length
+//   conf=77:4211    number and port of the conference bridge it hosts
+//   caps=call,conference,ring,ptt
+class PeerTable {
+public:
+    enum Capability { CALL = 1, CONFERENCE = 2, RING = 4, PUSH_TO_TALK = 8 };
+
+    static const uint32_t MAX_NAME = 31;
+    static const uint32_t MAX_NUMBERS = 47;
+    static const uint32_t MIN_QUERY_GAP_MS = 5000;
+
+    struct Entry {
+        char name[MAX_NAME + 1]; // Host or instance name, identifies the phone
+        CallPeer peer;           // Call port
+        char numbers[MAX_NUMBERS + 1];
+        char conferenceNumber[CallEngine::MAX_NUMBER + 1];
+        uint16_t conferencePort;
+        uint8_t capabilities;
+        uint32_t expiresMs;
+        bool used;
+    };
+
+    PeerTable(uint8_t capacity, uint32_t refreshMs) : capacity(capacity), refreshMs(refreshMs) {
+        entries = (Entry*)calloc(capacity, sizeof(Entry));
+    }
+
+    ~PeerTable() {
+        free(entries);
+    }
+
+    PeerTable(const PeerTable&) = delete;
+    PeerTable& operator=(const PeerTable&) = delete;
+
+    bool isAllocated() const { return entries != nullptr; }
+
+    // Adds or refreshes a phone from its TXT values, a ttlMs of 0 is a goodbye and removes it.
+    // conf may be null or empty. Returns false if the announcement is unusable.
+    bool update(const char* name, const CallPeer& peer, const char* numbers, const char* conf, const char* caps,
+                uint32_t ttlMs, uint32_t nowMs) {
+        if (!entries || name[0] == 0 || strlen(name) > MAX_NAME) return false;
+        if (ttlMs == 0) return remove(name);
+        if (strlen(numbers) > MAX_NUMBERS) return false;
+        Entry* entry = find(name);
+        if (!entry) {
+            entry = findFree(nowMs);
+            *entry = Entry();
+            strcpy(entry->name, name);
+            entry->used = true;
+            added++;
+        }
+        entry->peer = peer;
+        strcpy(entry->numbers, numbers);
+        entry->conferenceNumber[0] = 0;
+        entry->conferencePort = 0;
+        const char* colon = conf ? strchr(conf, ':') : nullptr;
+        if (colon && colon > conf && (uint32_t)(colon - conf) <= CallEngine::MAX_NUMBER) {
+            memcpy(entry->conferenceNumber, conf, colon - conf);
+            entry->conferenceNumber[colon - conf] = 0;
+            entry->conferencePort = (uint16_t)atoi(colon + 1);
+        }
+        entry->capabilities = parseCapabilities(caps);
+        entry->expiresMs = nowMs + ttlMs;
+        return true;
+    }
+
+    bool remove(const char* name) {
+        Entry* entry = find(name);
+        if (!entry) return false;
+        entry->used = false;
+        return true;
+    }
+
+    // Drops announcements that ran out, returns how many
+    uint8_t expire(uint32_t nowMs) {
+        uint8_t removed = 0;
+        for (uint8_t i = 0; i < capacity && entries; i++) {
+            if (entries[i].used && isExpired(entries[i], nowMs)) {
+                entries[i].used = false;
+                removed++;
+                expired++;
+            }
+        }
+        return removed;
+    }
+
+    // The call or conference address of the phone that answers the number
+    bool resolve(const char* number, uint32_t nowMs, CallPeer& peer) {
+        lookups++;
+        for (uint8_t i = 0; i < capacity && entries; i++) {
+            const Entry& entry = entries[i];
+            if (!entry.used || isExpired(entry, nowMs)) continue;
+            if (entry.conferencePort != 0 && strcmp(entry.conferenceNumber, number) == 0) {
+                peer.address = entry.peer.address;
+                peer.port = entry.conferencePort;
+                return true;
+            }
+            if (matchesNumber(entry.numbers, number)) {
+                peer = entry.peer;
+                return true;
+            }
+        }
+        misses++;
+        missPending = true;
+        return false;
+    }
+
+    // Whether a phone in the table answers digits (accepts) or a longer number starting with
+    // them (extendable), for deciding when dialling is complete. Not counted as a lookup.
+    void matchPrefix(const char* digits, uint32_t nowMs, bool& accepts, bool& extendable) const {
+        for (uint8_t i = 0; i < capacity && entries; i++) {
+            const Entry& entry = entries[i];
+            if (!entry.used || isExpired(entry, nowMs)) continue;
+            if (entry.conferencePort != 0) matchesPrefix(entry.conferenceNumber, digits, accepts, extendable);
+            matchesPrefix(entry.numbers, digits, accepts, extendable);
+        }
+    }
+
+    // Whether the owner should ask the network now
+    bool needsQuery(uint32_t nowMs) const {
+        if (queries == 0) return true;
+        uint32_t sinceQuery = nowMs - lastQueryMs;
+        return sinceQuery >= refreshMs || (missPending && sinceQuery >= MIN_QUERY_GAP_MS);
+    }
+
+    void markQueried(uint32_t nowMs) {
+        lastQueryMs = nowMs;
+        missPending = false;
+        queries++;
+    }
+
+    // Comma separated numbers and ranges like 40-49, both ends of a range have the same length
+    static bool matchesNumber(const char* numbers, const char* number) {
+        size_t len = strlen(number);
+        const char* item = numbers;
+        while (len > 0 && *item) {
+            const char* end = strchr(item, ',');
+            if (!end) end = item + strlen(item);
+            const char* dash = (const char*)memchr(item, '-', end - item);
+            if (!dash) {
+                if ((size_t)(end - item) == len && memcmp(item, number, len) == 0) return true;
+            } else if ((size_t)(dash - item) == len && (size_t)(end - dash - 1) == len) {
+                // Digit strings of equal length compare like their values
+                if (memcmp(item, number, len) <= 0 && memcmp(number, dash + 1, len) <= 0) return true;
+            }
+            item = *end ? end + 1 : end;
+        }
+        return false;
+    }
+
+    // matchesNumber() for numbers that are still being dialled: sets accepts if the list holds
+    // digits, extendable if it holds a longer number that starts with them
+    static void matchesPrefix(const char* numbers, const char* digits, bool& accepts, bool& extendable) {
+        size_t len = strlen(digits);
+        const char* item = numbers;
+        while (*item) {
+            const char* end = strchr(item, ',');
+            if (!end) end = item + strlen(item);
+            const char* dash = (const char*)memchr(item, '-', end - item);
+            size_t itemLen = dash ? dash - item : end - item;
+            if (itemLen >= len && (!dash || (size_t)(end - dash - 1) == itemLen)) {
+                // Numbers of a range share their first len digits with a value between those of both ends
+                const char* high = dash ? dash + 1 : item;
+                if (memcmp(item, digits, len) <= 0 && memcmp(digits, high, len) <= 0) {
+                    if (itemLen == len) accepts = true;
+                    else extendable = true;
+                }
+            }
+            item = *end ? end + 1 : end;
+        }
+    }
+
+    static uint8_t parseCapabilities(const char* text) {
+        uint8_t capabilities = 0;
+        const char* item = text ? text : "";
+        while (*item) {
+            const char* end = strchr(item, ',');
+            if (!end) end = item + strlen(item);
+            size_t len = end - item;
+            for (uint8_t bit = 0; bit < 4; bit++) {
+                if (strlen(getCapabilityName(bit)) == len && memcmp(getCapabilityName(bit), item, len) == 0) capabilities |= 1 << bit;
+            }
+            item = *end ? end + 1 : end;
+        }
+        return capabilities;
+    }
+
+    static void formatCapabilities(uint8_t capabilities, char* out, size_t size) {
+        size_t pos = 0;
+        out[0] = 0;
+        for (uint8_t bit = 0; bit < 4; bit++) {
+            if (!(capabilities & (1 << bit))) continue;
+            size_t len = strlen(getCapabilityName(bit));
+            if (pos + len + 2 > size) break;
+            if (pos > 0) out[pos++] = ',';
+            memcpy(out + pos, getCapabilityName(bit), len + 1);
+            pos += len;
+        }
+    }
+
+    // Entries that are in use, expired ones included until expire() runs
+    uint8_t getCount() const {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < capacity && entries; i++) {
+            if (entries[i].used) count++;
+        }
+        return count;
+    }
+
+    // TXT name of capability bit 0 to 3
+    static const char* getCapabilityName(uint8_t bit) {
+        static const char* names[] = { "call", "conference", "ring", "ptt" };
+        return names[bit];
+    }
+
+    uint8_t getCapacity() const { return capacity; }
+    // Slot i, check used
+    const Entry& getEntry(uint8_t i) const { return entries[i]; }
+    uint32_t getLookups() const { return lookups; }
+    uint32_t getMisses() const { return misses; }
+    uint32_t getQueries() const { return queries; }
+    uint32_t getAdded() const { return added; }
+    uint32_t getExpired() const { return expired; }
+    uint32_t getEvicted() const { return evicted; }
+
+private:
+    uint8_t capacity;
+    uint32_t refreshMs;
+    Entry* entries;
+    uint32_t lastQueryMs = 0;
+    bool missPending = false;
+    uint32_t lookups = 0;
+    uint32_t misses = 0;
+    uint32_t queries = 0;
+    uint32_t added = 0;
+    uint32_t expired = 0;
+    uint32_t evicted = 0;
+
+    static bool isExpired(const Entry& entry, uint32_t nowMs) {
+        return (int32_t)(nowMs - entry.expiresMs) >= 0;
+    }
+
+    Entry* find(const char* name) {
+        for (uint8_t i = 0; i < capacity && entries; i++) {
+            if (entries[i].used && strcmp(entries[i].name, name) == 0) return &entries[i];
+        }
+        return nullptr;
+    }
+
+    // A free slot, or the one that runs out first
+    Entry* findFree(uint32_t nowMs) {
+        Entry* soonest = &entries[0];
+        for (uint8_t i = 0; i < capacity; i++) {
+            if (!entries[i].used) return &entries[i];
+            if ((int32_t)(entries[i].expiresMs - soonest->expiresMs) < 0) soonest = &entries[i];
+        }
+        if (!isExpired(*soonest, nowMs)) evicted++;
+        return soonest;
+    }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Streaming stereo sample-rate converter: a windowed-sinc polyphase FIR with Q15
+// coefficients, linearly interpolated between neighbouring phases. The table is
+// computed by setRates() and only again when the cutoff changes.
+class Resampler {
+public:
+    static const int TAPS = 16;    // Input frames per output frame
+    static const int PHASE_BITS = 6;
+    static const int PHASES = 1 << PHASE_BITS; // Coefficient sets per input frame
+
+    // Also resets the history, call it at the start of every stream
+    void setRates(uint32_t inputRate, uint32_t outputRate) {
+        if (inputRate == 0 || outputRate == 0) inputRate = outputRate = 1;
+        inRate = inputRate;
+        outRate = outputRate;
+        uint64_t step = ((uint64_t)inputRate << 32) / outputRate;
+        stepFrames = (uint32_t)(step >> 32);
+        stepFraction = (uint32_t)step;
+        // Below the lower of both Nyquist frequencies, in cycles per input frame
+        float cutoff = CUTOFF * (outputRate < inputRate ? (float)outputRate / inputRate : 1.0f);
+        if (cutoff != tableCutoff) {
+            buildTable(cutoff);
+            tableCutoff = cutoff;
+        }
+        reset();
+    }
+
+    void reset() {
+        memset(history, 0, sizeof(history));
+        head = 0;
+        position = 0;
+        // Prime the history so the first input frame sits just before the output position
+        pending = TAPS / 2;
+    }
+
+    bool isPassthrough() const {
+        return inRate == outRate;
+    }
+
+    uint32_t getInputRate() const {
+        return inRate;
+    }
+
+    // Converts up to inFrames interleaved stereo frames into up to outFrames frames.
+    // Returns the frames written, *inUsed receives the input frames consumed. Output still
+    // owed for consumed input is produced by the next call, before it takes more input.
+    uint32_t process(const int16_t* in, uint32_t inFrames, uint32_t* inUsed, int16_t* out, uint32_t outFrames) {
+        if (isPassthrough()) {
+            uint32_t n = inFrames < outFrames ? inFrames : outFrames;
+            memcpy(out, in, n * 2 * sizeof(int16_t));
+            *inUsed = n;
+            return n;
+        }
+        uint32_t used = 0;
+        uint32_t produced = 0;
+        while (produced < outFrames) {
+            while (pending > 0) {
+                if (used >= inFrames) {
+                    *inUsed = used;
+                    return produced;
+                }
+                push(in + used * 2);
+                used++;
+                pending--;
+            }
+            filter(out + produced * 2);
+            produced++;
+            uint32_t previous = position;
+            position += stepFraction;
+            pending += stepFrames + (position < previous ? 1 : 0);
+        }
+        *inUsed = used;
+        return produced;
+    }
+
+private:
+    static constexpr float CUTOFF = 0.45f; // Leaves a transition band for the short filter
+
+    uint32_t inRate = 1;
+    uint32_t outRate = 1;
+    // Input frames per output frame in 32.32 fixed point, precise enough not to drift audibly
+    uint32_t stepFrames = 1;
+    uint32_t stepFraction = 0;
+    uint32_t position = 0;    // Output position between history frames TAPS/2 - 1 and TAPS/2, 0.32 fixed point
+    uint32_t pending = 0;     // Input frames to take before the next output frame
+    float tableCutoff = -1;
+    int16_t coefficients[PHASES + 1][TAPS];
+    // Every frame is stored twice so the newest TAPS frames are always contiguous
+    int16_t history[2][TAPS * 2];
+    uint32_t head = 0;
+
+    void push(const int16_t* frame) {
+        for (int c = 0; c < 2; c++) {
+            history[c][head] = frame[c];
+            history[c][head + TAPS] = frame[c];
+        }
+        head = (head + 1) % TAPS;
+    }
+
+    void filter(int16_t* out) {
+        // Coefficients between the two nearest phases
+        uint32_t phase = position >> (32 - PHASE_BITS);
+        int32_t fraction = (position >> (32 - PHASE_BITS - 8)) & 0xFF;
+        const int16_t* a = coefficients[phase];
+        const int16_t* b = coefficients[phase + 1];
+        int32_t taps[TAPS];
+        for (int k = 0; k < TAPS; k++) {
+            taps[k] = a[k] + (((b[k] - a[k]) * fraction) >> 8);
+        }
+        // history[c][head] is the oldest of the newest TAPS frames
+        for (int c = 0; c < 2; c++) {
+            const int16_t* h = &history[c][head];
+            int32_t sum = 0;
+            for (int k = 0; k < TAPS; k++) sum += h[k] * taps[k];
+            sum = (sum + (1 << 14)) >> 15;
+            if (sum > 32767) sum = 32767;
+            if (sum < -32768) sum = -32768;
+            out[c] = (int16_t)sum;
+        }
+    }
+
+    // Blackman windowed sinc, every phase normalized to unity gain at DC
+    void buildTable(float cutoff) {
+        for (int p = 0; p <= PHASES; p++) {
+            float fraction = (float)p / PHASES;
+            float values[TAPS];
+            float total = 0;
+            for (int k = 0; k < TAPS; k++) {
+                float x = (float)(k - (TAPS / 2 - 1)) - fraction;
+                float sinc = x == 0 ? 1.0f : sinf((float)M_PI * 2 * cutoff * x) / ((float)M_PI * 2 * cutoff * x);
+                float w = (x + TAPS / 2.0f) / TAPS; // 0..1 across the filter span
+                float window = 0.42f - 0.5f * cosf(2 * (float)M_PI * w) + 0.08f * cosf(4 * (float)M_PI * w);
+                values[k] = sinc * window;
+                total += values[k];
+            }
+            int32_t sum = 0;
+            int largest = 0;
+            for (int k = 0; k < TAPS; k++) {
+                coefficients[p][k] = (int16_t)lroundf(values[k] / total * 32767.0f);
+                sum += coefficients[p][k];
+                if (abs(coefficients[p][k]) > abs(coefficients[p][largest])) largest = k;
+            }
+            // Put the rounding error on the largest tap so DC passes unchanged
+            coefficients[p][largest] += (int16_t)(32767 - sum);
+        }
+    }
+};
+
+#endif
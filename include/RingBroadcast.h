@@ -0,0 +1,160 @@
+#ifndef RING_BROADCAST_H
+#define RING_BROADCAST_H
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include "WavFormat.h"
+
+// Rings or stops every phone in the venue with one UDP multicast packet. The owner sends and
+// receives on the multicast group and passes its millisecond clock; the class builds, repeats
+// and filters packets.
+//
+// Every packet starts with a HEADER_SIZE byte header, little endian:
+//   'H' 'R' version command, sender id (32 bit), sequence (32 bit), copy, number length
+// followed by the number for RING. Each event is sent COPIES times, REPEAT_MS apart, so a
+// phone that loses the first packet still acts. A receiver remembers the newest sequence of
+// the last SENDERS senders and handles every event once, repeats and old packets are dropped.
+// Senders pick a random id per boot, so a restarted sender is a new sender.
+class RingBroadcast {
+public:
+    enum Command { RING = 1, STOP };
+
+    static const uint8_t VERSION = 1;
+    static const uint32_t HEADER_SIZE = 14;
+    static const uint32_t MAX_NUMBER = 15;
+    static const uint32_t MAX_PACKET = HEADER_SIZE + MAX_NUMBER;
+    static const uint8_t COPIES = 3;
+    static const uint32_t REPEAT_MS = 10;
+    static const uint8_t SENDERS = 8;
+
+    typedef std::function<bool(const uint8_t*, size_t)> Send;
+    // Command and number, empty for STOP
+    typedef std::function<void(Command, const char*)> CommandCallback;
+
+    RingBroadcast(uint32_t senderId, Send send) : senderId(senderId), send(send) {
+        memset(senders, 0, sizeof(senders));
+    }
+
+    void onCommand(CommandCallback callback) { commandCallback = callback; }
+
+    bool ring(const char* number, uint32_t nowMs) {
+        size_t len = strlen(number);
+        if (len == 0 || len > MAX_NUMBER) return false;
+        return broadcast(RING, number, len, nowMs);
+    }
+
+    bool stop(uint32_t nowMs) {
+        return broadcast(STOP, "", 0, nowMs);
+    }
+
+    // Sends the repeats of the newest event, call it every few milliseconds
+    void poll(uint32_t nowMs) {
+        if (copiesLeft == 0 || nowMs - lastSentMs < REPEAT_MS) return;
+        pending[12] = (uint8_t)(COPIES - copiesLeft);
+        transmit(nowMs);
+    }
+
+    // Returns true if the packet was a new event and the callback ran
+    bool receive(const uint8_t* data, size_t len) {
+        if (len < HEADER_SIZE || data[0] != 'H' || data[1] != 'R' || data[2] != VERSION ||
+            (data[3] != RING && data[3] != STOP) || data[13] > MAX_NUMBER || len < HEADER_SIZE + data[13]) {
+            invalidPackets++;
+            return false;
+        }
+        uint32_t sender = wavRead32(data + 4);
+        uint32_t seq = wavRead32(data + 8);
+        // Our own packets come back over multicast loopback, the sender handles its events itself
+        if (sender == senderId) return false;
+
+        Sender* known = findSender(sender);
+        if (known && (int32_t)(seq - known->seq) <= 0) {
+            duplicates++;
+            return false;
+        }
+        if (!known) known = replaceSender(sender);
+        known->seq = seq;
+        known->lastUse = ++useCounter;
+
+        handled++;
+        if (data[12] > 0) recovered++;
+        char number[MAX_NUMBER + 1];
+        memcpy(number, data + HEADER_SIZE, data[13]);
+        number[data[13]] = 0;
+        if (commandCallback) commandCallback((Command)data[3], number);
+        return true;
+    }
+
+    uint32_t getSenderId() const { return senderId; }
+    uint32_t getSentPackets() const { return sentPackets; }
+    uint32_t getHandled() const { return handled; }
+    // Events that were only heard through a repeat
+    uint32_t getRecovered() const { return recovered; }
+    uint32_t getDuplicates() const { return duplicates; }
+    uint32_t getInvalidPackets() const { return invalidPackets; }
+
+private:
+    struct Sender {
+        uint32_t id;
+        uint32_t seq;
+        uint32_t lastUse; // 0 for a free entry
+    };
+
+    uint32_t senderId;
+    Send send;
+    CommandCallback commandCallback;
+    uint32_t seq = 0;
+    uint8_t pending[MAX_PACKET];
+    size_t pendingLen = 0;
+    uint8_t copiesLeft = 0;
+    uint32_t lastSentMs = 0;
+    Sender senders[SENDERS];
+    uint32_t useCounter = 0;
+    uint32_t sentPackets = 0;
+    uint32_t handled = 0;
+    uint32_t recovered = 0;
+    uint32_t duplicates = 0;
+    uint32_t invalidPackets = 0;
+
+    bool broadcast(Command command, const char* number, size_t len, uint32_t nowMs) {
+        pending[0] = 'H';
+        pending[1] = 'R';
+        pending[2] = VERSION;
+        pending[3] = (uint8_t)command;
+        wavWrite32(pending + 4, senderId);
+        wavWrite32(pending + 8, ++seq);
+        pending[12] = 0;
+        pending[13] = (uint8_t)len;
+        memcpy(pending + HEADER_SIZE, number, len);
+        pendingLen = HEADER_SIZE + len;
+        // A newer event replaces the repeats of the previous one
+        copiesLeft = COPIES;
+        return transmit(nowMs);
+    }
+
+    bool transmit(uint32_t nowMs) {
+        copiesLeft--;
+        lastSentMs = nowMs;
+        sentPackets++;
+        return send(pending, pendingLen);
+    }
+
+    Sender* findSender(uint32_t id) {
+        for (uint8_t i = 0; i < SENDERS; i++) {
+            if (senders[i].lastUse != 0 && senders[i].id == id) return &senders[i];
+        }
+        return nullptr;
+    }
+
+    // The least recently heard sender makes room
+    Sender* replaceSender(uint32_t id) {
+        Sender* oldest = &senders[0];
+        for (uint8_t i = 1; i < SENDERS; i++) {
+            if (senders[i].lastUse < oldest->lastUse) oldest = &senders[i];
+        }
+        oldest->id = id;
+        return oldest;
+    }
+};
+
+#endif
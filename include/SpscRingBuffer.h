@@ -0,0 +1,86 @@
+#ifndef SPSC_RING_BUFFER_H
+#define SPSC_RING_BUFFER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+// Lock-free ring buffer for exactly one producer and one consumer thread.
+// push() may only be called by the producer, pop()/discard() only by the consumer.
+template <typename T>
+class SpscRingBuffer {
+public:
+    // Capacity is rounded up to a power of two
+    explicit SpscRingBuffer(uint32_t minCapacity) : head(0), tail(0) {
+        capacity = 1;
+        while (capacity < minCapacity) capacity <<= 1;
+        mask = capacity - 1;
+        items = (T*)malloc(sizeof(T) * capacity);
+    }
+
+    ~SpscRingBuffer() {
+        free(items);
+    }
+
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    bool isAllocated() const { return items != nullptr; }
+    uint32_t getCapacity() const { return capacity; }
+
+    uint32_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    uint32_t space() const {
+        return capacity - size();
+    }
+
+    // Returns the number of items actually queued
+    uint32_t push(const T* src, uint32_t count) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        uint32_t n = capacity - (h - t);
+        if (count < n) n = count;
+        for (uint32_t i = 0; i < n; i++) {
+            items[(h + i) & mask] = src[i];
+        }
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    bool push(const T& item) {
+        return push(&item, 1) == 1;
+    }
+
+    // Returns the number of items actually taken
+    uint32_t pop(T* dest, uint32_t count) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t h = head.load(std::memory_order_acquire);
+        uint32_t n = h - t;
+        if (count < n) n = count;
+        for (uint32_t i = 0; i < n; i++) {
+            dest[i] = items[(t + i) & mask];
+        }
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    bool pop(T& item) {
+        return pop(&item, 1) == 1;
+    }
+
+    // Drops everything currently queued
+    void discard() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    T* items;
+    uint32_t capacity;
+    uint32_t mask;
+    std::atomic<uint32_t> head; // Written by the producer only
+    std::atomic<uint32_t> tail; // Written by the consumer only
+};
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef TONE_SYNTH_H
+#define TONE_SYNTH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// One step of a cadence: up to two mixed frequencies (0 = unused, both 0 = pause)
+// for durationMs milliseconds (0 = forever)
+struct ToneSegment {
+    uint16_t freq1;
+    uint16_t freq2;
+    uint16_t durationMs;
+};
+
+// A call-progress tone, its segments repeat until the tone is stopped
+struct ToneSpec {
+    const char* region;
+    const char* name;
+    uint8_t segmentCount;
+    ToneSegment segments[4];
+};
+
+// Call-progress tones per region (ITU-T E.180 and national specifications)
+static const ToneSpec TONE_TABLE[] = {
+    { "DE", "dial",       1, { { 425, 0, 0 } } },
+    { "DE", "busy",       2, { { 425, 0, 480 }, { 0, 0, 480 } } },
+    { "DE", "ringback",   2, { { 425, 0, 1000 }, { 0, 0, 4000 } } },
+    { "DE", "congestion", 2, { { 425, 0, 240 }, { 0, 0, 240 } } },
+    { "DE", "sit",        4, { { 950, 0, 330 }, { 1400, 0, 330 }, { 1800, 0, 330 }, { 0, 0, 1000 } } },
+    { "DE", "beep",       1, { { 1000, 0, 400 } } },   // Start of a mailbox recording, played once
+    { "US", "dial",       1, { { 350, 440, 0 } } },
+    { "US", "busy",       2, { { 480, 620, 500 }, { 0, 0, 500 } } },
+    { "US", "ringback",   2, { { 440, 480, 2000 }, { 0, 0, 4000 } } },
+    { "US", "congestion", 2, { { 480, 620, 250 }, { 0, 0, 250 } } },
+    { "US", "sit",        4, { { 914, 0, 274 }, { 1371, 0, 274 }, { 1777, 0, 380 }, { 0, 0, 1000 } } },
+    { "US", "beep",       1, { { 1000, 0, 400 } } },
+    { "UK", "dial",       1, { { 350, 450, 0 } } },
+    { "UK", "busy",       2, { { 400, 0, 375 }, { 0, 0, 375 } } },
+    { "UK", "ringback",   4, { { 400, 450, 400 }, { 0, 0, 200 }, { 400, 450, 400 }, { 0, 0, 2000 } } },
+    { "UK", "congestion", 4, { { 400, 0, 400 }, { 0, 0, 350 }, { 400, 0, 225 }, { 0, 0, 525 } } },
+    { "UK", "sit",        4, { { 950, 0, 333 }, { 1400, 0, 333 }, { 1800, 0, 333 }, { 0, 0, 1000 } } },
+    { "UK", "beep",       1, { { 1000, 0, 400 } } },
+};
+
+static inline const ToneSpec* findTone(const char* region, const char* name) {
+    for (const ToneSpec& tone : TONE_TABLE) {
+        if (strcmp(tone.region, region) == 0 && strcmp(tone.name, name) == 0) return &tone;
+    }
+    return nullptr;
+}
+
+// Table-driven DDS oscillator that renders a ToneSpec sample by sample
+class ToneSynth {
+public:
+    ToneSynth() {
+        initTable();
+    }
+
+    void start(const ToneSpec* spec, uint32_t rate, bool repeat = true) {
+        tone = spec;
+        sampleRate = rate;
+        repeating = repeat;
+        phase1 = 0;
+        phase2 = 0;
+        enterSegment(0);
+    }
+
+    void stop() {
+        tone = nullptr;
+    }
+
+    bool isRunning() const {
+        return tone != nullptr;
+    }
+
+    // Renders up to count mono samples, returns fewer once a non-repeating tone has ended
+    uint32_t render(int16_t* out, uint32_t count) {
+        uint32_t i = 0;
+        while (i < count && tone) {
+            const ToneSegment& segment = tone->segments[segmentIndex];
+            int32_t value = 0;
+            if (segment.freq1) {
+                value += lookup(phase1);
+                phase1 += increment1;
+            }
+            if (segment.freq2) {
+                value += lookup(phase2);
+                phase2 += increment2;
+            }
+            // Short fades at the segment edges avoid clicks in the cadence
+            if (samplesLeft != UINT32_MAX) {
+                uint32_t edge = samplePos < samplesLeft ? samplePos : samplesLeft;
+                if (edge < RAMP_SAMPLES) value = value * (int32_t)edge / RAMP_SAMPLES;
+            } else if (samplePos < RAMP_SAMPLES) {
+                value = value * (int32_t)samplePos / RAMP_SAMPLES;
+            }
+            out[i++] = (int16_t)value;
+            samplePos++;
+            if (samplesLeft != UINT32_MAX && --samplesLeft == 0) {
+                uint8_t next = segmentIndex + 1;
+                if (next >= tone->segmentCount) {
+                    if (!repeating) {
+                        tone = nullptr;
+                        break;
+                    }
+                    next = 0;
+                }
+                enterSegment(next);
+            }
+        }
+        return i;
+    }
+
+private:
+    static const uint32_t RAMP_SAMPLES = 64;
+    static const int16_t AMPLITUDE = 9000; // Per frequency, two of them stay well below full scale
+
+    const ToneSpec* tone = nullptr;
+    uint32_t sampleRate = 16000;
+    bool repeating = true;
+    uint8_t segmentIndex = 0;
+    uint32_t samplesLeft = 0;  // UINT32_MAX for a segment without end
+    uint32_t samplePos = 0;
+    uint32_t phase1 = 0;       // Phase accumulators, a full turn is 2^32
+    uint32_t phase2 = 0;
+    uint32_t increment1 = 0;
+    uint32_t increment2 = 0;
+
+    static int16_t* table() {
+        static int16_t sine[257];
+        return sine;
+    }
+
+    static void initTable() {
+        static bool initialized = false;
+        if (initialized) return;
+        for (int i = 0; i <= 256; i++) {
+            table()[i] = (int16_t)lroundf(AMPLITUDE * sinf(2.0f * (float)M_PI * i / 256.0f));
+        }
+        initialized = true;
+    }
+
+    // Linear interpolation between the 256 table entries
+    static int32_t lookup(uint32_t phase) {
+        uint32_t index = phase >> 24;
+        int32_t fraction = (phase >> 8) & 0xFFFF;
+        int32_t a = table()[index];
+        int32_t b = table()[index + 1];
+        return a + (((b - a) * fraction) >> 16);
+    }
+
+    uint32_t incrementFor(uint16_t freq) const {
+        return (uint32_t)(((uint64_t)freq << 32) / sampleRate);
+    }
+
+    void enterSegment(uint8_t index) {
+        segmentIndex = index;
+        const ToneSegment& segment = tone->segments[index];
+        increment1 = incrementFor(segment.freq1);
+        increment2 = incrementFor(segment.freq2);
+        samplesLeft = segment.durationMs ? (uint32_t)((uint64_t)segment.durationMs * sampleRate / 1000) : UINT32_MAX;
+        samplePos = 0;
+        if (samplesLeft == 0) samplesLeft = 1;
+    }
+};
+
+#endif
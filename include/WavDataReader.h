@@ -0,0 +1,145 @@
+#ifndef WAV_DATA_READER_H
+#define WAV_DATA_READER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "WavFormat.h"
+#include "ImaAdpcm.h"
+
+// Reads the data chunk of a WAV file frame by frame as 16 bit stereo, from 8 or 16 bit PCM or
+// IMA ADPCM. With looping on it wraps from the loop end back to the loop start inside the data
+// chunk, so the frame after the last one of a pass is the first one of the next, without
+// reopening the file or parsing the header again.
+// Source needs: uint32_t read(void* dest, uint32_t len) and bool seek(uint32_t position),
+// the position being a file offset.
+template <typename Source>
+class WavDataReader {
+public:
+    WavDataReader() : source(NULL), looping(false), loopStart(0), dataEnd(0), dataPos(0), bufferPos(0), bufferLen(0),
+                      adpcmBlock(NULL), adpcmSamples(NULL), adpcmFrames(0), adpcmPos(0) {}
+
+    ~WavDataReader() {
+        free(adpcmBlock);
+        free(adpcmSamples);
+    }
+
+    // The source must be positioned at format.dataOffset and format.dataLength must not reach
+    // past the end of the file. Loop points are in milliseconds, loopEndMs = 0 loops up to the
+    // end of the data. False if the format is not playable or the ADPCM buffers are missing.
+    bool start(Source* newSource, const WavFormat& newFormat, bool loop, uint32_t loopStartMs, uint32_t loopEndMs) {
+        source = newSource;
+        format = newFormat;
+        if (!format.isPlayable()) return false;
+        if (format.isImaAdpcm() && !allocateAdpcmBuffers()) return false;
+        looping = loop;
+        dataEnd = format.dataLength;
+        loopStart = 0;
+        if (looping) {
+            loopStart = msToBytes(loopStartMs);
+            if (loopEndMs > 0) dataEnd = std::min(dataEnd, msToBytes(loopEndMs));
+            if (loopStart >= dataEnd) loopStart = 0;
+        }
+        dataPos = 0;
+        bufferPos = 0;
+        bufferLen = 0;
+        adpcmFrames = 0;
+        adpcmPos = 0;
+        return true;
+    }
+
+    // The next frame, false at the end of the data or on a read error
+    bool next(int16_t frame[2]) {
+        if (format.formatTag == WavFormat::FORMAT_IMA_ADPCM) {
+            if (adpcmPos >= adpcmFrames && !decodeAdpcmBlock()) return false;
+            const int16_t* samples = adpcmSamples + adpcmPos * format.channels;
+            adpcmPos++;
+            frame[0] = samples[0];
+            frame[1] = format.channels == 2 ? samples[1] : samples[0];
+            return true;
+        }
+        if (bufferLen - bufferPos < format.blockAlign && !fillBuffer()) return false;
+        const uint8_t* bytes = buffer + bufferPos;
+        bufferPos += format.blockAlign;
+        if (format.bitsPerSample == 16) {
+            frame[0] = (int16_t)wavRead16(bytes);
+            frame[1] = format.channels == 2 ? (int16_t)wavRead16(bytes + 2) : frame[0];
+        } else {
+            frame[0] = (int16_t)((bytes[0] - 128) * 256);
+            frame[1] = format.channels == 2 ? (int16_t)((bytes[1] - 128) * 256) : frame[0];
+        }
+        return true;
+    }
+
+    const WavFormat& getFormat() const {
+        return format;
+    }
+
+private:
+    Source* source;
+    WavFormat format;
+    bool looping;
+    uint32_t loopStart; // Byte offsets inside the data chunk
+    uint32_t dataEnd;
+    uint32_t dataPos;   // Bytes of the data chunk read so far
+    uint8_t buffer[512];
+    uint16_t bufferPos;
+    uint16_t bufferLen;
+    uint8_t* adpcmBlock;    // One compressed block
+    int16_t* adpcmSamples;  // The block decoded, interleaved
+    uint32_t adpcmFrames;
+    uint32_t adpcmPos;
+
+    WavDataReader(const WavDataReader&);
+    WavDataReader& operator=(const WavDataReader&);
+
+    // Loop points are rounded down to whole blocks for ADPCM
+    uint32_t msToBytes(uint32_t ms) const {
+        uint32_t frames = (uint32_t)((uint64_t)ms * format.sampleRate / 1000);
+        uint32_t blocks = frames / format.samplesPerBlock();
+        return std::min(blocks * format.blockAlign, format.dataLength);
+    }
+
+    // Sized for the largest block once, so switching files does not fragment the heap
+    bool allocateAdpcmBuffers() {
+        if (!adpcmBlock) adpcmBlock = (uint8_t*)malloc(WavFormat::MAX_ADPCM_BLOCK);
+        if (!adpcmSamples) adpcmSamples = (int16_t*)malloc(imaSamplesPerBlock(WavFormat::MAX_ADPCM_BLOCK, 1) * sizeof(int16_t));
+        return adpcmBlock && adpcmSamples;
+    }
+
+    bool rewind() {
+        if (!looping || !source->seek(format.dataOffset + loopStart)) return false;
+        dataPos = loopStart;
+        return true;
+    }
+
+    bool decodeAdpcmBlock() {
+        if (dataPos + format.blockAlign > dataEnd && !rewind()) return false;
+        if (source->read(adpcmBlock, format.blockAlign) != format.blockAlign) return false;
+        dataPos += format.blockAlign;
+        adpcmFrames = imaDecodeBlock(adpcmBlock, format.blockAlign, format.channels, adpcmSamples);
+        adpcmPos = 0;
+        return adpcmFrames > 0;
+    }
+
+    // Refill the buffer, jumping back to the loop start at the loop end
+    bool fillBuffer() {
+        memmove(buffer, buffer + bufferPos, bufferLen - bufferPos);
+        bufferLen -= bufferPos;
+        bufferPos = 0;
+        while (bufferLen < format.blockAlign) {
+            if (dataPos >= dataEnd && !rewind()) return false;
+            uint32_t space = sizeof(buffer) - bufferLen;
+            space -= space % format.blockAlign;
+            uint32_t toRead = std::min(space, dataEnd - dataPos);
+            uint32_t got = source->read(buffer + bufferLen, toRead);
+            if (got == 0) return false;
+            bufferLen += got;
+            dataPos += got;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef WAV_FORMAT_H
+#define WAV_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Format of a RIFF/WAVE file and where its sample data is located
+struct WavFormat {
+    static const uint16_t FORMAT_PCM = 1;
+    static const uint16_t FORMAT_IMA_ADPCM = 0x11;
+    static const uint16_t FORMAT_MPEG_LAYER3 = 0x55;
+    static const uint16_t MAX_ADPCM_BLOCK = 2048;
+
+    uint16_t formatTag = 0;
+    uint16_t channels = 0;
+    uint32_t sampleRate = 0;
+    uint16_t bitsPerSample = 0;
+    uint16_t blockAlign = 0;  // Bytes per frame (PCM) or per compressed block
+    uint32_t dataOffset = 0;  // File offset of the first sample byte
+    uint32_t dataLength = 0;  // Size of the data chunk in bytes
+    uint32_t byteRate = 0;    // Average bytes per second, only used for MP3
+
+    bool isPcm() const {
+        return formatTag == FORMAT_PCM && (bitsPerSample == 8 || bitsPerSample == 16) && (channels == 1 || channels == 2);
+    }
+
+    bool isImaAdpcm() const {
+        return formatTag == FORMAT_IMA_ADPCM && bitsPerSample == 4 && (channels == 1 || channels == 2) &&
+               blockAlign > 4 * channels && blockAlign <= MAX_ADPCM_BLOCK && blockAlign % (4 * channels) == 0;
+    }
+
+    // MP3 data described in WAV terms, played by the MP3 decoder instead
+    bool isMp3() const {
+        return formatTag == FORMAT_MPEG_LAYER3;
+    }
+
+    // Formats the WAV player can decode
+    bool isPlayable() const {
+        return isPcm() || isImaAdpcm();
+    }
+
+    // Frames per compressed block, 1 for PCM
+    uint32_t samplesPerBlock() const {
+        if (formatTag != FORMAT_IMA_ADPCM) return 1;
+        return channels && blockAlign >= 4 * channels ? (uint32_t)(blockAlign - 4 * channels) * 2 / channels + 1 : 0;
+    }
+
+    uint32_t frameCount() const {
+        if (isMp3()) return byteRate ? (uint32_t)((uint64_t)dataLength * sampleRate / byteRate) : 0;
+        return blockAlign ? dataLength / blockAlign * samplesPerBlock() : 0;
+    }
+
+    uint32_t durationMs() const {
+        return sampleRate ? (uint32_t)((uint64_t)frameCount() * 1000 / sampleRate) : 0;
+    }
+};
+
+static inline uint16_t wavRead16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t wavRead32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void wavWrite16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static inline void wavWrite32(uint8_t* p, uint32_t v) {
+    wavWrite16(p, v & 0xFFFF);
+    wavWrite16(p + 2, v >> 16);
+}
+
+// Walks the RIFF chunks up to the start of the data chunk, skipping everything else (bext, LIST, ...).
+// Reader needs: uint32_t read(void* dest, uint32_t len) and bool skip(uint32_t len).
+// On success the reader is positioned at the first sample byte.
+template <typename Reader>
+bool parseWavHeader(Reader& reader, WavFormat& format) {
+    uint8_t header[12];
+    if (reader.read(header, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    uint32_t offset = 12;
+    bool haveFormat = false;
+    while (true) {
+        uint8_t chunk[8];
+        if (reader.read(chunk, 8) != 8) return false;
+        offset += 8;
+        uint32_t chunkSize = wavRead32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t fmt[16];
+            if (chunkSize < 16 || reader.read(fmt, 16) != 16) return false;
+            format.formatTag = wavRead16(fmt);
+            format.channels = wavRead16(fmt + 2);
+            format.sampleRate = wavRead32(fmt + 4);
+            format.blockAlign = wavRead16(fmt + 12);
+            format.bitsPerSample = wavRead16(fmt + 14);
+            haveFormat = true;
+            uint32_t rest = chunkSize - 16 + (chunkSize & 1);
+            if (rest && !reader.skip(rest)) return false;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!haveFormat || format.blockAlign == 0) return false;
+            format.dataOffset = offset;
+            format.dataLength = chunkSize - chunkSize % format.blockAlign;
+            return true;
+        } else {
+            // Chunks are word aligned
+            if (!reader.skip(chunkSize + (chunkSize & 1))) return false;
+        }
+        offset += chunkSize + (chunkSize & 1);
+    }
+}
+
+#endif
@@ -0,0 +1,412 @@
+#ifndef WAV_TRANSCODER_H
+#define WAV_TRANSCODER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include "WavFormat.h"
+#include "ImaAdpcm.h"
+
+// Converts a WAV file, fed in arbitrary sized pieces, into a canonical mono WAV
+// (44 byte header, no extra chunks) at a fixed sample rate and 8 or 16 bits,
+// or into IMA ADPCM (4 bits, 60 byte header with fact chunk).
+// Files that are compressed already (IMA ADPCM, MP3 in WAV, ...) or have the target format
+// are passed through: their samples are copied unchanged behind a header with only the fmt,
+// fact and data chunks.
+// Used by the web upload on the device and by tools/wavprep on a PC.
+class WavTranscoder {
+public:
+    // Receives the converted bytes in order, returns false if they could not be stored
+    typedef std::function<bool(const uint8_t*, size_t)> Sink;
+
+    static const size_t MAX_HEADER_SIZE = 80;
+    static const uint16_t ADPCM_BLOCK_ALIGN = 256; // 505 samples, about 32 ms at 16 kHz
+
+    // targetBits 4 selects IMA ADPCM
+    WavTranscoder(uint32_t targetRate, uint16_t targetBits, Sink sink)
+        : targetRate(targetRate), targetBits(targetBits == 4 || targetBits == 8 ? targetBits : 16), sink(sink) {}
+
+    // Only known once the data chunk has been reached, ask after finish()
+    size_t headerSize() const {
+        if (passthrough) return 12 + 8 + fmtSize + (fmtSize & 1) + (haveFact ? 12 : 0) + 8;
+        return targetBits == 4 ? 60 : 44;
+    }
+
+    // A placeholder header is emitted at the start of the data, the final one comes from finish()
+    bool begin() {
+        state = RIFF_HEADER;
+        stagedLen = 0;
+        skipRemaining = 0;
+        dataRemaining = 0;
+        haveFormat = false;
+        passthrough = false;
+        haveFact = false;
+        error = nullptr;
+        outLen = 0;
+        outputBytes = 0;
+        padded = false;
+        phase = 0;
+        previous = 0;
+        boxSum = 0;
+        boxCount = 0;
+        firstSample = true;
+        blockFill = 0;
+        adpcm = ImaAdpcmState();
+        samplesWritten = 0;
+        return true;
+    }
+
+    bool write(const uint8_t* data, size_t len) {
+        while (len > 0 && !error) {
+            switch (state) {
+                case RIFF_HEADER:
+                case CHUNK_HEADER:
+                case FORMAT:
+                case FACT: {
+                    size_t want = stageTarget();
+                    size_t n = want - stagedLen < len ? want - stagedLen : len;
+                    memcpy(staged + stagedLen, data, n);
+                    stagedLen += n;
+                    data += n;
+                    len -= n;
+                    if (stagedLen == want) {
+                        stagedLen = 0;
+                        handleStaged();
+                    }
+                    break;
+                }
+                case SKIP: {
+                    size_t n = skipRemaining < len ? skipRemaining : len;
+                    skipRemaining -= n;
+                    data += n;
+                    len -= n;
+                    if (skipRemaining == 0) state = CHUNK_HEADER;
+                    break;
+                }
+                case DATA: {
+                    size_t n = dataRemaining < len ? dataRemaining : len;
+                    if (passthrough) {
+                        if (!sink(data, n)) return fail("Write failed");
+                        outputBytes += n;
+                    } else {
+                        convert(data, n);
+                    }
+                    dataRemaining -= n;
+                    data += n;
+                    len -= n;
+                    if (dataRemaining == 0) state = DONE;
+                    break;
+                }
+                case DONE:
+                    return true; // Trailing chunks are dropped
+            }
+        }
+        return error == nullptr;
+    }
+
+    // Flushes pending output and fills in the headerSize() bytes that belong at offset 0
+    bool finish(uint8_t header[MAX_HEADER_SIZE]) {
+        if (error) return false;
+        if (state != DATA && state != DONE) return fail("No audio data found");
+        if (!passthrough && targetBits == 4 && blockFill > 0) {
+            // Complete the last block by holding the final sample, the fact chunk has the real length
+            uint32_t realSamples = samplesWritten;
+            int16_t last = blockSamples[blockFill - 1];
+            while (blockFill > 0) emit(last);
+            samplesWritten = realSamples;
+        }
+        if (!flushOutput()) return false;
+        // RIFF chunks are word aligned, the pad byte is not part of the data size
+        padded = outputBytes & 1;
+        if (padded) {
+            uint8_t zero = 0;
+            if (!sink(&zero, 1)) return fail("Write failed");
+        }
+        buildHeader(header);
+        return true;
+    }
+
+    const char* getError() const { return error; }
+    uint32_t getOutputBytes() const { return outputBytes; }
+    const WavFormat& getSourceFormat() const { return source; }
+    // The samples were copied unchanged, see the class comment
+    bool isPassthrough() const { return passthrough; }
+
+private:
+    enum State { RIFF_HEADER, CHUNK_HEADER, FORMAT, FACT, SKIP, DATA, DONE };
+    static const uint16_t FORMAT_EXTENSIBLE = 0xFFFE;
+
+    uint32_t targetRate;
+    uint16_t targetBits;
+    Sink sink;
+
+    State state = RIFF_HEADER;
+    uint8_t staged[40];
+    size_t stagedLen = 0;
+    uint32_t chunkSize = 0;
+    uint32_t skipRemaining = 0;
+    uint32_t dataRemaining = 0;
+    WavFormat source;
+    bool haveFormat = false;
+    bool passthrough = false;
+    uint8_t fmtChunk[sizeof(staged)]; // Copied as is when passing through
+    uint32_t fmtSize = 0;
+    bool haveFact = false;
+    uint32_t factSamples = 0;
+    const char* error = nullptr;
+
+    uint8_t frame[8];      // Partial input frame carried over between write() calls
+    size_t frameLen = 0;
+    uint32_t step = 0;     // Filtered input samples per output sample, 16.16 fixed point
+    uint32_t phase = 0;
+    int32_t previous = 0;
+    int32_t boxSum = 0;    // Box filter against aliasing when downsampling
+    uint32_t boxLength = 1;
+    uint32_t boxCount = 0;
+    bool firstSample = true;
+
+    uint8_t out[512];
+    size_t outLen = 0;
+    uint32_t outputBytes = 0;
+    bool padded = false;
+
+    int16_t blockSamples[(ADPCM_BLOCK_ALIGN - 4) * 2 + 1]; // Samples waiting for the next ADPCM block
+    uint32_t blockFill = 0;
+    ImaAdpcmState adpcm;
+    uint32_t samplesWritten = 0;
+
+    bool fail(const char* message) {
+        error = message;
+        return false;
+    }
+
+    size_t stageTarget() const {
+        if (state == RIFF_HEADER) return 12;
+        if (state == CHUNK_HEADER) return 8;
+        if (state == FACT) return 4;
+        return chunkSize < sizeof(staged) ? chunkSize : sizeof(staged);
+    }
+
+    void handleStaged() {
+        if (state == RIFF_HEADER) {
+            if (memcmp(staged, "RIFF", 4) != 0 || memcmp(staged + 8, "WAVE", 4) != 0) {
+                fail("Not a WAV file");
+                return;
+            }
+            state = CHUNK_HEADER;
+        } else if (state == CHUNK_HEADER) {
+            chunkSize = wavRead32(staged + 4);
+            if (memcmp(staged, "fmt ", 4) == 0) {
+                if (chunkSize < 16) {
+                    fail("Broken fmt chunk");
+                    return;
+                }
+                state = FORMAT;
+            } else if (memcmp(staged, "data", 4) == 0) {
+                if (!haveFormat) {
+                    fail("data chunk before fmt chunk");
+                    return;
+                }
+                dataRemaining = chunkSize;
+                frameLen = 0;
+                uint8_t header[MAX_HEADER_SIZE];
+                buildHeader(header);
+                if (!sink(header, headerSize())) {
+                    fail("Write failed");
+                    return;
+                }
+                state = dataRemaining ? DATA : DONE;
+            } else if (memcmp(staged, "fact", 4) == 0 && chunkSize == 4) {
+                state = FACT;
+            } else {
+                skipRemaining = chunkSize + (chunkSize & 1);
+                state = skipRemaining ? SKIP : CHUNK_HEADER;
+            }
+        } else if (state == FORMAT) {
+            parseFormat();
+            uint32_t consumed = stageTarget();
+            skipRemaining = chunkSize - consumed + (chunkSize & 1);
+            state = skipRemaining ? SKIP : CHUNK_HEADER;
+        } else if (state == FACT) {
+            factSamples = wavRead32(staged);
+            haveFact = true;
+            state = CHUNK_HEADER;
+        }
+    }
+
+    void parseFormat() {
+        source.formatTag = wavRead16(staged);
+        source.channels = wavRead16(staged + 2);
+        source.sampleRate = wavRead32(staged + 4);
+        source.blockAlign = wavRead16(staged + 12);
+        source.bitsPerSample = wavRead16(staged + 14);
+        if (source.formatTag == FORMAT_EXTENSIBLE && chunkSize >= 26) {
+            source.formatTag = wavRead16(staged + 24); // Sub format GUID starts with the format tag
+        }
+        if (source.formatTag != WavFormat::FORMAT_PCM) {
+            // Compressed already, transcoding would only lose quality
+            if (chunkSize > sizeof(fmtChunk)) {
+                fail("Unsupported WAV format, fmt chunk too large");
+                return;
+            }
+            keepFormat();
+            return;
+        }
+        uint16_t bytesPerSample = source.bitsPerSample / 8;
+        if (source.channels < 1 || source.channels > 2 ||
+            (source.bitsPerSample != 8 && source.bitsPerSample != 16 && source.bitsPerSample != 24) ||
+            source.blockAlign != bytesPerSample * source.channels || source.sampleRate == 0) {
+            fail("Unsupported WAV format, only 8/16/24 bit PCM is supported");
+            return;
+        }
+        if (source.channels == 1 && source.sampleRate == targetRate && source.bitsPerSample == targetBits && chunkSize <= sizeof(fmtChunk)) {
+            keepFormat();
+            return;
+        }
+        boxLength = source.sampleRate > targetRate ? source.sampleRate / targetRate : 1;
+        step = (uint32_t)(((uint64_t)source.sampleRate << 16) / ((uint64_t)targetRate * boxLength));
+        haveFormat = true;
+    }
+
+    void keepFormat() {
+        fmtSize = chunkSize;
+        memcpy(fmtChunk, staged, fmtSize);
+        passthrough = true;
+        haveFormat = true;
+    }
+
+    int32_t readSample(const uint8_t* p) const {
+        if (source.bitsPerSample == 8) return ((int32_t)p[0] - 128) * 256;
+        if (source.bitsPerSample == 16) return (int16_t)wavRead16(p);
+        return (int16_t)wavRead16(p + 1); // 24 bit, drop the lowest byte
+    }
+
+    void convert(const uint8_t* data, size_t len) {
+        uint16_t bytesPerSample = source.bitsPerSample / 8;
+        while (len > 0) {
+            size_t n = source.blockAlign - frameLen < len ? source.blockAlign - frameLen : len;
+            memcpy(frame + frameLen, data, n);
+            frameLen += n;
+            data += n;
+            len -= n;
+            if (frameLen < source.blockAlign) return;
+            frameLen = 0;
+
+            int32_t sample = readSample(frame);
+            if (source.channels == 2) {
+                sample = (sample + readSample(frame + bytesPerSample)) / 2;
+            }
+            boxSum += sample;
+            if (++boxCount < boxLength) continue;
+            pushSample(boxSum / (int32_t)boxLength);
+            boxSum = 0;
+            boxCount = 0;
+        }
+    }
+
+    // Linear interpolation between the previous and the current (filtered) input sample
+    void pushSample(int32_t sample) {
+        if (firstSample) {
+            previous = sample;
+            firstSample = false;
+        }
+        while (phase < 0x10000) {
+            // 17 bit difference times 16 bit phase, too large for 32 bits
+            emit(previous + (int32_t)(((int64_t)(sample - previous) * phase) >> 16));
+            phase += step;
+        }
+        phase -= 0x10000;
+        previous = sample;
+    }
+
+    void emit(int32_t sample) {
+        samplesWritten++;
+        if (targetBits == 4) {
+            blockSamples[blockFill++] = (int16_t)sample;
+            if (blockFill < sizeof(blockSamples) / sizeof(blockSamples[0])) return;
+            blockFill = 0;
+            if (outLen + ADPCM_BLOCK_ALIGN > sizeof(out)) flushOutput();
+            imaEncodeBlock(adpcm, blockSamples, ADPCM_BLOCK_ALIGN, out + outLen);
+            outLen += ADPCM_BLOCK_ALIGN;
+            return;
+        }
+        if (targetBits == 8) {
+            out[outLen++] = (uint8_t)((sample >> 8) + 128);
+        } else {
+            out[outLen++] = (uint8_t)(sample & 0xFF);
+            out[outLen++] = (uint8_t)((sample >> 8) & 0xFF);
+        }
+        if (outLen + 2 > sizeof(out)) flushOutput();
+    }
+
+    bool flushOutput() {
+        if (outLen == 0) return true;
+        if (!sink(out, outLen)) return fail("Write failed");
+        outputBytes += outLen;
+        outLen = 0;
+        return true;
+    }
+
+    static void put16(uint8_t* p, uint16_t v) {
+        p[0] = v & 0xFF;
+        p[1] = v >> 8;
+    }
+
+    static void put32(uint8_t* p, uint32_t v) {
+        put16(p, v & 0xFFFF);
+        put16(p + 2, v >> 16);
+    }
+
+    void buildHeader(uint8_t* h) const {
+        memcpy(h, "RIFF", 4);
+        put32(h + 4, (uint32_t)headerSize() - 8 + outputBytes + (padded ? 1 : 0));
+        if (passthrough) {
+            memcpy(h + 8, "WAVEfmt ", 8);
+            put32(h + 16, fmtSize);
+            memcpy(h + 20, fmtChunk, fmtSize);
+            uint8_t* p = h + 20 + fmtSize;
+            if (fmtSize & 1) *p++ = 0;
+            if (haveFact) {
+                memcpy(p, "fact", 4);
+                put32(p + 4, 4);
+                put32(p + 8, factSamples);
+                p += 12;
+            }
+            memcpy(p, "data", 4);
+            put32(p + 4, outputBytes);
+            return;
+        }
+        if (targetBits == 4) {
+            uint32_t samplesPerBlock = (ADPCM_BLOCK_ALIGN - 4) * 2 + 1;
+            memcpy(h + 8, "WAVEfmt ", 8);
+            put32(h + 16, 20);
+            put16(h + 20, WavFormat::FORMAT_IMA_ADPCM);
+            put16(h + 22, 1);
+            put32(h + 24, targetRate);
+            put32(h + 28, (uint32_t)((uint64_t)targetRate * ADPCM_BLOCK_ALIGN / samplesPerBlock));
+            put16(h + 32, ADPCM_BLOCK_ALIGN);
+            put16(h + 34, 4);
+            put16(h + 36, 2); // Extra format bytes
+            put16(h + 38, samplesPerBlock);
+            memcpy(h + 40, "fact", 4);
+            put32(h + 44, 4);
+            put32(h + 48, samplesWritten);
+            memcpy(h + 52, "data", 4);
+            put32(h + 56, outputBytes);
+            return;
+        }
+        uint16_t blockAlign = targetBits / 8;
+        memcpy(h + 8, "WAVEfmt ", 8);
+        put32(h + 16, 16);
+        put16(h + 20, WavFormat::FORMAT_PCM);
+        put16(h + 22, 1);
+        put32(h + 24, targetRate);
+        put32(h + 28, targetRate * blockAlign);
+        put16(h + 32, blockAlign);
+        put16(h + 34, targetBits);
+        memcpy(h + 36, "data", 4);
+        put32(h + 40, outputBytes);
+    }
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef WAV_WRITER_H
+#define WAV_WRITER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include "WavFormat.h"
+#include "ImaAdpcm.h"
+
+// Streams 16 bit PCM or IMA ADPCM blocks into a WAV file in whole SD sectors. A JUNK chunk
+// pads the header to HEADER_SIZE bytes, so the samples start sector aligned and every block
+// handed to the sink covers complete sectors. The block buffer is allocated once by the constructor,
+// nothing allocates while recording. The sizes are only known at the end, finish()
+// returns the final header for the caller to write back at offset 0.
+class WavWriter {
+public:
+    // Receives the bytes in order, returns false if they could not be stored
+    typedef std::function<bool(const uint8_t*, size_t)> Sink;
+
+    static const uint32_t SECTOR_SIZE = 512;
+    static const uint32_t HEADER_SIZE = SECTOR_SIZE;
+
+    // blockBytes is rounded up to whole sectors
+    WavWriter(uint32_t blockBytes, Sink sink) : sink(sink) {
+        blockSize = (blockBytes + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+        if (blockSize == 0) blockSize = SECTOR_SIZE;
+        block = (uint8_t*)malloc(blockSize);
+    }
+
+    ~WavWriter() {
+        free(block);
+    }
+
+    WavWriter(const WavWriter&) = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+
+    bool isAllocated() const { return block != nullptr; }
+
+    // Emits a placeholder header for 16 bit PCM
+    bool begin(uint32_t rate, uint16_t channelCount) {
+        formatTag = WavFormat::FORMAT_PCM;
+        blockAlign = channelCount * 2;
+        return start(rate, channelCount);
+    }
+
+    // Mono IMA ADPCM, every writeBytes() call has to hand over whole blocks
+    bool beginAdpcm(uint32_t rate, uint16_t adpcmBlockAlign) {
+        formatTag = WavFormat::FORMAT_IMA_ADPCM;
+        blockAlign = adpcmBlockAlign;
+        return start(rate, 1);
+    }
+
+    // Queues interleaved samples, full blocks go to the sink. False once a write failed,
+    // the samples of a failed block are lost.
+    bool write(const int16_t* samples, uint32_t count) {
+        // Both the ESP32 and PCs are little endian like the WAV data
+        return writeBytes((const uint8_t*)samples, count * sizeof(int16_t));
+    }
+
+    bool writeBytes(const uint8_t* data, uint32_t len) {
+        while (len > 0 && !failed) {
+            uint32_t n = blockSize - fill < len ? blockSize - fill : len;
+            memcpy(block + fill, data, n);
+            fill += n;
+            data += n;
+            len -= n;
+            if (fill == blockSize) flushBlock();
+        }
+        return !failed;
+    }
+
+    // Writes the partial last block and fills in the HEADER_SIZE bytes that belong at offset 0
+    bool finish(uint8_t header[HEADER_SIZE]) {
+        if (fill > 0 && !failed) flushBlock();
+        buildHeader(header);
+        return !failed;
+    }
+
+    uint32_t getDataBytes() const { return dataBytes; }
+    uint32_t getBlockWrites() const { return blockWrites; }
+    uint32_t getBlockSize() const { return blockSize; }
+    bool hasFailed() const { return failed; }
+
+private:
+    Sink sink;
+    uint8_t* block = nullptr;
+    uint32_t blockSize = 0;
+    uint32_t fill = 0;
+    uint16_t formatTag = WavFormat::FORMAT_PCM;
+    uint16_t blockAlign = 2;
+    uint32_t sampleRate = 0;
+    uint16_t channels = 1;
+    uint32_t dataBytes = 0;
+    uint32_t blockWrites = 0;
+    bool failed = false;
+
+    bool start(uint32_t rate, uint16_t channelCount) {
+        sampleRate = rate;
+        channels = channelCount;
+        fill = 0;
+        dataBytes = 0;
+        blockWrites = 0;
+        failed = !block;
+        if (failed) return false;
+        uint8_t header[HEADER_SIZE];
+        buildHeader(header);
+        failed = !sink(header, HEADER_SIZE);
+        return !failed;
+    }
+
+    void flushBlock() {
+        if (!sink(block, fill)) {
+            failed = true;
+            return;
+        }
+        dataBytes += fill;
+        blockWrites++;
+        fill = 0;
+    }
+
+    // RIFF, fmt (and fact for ADPCM), JUNK up to the data chunk header in the last 8 bytes
+    void buildHeader(uint8_t* h) const {
+        memset(h, 0, HEADER_SIZE);
+        memcpy(h, "RIFF", 4);
+        wavWrite32(h + 4, HEADER_SIZE - 8 + dataBytes);
+        memcpy(h + 8, "WAVEfmt ", 8);
+        wavWrite16(h + 20, formatTag);
+        wavWrite16(h + 22, channels);
+        wavWrite32(h + 24, sampleRate);
+        wavWrite16(h + 32, blockAlign);
+        uint32_t junk;
+        if (formatTag == WavFormat::FORMAT_IMA_ADPCM) {
+            uint32_t samplesPerBlock = imaSamplesPerBlock(blockAlign, 1);
+            wavWrite32(h + 16, 20);
+            wavWrite32(h + 28, (uint32_t)((uint64_t)sampleRate * blockAlign / samplesPerBlock));
+            wavWrite16(h + 34, 4);
+            wavWrite16(h + 36, 2); // Extra format bytes
+            wavWrite16(h + 38, samplesPerBlock);
+            memcpy(h + 40, "fact", 4);
+            wavWrite32(h + 44, 4);
+            wavWrite32(h + 48, dataBytes / blockAlign * samplesPerBlock);
+            junk = 52;
+        } else {
+            wavWrite32(h + 16, 16);
+            wavWrite32(h + 28, sampleRate * blockAlign);
+            wavWrite16(h + 34, 16);
+            junk = 36;
+        }
+        memcpy(h + junk, "JUNK", 4);
+        wavWrite32(h + junk + 4, HEADER_SIZE - 8 - (junk + 8));
+        memcpy(h + HEADER_SIZE - 8, "data", 4);
+        wavWrite32(h + HEADER_SIZE - 4, dataBytes);
+    }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include <ESPmDNS.h>
 #include <ESP32Servo.h>
 #include <map>
+#include <vector>
 #include <Arduino.h>
 #include <cmath>
 #include <FastLED.h>
@@ -11,14 +12,45 @@
 #include <algorithm>
 #include <Preferences.h>
 #include <WiFi.h>
+#include <WiFiUdp.h>
 #include <Arduino.h>
 #include <string>
 #include <sstream>
 #include <SD.h>
 #include <SPI.h>
+#include <ff.h>
 #include "AudioFileSourceSD.h"
 #include "AudioOutputI2S.h"
 #include "AudioGeneratorWAV.h"
+#include "AudioGeneratorMP3.h"
+#include "WavFormat.h"
+#include "SpscRingBuffer.h"
+#include "WavTranscoder.h"
+#include "AudioMixer.h"
+#include "ToneSynth.h"
+#include "GainRamp.h"
+#include "ImaAdpcm.h"
+#include "WavDataReader.h"
+#include "LatencyProbe.h"
+#include "DelayedSource.h"
+#include "AudioFileType.h"
+#include "Resampler.h"
+#include "DialTrie.h"
+#include "DialPlan.h"
+#include "DialMatch.h"
+#include "NumberIndex.h"
+#include "NumberTable.h"
+#include "WavWriter.h"
+#include "CallEngine.h"
+#include "JitterBuffer.h"
+#include "ConferenceBridge.h"
+#include "RingBroadcast.h"
+#include "PeerTable.h"
+#include <WebSocketsServer.h>
+#include <driver/i2s.h>
+#include <driver/adc.h>
+#include <unistd.h>
+#include <atomic>
 #include <FastLED.h>
 #include <DNSServer.h>
 
@@ -26,6 +58,47 @@
 #define SD_CS_PIN 5  // Chip Select pin for SD card reader
 #define AUDIO_PIN 25 // ESP32 DAC output pin
 #define LED_PIN 33
+#define SD_READ_CHUNK 8192        // Bytes per SD read, a multiple of the 512 byte sector size
+#define DIAL_PLAN_PATH "/dialplan.txt" // Wildcard routing rules, see DialPlan.h
+#define NUMBER_INDEX_PATH "/numbers/.index"       // Scan of /numbers, see NumberIndex.h
+#define NUMBER_INDEX_TEMP_PATH "/numbers/.index.tmp"
+#define NUMBER_INDEX_SAVE_DELAY_MS 3000 // Quiet time after a change before the index is rewritten
+#define PREFETCH_MAX_FILES 3      // Candidates opened during the dial timeout, SD allows 5 open files
+#define PREFETCH_SETTLE_MS 150    // Wait after a digit before touching the SD card
+#define AUDIO_RING_FRAMES 4096   // Decoded frames buffered between the decode and I2S feeder task
+#define MIX_VOICES 4              // Files that can play at the same time
+#define MIX_BLOCK_FRAMES 256      // Frames mixed per block
+#define AUDIO_OUTPUT_RATE 32000    // Fixed I2S rate, every voice is resampled to it
+#define TONE_SAMPLE_RATE AUDIO_OUTPUT_RATE
+#define MIC_ADC_CHANNEL ADC1_CHANNEL_6 // GPIO34, the handset microphone amplifier
+#define MIC_SAMPLE_RATE 16000
+#define MIC_RING_SAMPLES 16384    // One second between the capture and the SD writer task
+#define MIC_WRITE_BLOCK SD_READ_CHUNK
+#define MAILBOX_FOLDER "/mailbox"
+#define PTT_PORT 81               // WebSocket for push-to-talk from the website
+#define PTT_WINDOW_FRAMES 8       // Unacknowledged frames the browser may have in flight
+#define PTT_MAX_ADPCM_BLOCK 1024
+#define PTT_TEMP_PATH "/numbers/.ptt.tmp" // Recording in progress, renamed to its number once saved
+#define PTT_LIVE_BUFFER 16384     // Live playback ring, 0.5 s at 16 kHz
+#define PTT_LIVE_PREBUFFER 2048   // Queued before a live stream starts, 64 ms at 16 kHz
+#define PTT_LIVE_MAX_DELAY 8192   // Backlog the live stream drops, 256 ms at 16 kHz
+#define CALL_PORT 4210            // UDP port for phone-to-phone calls
+#define CALL_FRAME_SAMPLES 320    // 20 ms at MIC_SAMPLE_RATE per packet
+#define CALL_JITTER_SLOTS 16      // Up to 320 ms of jitter buffer
+#define CALL_DMA_BUFFERS 3        // Duplex I2S buffering during a call, 30 ms each way
+#define CALL_DMA_FRAMES 160
+#define CONFERENCE_PORT 4211      // Bridge hosted by this phone, see ConferenceHost
+#define CONFERENCE_MAX_PARTICIPANTS 8
+#define CONFERENCE_JITTER_SLOTS 8 // Per participant, 160 ms
+#define CONFERENCE_IDLE_FREE_MS 10000 // An empty bridge gives its memory back after this
+#define RING_GROUP 239, 255, 42, 1 // Multicast group that rings all phones, see RingChannel
+#define RING_PORT 4212
+#define DISCOVERY_MAX_PEERS 16
+#define DISCOVERY_REFRESH_MS 60000  // mDNS query for other phones
+#define DISCOVERY_TTL_MS 180000     // A phone missing from three answers in a row is dropped
+#define AUDIO_TASK_CORE 1
+#define AUDIO_DECODE_PRIORITY 2
+#define AUDIO_FEEDER_PRIORITY 3
 
 
 // Configuration class
@@ -156,9 +229,12 @@ private:
 
 class SDReader {
 public:
+    // Copy of a NumberTable record for callers that keep it
     struct NumberInfo {
         String filePath;
         String description;
+        WavFormat format; // Read once at scan time, formatTag is 0 if the header could not be parsed
+        uint32_t fileSize;
     };
 
     SDReader() {
@@ -174,31 +250,414 @@ public:
         }
 
         initializeMappings();
+        loadDialPlan();
     }
 
-    void refreshMappings() {
-        initializeMappings();
+    // Scans every file again, for changes made behind the phone's back (e.g. on a PC)
+    void rescan() {
+        NumberTable previous;
+        previous.swap(numbers);
+        uint32_t start = millis();
+        listNumbers();
+        scanNumbers();
+        saveIndex();
+        Serial.printf("Scanned %u numbers in %u ms (rescan)\n", (unsigned)numbers.size(), (unsigned)(millis() - start));
+        updateDialTrie(previous);
+    }
+
+    // Reads the header of a new or replaced file in /numbers and maps its number to it. The
+    // header is read again whenever the file comes back under a name the table knows, and a
+    // name whose file is gone (e.g. a failed upload replacing it) loses its number.
+    bool addOrUpdate(const String& filePath) {
+        String fileName = filePath.substring(filePath.lastIndexOf('/') + 1);
+        String number;
+        NumberInfo info;
+        File file = SD.open(filePath.c_str());
+        bool added = file && !file.isDirectory() && readNumber(file, fileName, number, info);
+        if (file) file.close();
+        if (!added) {
+            forget(fileName);
+            return false;
+        }
+        const NumberTable::Record* previous = numbers.find(number.c_str());
+        if (!previous) {
+            if (!dialTrie.insert(number.c_str())) Serial.printf("Number can not be dialled: %s\n", number.c_str());
+        }
+        char previousName[NumberTable::MAX_FILE_NAME + 1];
+        bool replaced = previous && fileName == numbers.getFileName(*previous, previousName);
+        put(number, info);
+        FILINFO entry;
+        if (replaced || !statNumber(filePath, entry)) {
+            listNumbers(); // The size and time of the replaced file are gone with it
+        } else {
+            listing.add(entry.fname, entry.fsize, modifiedOf(entry));
+        }
+        indexChanged();
+        return true;
+    }
+
+    // Deletes the file of a number
+    bool remove(const String& number) {
+        NumberInfo info;
+        if (!getNumberInfo(number, info)) return false;
+        FILINFO entry;
+        bool listed = statNumber(info.filePath, entry);
+        if (!SD.remove(info.filePath.c_str())) return false;
+        if (listed) {
+            listing.remove(entry.fname, entry.fsize, modifiedOf(entry));
+        } else {
+            listNumbers();
+        }
+        numbers.erase(number.c_str());
+        dialTrie.remove(number.c_str());
+        indexChanged();
+        return true;
+    }
+
+    // Gives a number's file a new number and description, the extension stays
+    bool rename(const String& number, const String& newNumber, const String& newDescription) {
+        NumberInfo info;
+        if (!getNumberInfo(number, info) || newNumber.length() == 0 || newNumber.indexOf('_') >= 0 || newNumber.indexOf('/') >= 0 ||
+            newDescription.indexOf('/') >= 0 || (newNumber != number && numbers.find(newNumber.c_str()))) {
+            return false;
+        }
+        String oldName = fileNameOf(info);
+        String newName = newNumber + "_" + newDescription + oldName.substring(oldName.length() - 4);
+        String newPath = "/numbers/" + newName;
+        FILINFO entry;
+        bool listed = statNumber(info.filePath, entry);
+        if (newPath != info.filePath && (SD.exists(newPath.c_str()) || !SD.rename(info.filePath.c_str(), newPath.c_str()))) return false;
+        if (listed) {
+            // A rename keeps the size and time of the directory entry
+            listing.remove(entry.fname, entry.fsize, modifiedOf(entry));
+            listing.add(newName.c_str(), entry.fsize, modifiedOf(entry));
+        } else {
+            listNumbers();
+        }
+        info.filePath = newPath;
+        info.description = newDescription;
+        numbers.erase(number.c_str());
+        put(newNumber, info);
+        if (newNumber != number) {
+            dialTrie.remove(number.c_str());
+            if (!dialTrie.insert(newNumber.c_str())) Serial.printf("Number can not be dialled: %s\n", newNumber.c_str());
+        }
+        indexChanged();
+        return true;
+    }
+
+    // Rewrites the index once changes have settled, call it while the phone is idle
+    void saveIndexIfDue() {
+        if (indexDirty && millis() - indexChangedMs >= NUMBER_INDEX_SAVE_DELAY_MS) {
+            uint32_t start = millis();
+            saveIndex();
+            Serial.printf("Number index saved in %u ms\n", (unsigned)(millis() - start));
+        }
     }
 
-    const std::map<String, NumberInfo>& getNumberMappings() const {
-        return numberMappings;
+    // Sorted by number, records point into the table's arena
+    const NumberTable& getNumbers() const {
+        return numbers;
     }
 
     bool getNumberInfo(const String& number, NumberInfo& info) const {
-        auto it = numberMappings.find(number);
-        if (it != numberMappings.end()) {
-            info = it->second;
+        const NumberTable::Record* record = numbers.find(number.c_str());
+        if (record) {
+            char fileName[NumberTable::MAX_FILE_NAME + 1];
+            info.filePath = "/numbers/" + String(numbers.getFileName(*record, fileName));
+            info.description = numbers.getDescription(*record);
+            info.format = record->format;
+            info.fileSize = record->fileSize;
             return true;
         } else {
             return false;
         }
     }
 
+    // Dial plan rule for a number without a file of its own, DialPlan::NO_RULE if none
+    int32_t matchDialPlan(const String& digits) const {
+        return dialPlan.match(digits.c_str());
+    }
+
+    const DialPlan& getDialPlan() const {
+        return dialPlan;
+    }
+
+    // Dial plan state before the first digit, stepped with every digit while dialling
+    int32_t startDialPlan() const {
+        return dialPlan.startState();
+    }
+
+    int32_t stepDialPlan(int32_t state, int digit) const {
+        return dialPlan.step(state, digit);
+    }
+
+    // Adds what the files and the dial plan make of the digits, planState is where they led
+    void matchNumber(DialMatch& match, int32_t planState) const {
+        match.addTrie(dialTrie);
+        match.addPlan(dialPlan, planState);
+    }
+
+    // Any .wav or .mp3 in the folder, each with the same chance
+    String pickRandomFile(const String& folderPath) {
+        File folder = SD.open(folderPath.c_str());
+        if (!folder || !folder.isDirectory()) {
+            Serial.printf("Failed to open %s directory\n", folderPath.c_str());
+            return "";
+        }
+        String picked;
+        uint32_t seen = 0;
+        File file = folder.openNextFile();
+        while (file) {
+            String fileName = file.name();
+            if (!file.isDirectory() && (fileName.endsWith(".wav") || fileName.endsWith(".mp3"))) {
+                // Reservoir sampling, one pass and no list of names
+                if (random(++seen) == 0) picked = folderPath + "/" + fileName;
+            }
+            file.close();
+            file = folder.openNextFile();
+        }
+        folder.close();
+        return picked;
+    }
+
 private:
-    std::map<String, NumberInfo> numberMappings;
+    NumberTable numbers;
+    DialTrie dialTrie;
+    DialPlan dialPlan;
+    NumberIndex::Signature listing; // Samples in /numbers, kept up to date by the changes above
+    String fatDrive; // FatFs drive of the card, "0:" unless something else mounted FAT first
+    bool indexDirty = false;
+    uint32_t indexChangedMs = 0;
+
+    void indexChanged() {
+        indexDirty = true;
+        indexChangedMs = millis();
+    }
+
+    // Drops the number a file name maps to, for a file that is gone or no longer a sample
+    void forget(const String& fileName) {
+        int underscore = fileName.indexOf('_');
+        if (underscore <= 0) return;
+        String number = fileName.substring(0, underscore);
+        const NumberTable::Record* record = numbers.find(number.c_str());
+        char name[NumberTable::MAX_FILE_NAME + 1];
+        if (!record || fileName != numbers.getFileName(*record, name)) return;
+        numbers.erase(number.c_str());
+        dialTrie.remove(number.c_str());
+        listNumbers();
+        indexChanged();
+    }
+
+    static String fileNameOf(const NumberInfo& info) {
+        return info.filePath.substring(info.filePath.lastIndexOf('/') + 1);
+    }
+
+    void put(const String& number, const NumberInfo& info) {
+        if (!numbers.put(number.c_str(), info.description.c_str(), fileNameOf(info).c_str(), info.fileSize, info.format)) {
+            Serial.printf("Name does not fit the number table: %s\n", info.filePath.c_str());
+        }
+    }
+
+    void loadDialPlan() {
+        dialPlan.clear();
+        File file = SD.open(DIAL_PLAN_PATH);
+        if (!file) {
+            Serial.println("No dial plan found");
+            return;
+        }
+        int lineNumber = 0;
+        while (file.available()) {
+            String line = file.readStringUntil('\n');
+            lineNumber++;
+            const char* error;
+            if (!dialPlan.addLine(line.c_str(), &error)) {
+                Serial.printf("Dial plan line %d ignored: %s\n", lineNumber, error);
+            }
+        }
+        file.close();
+
+        uint32_t start = micros();
+        if (!dialPlan.compile()) {
+            Serial.printf("Dial plan ignored: its %u rules need more than %u states\n", (unsigned)dialPlan.getRuleCount(),
+                          (unsigned)DialPlan::MAX_STATES);
+            dialPlan.clear();
+            return;
+        }
+        uint32_t compileUs = micros() - start;
+        // The cost per digit is measured on the host, see tools/dialplanbench.cpp
+        Serial.printf("Dial plan: %u rules, %u states, %u bytes, compiled in %u us\n", (unsigned)dialPlan.getRuleCount(),
+                      (unsigned)dialPlan.getStateCount(), (unsigned)dialPlan.getTableBytes(), (unsigned)compileUs);
+    }
+
+    // Adapts a File to the reader interface of parseWavHeader()
+    struct FileReader {
+        File& file;
+
+        uint32_t read(void* dest, uint32_t len) {
+            return file.read((uint8_t*)dest, len);
+        }
+
+        bool skip(uint32_t len) {
+            return file.seek(file.position() + len);
+        }
+    };
+
+    // Adapts a File to the writer interface of NumberIndex::Builder
+    struct FileWriter {
+        File& file;
+
+        uint32_t write(const void* data, uint32_t len) {
+            return file.write((const uint8_t*)data, len);
+        }
+    };
+
+    // Records where the samples are so playback can seek straight to them
+    bool readFormat(File& file, WavFormat& format) {
+        uint8_t head[AUDIO_FILE_SIGNATURE_SIZE];
+        uint32_t headLen = file.read(head, sizeof(head));
+        AudioFileType type = detectAudioFileType(head, headLen);
+        FileReader reader = { file };
+        bool parsed = file.seek(0);
+        if (type == AUDIO_FILE_MP3) {
+            parsed = parsed && parseMp3Header(reader, format);
+        } else {
+            parsed = parsed && parseWavHeader(reader, format);
+        }
+        if (!parsed) {
+            format = WavFormat();
+            return false;
+        }
+        uint32_t available = file.size() > format.dataOffset ? file.size() - format.dataOffset : 0;
+        if (format.dataLength == 0 || format.dataLength > available) {
+            format.dataLength = available - available % format.blockAlign;
+        }
+        return true;
+    }
 
+    // Loads the index if it was built from the files that are there now, scans otherwise
     void initializeMappings() {
-        numberMappings.clear(); // Clear existing mappings
+        NumberTable previous;
+        previous.swap(numbers); // Start with an empty table
+        uint32_t start = millis();
+        listNumbers();
+        const char* reason = "no index";
+        File index = SD.open(NUMBER_INDEX_PATH);
+        if (index) {
+            NumberIndex::LoadResult result = loadIndex(index, listing.value());
+            index.close();
+            if (result == NumberIndex::LOADED) {
+                Serial.printf("Loaded %u numbers from the index in %u ms\n", (unsigned)numbers.size(), (unsigned)(millis() - start));
+                updateDialTrie(previous);
+                return;
+            }
+            reason = result == NumberIndex::STALE ? "files changed" : "index damaged";
+            numbers.clear();
+        }
+        scanNumbers();
+        saveIndex();
+        Serial.printf("Scanned %u numbers in %u ms (%s)\n", (unsigned)numbers.size(), (unsigned)(millis() - start), reason);
+        updateDialTrie(previous);
+    }
+
+    // Signature of the samples in /numbers, read from the directory entries without opening the files
+    void listNumbers() {
+        listing = NumberIndex::Signature();
+        FF_DIR folder;
+        if (f_opendir(&folder, fatPath("/numbers").c_str()) != FR_OK) return;
+        FILINFO entry;
+        while (f_readdir(&folder, &entry) == FR_OK && entry.fname[0]) {
+            String name = entry.fname;
+            if (!(entry.fattrib & AM_DIR) && (name.endsWith(".wav") || name.endsWith(".mp3"))) {
+                listing.add(entry.fname, entry.fsize, modifiedOf(entry));
+            }
+        }
+        f_closedir(&folder);
+    }
+
+    // Size and time of a file come from its directory entry, which only FatFs hands out. The SD
+    // library does not say which FatFs drive it mounted the card as, so the first drive with a
+    // /numbers folder is taken; the card is the phone's only FAT file system.
+    String fatPath(const String& path) {
+        for (int drive = 0; fatDrive.length() == 0 && drive < FF_VOLUMES; drive++) {
+            FILINFO entry;
+            String folder = String(drive) + ":/numbers";
+            if (f_stat(folder.c_str(), &entry) == FR_OK && (entry.fattrib & AM_DIR)) fatDrive = String(drive) + ":";
+        }
+        return fatDrive + path;
+    }
+
+    bool statNumber(const String& filePath, FILINFO& entry) {
+        return f_stat(fatPath(filePath).c_str(), &entry) == FR_OK;
+    }
+
+    static uint32_t modifiedOf(const FILINFO& entry) {
+        return (uint32_t)entry.fdate << 16 | entry.ftime;
+    }
+
+    NumberIndex::LoadResult loadIndex(File& file, uint32_t signature) {
+        FileReader reader = { file };
+        bool appended = true;
+        NumberIndex::LoadResult result = NumberIndex::load(reader, signature, [this, &appended](const NumberIndex::Entry& entry) {
+            appended = numbers.append(entry.number, entry.description, entry.fileName, entry.fileSize, entry.format) && appended;
+        });
+        numbers.sort(); // Saved in order, so only a check
+        numbers.shrink();
+        // An entry the table refuses means the index does not hold what a scan would find
+        if (result == NumberIndex::LOADED && !appended) return NumberIndex::CORRUPT;
+        return result;
+    }
+
+    // Written under a temporary name first, so a torn write never replaces a good index
+    void saveIndex() {
+        indexDirty = false;
+        File file = SD.open(NUMBER_INDEX_TEMP_PATH, FILE_WRITE);
+        if (!file) {
+            Serial.println("Could not write the number index");
+            return;
+        }
+        FileWriter writer = { file };
+        NumberIndex::Builder<FileWriter> builder(writer, listing.value());
+        bool complete = true;
+        char fileName[NumberTable::MAX_FILE_NAME + 1];
+        for (size_t i = 0; i < numbers.size(); i++) {
+            const NumberTable::Record& record = numbers.at(i);
+            NumberIndex::Entry indexEntry;
+            indexEntry.number = numbers.getNumber(record);
+            indexEntry.description = numbers.getDescription(record);
+            indexEntry.fileName = numbers.getFileName(record, fileName);
+            indexEntry.fileSize = record.fileSize;
+            indexEntry.format = record.format;
+            complete = builder.add(indexEntry) && complete;
+        }
+        complete = builder.finish() && complete;
+        file.close();
+        SD.remove(NUMBER_INDEX_PATH);
+        if (!complete || !SD.rename(NUMBER_INDEX_TEMP_PATH, NUMBER_INDEX_PATH)) {
+            SD.remove(NUMBER_INDEX_TEMP_PATH);
+            Serial.println("Could not write the number index, the next boot scans again");
+        }
+    }
+
+    // Only numbers that came or went touch the trie. Both tables are sorted, so one merge pass finds them.
+    void updateDialTrie(const NumberTable& previous) {
+        size_t i = 0, j = 0;
+        while (i < previous.size() || j < numbers.size()) {
+            int order = i == previous.size() ? 1 : j == numbers.size() ? -1 :
+                        strcmp(previous.getNumber(previous.at(i)), numbers.getNumber(numbers.at(j)));
+            if (order < 0) {
+                dialTrie.remove(previous.getNumber(previous.at(i++)));
+            } else if (order > 0) {
+                const char* number = numbers.getNumber(numbers.at(j++));
+                if (!dialTrie.insert(number)) Serial.printf("Number can not be dialled: %s\n", number);
+            } else {
+                i++;
+                j++;
+            }
+        }
+    }
+
+    void scanNumbers() {
         File numbersFolder = SD.open("/numbers");
         if (!numbersFolder || !numbersFolder.isDirectory()) {
             Serial.println("Failed to open /numbers directory");
@@ -208,27 +667,40 @@ private:
         File file = numbersFolder.openNextFile();
         while (file) {
             if (!file.isDirectory()) {
-                String fileName = file.name();
-                if (fileName.endsWith(".wav")) {
-                    // Extract number and description
-                    String nameWithoutExt = fileName.substring(0, fileName.length() - 4);
-                    int underscoreIndex = nameWithoutExt.indexOf('_');
-                    if (underscoreIndex != -1) {
-                        String number = nameWithoutExt.substring(0, underscoreIndex);
-                        String description = nameWithoutExt.substring(underscoreIndex + 1);
-                        String filePath = "/numbers/" + String(fileName);
-                        NumberInfo info = { filePath, description };
-                        numberMappings[number] = info;
-                        Serial.printf("Loaded number: %s, description: %s, file: %s\n", number.c_str(), description.c_str(), filePath.c_str());
-                    } else {
-                        Serial.printf("Filename format incorrect: %s\n", fileName.c_str());
-                    }
+                String number;
+                NumberInfo info;
+                if (readNumber(file, file.name(), number, info) &&
+                    !numbers.append(number.c_str(), info.description.c_str(), fileNameOf(info).c_str(), info.fileSize, info.format)) {
+                    Serial.printf("Name does not fit the number table: %s\n", info.filePath.c_str());
                 }
             }
             file.close();
             file = numbersFolder.openNextFile();
         }
         numbersFolder.close();
+        numbers.sort();
+        numbers.shrink();
+    }
+
+    // Number and description from <number>_<description>.wav or .mp3, the format from the header
+    bool readNumber(File& file, const String& fileName, String& number, NumberInfo& info) {
+        if (!fileName.endsWith(".wav") && !fileName.endsWith(".mp3")) return false;
+        String nameWithoutExt = fileName.substring(0, fileName.length() - 4);
+        int underscoreIndex = nameWithoutExt.indexOf('_');
+        if (underscoreIndex == -1) {
+            Serial.printf("Filename format incorrect: %s\n", fileName.c_str());
+            return false;
+        }
+        number = nameWithoutExt.substring(0, underscoreIndex);
+        info.description = nameWithoutExt.substring(underscoreIndex + 1);
+        info.filePath = "/numbers/" + fileName;
+        info.fileSize = (uint32_t)file.size();
+        if (!readFormat(file, info.format)) {
+            Serial.printf("Could not read audio header: %s\n", info.filePath.c_str());
+        } else if (!info.format.isPlayable() && !info.format.isMp3()) {
+            Serial.printf("Unsupported WAV format 0x%x: %s\n", info.format.formatTag, info.filePath.c_str());
+        }
+        return true;
     }
 };
 
@@ -314,14 +786,17 @@ public:
         propertiesModifiedCallback = callback;
     }
 
-    void onUploadComplete(std::function<void()> callback) {
+    // Called with the path of every file that was uploaded
+    void onUploadComplete(std::function<void(const String&)> callback) {
         uploadCompleteCallback = callback;
     }
 
 private:
     File uploadFile; // To store the file being uploaded
+    String uploadFilePath;
+    WavTranscoder* transcoder = nullptr; // Set while an upload is converted on the fly
     bool uploadFileAllowed = true; // Flag to allow or reject the upload
-    std::function<void()> uploadCompleteCallback; // Callback after upload
+    std::function<void(const String&)> uploadCompleteCallback; // Callback after upload
     const char* softAP_ssid;
     const char* softAP_password;
     IPAddress apIP = IPAddress(8, 8, 8, 8); // Access Point IP Address
@@ -367,6 +842,8 @@ private:
         );
 
         server.on("/delete", HTTP_GET, [this]() { handleDelete(); });
+        server.on("/rename", HTTP_GET, [this]() { handleRename(); });
+        server.on("/rescan", HTTP_GET, [this]() { handleRescan(); });
 
         server.onNotFound([this]() { handleNotFound(); });
         server.begin();
@@ -400,13 +877,14 @@ private:
         HTTPUpload& upload = server.upload();
 
         if(upload.status == UPLOAD_FILE_START){
+            uploadFilePath = "";
             String filename = upload.filename;
             Serial.print("Upload File Name: ");
             Serial.println(filename);
 
             // **Validate File Extension**
-            if(!filename.endsWith(".wav")) {
-                Serial.println("Only .wav files are allowed");
+            if(!filename.endsWith(".wav") && !filename.endsWith(".mp3")) {
+                Serial.println("Only .wav and .mp3 files are allowed");
                 uploadFileAllowed = false;
                 return;
             }
@@ -417,12 +895,18 @@ private:
             }
 
             // **Create the File on SD Card**
-            String filepath = "/numbers/" + filename;
-            uploadFile = SD.open(filepath.c_str(), FILE_WRITE);
+            uploadFilePath = "/numbers/" + filename;
+            uploadFile = SD.open(uploadFilePath.c_str(), FILE_WRITE);
             if(uploadFile){
                 Serial.print("Uploading to: ");
-                Serial.println(filepath);
+                Serial.println(uploadFilePath);
                 uploadFileAllowed = true;
+                if(filename.endsWith(".wav")){
+                    startTranscoding(); // MP3 is already compact and stored as is
+                } else {
+                    delete transcoder;
+                    transcoder = nullptr;
+                }
             } else {
                 Serial.println("Failed to open file for writing");
                 uploadFileAllowed = false;
@@ -430,28 +914,86 @@ private:
         }
         else if(upload.status == UPLOAD_FILE_WRITE){
             if(uploadFileAllowed && uploadFile){
-                uploadFile.write(upload.buf, upload.currentSize);
+                if(transcoder){
+                    if(!transcoder->write(upload.buf, upload.currentSize)){
+                        Serial.printf("Transcoding failed: %s\n", transcoder->getError());
+                        discardUpload();
+                    }
+                } else {
+                    uploadFile.write(upload.buf, upload.currentSize);
+                }
             }
         }
         else if(upload.status == UPLOAD_FILE_END){
             if(uploadFileAllowed && uploadFile){
+                if(transcoder){
+                    // Patch the header now that the data size is known
+                    uint8_t header[WavTranscoder::MAX_HEADER_SIZE];
+                    bool finished = transcoder->finish(header);
+                    size_t headerSize = transcoder->headerSize();
+                    if(finished && uploadFile.seek(0) && uploadFile.write(header, headerSize) == headerSize){
+                        Serial.printf("%s %u bytes to %u bytes\n", transcoder->isPassthrough() ? "Kept the format, copied" : "Transcoded",
+                                      (unsigned)upload.totalSize, (unsigned)(transcoder->getOutputBytes() + headerSize));
+                    } else {
+                        Serial.printf("Transcoding failed: %s\n", transcoder->getError() ? transcoder->getError() : "Write failed");
+                        discardUpload();
+                        return;
+                    }
+                    delete transcoder;
+                    transcoder = nullptr;
+                }
                 uploadFile.close();
                 Serial.println("File upload complete");
             }
         }
+        else if(upload.status == UPLOAD_FILE_ABORTED){
+            if(uploadFileAllowed && uploadFile){
+                Serial.println("Upload aborted");
+                discardUpload();
+            }
+        }
     } 
 
+    // Converts the upload to mono at the configured rate while it is written, if enabled
+    void startTranscoding() {
+        delete transcoder;
+        transcoder = nullptr;
+        if (getParamFloat("upload_transcode") <= 0) {
+            return;
+        }
+        uint32_t rate = (uint32_t)getParamFloat("upload_sampleRate");
+        uint16_t bits = (uint16_t)getParamFloat("upload_bits");
+        if (rate < 4000 || rate > 48000) rate = 16000;
+        transcoder = new WavTranscoder(rate, bits, [this](const uint8_t* data, size_t len) {
+            return uploadFile.write(data, len) == len;
+        });
+        if (!transcoder->begin()) {
+            discardUpload();
+        }
+    }
+
+    void discardUpload() {
+        uploadFile.close();
+        SD.remove(uploadFilePath.c_str());
+        uploadFileAllowed = false;
+        delete transcoder;
+        transcoder = nullptr;
+    }
+
     void handleUploadComplete(){
         if(uploadFileAllowed){
-            Serial.println("Upload Complete. Refreshing number mappings.");
+            Serial.println("Upload Complete. Updating the number.");
             if(uploadCompleteCallback){
-                uploadCompleteCallback(); // Refresh SDReader mappings
+                uploadCompleteCallback(uploadFilePath); // Add or update the SDReader mapping
             }
             // Redirect to the main page with a success message
             server.sendHeader("Location", "/?upload=success", true);
             server.send(303); // 303 See Other
         } else {
             Serial.println("Upload Failed.");
+            if(uploadFilePath.length() > 0 && uploadCompleteCallback){
+                uploadCompleteCallback(uploadFilePath); // The discarded upload took a file of the same name with it
+            }
             // Redirect to the main page with an error message
             server.sendHeader("Location", "/?upload=failed", true);
             server.send(303); // 303 See Other
@@ -478,11 +1020,9 @@ private:
             String number = server.arg("number");
             SDReader::NumberInfo info;
             if (sdReader->getNumberInfo(number, info)) { // Use '->' to access members
-                // Attempt to delete the file
-                if (SD.remove(info.filePath.c_str())) {
+                // Delete the file, only its number leaves the mappings
+                if (sdReader->remove(number)) {
                     Serial.printf("Deleted file: %s\n", info.filePath.c_str());
-                    // Refresh the mappings
-                    sdReader->refreshMappings();
 
                     // Redirect back with success message
                     server.sendHeader("Location", "/?delete=success", true);
@@ -507,6 +1047,33 @@ private:
         }
     }
 
+    // New number and description of a file, as <number>_<description> in 'to'
+    void handleRename() {
+        if (!server.hasArg("number") || !server.hasArg("to") || server.arg("to").indexOf('_') <= 0) {
+            server.sendHeader("Location", "/?rename=badrequest", true);
+            server.send(303);
+            return;
+        }
+        String number = server.arg("number");
+        String to = server.arg("to");
+        int underscore = to.indexOf('_');
+        if (sdReader->rename(number, to.substring(0, underscore), to.substring(underscore + 1))) {
+            Serial.printf("Renamed %s to %s\n", number.c_str(), to.c_str());
+            server.sendHeader("Location", "/?rename=success", true);
+        } else {
+            Serial.printf("Could not rename %s to %s\n", number.c_str(), to.c_str());
+            server.sendHeader("Location", "/?rename=failed", true);
+        }
+        server.send(303);
+    }
+
+    // Full scan of /numbers, only when asked for
+    void handleRescan() {
+        sdReader->rescan();
+        server.sendHeader("Location", "/?rescan=done", true);
+        server.send(303);
+    }
+
 
 
     void handleRoot() {
@@ -681,7 +1248,7 @@ private:
                 p += "<p style='color: green; font-size: 2rem; text-align: center;'>File uploaded successfully!</p>";
             }
             else if(uploadStatus == "failed"){
-                p += "<p style='color: red; font-size: 2rem; text-align: center;'>File upload failed. Only .wav files are allowed.</p>";
+                p += "<p style='color: red; font-size: 2rem; text-align: center;'>File upload failed. Only .wav and .mp3 files are allowed.</p>";
             }
         }
 
@@ -924,157 +1491,2932 @@ class DialController {
     unsigned long dialTimeout;
     String numberBuffer;
 
-    std::function<void(bool)> phoneHandleCallback;
-    std::function<void(int)> digitCallback;
-    std::function<void(String)> dialledCallback;
+    std::function<void(bool)> phoneHandleCallback;
+    std::function<void(int)> digitCallback;
+    std::function<void(String)> dialledCallback;
+    std::function<bool(const String&)> completionCheck;
+
+  public:
+    DialController(int pulsePin, int rotationPin, int phoneHandlePin, unsigned long debounceDelay = 100, unsigned long dialTimeout = 3000)
+      : rotaryDial(pulsePin, rotationPin), phoneHandlePin(phoneHandlePin), debounceDelay(debounceDelay), dialTimeout(dialTimeout) {
+        this->lastHandleChangeTime = 0;
+        pinMode(phoneHandlePin, INPUT_PULLUP);
+        // Initialize state to the actual initial state of the pin
+        this->lastHandleState = digitalRead(phoneHandlePin);
+        this->handlePickedUp = false;
+        this->lastDigitTime = 0;
+    }
+
+    void setPhoneHandleCallback(std::function<void(bool)> callback) {
+        phoneHandleCallback = callback;
+    }
+
+    void setDigitCallback(std::function<void(int)> callback) {
+        digitCallback = callback;
+    }
+
+    void setDialledCallback(std::function<void(String)> callback) {
+        dialledCallback = callback;
+    }
+
+    // Returns true when the digits so far can only mean one number, which then skips the dial timeout
+    void setCompletionCheck(std::function<bool(const String&)> check) {
+        completionCheck = check;
+    }
+
+    bool isHandlePickedUp() const {
+        return handlePickedUp;
+    }
+
+    // Digits dialled so far, the number is complete after the dial timeout
+    const String& getNumberBuffer() const {
+        return numberBuffer;
+    }
+
+    void update() {
+        // Check for handle state change with debounce
+        bool currentHandleState = digitalRead(phoneHandlePin);
+        if (currentHandleState != lastHandleState && (millis() - lastHandleChangeTime) > debounceDelay) {
+            lastHandleChangeTime = millis();
+            lastHandleState = currentHandleState;
+
+            if (currentHandleState == LOW) {
+                // Handle picked up
+                handlePickedUp = true;
+                numberBuffer = ""; // Reset the buffer
+            } else {
+                // Handle placed down
+                handlePickedUp = false;
+                numberBuffer = ""; // Reset the buffer
+            }
+
+            if (phoneHandleCallback) {
+                phoneHandleCallback(handlePickedUp);
+            }
+        }
+
+        if (handlePickedUp) {
+            // Update the rotary dial
+            rotaryDial.update();
+            int digit = rotaryDial.getNumber();
+            bool complete = false;
+            if (digit != -1) {
+                // Append the digit to the number buffer
+                numberBuffer += String(digit);
+                lastDigitTime = millis();
+
+                if (digitCallback) {
+                    digitCallback(digit);
+                }
+                complete = completionCheck && completionCheck(numberBuffer);
+            }
+
+            // Check if number is dialled based on a unique match, timeout or max digits
+            if (complete || (numberBuffer.length() >= 2 && (millis() - lastDigitTime) > dialTimeout) || numberBuffer.length() >= 16) {
+                if (dialledCallback) {
+                    dialledCallback(numberBuffer);
+                    Serial.println(numberBuffer);
+                }
+
+                numberBuffer = ""; // Reset after dialled
+            }
+        }
+    }
+};
+
+// Read-only AudioFileSource over a buffer that is already in memory
+class AudioFileSourceRAM : public AudioFileSource {
+  public:
+      AudioFileSourceRAM() : data(NULL), size(0), pos(0) {}
+
+      // Point the source at a buffer; the buffer is not copied and must outlive playback
+      bool open(const uint8_t* buffer, uint32_t length) {
+          data = buffer;
+          size = length;
+          pos = 0;
+          return data != NULL;
+      }
+
+      virtual bool open(const char* filename) override {
+          (void)filename; // Only buffers can be opened
+          return false;
+      }
+
+      virtual uint32_t read(void* dest, uint32_t len) override {
+          if (!data || pos >= size) return 0;
+          if (len > size - pos) len = size - pos;
+          memcpy(dest, data + pos, len);
+          pos += len;
+          return len;
+      }
+
+      virtual bool seek(int32_t offset, int dir) override {
+          if (!data) return false;
+          int64_t newPos;
+          if (dir == SEEK_SET) newPos = offset;
+          else if (dir == SEEK_CUR) newPos = (int64_t)pos + offset;
+          else if (dir == SEEK_END) newPos = (int64_t)size + offset;
+          else return false;
+          if (newPos < 0 || newPos > size) return false;
+          pos = (uint32_t)newPos;
+          return true;
+      }
+
+      virtual bool close() override {
+          data = NULL;
+          size = 0;
+          pos = 0;
+          return true;
+      }
+
+      virtual bool isOpen() override { return data != NULL; }
+      virtual uint32_t getSize() override { return size; }
+      virtual uint32_t getPos() override { return pos; }
+
+  private:
+      const uint8_t* data;
+      uint32_t size;
+      uint32_t pos;
+};
+
+// Audio that arrives while it plays, e.g. from the browser. push() queues 16 bit PCM from the
+// main loop, the decode task reads it like a file of endless length. A gap in the stream is
+// played as silence and the source waits for prebufferBytes again, a backlog beyond
+// maxBytes is dropped so the delay cannot grow. Playback ends once finish() was called and
+// everything queued has been read.
+class AudioFileSourceLive : public AudioFileSource {
+  public:
+      static const uint32_t ENDLESS = 0x7FFFFFFE; // getSize(), an even number of bytes
+
+      AudioFileSourceLive(uint32_t capacity, uint32_t prebufferBytes, uint32_t maxBytes)
+          : ring(capacity), prebuffer(prebufferBytes), maxFill(maxBytes), opened(false), finished(false), priming(true) {
+          resetStats();
+      }
+
+      // Starts a new stream, WavPlayer::playLive() does so while no one reads
+      void start() {
+          ring.discard();
+          finished = false;
+          priming = true;
+          opened = true;
+      }
+
+      // Returns the bytes queued, the rest did not fit
+      uint32_t push(const uint8_t* data, uint32_t len) {
+          uint32_t queued = ring.push(data, len & ~1u);
+          dropped += len - queued;
+          return queued;
+      }
+
+      void finish() {
+          finished = true;
+      }
+
+      virtual bool open(const char* filename) override {
+          (void)filename; // Streams are started with start()
+          return false;
+      }
+
+      virtual uint32_t read(void* dest, uint32_t len) override {
+          if (!opened) return 0;
+          uint8_t* out = (uint8_t*)dest;
+          uint32_t available = ring.size();
+          if (priming && available < prebuffer && !finished) {
+              memset(out, 0, len);
+              return len;
+          }
+          priming = false;
+          if (available > maxFill) {
+              // Catch up to the prebuffer level, the decoder's buffer serves as scratch space
+              uint32_t excess = (available - prebuffer) & ~1u;
+              while (excess > 0) {
+                  uint32_t n = ring.pop(out, excess < len ? excess : len);
+                  if (n == 0) break;
+                  excess -= n;
+                  trimmed += n;
+              }
+          }
+          uint32_t got = ring.pop(out, len);
+          if (got < len) {
+              if (finished) return got;
+              memset(out + got, 0, len - got);
+              underruns++;
+              priming = true;
+          }
+          return len;
+      }
+
+      virtual bool seek(int32_t offset, int dir) override {
+          // Only the generator's seek to the start of the data is meaningful
+          return opened && dir == SEEK_SET && offset == 0;
+      }
+
+      virtual bool close() override {
+          opened = false;
+          return true;
+      }
+
+      virtual bool isOpen() override { return opened; }
+      virtual uint32_t getSize() override { return ENDLESS; }
+      virtual uint32_t getPos() override { return 0; }
+
+      uint32_t getBufferedMs(uint32_t sampleRate) const {
+          return sampleRate ? (uint32_t)((uint64_t)ring.size() / 2 * 1000 / sampleRate) : 0;
+      }
+
+      uint32_t getUnderruns() const { return underruns; }
+      uint32_t getDroppedBytes() const { return dropped; }
+      uint32_t getTrimmedBytes() const { return trimmed; }
+
+      void resetStats() {
+          underruns = 0;
+          dropped = 0;
+          trimmed = 0;
+      }
+
+  private:
+      SpscRingBuffer<uint8_t> ring;
+      uint32_t prebuffer;
+      uint32_t maxFill;
+      std::atomic<bool> opened;
+      std::atomic<bool> finished;
+      bool priming;                   // Owned by the reader
+      std::atomic<uint32_t> underruns;
+      std::atomic<uint32_t> dropped;  // Did not fit into the ring
+      std::atomic<uint32_t> trimmed;  // Dropped by the reader to keep the delay down
+};
+
+// Reads SD files in large chunks aligned to the chunk size (a multiple of the 512 byte sector)
+// into two buffers. While the decoder consumes one chunk, prefetch() reads the next one,
+// so the small reads of the decoder never go to the SPI bus. The buffers only exist while a
+// file is open and are halved down to MIN_CHUNK when the heap is short.
+class AudioFileSourceSDBuffered : public AudioFileSource {
+  public:
+      static const uint32_t MIN_CHUNK = 1024;
+      static const uint32_t HEAP_RESERVE = 32 * 1024; // Largest free block left to WiFi and the webserver
+
+      AudioFileSourceSDBuffered(uint32_t chunkSize = SD_READ_CHUNK) : maxChunkSize(chunkSize), chunkSize(0), size(0), pos(0), primed(false) {
+          front = { NULL, 0, 0 };
+          back = { NULL, 0, 0 };
+          resetStats();
+      }
+
+      virtual ~AudioFileSourceSDBuffered() override {
+          close();
+      }
+
+      virtual bool open(const char* filename) override {
+          close();
+          if (!allocateBuffers()) {
+              Serial.println("Not enough memory for SD read buffers");
+              return false;
+          }
+          file = SD.open(filename);
+          if (!file) {
+              freeBuffers();
+              return false;
+          }
+          size = file.size();
+          pos = 0;
+          primed = false;
+          resetStats();
+          return true;
+      }
+
+      // Takes over a file that is already open together with its first chunk read earlier
+      bool adopt(File& source, const uint8_t* head, uint32_t length) {
+          close();
+          if (!allocateBuffers()) return false;
+          file = source;
+          size = file.size();
+          pos = 0;
+          primed = true;
+          resetStats();
+          front.start = 0;
+          front.length = std::min(std::min(length, chunkSize), size);
+          memcpy(front.data, head, front.length);
+          return true;
+      }
+
+      virtual uint32_t read(void* data, uint32_t len) override {
+          uint8_t* dest = (uint8_t*)data;
+          uint32_t done = 0;
+          while (done < len && pos < size) {
+              if (!contains(front, pos)) {
+                  if (contains(back, pos)) {
+                      std::swap(front, back);
+                  } else {
+                      // The prefetch did not have this chunk ready, the decoder has to wait for the card.
+                      // The first chunk of a file is always read this way and is no stall.
+                      uint32_t start = micros();
+                      if (!fill(front, pos - pos % chunkSize)) break;
+                      if (primed) {
+                          stalls++;
+                          stallMicros += micros() - start;
+                      }
+                      primed = true;
+                  }
+              }
+              uint32_t offset = pos - front.start;
+              uint32_t n = std::min(len - done, front.length - offset);
+              memcpy(dest + done, front.data + offset, n);
+              done += n;
+              pos += n;
+          }
+          return done;
+      }
+
+      virtual bool seek(int32_t offset, int dir) override {
+          if (!file) return false;
+          int64_t newPos;
+          if (dir == SEEK_SET) newPos = offset;
+          else if (dir == SEEK_CUR) newPos = (int64_t)pos + offset;
+          else if (dir == SEEK_END) newPos = (int64_t)size + offset;
+          else return false;
+          if (newPos < 0 || newPos > size) return false;
+          pos = (uint32_t)newPos; // The buffers are reused if they hold the new position
+          return true;
+      }
+
+      // Reads the chunk after the one being consumed. Called by the decode task once the ring
+      // buffer is full, not from loop(), so the card is read while I2S plays the ring and not
+      // in the middle of decoding a block.
+      void prefetch() {
+          if (!file || front.length == 0) return;
+          uint32_t next = front.start + front.length;
+          if (next < size && !(back.length > 0 && back.start == next)) {
+              fill(back, next);
+          }
+      }
+
+      virtual bool close() override {
+          if (!file) return true;
+          if (bytesRead > 0) {
+              Serial.printf("SD read: %u KB in %u KB chunks in %u ms (%u KB/s), %u stalls, %u ms stalled\n",
+                            (unsigned)(bytesRead / 1024), (unsigned)(chunkSize / 1024), (unsigned)(readMicros / 1000),
+                            (unsigned)(readMicros ? (uint64_t)bytesRead * 1000000 / readMicros / 1024 : 0),
+                            (unsigned)stalls, (unsigned)(stallMicros / 1000));
+          }
+          file.close();
+          freeBuffers();
+          size = 0;
+          pos = 0;
+          return true;
+      }
+
+      virtual bool isOpen() override { return (bool)file; }
+      virtual uint32_t getSize() override { return size; }
+      virtual uint32_t getPos() override { return pos; }
+
+  private:
+      struct Chunk {
+          uint8_t* data;
+          uint32_t start;  // File offset of data[0]
+          uint32_t length; // Valid bytes, 0 = empty
+      };
+
+      File file;
+      uint32_t maxChunkSize;
+      uint32_t chunkSize; // Of the buffers allocated, 0 while there are none
+      uint32_t size;
+      uint32_t pos;
+      bool primed;        // The first chunk has been read
+      Chunk front; // Chunk being consumed
+      Chunk back;  // Prefetched chunk
+      uint32_t bytesRead;
+      uint32_t readMicros;
+      uint32_t stalls;
+      uint32_t stallMicros;
+
+      bool allocateBuffers() {
+          if (front.data) return true;
+          chunkSize = maxChunkSize;
+          while (chunkSize > MIN_CHUNK && 2 * chunkSize + HEAP_RESERVE > ESP.getMaxAllocHeap()) {
+              chunkSize /= 2;
+          }
+          // DMA capable memory lets the SPI driver read straight into the buffers
+          front.data = (uint8_t*)heap_caps_malloc(chunkSize, MALLOC_CAP_DMA);
+          back.data = (uint8_t*)heap_caps_malloc(chunkSize, MALLOC_CAP_DMA);
+          if (!front.data || !back.data) {
+              freeBuffers();
+              return false;
+          }
+          return true;
+      }
+
+      void freeBuffers() {
+          heap_caps_free(front.data);
+          heap_caps_free(back.data);
+          front = { NULL, 0, 0 };
+          back = { NULL, 0, 0 };
+          chunkSize = 0;
+      }
+
+      bool contains(const Chunk& chunk, uint32_t offset) const {
+          return chunk.length > 0 && offset >= chunk.start && offset < chunk.start + chunk.length;
+      }
+
+      bool fill(Chunk& chunk, uint32_t start) {
+          uint32_t t0 = micros();
+          chunk.length = 0;
+          if (!file.seek(start)) return false;
+          uint32_t n = file.read(chunk.data, std::min(chunkSize, size - start));
+          readMicros += micros() - t0;
+          bytesRead += n;
+          chunk.start = start;
+          chunk.length = n;
+          return n > 0;
+      }
+
+      void resetStats() {
+          bytesRead = 0;
+          readMicros = 0;
+          stalls = 0;
+          stallMicros = 0;
+      }
+};
+
+// Opens the files of the numbers that can still be dialled while the dial timeout runs
+// and reads their first chunk, so the call starts without waiting for the SD card
+class DialPrefetcher {
+  public:
+      DialPrefetcher(SDReader* sdReader) : sdReader(sdReader), lastChange(0), armed(false), hits(0), misses(0) {
+          for (Slot& slot : slots) {
+              slot.head = NULL;
+              slot.length = 0;
+          }
+      }
+
+      // Called with the digits dialled so far, prefetching starts once few numbers are left
+      void setPrefix(const String& digits) {
+          candidates.clear();
+          armed = digits.length() > 0;
+          if (digits.length() > 0) {
+              // Numbers starting with the digits sort right after them
+              const NumberTable& numbers = sdReader->getNumbers();
+              for (size_t i = numbers.lowerBound(digits.c_str()); i < numbers.size(); i++) {
+                  const NumberTable::Record& record = numbers.at(i);
+                  if (strncmp(numbers.getNumber(record), digits.c_str(), digits.length()) != 0) break;
+                  if (candidates.size() == PREFETCH_MAX_FILES) {
+                      candidates.clear(); // Too many left, wait for the next digit
+                      break;
+                  }
+                  char fileName[NumberTable::MAX_FILE_NAME + 1];
+                  candidates.push_back("/numbers/" + String(numbers.getFileName(record, fileName)));
+              }
+          }
+          // Files that can no longer be dialled free their slot
+          for (Slot& slot : slots) {
+              if (slot.length > 0 && std::find(candidates.begin(), candidates.end(), slot.path) == candidates.end()) {
+                  release(slot);
+              }
+          }
+          lastChange = millis();
+      }
+
+      // Loads one candidate per call, so the dial is never blocked for long
+      void update() {
+          if (candidates.empty() || millis() - lastChange < PREFETCH_SETTLE_MS) return;
+          for (const String& path : candidates) {
+              if (findSlot(path)) continue;
+              for (Slot& slot : slots) {
+                  if (slot.length == 0) {
+                      load(slot, path);
+                      return;
+                  }
+              }
+              return;
+          }
+      }
+
+      // Hands the prefetched file to the player, counts whether the prefetch was in time.
+      // Only calls dialled since the last clear() count, others had nothing to prefetch.
+      bool take(const String& path, AudioFileSourceSDBuffered& target) {
+          if (!armed) return false;
+          armed = false;
+          Slot* slot = findSlot(path);
+          if (!slot || !target.adopt(slot->file, slot->head, slot->length)) {
+              misses++;
+              Serial.printf("Prefetch miss: %s (%u hits, %u misses)\n", path.c_str(), (unsigned)hits, (unsigned)misses);
+              return false;
+          }
+          slot->file = File(); // The source owns the file now
+          slot->length = 0;
+          hits++;
+          Serial.printf("Prefetch hit: %s (%u hits, %u misses)\n", path.c_str(), (unsigned)hits, (unsigned)misses);
+          return true;
+      }
+
+      // Also frees the heads, they are only needed while dialling
+      void clear() {
+          candidates.clear();
+          armed = false;
+          for (Slot& slot : slots) {
+              if (slot.length > 0) release(slot);
+              free(slot.head);
+              slot.head = NULL;
+          }
+      }
+
+      uint32_t getHits() const {
+          return hits;
+      }
+
+      uint32_t getMisses() const {
+          return misses;
+      }
+
+  private:
+      struct Slot {
+          String path;
+          File file;
+          uint8_t* head;   // First SD_READ_CHUNK bytes, allocated on first use
+          uint32_t length; // 0 = slot is free
+      };
+
+      SDReader* sdReader;
+      std::vector<String> candidates;
+      Slot slots[PREFETCH_MAX_FILES];
+      unsigned long lastChange;
+      bool armed; // Digits were dialled since the last clear()
+      uint32_t hits;
+      uint32_t misses;
+
+      Slot* findSlot(const String& path) {
+          for (Slot& slot : slots) {
+              if (slot.length > 0 && slot.path == path) return &slot;
+          }
+          return NULL;
+      }
+
+      void load(Slot& slot, const String& path) {
+          if (!slot.head) slot.head = (uint8_t*)malloc(SD_READ_CHUNK);
+          slot.path = path;
+          slot.file = SD.open(path.c_str());
+          if (!slot.head || !slot.file) {
+              Serial.printf("Prefetch failed: %s\n", path.c_str());
+              candidates.erase(std::find(candidates.begin(), candidates.end(), path));
+              slot.file = File();
+              return;
+          }
+          slot.length = slot.file.read(slot.head, SD_READ_CHUNK);
+          if (slot.length == 0) {
+              slot.file.close();
+              candidates.erase(std::find(candidates.begin(), candidates.end(), path));
+          }
+      }
+
+      void release(Slot& slot) {
+          slot.file.close();
+          slot.length = 0;
+      }
+};
+
+// Keeps system prompts in RAM so a looping prompt needs no SD access. With PSRAM every prompt
+// that fits the budget is loaded once at boot. Without it the prompts would take the internal
+// heap from WiFi and the webserver for good, so only small ones are loaded, when a state starts
+// playing them and only while the heap has room, and release() frees them again.
+class PromptCache {
+  public:
+      struct Prompt {
+          uint8_t* data;
+          uint32_t size;
+      };
+
+      static const uint32_t MAX_HEAP_PROMPT = 16 * 1024; // Larger prompts stream from SD without PSRAM
+      static const uint32_t HEAP_RESERVE = 48 * 1024;    // Largest free block left to the rest of the firmware
+
+      ~PromptCache() {
+          clear();
+      }
+
+      void load(const char* folderPath = "/system") {
+          clear();
+          usePsram = psramFound();
+          uint32_t maxFileSize = 1024 * 1024;
+          uint32_t budget = 2 * 1024 * 1024;
+
+          File folder = SD.open(folderPath);
+          if (!folder || !folder.isDirectory()) {
+              Serial.printf("Failed to open %s directory\n", folderPath);
+              return;
+          }
+
+          File file = folder.openNextFile();
+          while (file) {
+              if (!file.isDirectory()) {
+                  String fileName = file.name();
+                  uint32_t size = file.size();
+                  String filePath = String(folderPath) + "/" + fileName;
+                  if ((fileName.endsWith(".wav") || fileName.endsWith(".mp3")) && size > 0) {
+                      if (!usePsram) {
+                          if (size <= MAX_HEAP_PROMPT) {
+                              candidates[filePath] = size; // Loaded by acquire()
+                          } else {
+                              Serial.printf("Prompt too large for the heap, streaming from SD: %s (%u bytes)\n", filePath.c_str(), size);
+                          }
+                      } else if (size > maxFileSize || totalBytes + size > budget) {
+                          Serial.printf("Prompt too large to cache, streaming from SD: %s (%u bytes)\n", filePath.c_str(), size);
+                      } else {
+                          store(filePath, file, size);
+                      }
+                  }
+              }
+              file.close();
+              file = folder.openNextFile();
+          }
+          folder.close();
+          if (usePsram) {
+              Serial.printf("Prompt cache holds %u files, %u bytes in PSRAM\n", (unsigned)prompts.size(), totalBytes);
+          } else {
+              Serial.printf("Prompt cache loads %u small files on demand\n", (unsigned)candidates.size());
+          }
+      }
+
+      // Without PSRAM loads a small prompt before it is played, if the heap can spare it.
+      // True if the prompt is in RAM.
+      bool acquire(const String& filePath) {
+          if (prompts.count(filePath)) return true;
+          auto it = candidates.find(filePath);
+          if (it == candidates.end()) return false;
+          uint32_t size = it->second;
+          if (size + HEAP_RESERVE > ESP.getMaxAllocHeap()) {
+              Serial.printf("Not enough heap to cache %s, streaming from SD\n", filePath.c_str());
+              return false;
+          }
+          File file = SD.open(filePath.c_str());
+          bool stored = file && store(filePath, file, size);
+          file.close();
+          return stored;
+      }
+
+      // Frees what acquire() loaded. Only call it when no voice plays a prompt.
+      void release() {
+          if (usePsram || prompts.empty()) return;
+          for (auto& pair : prompts) {
+              free(pair.second.data);
+          }
+          prompts.clear();
+          totalBytes = 0;
+      }
+
+      void clear() {
+          for (auto& pair : prompts) {
+              free(pair.second.data);
+          }
+          prompts.clear();
+          candidates.clear();
+          totalBytes = 0;
+      }
+
+      bool get(const String& filePath, Prompt& prompt) const {
+          auto it = prompts.find(filePath);
+          if (it != prompts.end()) {
+              prompt = it->second;
+              return true;
+          }
+          return false;
+      }
+
+  private:
+      std::map<String, Prompt> prompts;
+      std::map<String, uint32_t> candidates; // Small prompts acquire() may load, without PSRAM
+      uint32_t totalBytes = 0;
+      bool usePsram = false;
+
+      bool store(const String& filePath, File& file, uint32_t size) {
+          uint8_t* data = (uint8_t*)(usePsram ? ps_malloc(size) : malloc(size));
+          if (!data || file.read(data, size) != size) {
+              free(data);
+              Serial.printf("Failed to cache prompt: %s\n", filePath.c_str());
+              return false;
+          }
+          prompts[filePath] = { data, size };
+          totalBytes += size;
+          Serial.printf("Cached prompt: %s (%u bytes)\n", filePath.c_str(), size);
+          return true;
+      }
+};
+
+// Adapts an AudioFileSource to the reader interface of parseWavHeader() and WavDataReader
+struct AudioSourceReader {
+    AudioFileSource* source;
+
+    uint32_t read(void* dest, uint32_t len) {
+        return source->read(dest, len);
+    }
+
+    bool skip(uint32_t len) {
+        return source->seek(len, SEEK_CUR);
+    }
+
+    bool seek(uint32_t position) {
+        return source->seek(position, SEEK_SET);
+    }
+};
+
+// WAV decoder that loops inside the data chunk instead of restarting the file,
+// so the sample after the loop end is the loop start without any gap
+class AudioGeneratorWAVLoop : public AudioGenerator {
+  public:
+      AudioGeneratorWAVLoop() : hasKnownFormat(false), looping(false), loopStartMs(0), loopEndMs(0), pending(false) {
+          running = false;
+          file = NULL;
+          output = NULL;
+          reader.source = NULL;
+      }
+
+      // Header info recorded earlier, lets the next begin() seek straight to the samples
+      void setKnownFormat(const WavFormat* known) {
+          hasKnownFormat = known && known->isPlayable();
+          if (hasKnownFormat) knownFormat = *known;
+      }
+
+      // Loop points in milliseconds, loopEndMs = 0 loops up to the end of the data
+      void setLoop(bool enabled, uint32_t startMs = 0, uint32_t endMs = 0) {
+          looping = enabled;
+          loopStartMs = startMs;
+          loopEndMs = endMs;
+      }
+
+      virtual bool begin(AudioFileSource *source, AudioOutput *output) override {
+          if (!source || !output) return false;
+          file = source;
+          this->output = output;
+          if (!file->isOpen()) return false;
+
+          reader.source = file;
+          WavFormat format;
+          if (hasKnownFormat) {
+              hasKnownFormat = false;
+              format = knownFormat;
+              if (!file->seek(format.dataOffset, SEEK_SET)) return false;
+          } else if (!parseWavHeader(reader, format) || !format.isPlayable()) {
+              Serial.println("Unsupported WAV file");
+              return false;
+          }
+          // Files with a bogus data length are played up to the end of the file
+          uint32_t available = file->getSize() > format.dataOffset ? file->getSize() - format.dataOffset : 0;
+          if (format.dataLength == 0 || format.dataLength > available) {
+              format.dataLength = available - available % format.blockAlign;
+          }
+          if (!frames.start(&reader, format, looping, loopStartMs, loopEndMs)) {
+              Serial.println("Not enough memory for ADPCM decoding");
+              return false;
+          }
+          pending = false;
+
+          output->SetRate(format.sampleRate);
+          output->SetBitsPerSample(16);
+          output->SetChannels(format.channels);
+          if (!output->begin()) return false;
+          running = true;
+          return true;
+      }
+
+      virtual bool loop() override {
+          if (running) {
+              // First push the sample the output refused last time
+              if (!pending || output->ConsumeSample(lastSample)) {
+                  pending = false;
+                  while (running) {
+                      if (!frames.next(lastSample)) {
+                          stop();
+                          break;
+                      }
+                      if (!output->ConsumeSample(lastSample)) {
+                          pending = true;
+                          break;
+                      }
+                  }
+              }
+          }
+          if (file) file->loop();
+          if (output) output->loop();
+          return running;
+      }
+
+      virtual bool stop() override {
+          if (!running) return true;
+          running = false;
+          output->stop();
+          return file->close();
+      }
+
+      virtual bool isRunning() override {
+          return running;
+      }
+
+      const WavFormat& getFormat() const {
+          return frames.getFormat();
+      }
+
+  private:
+      AudioSourceReader reader;
+      WavDataReader<AudioSourceReader> frames;
+      WavFormat knownFormat;
+      bool hasKnownFormat;
+      bool looping;
+      uint32_t loopStartMs;
+      uint32_t loopEndMs;
+      bool pending;
+};
+
+// Plays a synthesized call-progress tone, no source file needed
+class AudioGeneratorTone : public AudioGenerator {
+  public:
+      AudioGeneratorTone() : tone(NULL), repeat(true), pending(false) {
+          running = false;
+          file = NULL;
+          output = NULL;
+      }
+
+      // Without repeat the generator stops after the last segment
+      void setTone(const ToneSpec* newTone, bool repeatTone = true) {
+          tone = newTone;
+          repeat = repeatTone;
+      }
+
+      virtual bool begin(AudioFileSource *source, AudioOutput *output) override {
+          (void)source;
+          if (!output || !tone) return false;
+          this->output = output;
+          synth.start(tone, TONE_SAMPLE_RATE, repeat);
+          pending = false;
+          output->SetRate(TONE_SAMPLE_RATE);
+          output->SetBitsPerSample(16);
+          output->SetChannels(1);
+          if (!output->begin()) return false;
+          running = true;
+          return true;
+      }
+
+      virtual bool loop() override {
+          if (running) {
+              if (!pending || output->ConsumeSample(lastSample)) {
+                  pending = false;
+                  while (running) {
+                      if (synth.render(&lastSample[AudioOutput::LEFTCHANNEL], 1) == 0) {
+                          stop();
+                          break;
+                      }
+                      lastSample[AudioOutput::RIGHTCHANNEL] = lastSample[AudioOutput::LEFTCHANNEL];
+                      if (!output->ConsumeSample(lastSample)) {
+                          pending = true;
+                          break;
+                      }
+                  }
+              }
+          }
+          if (output) output->loop();
+          return running;
+      }
+
+      virtual bool stop() override {
+          if (!running) return true;
+          running = false;
+          synth.stop();
+          return output->stop();
+      }
+
+      virtual bool isRunning() override {
+          return running;
+      }
+
+  private:
+      ToneSynth synth;
+      const ToneSpec* tone;
+      bool repeat;
+      bool pending;
+};
+
+#ifdef LATENCY_BENCH
+// Time from a completed dial to the first audible sample at the I2S feeder, only in builds
+// with LATENCY_BENCH defined (pio run -e esp32dev-latency)
+LatencyProbe latencyProbe;
+#define LATENCY_MARK(stage) latencyProbe.mark(LatencyProbe::stage, micros())
+
+// Call from loop(), prints a finished measurement and the histogram so far
+void reportLatency() {
+    if (!latencyProbe.collect()) return;
+    Serial.print("Latency [us]:");
+    for (int i = LatencyProbe::Calling; i < LatencyProbe::STAGE_COUNT; i++) {
+        Serial.printf(" %s +%u", LatencyProbe::getStageName((LatencyProbe::Stage)i), (unsigned)latencyProbe.getStageUs((LatencyProbe::Stage)i));
+    }
+    Serial.printf(", total %u\n", (unsigned)latencyProbe.getStageUs(LatencyProbe::Dialled));
+    Serial.print("Latency histogram (ms):");
+    for (int b = 0; b < LatencyProbe::BUCKET_COUNT; b++) {
+        Serial.printf(" <%u", (unsigned)LatencyProbe::getBucketLimitMs(b));
+    }
+    Serial.println();
+    for (int i = 0; i < LatencyProbe::STAGE_COUNT; i++) {
+        Serial.printf("  %-12s", i == LatencyProbe::Dialled ? "total" : LatencyProbe::getStageName((LatencyProbe::Stage)i));
+        for (int b = 0; b < LatencyProbe::BUCKET_COUNT; b++) {
+            Serial.printf(" %u", (unsigned)latencyProbe.getCount((LatencyProbe::Stage)i, b));
+        }
+        Serial.println();
+    }
+}
+
+// Delays open() and read() of the SD source to simulate slow cards, see DelayedSource
+class AudioFileSourceDelay : public AudioFileSource {
+  public:
+      AudioFileSourceDelay(AudioFileSource* inner) : inner(inner), delayed(inner, [](uint32_t us) { delayMicroseconds(us); }) {}
+
+      void setDelays(uint32_t openUs, uint32_t readUs) {
+          delayed.setDelays(openUs, readUs);
+      }
+
+      virtual bool open(const char* filename) override { return delayed.open(filename); }
+      virtual uint32_t read(void* data, uint32_t len) override { return delayed.read(data, len); }
+      virtual bool seek(int32_t pos, int dir) override { return delayed.seek(pos, dir); }
+      virtual bool loop() override { return inner->loop(); }
+      virtual bool close() override { return delayed.close(); }
+      virtual bool isOpen() override { return delayed.isOpen(); }
+      virtual uint32_t getSize() override { return delayed.getSize(); }
+      virtual uint32_t getPos() override { return delayed.getPos(); }
+
+  private:
+      AudioFileSource* inner;
+      DelayedSource<AudioFileSource> delayed;
+};
+#else
+#define LATENCY_MARK(stage)
+#endif
+
+struct AudioFrame {
+    int16_t left;
+    int16_t right;
+};
+
+// AudioOutput that collects the frames of one mixer voice into a block
+class AudioOutputVoice : public AudioOutput {
+  public:
+      AudioOutputVoice() : frames(0), inputFrames(0), rate(AUDIO_OUTPUT_RATE), resampleCycles(0), resampledFrames(0) {
+          resampler.setRates(rate, AUDIO_OUTPUT_RATE);
+      }
+
+      // Rate of the decoded samples, they are converted to AUDIO_OUTPUT_RATE on the way in
+      virtual bool SetRate(int hz) override {
+          rate = hz;
+          resampler.setRates(hz, AUDIO_OUTPUT_RATE);
+          inputFrames = 0;
+          return true;
+      }
+
+      int getRate() const {
+          return rate;
+      }
+
+      virtual bool begin() override {
+          return true;
+      }
+
+      // Samples at the output rate go straight into the block, others are collected and
+      // converted RESAMPLE_FRAMES at a time
+      virtual bool ConsumeSample(int16_t sample[2]) override {
+          if (resampler.isPassthrough()) {
+              if (frames >= MIX_BLOCK_FRAMES) return false; // Block is full, the decoder retries later
+              block[frames * 2] = sample[0];
+              block[frames * 2 + 1] = sample[1];
+              frames++;
+              return true;
+          }
+          if (inputFrames == RESAMPLE_FRAMES) {
+              resample();
+              if (inputFrames == RESAMPLE_FRAMES) return false; // Block is full
+          }
+          input[inputFrames * 2] = sample[0];
+          input[inputFrames * 2 + 1] = sample[1];
+          if (++inputFrames == RESAMPLE_FRAMES) resample();
+          return true;
+      }
+
+      virtual bool stop() override {
+          return true; // I2S keeps running, the mixer decides what is played
+      }
+
+      bool isFull() const {
+          return frames >= MIX_BLOCK_FRAMES;
+      }
+
+      uint32_t getFrames() const {
+          return frames;
+      }
+
+      // Converts what is collected so far and zero-pads a partial last block
+      const int16_t* takeBlock() {
+          if (inputFrames > 0) resample();
+          for (uint32_t i = frames * 2; i < MIX_BLOCK_FRAMES * 2; i++) block[i] = 0;
+          frames = 0;
+          return block;
+      }
+
+      void clear() {
+          frames = 0;
+          inputFrames = 0;
+          resampler.reset();
+      }
+
+      uint64_t getResampleCycles() const {
+          return resampleCycles;
+      }
+
+      uint64_t getResampledFrames() const {
+          return resampledFrames;
+      }
+
+      void resetStats() {
+          resampleCycles = 0;
+          resampledFrames = 0;
+      }
+
+  private:
+      static const uint32_t RESAMPLE_FRAMES = 64; // Input frames converted per resampler call
+
+      int16_t block[MIX_BLOCK_FRAMES * 2];
+      uint32_t frames;
+      int16_t input[RESAMPLE_FRAMES * 2];
+      uint32_t inputFrames;
+      int rate;
+      Resampler resampler;
+      uint64_t resampleCycles;
+      uint64_t resampledFrames;
+
+      // Converts the collected input into the free part of the block, input that does not fit
+      // moves to the front and waits for the next block
+      void resample() {
+          uint32_t start = ESP.getCycleCount();
+          uint32_t used;
+          uint32_t produced = resampler.process(input, inputFrames, &used, block + frames * 2, MIX_BLOCK_FRAMES - frames);
+          resampleCycles += ESP.getCycleCount() - start;
+          resampledFrames += produced;
+          frames += produced;
+          inputFrames -= used;
+          if (inputFrames > 0 && used > 0) memmove(input, input + used * 2, inputFrames * 2 * sizeof(int16_t));
+      }
+};
+
+// Plays up to MIX_VOICES files at once. Decoding and mixing run in their own task and fill
+// a ring buffer, a second task drains it into I2S. Slow work in loop() (web requests, uploads)
+// can therefore no longer starve the DMA.
+// Voice 0 is the primary voice used by playAudio(), the others can be layered on top of it.
+class WavPlayer {
+  public:
+      static const int PRIMARY_VOICE = 0;
+      static const int MAX_DECODE_ATTEMPTS = 8; // Decoder calls per voice and block
+
+      enum Decoder { DECODER_PCM, DECODER_ADPCM, DECODER_MP3, DECODER_TONE, DECODER_COUNT };
+
+      WavPlayer() : output(NULL), ring(NULL), promptCache(NULL), prefetcher(NULL), lock(NULL), decodeTaskHandle(NULL), feederTaskHandle(NULL),
+                    targetGain(GainRamp::UNITY_GAIN), volumeRampMs(30), appliedGain(GainRamp::UNITY_GAIN), flushRequested(false),
+                    parkRequested(false), resumeRequested(false), underruns(0), reportedUnderruns(0), minFill(AUDIO_RING_FRAMES) {
+          resetStats();
+      }
+
+      void begin() {
+          for (int i = 0; i < MIX_VOICES; i++) {
+              Voice& voice = voices[i];
+              voice.sdBuffered = new AudioFileSourceSDBuffered();
+#ifdef LATENCY_BENCH
+              voice.sdSource = voice.delaySource = new AudioFileSourceDelay(voice.sdBuffered);
+#else
+              voice.sdSource = voice.sdBuffered;
+#endif
+              voice.ramSource = new AudioFileSourceRAM();
+              voice.source = voice.sdSource;
+              voice.sink = new AudioOutputVoice();
+              voice.decoder = new AudioGeneratorWAVLoop();
+              voice.toneGenerator = new AudioGeneratorTone();
+              voice.mp3Decoder = NULL;
+              voice.generator = voice.decoder;
+              voice.decoderKind = DECODER_PCM;
+              voice.gainQ15 = AudioMixer::UNITY_GAIN;
+              voice.active = false;
+          }
+          createOutput();
+          ring = new SpscRingBuffer<AudioFrame>(AUDIO_RING_FRAMES);
+          lock = xSemaphoreCreateMutex();
+
+          // Both tasks run above loop() (priority 1) on the same core
+          xTaskCreatePinnedToCore(decodeTask, "audioDecode", 8192, this, AUDIO_DECODE_PRIORITY, &decodeTaskHandle, AUDIO_TASK_CORE);
+          xTaskCreatePinnedToCore(feederTask, "audioFeeder", 4096, this, AUDIO_FEEDER_PRIORITY, &feederTaskHandle, AUDIO_TASK_CORE);
+      }
+
+      // Files found in the cache are played from memory instead of the SD card
+      void setPromptCache(PromptCache* cache) {
+          promptCache = cache;
+      }
+
+      // Dialled numbers are taken from the prefetcher when it has them open already
+      void setPrefetcher(DialPrefetcher* dialPrefetcher) {
+          prefetcher = dialPrefetcher;
+      }
+
+      // Replaces whatever the primary voice plays and drops queued audio so it starts right away.
+      // With loop enabled the part between loopStartMs and loopEndMs (0 = end of file) repeats gaplessly
+      void playAudio(const String &filePath, bool loop = false, uint32_t loopStartMs = 0, uint32_t loopEndMs = 0) {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          stopVoiceLocked(PRIMARY_VOICE);
+          flushOutput();
+          startVoiceLocked(PRIMARY_VOICE, filePath, loop, loopStartMs, loopEndMs);
+          xSemaphoreGive(lock);
+      }
+
+      // Plays a file whose header was indexed by SDReader, skipping the signature check and
+      // the RIFF chunk walk
+      void playAudio(const String &filePath, const WavFormat &format) {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          stopVoiceLocked(PRIMARY_VOICE);
+          flushOutput();
+          startVoiceLocked(PRIMARY_VOICE, filePath, false, 0, 0, &format, true);
+          LATENCY_MARK(Begun);
+          xSemaphoreGive(lock);
+      }
+
+      // Starts a new stream on the live source and plays it on the primary voice,
+      // until the source runs dry after finish()
+      bool playLive(AudioFileSourceLive* live, uint32_t sampleRate, uint16_t channels) {
+          WavFormat format;
+          format.formatTag = WavFormat::FORMAT_PCM;
+          format.channels = channels;
+          format.sampleRate = sampleRate;
+          format.bitsPerSample = 16;
+          format.blockAlign = channels * 2;
+          format.dataOffset = 0;
+          format.dataLength = AudioFileSourceLive::ENDLESS - AudioFileSourceLive::ENDLESS % format.blockAlign;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          stopVoiceLocked(PRIMARY_VOICE);
+          flushOutput();
+          Voice& voice = voices[PRIMARY_VOICE];
+          voice.source->close();
+          live->start();
+          voice.source = live;
+          voice.sink->clear();
+          voice.decoder->setKnownFormat(&format);
+          voice.decoder->setLoop(false);
+          voice.generator = voice.decoder;
+          voice.decoderKind = DECODER_PCM;
+          bool started = voice.generator->begin(voice.source, voice.sink);
+          if (started) {
+              Serial.println("Playing live stream on voice 0...");
+              activateVoice(PRIMARY_VOICE);
+          }
+          xSemaphoreGive(lock);
+          return started;
+      }
+
+      // Layers a file on top of what is playing, e.g. key clicks over a dial tone
+      bool playVoice(int index, const String &filePath, bool loop = false, float gain = 1.0f) {
+          if (index < 0 || index >= MIX_VOICES) return false;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          stopVoiceLocked(index);
+          voices[index].gainQ15 = AudioMixer::gainToQ15(gain);
+          bool started = startVoiceLocked(index, filePath, loop, 0, 0);
+          xSemaphoreGive(lock);
+          return started;
+      }
+
+      // Synthesized tones cost no SD bandwidth and start immediately
+      bool playTone(const ToneSpec* tone, int index = PRIMARY_VOICE, bool repeat = true) {
+          if (!tone || index < 0 || index >= MIX_VOICES) return false;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          stopVoiceLocked(index);
+          if (index == PRIMARY_VOICE) {
+              flushOutput();
+          }
+          bool started = startToneLocked(index, tone, repeat);
+          xSemaphoreGive(lock);
+          return started;
+      }
+
+      void setVoiceGain(int index, float gain) {
+          if (index >= 0 && index < MIX_VOICES) {
+              voices[index].gainQ15 = AudioMixer::gainToQ15(gain);
+          }
+      }
+
+      void stopVoice(int index) {
+          if (index < 0 || index >= MIX_VOICES) return;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          stopVoiceLocked(index);
+          xSemaphoreGive(lock);
+      }
+
+      bool isVoicePlaying(int index) const {
+          return index >= 0 && index < MIX_VOICES && voices[index].active;
+      }
+
+      // Stops everything and hands I2S0 over, the built-in ADC can only be sampled through it.
+      // Nothing is audible until restoreOutput()
+      void releaseOutput() {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          for (int i = 0; i < MIX_VOICES; i++) {
+              stopVoiceLocked(i);
+          }
+          flushOutput();
+          // The feeder must not touch the output while it is deleted
+          parkRequested = true;
+          while (parkRequested && feederTaskHandle) {
+              vTaskDelay(1);
+          }
+          delete output; // Uninstalls the I2S driver
+          output = NULL;
+          xSemaphoreGive(lock);
+      }
+
+      void restoreOutput() {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          if (!output) {
+              createOutput();
+              resumeRequested = true;
+              while (resumeRequested && feederTaskHandle) {
+                  vTaskDelay(1);
+              }
+          }
+          xSemaphoreGive(lock);
+      }
+
+      // Stops all voices and drops queued audio
+      void stop() {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          if (voices[PRIMARY_VOICE].active) {
+              Serial.println("Playback stopped.");
+          }
+          for (int i = 0; i < MIX_VOICES; i++) {
+              stopVoiceLocked(i);
+          }
+          flushOutput();
+          xSemaphoreGive(lock);
+      }
+
+      // Volume in percent (0 = mute, 100 = full scale), the mixer glides to it within the ramp time
+      void setVolume(float volume) {
+          targetGain = GainRamp::gainToQ15(volume / 100);
+          Serial.printf("Volume set to %.2f\n", volume);
+      }
+
+#ifdef LATENCY_BENCH
+      // Simulated SD card latency for the benchmark build
+      void setSimulatedSdDelays(uint32_t openUs, uint32_t readUs) {
+          for (int i = 0; i < MIX_VOICES; i++) {
+              if (voices[i].delaySource) voices[i].delaySource->setDelays(openUs, readUs);
+          }
+      }
+#endif
+
+      // Q15 gain the mixer glides to, for audio that does not go through the mixer
+      int32_t getVolumeGain() const {
+          return targetGain;
+      }
+
+      void setVolumeRamp(uint32_t milliseconds) {
+          volumeRampMs = milliseconds;
+      }
+
+    // Called by the decode task, there is no need to call this from the main loop
+    void loop() {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        while (ring && ring->space() >= MIX_BLOCK_FRAMES && mixBlock()) {
+        }
+        // The ring is full, read ahead while the feeder plays it
+        for (int i = 0; i < MIX_VOICES; i++) {
+            if (voices[i].active && voices[i].source == voices[i].sdSource) {
+                voices[i].sdBuffered->prefetch();
+            }
+        }
+        xSemaphoreGive(lock);
+    }
+
+      // Playing until the primary voice has finished and the ring buffer is drained
+      bool isPlaying() {
+          if (!lock) return false;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          bool playing = voices[PRIMARY_VOICE].active || (ring && ring->size() > 0);
+          xSemaphoreGive(lock);
+          return playing;
+      }
+
+      // Call from loop(), reports the underruns the feeder counted since the last call
+      void update() {
+          uint32_t count = underruns;
+          if (count > reportedUnderruns) {
+              Serial.printf("Audio buffer underrun, %u since the stats were reset\n", (unsigned)count);
+          }
+          reportedUnderruns = count;
+      }
+
+      uint8_t getBufferFillPercent() const {
+          return ring ? ring->size() * 100 / ring->getCapacity() : 0;
+      }
+
+      // Lowest fill level seen while a stream was active since the last resetStats()
+      uint8_t getMinBufferFillPercent() const {
+          return ring ? minFill * 100 / ring->getCapacity() : 0;
+      }
+
+      uint32_t getUnderrunCount() const {
+          return underruns;
+      }
+
+      // CPU cycles spent mixing per output sample while the given number of voices was active
+      uint32_t getMixCyclesPerSample(int activeVoices) const {
+          if (activeVoices < 1 || activeVoices > MIX_VOICES || mixSamples[activeVoices] == 0) return 0;
+          return (uint32_t)(mixCycles[activeVoices] / mixSamples[activeVoices]);
+      }
+
+      // CPU cycles a decoder needed per output frame, including its SD reads and resampling
+      uint32_t getDecodeCyclesPerFrame(Decoder decoder) const {
+          if (decoder < 0 || decoder >= DECODER_COUNT || decodeFrames[decoder] == 0) return 0;
+          return (uint32_t)(decodeCycles[decoder] / decodeFrames[decoder]);
+      }
+
+      // Share of one core a single voice with this decoder needs to keep up in real time
+      float getDecodeLoadPercent(Decoder decoder) const {
+          if (decoder < 0 || decoder >= DECODER_COUNT || decodeAudioUs[decoder] == 0) return 0;
+          return decodeCycles[decoder] * 100.0f / ((float)decodeAudioUs[decoder] * ESP.getCpuFreqMHz());
+      }
+
+      static const char* getDecoderName(Decoder decoder) {
+          static const char* names[DECODER_COUNT] = { "PCM", "ADPCM", "MP3", "Tone" };
+          return decoder >= 0 && decoder < DECODER_COUNT ? names[decoder] : "";
+      }
+
+      // CPU cycles spent converting sample rates per output frame, over all voices
+      uint32_t getResampleCyclesPerFrame() const {
+          uint64_t cycles = 0;
+          uint64_t frames = 0;
+          for (int i = 0; i < MIX_VOICES; i++) {
+              if (!voices[i].sink) continue;
+              cycles += voices[i].sink->getResampleCycles();
+              frames += voices[i].sink->getResampledFrames();
+          }
+          return frames ? (uint32_t)(cycles / frames) : 0;
+      }
+
+      void resetStats() {
+          for (int i = 0; i < MIX_VOICES; i++) {
+              if (voices[i].sink) voices[i].sink->resetStats();
+          }
+          underruns = 0;
+          minFill = AUDIO_RING_FRAMES;
+          for (int i = 0; i <= MIX_VOICES; i++) {
+              mixCycles[i] = 0;
+              mixSamples[i] = 0;
+          }
+          for (int i = 0; i < DECODER_COUNT; i++) {
+              decodeCycles[i] = 0;
+              decodeFrames[i] = 0;
+              decodeAudioUs[i] = 0;
+          }
+      }
+
+  private:
+      struct Voice {
+          AudioFileSourceSDBuffered *sdBuffered;
+          AudioFileSource *sdSource; // sdBuffered, wrapped in the benchmark build
+#ifdef LATENCY_BENCH
+          AudioFileSourceDelay *delaySource;
+#endif
+          AudioFileSourceRAM *ramSource;
+          AudioFileSource *source; // Either sdSource or ramSource
+          AudioGeneratorWAVLoop *decoder;
+          AudioGeneratorTone *toneGenerator;
+          AudioGeneratorMP3 *mp3Decoder; // Only while the voice plays MP3
+          AudioGenerator *generator; // decoder, toneGenerator or mp3Decoder
+          Decoder decoderKind;
+          AudioOutputVoice *sink;
+          std::atomic<int32_t> gainQ15;
+          std::atomic<bool> active;
+      };
+
+      Voice voices[MIX_VOICES];
+      AudioOutputI2S *output;
+      SpscRingBuffer<AudioFrame> *ring;
+      PromptCache *promptCache;
+      DialPrefetcher *prefetcher;
+      SemaphoreHandle_t lock; // Guards the voices between the public methods and the decode task
+      TaskHandle_t decodeTaskHandle;
+      TaskHandle_t feederTaskHandle;
+      std::atomic<int32_t> targetGain;
+      std::atomic<uint32_t> volumeRampMs;
+      int32_t appliedGain;        // Last target handed to masterGain, owned by the decode task
+      GainRamp masterGain;
+      std::atomic<bool> flushRequested;
+      std::atomic<bool> parkRequested;   // Feeder stops using the output, see releaseOutput()
+      std::atomic<bool> resumeRequested;
+      std::atomic<uint32_t> underruns;
+      uint32_t reportedUnderruns; // Owned by update()
+      std::atomic<uint32_t> minFill;
+      int32_t accumulator[MIX_BLOCK_FRAMES * 2];
+      AudioFrame mixed[MIX_BLOCK_FRAMES];
+      uint64_t mixCycles[MIX_VOICES + 1];
+      uint64_t mixSamples[MIX_VOICES + 1];
+      uint64_t decodeCycles[DECODER_COUNT];
+      uint64_t decodeFrames[DECODER_COUNT];
+      uint64_t decodeAudioUs[DECODER_COUNT]; // Playing time of the decoded frames
+
+      void createOutput() {
+          output = new AudioOutputI2S(0, 1);
+          output->SetRate(AUDIO_OUTPUT_RATE); // Never changes, the voices are resampled
+          output->SetChannels(2); // Mixed frames are always stereo
+          output->SetGain(1.0);   // Volume is applied by masterGain in the mixer
+          output->begin();
+      }
+
+      // A known format, recorded when the file was indexed, saves reading the head of the file
+      bool startVoiceLocked(int index, const String &filePath, bool loop, uint32_t loopStartMs, uint32_t loopEndMs,
+                            const WavFormat* known = NULL, bool dialled = false) {
+          Voice& voice = voices[index];
+          voice.source->close();
+          if (!openSource(voice, filePath, dialled)) {
+              Serial.printf("Error opening '%s'\n", filePath.c_str());
+              return false;
+          }
+          if (index == PRIMARY_VOICE) {
+              LATENCY_MARK(Opened);
+          }
+          Serial.printf("Playing '%s' from %s on voice %d...\n", filePath.c_str(), voice.source == voice.ramSource ? "RAM" : "SD card", index);
+          voice.sink->clear();
+          if (known && !known->isMp3() && !known->isPlayable()) known = NULL;
+          AudioFileType type = known ? (known->isMp3() ? AUDIO_FILE_MP3 : AUDIO_FILE_WAV) : detectFileType(voice.source);
+          if (type == AUDIO_FILE_MP3) {
+              voice.decoder->setKnownFormat(NULL);
+              if (loop) {
+                  Serial.println("Looping is only supported for WAV files, playing MP3 once");
+              }
+              // Start at the first frame, libmad does not know about ID3 tags
+              WavFormat mp3Format;
+              bool found = true;
+              if (known) {
+                  mp3Format = *known;
+              } else {
+                  AudioSourceReader reader = { voice.source };
+                  found = parseMp3Header(reader, mp3Format);
+              }
+              if (!found || !voice.source->seek(mp3Format.dataOffset, SEEK_SET)) {
+                  Serial.println("No MP3 frame found");
+                  return false;
+              }
+              if (!voice.mp3Decoder) {
+                  voice.mp3Decoder = new AudioGeneratorMP3();
+              }
+              voice.generator = voice.mp3Decoder;
+              voice.decoderKind = DECODER_MP3;
+          } else {
+              voice.decoder->setKnownFormat(known);
+              voice.decoder->setLoop(loop, loopStartMs, loopEndMs);
+              voice.generator = voice.decoder;
+          }
+          if (!voice.generator->begin(voice.source, voice.sink)) {
+              endVoiceLocked(voice);
+              return false;
+          }
+          if (voice.generator == voice.decoder) {
+              voice.decoderKind = voice.decoder->getFormat().isImaAdpcm() ? DECODER_ADPCM : DECODER_PCM;
+          }
+          activateVoice(index);
+          return true;
+      }
+
+      // Picks the decoder by signature, the source is rewound afterwards
+      static AudioFileType detectFileType(AudioFileSource* source) {
+          uint8_t head[AUDIO_FILE_SIGNATURE_SIZE];
+          uint32_t len = source->read(head, sizeof(head));
+          source->seek(0, SEEK_SET);
+          return detectAudioFileType(head, len);
+      }
+
+      bool startToneLocked(int index, const ToneSpec* tone, bool repeat) {
+          Voice& voice = voices[index];
+          Serial.printf("Playing %s %s tone on voice %d...\n", tone->region, tone->name, index);
+          voice.sink->clear();
+          voice.toneGenerator->setTone(tone, repeat);
+          voice.generator = voice.toneGenerator;
+          voice.decoderKind = DECODER_TONE;
+          if (!voice.toneGenerator->begin(NULL, voice.sink)) {
+              return false;
+          }
+          activateVoice(index);
+          return true;
+      }
+
+      void activateVoice(int index) {
+          voices[index].active = true;
+      }
+
+      void stopVoiceLocked(int index) {
+          Voice& voice = voices[index];
+          endVoiceLocked(voice);
+          if (voice.sink) voice.sink->clear();
+      }
+
+      // The MP3 decoder holds about 30 KB, it only exists while its voice plays
+      void endVoiceLocked(Voice& voice) {
+          if (voice.generator && voice.generator->isRunning()) {
+              voice.generator->stop();
+          }
+          voice.active = false;
+          if (voice.mp3Decoder) {
+              delete voice.mp3Decoder;
+              voice.mp3Decoder = NULL;
+              voice.generator = voice.decoder;
+          }
+      }
+
+      bool openSource(Voice& voice, const String &filePath, bool dialled) {
+          PromptCache::Prompt prompt;
+          if (promptCache && promptCache->get(filePath, prompt)) {
+              voice.source = voice.ramSource;
+              return voice.ramSource->open(prompt.data, prompt.size);
+          }
+          voice.source = voice.sdSource;
+          if (dialled && prefetcher && prefetcher->take(filePath, *voice.sdBuffered)) {
+              return true;
+          }
+          return voice.sdSource->open(filePath.c_str());
+      }
+
+      // Drops everything queued for I2S, call with the lock held
+      void flushOutput() {
+          // Only the feeder may empty the ring buffer, wait until it has done so
+          flushRequested = true;
+          while (flushRequested && feederTaskHandle) {
+              vTaskDelay(1);
+          }
+      }
+
+      // Decodes one block per active voice and queues their saturated sum, false if nothing plays
+      bool mixBlock() {
+          bool contributes[MIX_VOICES];
+          int activeVoices = 0;
+          for (int i = 0; i < MIX_VOICES; i++) {
+              Voice& voice = voices[i];
+              contributes[i] = voice.active;
+              if (!voice.active) continue;
+              // The decoder returns once the block is full or the file has ended. The MP3 decoder
+              // also returns early after a frame it could not decode, it is called again then.
+              uint32_t decodeStart = ESP.getCycleCount();
+              bool more = voice.generator->loop();
+              for (int attempt = 1; more && !voice.sink->isFull() && attempt < MAX_DECODE_ATTEMPTS; attempt++) {
+                  more = voice.generator->loop();
+              }
+              decodeCycles[voice.decoderKind] += ESP.getCycleCount() - decodeStart;
+              uint32_t frames = voice.sink->getFrames();
+              decodeFrames[voice.decoderKind] += frames;
+              decodeAudioUs[voice.decoderKind] += (uint64_t)frames * 1000000 / AUDIO_OUTPUT_RATE;
+              if (!more) {
+                  endVoiceLocked(voice); // Its last, partial block is still mixed below
+              }
+              activeVoices++;
+          }
+          if (activeVoices == 0) return false;
+
+          uint32_t start = ESP.getCycleCount();
+          const uint32_t samples = MIX_BLOCK_FRAMES * 2;
+          AudioMixer::clear(accumulator, samples);
+          for (int i = 0; i < MIX_VOICES; i++) {
+              if (contributes[i]) {
+                  AudioMixer::accumulate(accumulator, voices[i].sink->takeBlock(), samples, voices[i].gainQ15);
+              }
+          }
+          AudioMixer::saturate((int16_t*)mixed, accumulator, samples);
+
+          int32_t gain = targetGain;
+          if (gain != appliedGain) {
+              masterGain.setTarget(gain, volumeRampMs * AUDIO_OUTPUT_RATE / 1000);
+              appliedGain = gain;
+          }
+          masterGain.process((int16_t*)mixed, MIX_BLOCK_FRAMES, 2);
+          mixCycles[activeVoices] += ESP.getCycleCount() - start;
+          mixSamples[activeVoices] += samples;
+
+          ring->push(mixed, MIX_BLOCK_FRAMES);
+          return true;
+      }
+
+      static void decodeTask(void* param) {
+          WavPlayer* player = (WavPlayer*)param;
+          while (true) {
+              player->loop();
+              // Mixing stops as soon as the ring buffer is full
+              vTaskDelay(pdMS_TO_TICKS(2));
+          }
+      }
+
+      static void feederTask(void* param) {
+          ((WavPlayer*)param)->feedOutput();
+      }
+
+      bool anyVoiceActive() const {
+          for (int i = 0; i < MIX_VOICES; i++) {
+              if (voices[i].active) return true;
+          }
+          return false;
+      }
+
+      void feedOutput() {
+          AudioFrame frame;
+          bool haveFrame = false;
+          bool starved = true; // An empty buffer only counts as underrun after a stream delivered frames
+          bool parked = false;
+          while (true) {
+              if (flushRequested) {
+                  ring->discard();
+                  haveFrame = false;
+                  starved = true;
+                  flushRequested = false;
+              }
+              if (parkRequested) {
+                  parked = true;
+                  haveFrame = false;
+                  parkRequested = false;
+              }
+              if (resumeRequested) {
+                  parked = false;
+                  starved = true;
+                  resumeRequested = false;
+              }
+              if (parked) {
+                  vTaskDelay(pdMS_TO_TICKS(10));
+                  continue;
+              }
+
+              bool streamActive = anyVoiceActive();
+              while (true) {
+                  if (!haveFrame) {
+                      if (!ring->pop(frame)) {
+                          if (streamActive && !starved) {
+                              underruns++; // Reported by update(), printing here would stall the DMA
+                          }
+                          starved = true;
+                          break;
+                      }
+                      haveFrame = true;
+                      starved = false;
+                  }
+                  int16_t sample[2] = { frame.left, frame.right };
+                  if (!output->ConsumeSample(sample)) {
+                      break; // DMA buffers are full
+                  }
+#ifdef LATENCY_BENCH
+                  latencyProbe.onFrame(frame.left, frame.right, micros());
+#endif
+                  haveFrame = false;
+              }
+
+              uint32_t fill = ring->size();
+              if (streamActive && !starved && fill < minFill) {
+                  minFill = fill;
+              }
+              vTaskDelay(1);
+          }
+      }
+};
+
+// Records the handset microphone into a WAV file. The built-in ADC is sampled by I2S0 in
+// DMA mode, the port the DAC output uses, so WavPlayer::releaseOutput() has to come first.
+// A capture task moves the DMA buffers into a lock-free ring and a writer task drains it to
+// the SD card, an SD stall only costs ring space. Buffers are allocated by the first start().
+class MicRecorder {
+  public:
+      MicRecorder() : ring(NULL), writer(NULL), captureTaskHandle(NULL), writerTaskHandle(NULL),
+                      capturing(false), writing(false), captureIdle(true), writerIdle(true) {
+          resetStats();
+      }
+
+      // Records until stop() or maxSeconds, the file's clusters are reserved up front
+      bool start(const String& path, uint32_t maxSeconds) {
+          if (writing || !allocate()) return false;
+          file = SD.open(path, FILE_WRITE);
+          if (!file) {
+              Serial.printf("Could not create '%s'\n", path.c_str());
+              return false;
+          }
+          resetStats();
+          filePath = path;
+          maxSamples = maxSeconds * MIC_SAMPLE_RATE;
+          // Seeking past the end allocates the cluster chain now instead of during the recording
+          uint32_t start = micros();
+          if (!file.seek(WavWriter::HEADER_SIZE + maxSamples * 2) || !file.seek(0)) {
+              Serial.println("Could not reserve space for the recording");
+          }
+          reserveUs = micros() - start;
+          if (!writer->begin(MIC_SAMPLE_RATE, 1) || !startAdc()) {
+              Serial.println("Could not start recording");
+              file.close();
+              SD.remove(path);
+              return false;
+          }
+          ring->discard();
+          dcLevel = 2048 << 8;
+          captureIdle = false;
+          writerIdle = false;
+          writing = true;
+          capturing = true;
+          xTaskNotifyGive(captureTaskHandle);
+          xTaskNotifyGive(writerTaskHandle);
+          Serial.printf("Recording to '%s'...\n", path.c_str());
+          return true;
+      }
+
+      // Writes what is still buffered, patches the header and gives back the unused reservation
+      bool stop() {
+          if (!writing) return false;
+          capturing = false;
+          while (!captureIdle) {
+              vTaskDelay(1);
+          }
+          stopAdc();
+          writing = false;
+          while (!writerIdle) {
+              vTaskDelay(1);
+          }
+          // The writer task is idle, this task is the ring's consumer now
+          int16_t samples[256];
+          uint32_t count;
+          while ((count = ring->pop(samples, 256)) > 0) {
+              writeSamples(samples, count);
+          }
+          uint8_t header[WavWriter::HEADER_SIZE];
+          bool saved = writer->finish(header) && file.seek(0) && file.write(header, sizeof(header)) == sizeof(header);
+          file.close();
+          uint32_t size = WavWriter::HEADER_SIZE + writer->getDataBytes();
+          // SD mounts the card at /sd in the VFS
+          if (truncate((String("/sd") + filePath).c_str(), size) != 0) {
+              Serial.println("Could not trim the recording, the WAV header is still valid");
+          }
+          lastBytes = writer->getDataBytes();
+          Serial.printf("Recorded %u ms to '%s'%s, %u samples dropped, %u KB/s to SD (longest write %u us), ring peak %u%%, reserve %u us\n",
+                        (unsigned)getRecordedMs(), filePath.c_str(), saved ? "" : " (write failed)", (unsigned)droppedSamples,
+                        (unsigned)getThroughputKBps(), (unsigned)maxWriteUs, (unsigned)getPeakFillPercent(), (unsigned)reserveUs);
+          return saved;
+      }
+
+      bool isRecording() const {
+          return writing;
+      }
+
+      uint32_t getRecordedMs() const {
+          return (uint32_t)((uint64_t)capturedSamples * 1000 / MIC_SAMPLE_RATE);
+      }
+
+      // Samples lost because the ring was full, i.e. the SD card fell behind for too long
+      uint32_t getDroppedSamples() const {
+          return droppedSamples;
+      }
+
+      // Sustained SD write rate while the writer was busy
+      uint32_t getThroughputKBps() const {
+          return writeUs ? (uint32_t)((uint64_t)writtenBytes * 1000000 / writeUs / 1024) : 0;
+      }
+
+      uint32_t getMaxWriteUs() const {
+          return maxWriteUs;
+      }
+
+      uint8_t getPeakFillPercent() const {
+          return ring ? peakFill * 100 / ring->getCapacity() : 0;
+      }
+
+      uint32_t getLastBytes() const {
+          return lastBytes;
+      }
+
+  private:
+      static const uint32_t DRAIN_SAMPLES = 1024;
+
+      SpscRingBuffer<int16_t> *ring;
+      WavWriter *writer;
+      File file;
+      String filePath;
+      TaskHandle_t captureTaskHandle;
+      TaskHandle_t writerTaskHandle;
+      std::atomic<bool> capturing;
+      std::atomic<bool> writing;
+      std::atomic<bool> captureIdle; // Set by the tasks once they wait for the next start()
+      std::atomic<bool> writerIdle;
+      uint32_t maxSamples;
+      int32_t dcLevel;               // Microphone bias in 12 bit ADC units, 8 fraction bits
+      std::atomic<uint32_t> capturedSamples;
+      std::atomic<uint32_t> droppedSamples;
+      std::atomic<uint32_t> peakFill;
+      uint64_t writeUs;
+      uint32_t writtenBytes;
+      uint32_t maxWriteUs;
+      uint32_t reserveUs;
+      uint32_t lastBytes;
+      int16_t drainSamples[DRAIN_SAMPLES]; // Only the writer task uses it, too big for its stack
+
+      bool allocate() {
+          if (ring) return true;
+          ring = new SpscRingBuffer<int16_t>(MIC_RING_SAMPLES);
+          writer = new WavWriter(MIC_WRITE_BLOCK, [this](const uint8_t* data, size_t len) {
+              return file.write(data, len) == len;
+          });
+          if (!ring->isAllocated() || !writer->isAllocated()) {
+              Serial.println("Not enough memory for recording");
+              delete ring;
+              delete writer;
+              ring = NULL;
+              writer = NULL;
+              return false;
+          }
+          xTaskCreatePinnedToCore(captureTask, "micCapture", 4096, this, AUDIO_FEEDER_PRIORITY, &captureTaskHandle, AUDIO_TASK_CORE);
+          xTaskCreatePinnedToCore(writerTask, "micWriter", 4096, this, AUDIO_DECODE_PRIORITY, &writerTaskHandle, AUDIO_TASK_CORE);
+          return true;
+      }
+
+      void resetStats() {
+          capturedSamples = 0;
+          droppedSamples = 0;
+          peakFill = 0;
+          writeUs = 0;
+          writtenBytes = 0;
+          maxWriteUs = 0;
+          reserveUs = 0;
+      }
+
+      bool startAdc() {
+          i2s_config_t config = {};
+          config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
+          config.sample_rate = MIC_SAMPLE_RATE;
+          config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+          config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+          config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+          config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1;
+          config.dma_buf_count = 8;
+          config.dma_buf_len = 256;
+          config.use_apll = false;
+          if (i2s_driver_install(I2S_NUM_0, &config, 0, NULL) != ESP_OK) return false;
+          adc1_config_channel_atten(MIC_ADC_CHANNEL, ADC_ATTEN_DB_11);
+          if (i2s_set_adc_mode(ADC_UNIT_1, MIC_ADC_CHANNEL) != ESP_OK || i2s_adc_enable(I2S_NUM_0) != ESP_OK) {
+              i2s_driver_uninstall(I2S_NUM_0);
+              return false;
+          }
+          return true;
+      }
+
+      void stopAdc() {
+          i2s_adc_disable(I2S_NUM_0);
+          i2s_driver_uninstall(I2S_NUM_0);
+      }
+
+      void writeSamples(const int16_t* samples, uint32_t count) {
+          uint32_t start = micros();
+          writer->write(samples, count);
+          uint32_t elapsed = micros() - start;
+          writeUs += elapsed;
+          writtenBytes += count * sizeof(int16_t);
+          if (elapsed > maxWriteUs) maxWriteUs = elapsed;
+      }
+
+      static void captureTask(void* param) {
+          ((MicRecorder*)param)->capture();
+      }
+
+      static void writerTask(void* param) {
+          ((MicRecorder*)param)->drain();
+      }
+
+      void capture() {
+          uint16_t raw[256];
+          int16_t samples[256];
+          while (true) {
+              if (!capturing) {
+                  captureIdle = true;
+                  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                  continue;
+              }
+              size_t bytesRead = 0;
+              i2s_read(I2S_NUM_0, raw, sizeof(raw), &bytesRead, pdMS_TO_TICKS(100));
+              uint32_t count = (bytesRead / sizeof(uint16_t)) & ~1u;
+              uint32_t room = maxSamples - capturedSamples;
+              if (count > room) count = room;
+              for (uint32_t i = 0; i < count; i++) {
+                  // The ADC delivers every pair of samples swapped, the upper 4 bits hold the channel
+                  int32_t value = (raw[i ^ 1] & 0x0FFF) << 8;
+                  // One pole high-pass, removes the bias of the microphone amplifier
+                  dcLevel += (value - dcLevel) >> 9;
+                  int32_t sample = (value - dcLevel) >> 4;
+                  if (sample > 32767) sample = 32767;
+                  if (sample < -32768) sample = -32768;
+                  samples[i] = (int16_t)sample;
+              }
+              uint32_t queued = ring->push(samples, count);
+              droppedSamples += count - queued;
+              capturedSamples += count;
+              uint32_t fill = ring->size();
+              if (fill > peakFill) peakFill = fill;
+              if (capturedSamples >= maxSamples) {
+                  capturing = false;
+              }
+          }
+      }
+
+      void drain() {
+          while (true) {
+              if (!writing) {
+                  writerIdle = true;
+                  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                  continue;
+              }
+              uint32_t count = ring->pop(drainSamples, DRAIN_SAMPLES);
+              if (count == 0) {
+                  vTaskDelay(pdMS_TO_TICKS(5));
+                  continue;
+              }
+              writeSamples(drainSamples, count);
+          }
+      }
+};
+
+// Push-to-talk from the website. While the button is held the browser streams small frames
+// of 16 bit PCM or IMA ADPCM over a WebSocket, they go straight into a WAV file in /numbers
+// and optionally to a live voice. Every frame is acknowledged once it is stored and the browser
+// keeps at most the announced window of frames unacknowledged, so a slow SD card throttles
+// the sender instead of piling up data in the socket.
+//
+// Text messages, browser to phone:
+//   start <rate> pcm|adpcm <blockAlign> <live 0|1> <number> <description>
+//   stop
+// phone to browser:
+//   ready <window>, ack <seq> <timestamp>, saved <path> <bytes>, error <message>
+// Binary frames: sequence number (16 bit), 0 (16 bit), timestamp in ms (32 bit), little endian,
+// then the samples or one ADPCM block. The timestamp is echoed in the ack for latency statistics.
+class PushToTalkServer {
+  public:
+      static const uint32_t FRAME_HEADER = 8;
+
+      PushToTalkServer(uint16_t port, WavPlayer* player)
+          : socket(port), player(player), writer(NULL), live(NULL), decoded(NULL), client(-1), recording(false) {
+          resetStats();
+      }
+
+      void begin() {
+          socket.begin();
+          socket.onEvent([this](uint8_t num, WStype_t type, uint8_t* payload, size_t length) {
+              this->onEvent(num, type, payload, length);
+          });
+      }
+
+      // Handles the socket, frames are written to SD from here
+      void loop() {
+          socket.loop();
+      }
+
+      // Called with the path of every saved recording, and of a sample a failed save removed
+      void onSaved(std::function<void(const String&)> callback) {
+          savedCallback = callback;
+      }
+
+      uint32_t getFrames() const { return frames; }
+      uint32_t getBytes() const { return bytes; }
+      uint32_t getLostFrames() const { return lostFrames; }
+      uint32_t getMaxFrameUs() const { return maxFrameUs; }
+      uint32_t getLiveUnderruns() const { return live ? live->getUnderruns() : 0; }
+
+      // Payload received per second of the last session
+      uint32_t getThroughputKBps() const {
+          uint32_t elapsed = (recording ? millis() : endMs) - startMs;
+          return elapsed ? (uint32_t)((uint64_t)bytes * 1000 / elapsed / 1024) : 0;
+      }
+
+  private:
+      WebSocketsServer socket;
+      WavPlayer* player;
+      WavWriter* writer;
+      AudioFileSourceLive* live;
+      int16_t* decoded;    // One ADPCM block decoded for live playback
+      File file;
+      String filePath;
+      std::function<void(const String&)> savedCallback;
+      int client;          // Socket number of the recording browser, -1 if none
+      bool recording;
+      bool adpcm;
+      bool playing;
+      uint32_t sampleRate;
+      uint16_t blockAlign;
+      uint16_t lastSeq;
+      uint32_t frames;
+      uint32_t bytes;
+      uint32_t lostFrames;  // Gaps in the sequence numbers
+      uint32_t maxFrameUs;  // Longest time to store one frame, SD writes included
+      uint32_t startMs;
+      uint32_t endMs;
+
+      void resetStats() {
+          frames = 0;
+          bytes = 0;
+          lostFrames = 0;
+          maxFrameUs = 0;
+          startMs = 0;
+          endMs = 0;
+      }
+
+      void onEvent(uint8_t num, WStype_t type, uint8_t* payload, size_t length) {
+          if (type == WStype_DISCONNECTED) {
+              // Closing the page saves what arrived so far
+              if (recording && num == client) finishSession(true);
+          } else if (type == WStype_TEXT) {
+              String message = String((const char*)payload).substring(0, length);
+              if (message.startsWith("start ")) {
+                  startSession(num, message.substring(6));
+              } else if (message == "stop" && recording && num == client) {
+                  finishSession(true);
+              }
+          } else if (type == WStype_BIN && recording && num == client) {
+              onFrame(payload, length);
+          }
+      }
+
+      void sendError(uint8_t num, const char* message) {
+          String text = String("error ") + message;
+          socket.sendTXT(num, text);
+      }
+
+      // Arguments: <rate> pcm|adpcm <blockAlign> <live 0|1> <number> <description>
+      void startSession(uint8_t num, const String& arguments) {
+          if (recording) {
+              sendError(num, "Busy, someone else is talking");
+              return;
+          }
+          String fields[5];
+          int pos = 0;
+          for (int i = 0; i < 5; i++) {
+              int space = arguments.indexOf(' ', pos);
+              if (space < 0) {
+                  sendError(num, "Expected: start <rate> pcm|adpcm <blockAlign> <live> <number> <description>");
+                  return;
+              }
+              fields[i] = arguments.substring(pos, space);
+              pos = space + 1;
+          }
+          String description = arguments.substring(pos);
+          description.replace("/", "-");
+          sampleRate = fields[0].toInt();
+          adpcm = fields[1] == "adpcm";
+          blockAlign = adpcm ? fields[2].toInt() : 2;
+          playing = fields[3] == "1";
+          String number = fields[4];
+          bool dialable = number.length() > 0;
+          for (unsigned int i = 0; i < number.length(); i++) {
+              if (number[i] < '0' || number[i] > '9') dialable = false;
+          }
+          if (sampleRate < 4000 || sampleRate > 48000 || (!adpcm && fields[1] != "pcm") || !dialable || description.length() == 0 ||
+              (adpcm && (blockAlign <= 4 || blockAlign > PTT_MAX_ADPCM_BLOCK || (blockAlign - 4) % 4 != 0))) {
+              sendError(num, "Invalid start parameters");
+              return;
+          }
+          if (!allocate()) {
+              sendError(num, "Not enough memory");
+              return;
+          }
+          if (!SD.exists("/numbers")) {
+              SD.mkdir("/numbers");
+          }
+          // A sample already under this name stays until the new one is saved
+          filePath = "/numbers/" + number + "_" + description + ".wav";
+          SD.remove(PTT_TEMP_PATH);
+          file = SD.open(PTT_TEMP_PATH, FILE_WRITE);
+          bool started = file && (adpcm ? writer->beginAdpcm(sampleRate, blockAlign) : writer->begin(sampleRate, 1));
+          if (!started) {
+              if (file) {
+                  file.close();
+                  SD.remove(PTT_TEMP_PATH);
+              }
+              sendError(num, "Could not create the file");
+              return;
+          }
+          resetStats();
+          startMs = millis();
+          client = num;
+          recording = true;
+          if (playing) {
+              live->resetStats();
+              player->playLive(live, sampleRate, 1);
+          }
+          Serial.printf("Push-to-talk to '%s', %u Hz %s%s\n", filePath.c_str(), (unsigned)sampleRate, adpcm ? "IMA ADPCM" : "PCM", playing ? ", playing live" : "");
+          String ready = "ready " + String(PTT_WINDOW_FRAMES);
+          socket.sendTXT(num, ready);
+      }
+
+      void onFrame(const uint8_t* data, size_t length) {
+          if (length <= FRAME_HEADER) return;
+          uint16_t seq = wavRead16(data);
+          uint32_t timestamp = wavRead32(data + 4);
+          const uint8_t* samples = data + FRAME_HEADER;
+          uint32_t len = length - FRAME_HEADER;
+          if ((adpcm && len != blockAlign) || (!adpcm && (len & 1))) {
+              sendError(client, "Frame does not match the format");
+              return;
+          }
+          if (frames > 0 && seq != (uint16_t)(lastSeq + 1)) {
+              lostFrames += (uint16_t)(seq - lastSeq - 1);
+          }
+          lastSeq = seq;
+
+          uint32_t start = micros();
+          if (!writer->writeBytes(samples, len)) {
+              sendError(client, "Write failed");
+              finishSession(false);
+              return;
+          }
+          if (playing) {
+              if (adpcm) {
+                  uint32_t count = imaDecodeBlock(samples, blockAlign, 1, decoded);
+                  live->push((const uint8_t*)decoded, count * sizeof(int16_t));
+              } else {
+                  live->push(samples, len);
+              }
+          }
+          uint32_t elapsed = micros() - start;
+          if (elapsed > maxFrameUs) maxFrameUs = elapsed;
+          frames++;
+          bytes += len;
+
+          char ack[32];
+          snprintf(ack, sizeof(ack), "ack %u %u", (unsigned)seq, (unsigned)timestamp);
+          socket.sendTXT(client, ack);
+      }
+
+      void finishSession(bool save) {
+          uint8_t header[WavWriter::HEADER_SIZE];
+          bool saved = save && frames > 0 && writer->finish(header) && file.seek(0) && file.write(header, sizeof(header)) == sizeof(header);
+          file.close();
+          bool replaced = false; // The old sample of the number is gone
+          if (saved) {
+              replaced = !SD.exists(filePath.c_str()) || SD.remove(filePath.c_str());
+              saved = replaced && SD.rename(PTT_TEMP_PATH, filePath.c_str());
+          }
+          if (!saved) {
+              SD.remove(PTT_TEMP_PATH);
+          }
+          if (playing) {
+              live->finish();
+          }
+          recording = false;
+          endMs = millis();
+          Serial.printf("Push-to-talk %s: %u frames, %u bytes, %u KB/s, %u frames lost, longest frame %u us, %u live underruns\n",
+                        saved ? "saved" : "discarded", (unsigned)frames, (unsigned)bytes, (unsigned)getThroughputKBps(),
+                        (unsigned)lostFrames, (unsigned)maxFrameUs, (unsigned)getLiveUnderruns());
+          if (saved) {
+              String message = "saved " + filePath + " " + String(WavWriter::HEADER_SIZE + writer->getDataBytes());
+              socket.sendTXT(client, message);
+          }
+          if (replaced && savedCallback) {
+              savedCallback(filePath); // Also when the rename failed, so the number lets go of the removed file
+          }
+          client = -1;
+      }
+
+      // First use only, the buffers are kept for later sessions
+      bool allocate() {
+          if (!writer) {
+              writer = new WavWriter(MIC_WRITE_BLOCK, [this](const uint8_t* data, size_t len) {
+                  return file.write(data, len) == len;
+              });
+              live = new AudioFileSourceLive(PTT_LIVE_BUFFER, PTT_LIVE_PREBUFFER, PTT_LIVE_MAX_DELAY);
+              decoded = (int16_t*)malloc(imaSamplesPerBlock(PTT_MAX_ADPCM_BLOCK, 1) * sizeof(int16_t));
+          }
+          return writer->isAllocated() && decoded;
+      }
+};
+
+// Phone-to-phone calls over WiFi, the protocol is in CallEngine.h. A network task receives the
+// packets and runs the engine's timers. While a call is connected an audio task owns I2S0.
+// Built with CALL_DUPLEX_I2S it runs I2S0 in full duplex: the built-in ADC and DAC run on one
+// clock, so every 20 ms it sends the frame just captured and plays one from the jitter buffer,
+// which also absorbs the drift to the other phone. Running both built-in converters on one I2S
+// port is not a mode Espressif documents, so by default only the DAC runs, paced by its DMA,
+// and the other phone hears silence. State changes are queued for loop(), where the
+// PhoneController follows them.
+class CallManager {
+  public:
+      CallManager(uint16_t port, WavPlayer* player)
+          : port(port), player(player), engine(CALL_FRAME_SAMPLES, esp_random(), [this](const CallPeer& to, const uint8_t* data, size_t len) {
+                return this->transmit(to, data, len);
+            }),
+            jitter(CALL_FRAME_SAMPLES, CALL_JITTER_SLOTS, MIC_SAMPLE_RATE), events(16), lock(NULL),
+            networkTaskHandle(NULL), audioTaskHandle(NULL), audioRunning(false), audioIdle(true) {
+          resetStats();
+      }
+
+      void begin() {
+          lock = xSemaphoreCreateMutex();
+          udp.begin(port);
+          engine.onAudio([this](uint16_t seq, uint32_t timestamp, const int16_t* samples, uint32_t sentMs) {
+              jitter.push(seq, timestamp, samples, millis(), sentMs);
+          });
+          // Runs with the lock held, loop() picks the change up
+          engine.onStateChanged([this](CallEngine::State oldState, CallEngine::State newState) {
+              events.push((uint8_t)(oldState << 4 | newState));
+          });
+          xTaskCreatePinnedToCore(networkTask, "callNetwork", 4096, this, AUDIO_DECODE_PRIORITY, &networkTaskHandle, 0);
+          xTaskCreatePinnedToCore(audioTask, "callAudio", 6144, this, AUDIO_FEEDER_PRIORITY, &audioTaskHandle, AUDIO_TASK_CORE);
+          Serial.printf("Calls on UDP port %u\n", (unsigned)port);
+      }
+
+      // Own number, shown to the phones this one calls
+      void setNumber(const String& number) {
+          ownNumber = number;
+      }
+
+      // "<number>=<ip>[:<port>]" separated by spaces or commas
+      void setPeers(const String& list) {
+          peers.clear();
+          int pos = 0;
+          while (pos < (int)list.length()) {
+              int end = pos;
+              while (end < (int)list.length() && list[end] != ' ' && list[end] != ',') end++;
+              String entry = list.substring(pos, end);
+              pos = end + 1;
+              int equals = entry.indexOf('=');
+              if (entry.length() == 0) continue;
+              if (equals <= 0) {
+                  Serial.printf("Ignoring call peer '%s', expected <number>=<ip>\n", entry.c_str());
+                  continue;
+              }
+              String host = entry.substring(equals + 1);
+              uint16_t peerPort = port;
+              int colon = host.indexOf(':');
+              if (colon >= 0) {
+                  peerPort = (uint16_t)host.substring(colon + 1).toInt();
+                  host = host.substring(0, colon);
+              }
+              IPAddress address;
+              if (!address.fromString(host) || peerPort == 0) {
+                  Serial.printf("Ignoring call peer '%s', invalid address\n", entry.c_str());
+                  continue;
+              }
+              addPeer(entry.substring(0, equals), address, peerPort);
+          }
+      }
+
+      void addPeer(const String& number, IPAddress address, uint16_t peerPort) {
+          CallPeer peer;
+          peer.address = (uint32_t)address;
+          peer.port = peerPort;
+          peers[number] = peer;
+      }
+
+      // Asked for numbers that are not in call_peers, e.g. phones found on the network
+      void setResolver(std::function<bool(const String&, CallPeer&)> resolver) {
+          this->resolver = resolver;
+      }
+
+      bool isPeerNumber(const String& number) const {
+          CallPeer peer;
+          return findPeer(number, peer);
+      }
+
+      // Adds the numbers from call_peers, the bridge hosted here included
+      void matchNumber(DialMatch& match) const {
+          for (const auto& peer : peers) {
+              match.addNumber(peer.first.c_str());
+          }
+      }
+
+      bool call(const String& number) {
+          CallPeer peer;
+          if (!findPeer(number, peer)) return false;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          bool started = engine.call(peer, ownNumber.c_str(), millis());
+          xSemaphoreGive(lock);
+          return started;
+      }
+
+      bool answer() {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          bool answered = engine.answer(millis());
+          xSemaphoreGive(lock);
+          return answered;
+      }
+
+      void hangup() {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          engine.hangup(millis());
+          xSemaphoreGive(lock);
+      }
+
+      // Turns an incoming call away while the phone is in use
+      void reject() {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          engine.reject(millis());
+          xSemaphoreGive(lock);
+      }
+
+      CallEngine::State getState() const {
+          return engine.getState();
+      }
+
+      String getRemoteNumber() {
+          xSemaphoreTake(lock, portMAX_DELAY);
+          String number = engine.getRemoteNumber();
+          xSemaphoreGive(lock);
+          return number;
+      }
+
+      void onStateChanged(std::function<void(CallEngine::State, CallEngine::State)> callback) {
+          stateCallback = callback;
+      }
+
+      // Delivers the queued state changes
+      void loop() {
+          uint8_t event;
+          while (events.pop(event)) {
+              if (stateCallback) stateCallback((CallEngine::State)(event >> 4), (CallEngine::State)(event & 0x0F));
+          }
+      }
+
+      // I2S0 has to be free, see WavPlayer::releaseOutput()
+      bool startAudio() {
+          if (audioRunning) return true;
+          if (!jitter.isAllocated() || !startDuplex()) {
+              Serial.println("Could not start call audio");
+              return false;
+          }
+#ifndef CALL_DUPLEX_I2S
+          Serial.println("Call audio is one way, build with CALL_DUPLEX_I2S to send the microphone");
+#endif
+          xSemaphoreTake(lock, portMAX_DELAY);
+          jitter.reset();
+          xSemaphoreGive(lock);
+          resetStats();
+          dcLevel = 2048 << 8;
+          audioIdle = false;
+          audioRunning = true;
+          xTaskNotifyGive(audioTaskHandle);
+          return true;
+      }
+
+      void stopAudio() {
+          if (!audioRunning) return;
+          audioRunning = false;
+          while (!audioIdle) {
+              vTaskDelay(1);
+          }
+          stopDuplex();
+          const JitterBuffer::Stats& stats = jitter.getStats();
+          Serial.printf("Call audio: %u frames, %u received, %u lost (%u%%), %u late, %u concealed, %u skipped, "
+                        "jitter %u ms, round trip %u ms, mouth to ear about %u ms, longest frame %u us\n",
+                        (unsigned)frames, (unsigned)stats.received, (unsigned)stats.lost, (unsigned)getLossPercent(),
+                        (unsigned)stats.late, (unsigned)concealed, (unsigned)stats.skipped, (unsigned)jitter.getJitterMs(),
+                        (unsigned)engine.getRttMs(), (unsigned)getMouthToEarMs(), (unsigned)maxFrameUs);
+      }
+
+      bool isAudioRunning() const {
+          return audioRunning;
+      }
+
+      uint32_t getRttMs() const { return engine.getRttMs(); }
+      uint32_t getJitterMs() const { return jitter.getJitterMs(); }
+      uint32_t getBufferMs() const { return jitter.getDelayMs(); }
+      uint32_t getConcealedFrames() const { return concealed; }
+      uint32_t getLateFrames() const { return jitter.getStats().late; }
+      uint32_t getMaxFrameUs() const { return maxFrameUs; }
+
+      uint32_t getLossPercent() const {
+          const JitterBuffer::Stats& stats = jitter.getStats();
+          uint32_t expected = stats.received + stats.lost;
+          return expected ? stats.lost * 100 / expected : 0;
+      }
+
+      // The clocks of two phones are not synchronized, so this adds up the parts: one frame of
+      // capture, half the round trip, the jitter buffer and the DAC's DMA buffers
+      uint32_t getMouthToEarMs() const {
+          return CALL_FRAME_SAMPLES * 1000 / MIC_SAMPLE_RATE + engine.getRttMs() / 2 + jitter.getDelayMs() +
+                 CALL_DMA_BUFFERS * CALL_DMA_FRAMES * 1000 / MIC_SAMPLE_RATE;
+      }
+
+  private:
+      uint16_t port;
+      WavPlayer* player;
+      WiFiUDP udp;
+      CallEngine engine;
+      JitterBuffer jitter;
+      SpscRingBuffer<uint8_t> events; // Old state in the upper, new state in the lower nibble
+      SemaphoreHandle_t lock;         // Engine, jitter buffer and socket
+      TaskHandle_t networkTaskHandle;
+      TaskHandle_t audioTaskHandle;
+      std::atomic<bool> audioRunning;
+      std::atomic<bool> audioIdle;
+      String ownNumber;
+      std::map<String, CallPeer> peers;
+      std::function<bool(const String&, CallPeer&)> resolver;
+      std::function<void(CallEngine::State, CallEngine::State)> stateCallback;
+      int32_t dcLevel;
+      uint32_t frames;
+      uint32_t concealed;
+      uint32_t maxFrameUs;
+
+      void resetStats() {
+          frames = 0;
+          concealed = 0;
+          maxFrameUs = 0;
+      }
+
+      // Configured peers go first
+      bool findPeer(const String& number, CallPeer& peer) const {
+          auto it = peers.find(number);
+          if (it != peers.end()) {
+              peer = it->second;
+              return true;
+          }
+          return resolver && resolver(number, peer);
+      }
+
+      // Called by the engine with the lock held
+      bool transmit(const CallPeer& to, const uint8_t* data, size_t len) {
+          return udp.beginPacket(IPAddress(to.address), to.port) && udp.write(data, len) == len && udp.endPacket();
+      }
+
+      // Without CALL_DUPLEX_I2S only the DAC half
+      bool startDuplex() {
+          i2s_config_t config = {};
+#ifdef CALL_DUPLEX_I2S
+          config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_RX | I2S_MODE_DAC_BUILT_IN | I2S_MODE_ADC_BUILT_IN);
+#else
+          config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_DAC_BUILT_IN);
+#endif
+          config.sample_rate = MIC_SAMPLE_RATE;
+          config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+          config.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT;
+          config.communication_format = I2S_COMM_FORMAT_STAND_MSB;
+          config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1;
+          config.dma_buf_count = CALL_DMA_BUFFERS;
+          config.dma_buf_len = CALL_DMA_FRAMES;
+          config.use_apll = false;
+          config.tx_desc_auto_clear = true; // Silence rather than the old buffer if the task is late
+          if (i2s_driver_install(I2S_NUM_0, &config, 0, NULL) != ESP_OK) return false;
+          i2s_set_dac_mode(I2S_DAC_CHANNEL_BOTH_EN);
+#ifdef CALL_DUPLEX_I2S
+          adc1_config_channel_atten(MIC_ADC_CHANNEL, ADC_ATTEN_DB_11);
+          if (i2s_set_adc_mode(ADC_UNIT_1, MIC_ADC_CHANNEL) != ESP_OK || i2s_adc_enable(I2S_NUM_0) != ESP_OK) {
+              i2s_driver_uninstall(I2S_NUM_0);
+              return false;
+          }
+#endif
+          return true;
+      }
+
+      void stopDuplex() {
+#ifdef CALL_DUPLEX_I2S
+          i2s_adc_disable(I2S_NUM_0);
+#endif
+          i2s_driver_uninstall(I2S_NUM_0);
+      }
+
+      static void networkTask(void* param) {
+          ((CallManager*)param)->receive();
+      }
+
+      static void audioTask(void* param) {
+          ((CallManager*)param)->exchangeAudio();
+      }
+
+      void receive() {
+          uint8_t packet[CallEngine::HEADER_SIZE + CALL_FRAME_SAMPLES * 2];
+          while (true) {
+              xSemaphoreTake(lock, portMAX_DELAY);
+              while (udp.parsePacket() > 0) {
+                  int len = udp.read(packet, sizeof(packet));
+                  CallPeer from;
+                  from.address = (uint32_t)udp.remoteIP();
+                  from.port = udp.remotePort();
+                  if (len > 0) engine.receive(from, packet, len, millis());
+              }
+              engine.poll(millis());
+              xSemaphoreGive(lock);
+              vTaskDelay(pdMS_TO_TICKS(2));
+          }
+      }
+
+      void exchangeAudio() {
+          uint16_t raw[CALL_FRAME_SAMPLES * 2]; // Stereo frames, in and out
+          int16_t mic[CALL_FRAME_SAMPLES];
+          int16_t speaker[CALL_FRAME_SAMPLES];
+          while (true) {
+              if (!audioRunning) {
+                  audioIdle = true;
+                  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                  continue;
+              }
+#ifdef CALL_DUPLEX_I2S
+              // Paced by the ADC, returns once a whole frame is captured
+              size_t bytesRead = 0;
+              i2s_read(I2S_NUM_0, raw, sizeof(raw), &bytesRead, pdMS_TO_TICKS(100));
+              if (bytesRead < sizeof(raw)) continue;
+              uint32_t start = micros();
+              for (uint32_t i = 0; i < CALL_FRAME_SAMPLES; i++) {
+                  // Both samples of a frame come from the microphone channel, the upper 4 bits hold the channel
+                  int32_t value = ((raw[i * 2] & 0x0FFF) + (raw[i * 2 + 1] & 0x0FFF)) << 7;
+                  // One pole high-pass like the mailbox recording
+                  dcLevel += (value - dcLevel) >> 9;
+                  int32_t sample = (value - dcLevel) >> 4;
+                  if (sample > 32767) sample = 32767;
+                  if (sample < -32768) sample = -32768;
+                  mic[i] = (int16_t)sample;
+              }
+#else
+              // Paced by the blocking write to the DAC below, the microphone is not sampled
+              uint32_t start = micros();
+              memset(mic, 0, sizeof(mic));
+#endif
+
+              xSemaphoreTake(lock, portMAX_DELAY);
+              engine.sendAudio(mic, millis());
+              JitterBuffer::Result result = jitter.pop(speaker, NULL);
+              xSemaphoreGive(lock);
+              frames++;
+              if (result == JitterBuffer::CONCEALED) concealed++;
+
+              // The DAC takes the upper 8 bits of an unsigned sample
+              int32_t gain = player->getVolumeGain();
+              for (uint32_t i = 0; i < CALL_FRAME_SAMPLES; i++) {
+                  int32_t sample = (speaker[i] * gain) >> 15;
+                  if (sample > 32767) sample = 32767;
+                  if (sample < -32768) sample = -32768;
+                  raw[i * 2] = raw[i * 2 + 1] = (uint16_t)(sample + 0x8000);
+              }
+              uint32_t elapsed = micros() - start;
+              if (elapsed > maxFrameUs) maxFrameUs = elapsed;
+              size_t written;
+              i2s_write(I2S_NUM_0, raw, sizeof(raw), &written, portMAX_DELAY);
+          }
+      }
+};
 
+// Runs the conference bridge on this phone while conference_number is set. Other phones list
+// <number>=<this phone's ip>:CONFERENCE_PORT in call_peers, this phone reaches it over loopback.
+// One task receives, runs the timers and mixes a frame every 20 ms, timing the mixing per
+// participant. The bridge is allocated by the first call to it, with as many participants as
+// the heap allows, and freed again once nobody has been on it for CONFERENCE_IDLE_FREE_MS.
+class ConferenceHost {
   public:
-    DialController(int pulsePin, int rotationPin, int phoneHandlePin, unsigned long debounceDelay = 100, unsigned long dialTimeout = 3000)
-      : rotaryDial(pulsePin, rotationPin), phoneHandlePin(phoneHandlePin), debounceDelay(debounceDelay), dialTimeout(dialTimeout) {
-        this->lastHandleChangeTime = 0;
-        pinMode(phoneHandlePin, INPUT_PULLUP);
-        // Initialize state to the actual initial state of the pin
-        this->lastHandleState = digitalRead(phoneHandlePin);
-        this->handlePickedUp = false;
-        this->lastDigitTime = 0;
-    }
+      ConferenceHost(uint16_t port) : port(port), bridge(NULL), taskHandle(NULL), running(false), participants(0), capacity(0) {
+          busyUs = 0;
+          participantFrames = 0;
+          ticks = 0;
+          maxTickUs = 0;
+      }
 
-    void setPhoneHandleCallback(std::function<void(bool)> callback) {
-        phoneHandleCallback = callback;
-    }
+      bool start() {
+          if (running) return true;
+          if (!taskHandle) {
+              udp.begin(port);
+              Serial.printf("Conference bridge on UDP port %u, allocated on the first call\n", (unsigned)port);
+              xTaskCreatePinnedToCore(hostTask, "conference", 6144, this, AUDIO_DECODE_PRIORITY, &taskHandle, 0);
+          }
+          running = true;
+          return true;
+      }
 
-    void setDigitCallback(std::function<void(int)> callback) {
-        digitCallback = callback;
-    }
+      // Hangs up on everyone, the bridge is freed once idle
+      void stop() {
+          running = false;
+      }
 
-    void setDialledCallback(std::function<void(String)> callback) {
-        dialledCallback = callback;
-    }
+      bool isRunning() const {
+          return running;
+      }
 
-    bool isHandlePickedUp() const {
-        return handlePickedUp;
-    }
+      uint16_t getParticipantCount() const {
+          return participants;
+      }
 
-    void update() {
-        // Check for handle state change with debounce
-        bool currentHandleState = digitalRead(phoneHandlePin);
-        if (currentHandleState != lastHandleState && (millis() - lastHandleChangeTime) > debounceDelay) {
-            lastHandleChangeTime = millis();
-            lastHandleState = currentHandleState;
+      // Participants the allocated bridge has room for, 0 while it is freed
+      uint16_t getCapacity() const {
+          return capacity;
+      }
 
-            if (currentHandleState == LOW) {
-                // Handle picked up
-                handlePickedUp = true;
-                numberBuffer = ""; // Reset the buffer
-            } else {
-                // Handle placed down
-                handlePickedUp = false;
-                numberBuffer = ""; // Reset the buffer
-            }
+      // Mixing time per participant and frame, packet sending included
+      uint32_t getUsPerParticipant() const {
+          return participantFrames ? (uint32_t)(busyUs / participantFrames) : 0;
+      }
 
-            if (phoneHandleCallback) {
-                phoneHandleCallback(handlePickedUp);
-            }
-        }
+      // Share of one core spent mixing while anyone was connected
+      float getLoadPercent() const {
+          return ticks ? (float)busyUs * 100 / ticks / FRAME_US : 0;
+      }
 
-        if (handlePickedUp) {
-            // Update the rotary dial
-            rotaryDial.update();
-            int digit = rotaryDial.getNumber();
-            if (digit != -1) {
-                if (digitCallback) {
-                    digitCallback(digit);
-                }
+      uint32_t getMaxTickUs() const {
+          return maxTickUs;
+      }
 
-                // Append the digit to the number buffer
-                numberBuffer += String(digit);
-                lastDigitTime = millis();
-            }
+  private:
+      static const uint32_t FRAME_US = (uint64_t)CALL_FRAME_SAMPLES * 1000000 / MIC_SAMPLE_RATE;
+      static const uint16_t MIN_PARTICIPANTS = 2; // This phone and one other
+      static const uint32_t HEAP_RESERVE = 32768;
+
+      uint16_t port;
+      WiFiUDP udp;
+      ConferenceBridge* bridge; // Only the task touches it
+      TaskHandle_t taskHandle;
+      std::atomic<bool> running;
+      std::atomic<uint16_t> participants;
+      std::atomic<uint16_t> capacity;
+      uint32_t lastBusyMs;
+      uint64_t busyUs;
+      uint64_t participantFrames;
+      uint32_t ticks;
+      uint32_t maxTickUs;
+
+      static void hostTask(void* param) {
+          ((ConferenceHost*)param)->run();
+      }
 
-            // Check if number is dialled based on timeout or max digits
-            if ((numberBuffer.length() >= 2 && (millis() - lastDigitTime) > dialTimeout) || numberBuffer.length() >= 16) {
-                if (dialledCallback) {
-                    dialledCallback(numberBuffer);
-                    Serial.println(numberBuffer);
-                }
+      // As many participants as fit next to HEAP_RESERVE, up to CONFERENCE_MAX_PARTICIPANTS
+      bool allocate() {
+          uint32_t available = ESP.getMaxAllocHeap();
+          uint16_t fitting = CONFERENCE_MAX_PARTICIPANTS;
+          while (fitting >= MIN_PARTICIPANTS &&
+                 ConferenceBridge::bytesFor(fitting, CALL_FRAME_SAMPLES, CONFERENCE_JITTER_SLOTS) + HEAP_RESERVE > available) {
+              fitting--;
+          }
+          if (fitting < MIN_PARTICIPANTS) {
+              Serial.println("Not enough memory for the conference bridge");
+              return false;
+          }
+          uint32_t freeBefore = ESP.getFreeHeap();
+          bridge = new ConferenceBridge(fitting, CALL_FRAME_SAMPLES, MIC_SAMPLE_RATE, CONFERENCE_JITTER_SLOTS,
+                                        esp_random(), [this](const CallPeer& to, const uint8_t* data, size_t len) {
+              return udp.beginPacket(IPAddress(to.address), to.port) && udp.write(data, len) == len && udp.endPacket();
+          });
+          if (!bridge->isAllocated()) {
+              Serial.println("Not enough memory for the conference bridge");
+              delete bridge;
+              bridge = NULL;
+              return false;
+          }
+          bridge->onMember([this](uint16_t participant, bool joined) {
+              Serial.printf("Conference: %s %s, %u on the bridge\n", IPAddress(bridge->getEngine(participant).getPeer().address).toString().c_str(),
+                            joined ? "joined" : "left", (unsigned)bridge->getParticipantCount());
+          });
+          capacity = fitting;
+          lastBusyMs = millis();
+          Serial.printf("Conference bridge for %u participants, %u bytes\n", (unsigned)fitting, (unsigned)(freeBefore - ESP.getFreeHeap()));
+          return true;
+      }
 
-                numberBuffer = ""; // Reset after dialled
-            }
-        }
-    }
+      void release() {
+          delete bridge;
+          bridge = NULL;
+          capacity = 0;
+          participants = 0;
+          Serial.println("Conference bridge idle, freed");
+      }
+
+      void run() {
+          uint8_t packet[CallEngine::HEADER_SIZE + CALL_FRAME_SAMPLES * 2];
+          uint32_t nextTickUs = micros();
+          while (true) {
+              if (!running) {
+                  if (bridge) {
+                      bridge->hangupAll(millis());
+                      participants = 0;
+                  }
+                  // Drop what arrives while switched off
+                  while (udp.parsePacket() > 0) udp.read(packet, sizeof(packet));
+                  if (bridge && millis() - lastBusyMs > CONFERENCE_IDLE_FREE_MS) release();
+                  vTaskDelay(pdMS_TO_TICKS(100));
+                  nextTickUs = micros();
+                  continue;
+              }
+              while (udp.parsePacket() > 0) {
+                  int len = udp.read(packet, sizeof(packet));
+                  if (len <= 0) continue;
+                  // Stray packets of finished calls do not bring the bridge back
+                  if (!bridge && (!ConferenceBridge::isInvite(packet, len) || !allocate())) continue;
+                  CallPeer from;
+                  from.address = (uint32_t)udp.remoteIP();
+                  from.port = udp.remotePort();
+                  bridge->receive(from, packet, len, millis());
+              }
+              if (!bridge) {
+                  vTaskDelay(pdMS_TO_TICKS(10));
+                  nextTickUs = micros();
+                  continue;
+              }
+              bridge->poll(millis());
+              if ((int32_t)(micros() - nextTickUs) >= 0) {
+                  uint32_t start = micros();
+                  uint16_t mixed = bridge->tick(millis());
+                  uint32_t elapsed = micros() - start;
+                  if (mixed > 0) {
+                      busyUs += elapsed;
+                      participantFrames += mixed;
+                      ticks++;
+                      if (elapsed > maxTickUs) maxTickUs = elapsed;
+                  }
+                  nextTickUs += FRAME_US;
+                  // After a long stall start over instead of mixing a burst of frames
+                  if ((int32_t)(micros() - nextTickUs) > (int32_t)(FRAME_US * 5)) nextTickUs = micros();
+              }
+              participants = bridge->getParticipantCount();
+              if (participants > 0) {
+                  lastBusyMs = millis();
+              } else if (millis() - lastBusyMs > CONFERENCE_IDLE_FREE_MS) {
+                  release();
+              }
+              vTaskDelay(1);
+          }
+      }
 };
 
-class WavPlayer {
+// Rings the phones of a venue together over UDP multicast, see RingBroadcast.h. Listening starts
+// once the phone is on the network and the group is joined again whenever it gets an address
+// after a reconnect, commands are handed to the callback from loop().
+class RingChannel {
   public:
-      WavPlayer() : source(NULL), output(NULL), decoder(NULL), loopEnabled(false) {}
+      RingChannel(IPAddress group, uint16_t port) : group(group), port(port), broadcast(NULL), rejoin(false) {
+      }
 
       void begin() {
-          source = new AudioFileSourceSD();
-          output = new AudioOutputI2S(0, 1);
-          decoder = new AudioGeneratorWAV();
+          // Runs in the WiFi event task, loop() does the joining
+          WiFi.onEvent([this](WiFiEvent_t, WiFiEventInfo_t) { rejoin = true; }, ARDUINO_EVENT_WIFI_STA_GOT_IP);
       }
 
-      void playAudio(const String &filePath, bool loop = false) {
-          loopEnabled = loop;  // Set whether to loop the audio
-          currentFilePath = filePath;
-          if (decoder->isRunning()) {
-              decoder->stop();
-          }
+      void onCommand(RingBroadcast::CommandCallback callback) {
+          commandCallback = callback;
+      }
 
-          source->close();
-          if (source->open(filePath.c_str())) {
-              Serial.printf("Playing '%s' from SD card...\n", filePath.c_str());
-              decoder->begin(source, output);
-          } else {
-              Serial.printf("Error opening '%s'\n", filePath.c_str());
+      void loop() {
+          if (broadcast && rejoin) {
+              // The membership went with the old connection
+              rejoin = false;
+              udp.stop();
+              WiFi.setSleep(false);
+              udp.beginMulticast(group, port);
+              Serial.printf("Ring broadcast joined %s again\n", group.toString().c_str());
+          }
+          if (!broadcast) {
+              // The group is joined on the interfaces that are up, so wait for the network
+              if (WiFi.status() != WL_CONNECTED) return;
+              // Without modem sleep the access point delivers multicast at once instead of
+              // holding it for the next DTIM beacon, which would add up to a few hundred ms
+              WiFi.setSleep(false);
+              udp.beginMulticast(group, port);
+              rejoin = false;
+              // The radio is on now, so esp_random() gives every boot its own sender id
+              broadcast = new RingBroadcast(esp_random(), [this](const uint8_t* data, size_t len) {
+                  return udp.beginMulticastPacket() && udp.write(data, len) == len && udp.endPacket();
+              });
+              broadcast->onCommand([this](RingBroadcast::Command command, const char* number) {
+                  if (commandCallback) commandCallback(command, number);
+              });
+              Serial.printf("Ring broadcast on %s:%u\n", group.toString().c_str(), (unsigned)port);
           }
+          uint8_t packet[RingBroadcast::MAX_PACKET];
+          while (udp.parsePacket() > 0) {
+              int len = udp.read(packet, sizeof(packet));
+              if (len > 0) broadcast->receive(packet, len);
+          }
+          broadcast->poll(millis());
       }
 
-      void stop() {
-          loopEnabled = false;  // Disable looping
-          if (decoder && decoder->isRunning()) {
-              decoder->stop();
-              Serial.println("Playback stopped.");
-          }
+      bool ring(const String& number) {
+          return broadcast && broadcast->ring(number.c_str(), millis());
       }
 
-      void setVolume(float volume) {
-          if (output) {
-              output->SetGain(volume / 100); // Set volume (0.0 = mute, 1.0 = max)
-              Serial.printf("Volume set to %.2f\n", volume);
-          }
+      bool stop() {
+          return broadcast && broadcast->stop(millis());
       }
 
-    void loop() {
-        if (decoder && decoder->isRunning()) {
-            if (!decoder->loop()) {
-                decoder->stop();
-                if (loopEnabled) {
-                    // Close and reopen the source file
-                    source->close();
-                    if (source->open(currentFilePath.c_str())) {
-                        // Restart playback if looping is enabled
-                        decoder->begin(source, output);
-                    } else {
-                        Serial.printf("Error reopening '%s'\n", currentFilePath.c_str());
-                    }
-                }
-            }
-        }
-    }
+      bool isListening() const { return broadcast != NULL; }
+      uint32_t getHandled() const { return broadcast ? broadcast->getHandled() : 0; }
+      uint32_t getRecovered() const { return broadcast ? broadcast->getRecovered() : 0; }
+      uint32_t getDuplicates() const { return broadcast ? broadcast->getDuplicates() : 0; }
+      uint32_t getSentPackets() const { return broadcast ? broadcast->getSentPackets() : 0; }
+
+  private:
+      IPAddress group;
+      uint16_t port;
+      WiFiUDP udp;
+      RingBroadcast* broadcast;
+      RingBroadcast::CommandCallback commandCallback;
+      std::atomic<bool> rejoin; // Set when the station got an address
+};
 
+// Announces this phone as _highphone._udp over mDNS and keeps the phones it finds in a
+// PeerTable, see PeerTable.h for the TXT keys. ESPmDNS queries block until the answers are in,
+// so a task on core 0 runs them when the table asks for one; resolve() only reads the table.
+// The Arduino mDNS API does not hand out record TTLs, every answer holds DISCOVERY_TTL_MS.
+class PeerDiscovery {
+  public:
+      PeerDiscovery(uint16_t callPort)
+          : callPort(callPort), table(DISCOVERY_MAX_PEERS, DISCOVERY_REFRESH_MS), lock(NULL), taskHandle(NULL), started(false), capabilities(0) {
+      }
 
+      // Numbers, "<number>:<port>" of a hosted conference bridge and PeerTable::Capability bits
+      void setAnnouncement(const String& numbers, const String& conference, uint8_t capabilities) {
+          this->numbers = numbers;
+          this->conference = conference;
+          this->capabilities = capabilities;
+          if (started) updateTxt();
+      }
 
-      bool isPlaying() {
-          return decoder && decoder->isRunning();
+      // Starts mDNS once the phone is on the network
+      void loop() {
+          if (started || WiFi.status() != WL_CONNECTED) return;
+          started = true;
+          String mac = WiFi.macAddress();
+          mac.replace(":", "");
+          hostname = "highphone-" + mac.substring(6);
+          hostname.toLowerCase();
+          if (!MDNS.begin(hostname.c_str())) {
+              Serial.println("mDNS did not start, phones are only found through call_peers");
+              return;
+          }
+          MDNS.addService("highphone", "udp", callPort);
+          updateTxt();
+          lock = xSemaphoreCreateMutex();
+          xTaskCreatePinnedToCore(discoveryTask, "discovery", 4096, this, 1, &taskHandle, 0);
+          Serial.printf("Announcing %s.local as _highphone._udp\n", hostname.c_str());
+      }
+
+      bool resolve(const String& number, CallPeer& peer) {
+          if (!lock) return false;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          bool found = table.resolve(number.c_str(), millis(), peer);
+          xSemaphoreGive(lock);
+          // The task asks the network early if the table allows it
+          if (!found) xTaskNotifyGive(taskHandle);
+          return found;
+      }
+
+      // Adds the numbers and ranges the phones found so far answer, without asking the network
+      void matchNumber(DialMatch& match) {
+          if (!lock) return;
+          bool accepts = false;
+          bool extendable = false;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          table.matchPrefix(match.getDigits(), millis(), accepts, extendable);
+          xSemaphoreGive(lock);
+          match.add(accepts, extendable);
+      }
+
+      uint8_t getPeerCount() {
+          if (!lock) return 0;
+          xSemaphoreTake(lock, portMAX_DELAY);
+          uint8_t count = table.getCount();
+          xSemaphoreGive(lock);
+          return count;
       }
 
+      uint32_t getLookups() const { return table.getLookups(); }
+      uint32_t getMisses() const { return table.getMisses(); }
+      uint32_t getQueries() const { return table.getQueries(); }
+
   private:
-      AudioFileSourceSD *source;
-      AudioOutputI2S *output;
-      AudioGeneratorWAV *decoder;
-      bool loopEnabled;  // Track if looping is enabled
-        String currentFilePath; // Store the current file path
+      uint16_t callPort;
+      PeerTable table;
+      SemaphoreHandle_t lock; // The table
+      TaskHandle_t taskHandle;
+      bool started;
+      String hostname;
+      String numbers;
+      String conference;
+      uint8_t capabilities;
+
+      void updateTxt() {
+          char caps[40];
+          PeerTable::formatCapabilities(capabilities, caps, sizeof(caps));
+          MDNS.addServiceTxt("highphone", "udp", "num", numbers);
+          MDNS.addServiceTxt("highphone", "udp", "conf", conference);
+          MDNS.addServiceTxt("highphone", "udp", "caps", String(caps));
+      }
+
+      static void discoveryTask(void* param) {
+          ((PeerDiscovery*)param)->run();
+      }
+
+      void run() {
+          while (true) {
+              ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+              xSemaphoreTake(lock, portMAX_DELAY);
+              bool due = table.needsQuery(millis());
+              if (due) table.markQueried(millis());
+              xSemaphoreGive(lock);
+              if (!due) continue;
+
+              // Lookups keep using the table while this waits for answers
+              int found = MDNS.queryService("highphone", "udp");
+              uint32_t now = millis();
+              xSemaphoreTake(lock, portMAX_DELAY);
+              for (int i = 0; i < found; i++) {
+                  String name = MDNS.hostname(i);
+                  if (name == hostname) continue;
+                  CallPeer peer;
+                  peer.address = (uint32_t)MDNS.IP(i);
+                  peer.port = MDNS.port(i);
+                  table.update(name.c_str(), peer, MDNS.txt(i, "num").c_str(), MDNS.txt(i, "conf").c_str(), MDNS.txt(i, "caps").c_str(),
+                               DISCOVERY_TTL_MS, now);
+              }
+              table.expire(now);
+              xSemaphoreGive(lock);
+          }
+      }
 };
 
 enum PhoneState {
@@ -1082,7 +4424,9 @@ enum PhoneState {
     Dialing,
     Calling,
     InvalidNumber,
-    Ringing 
+    Ringing,
+    Recording,
+    Connected   // Talking to another phone
 };
 
 class FrontLED {
@@ -1185,17 +4529,32 @@ class PhoneController {
     PhoneState lastState;
     String lastNumber = "";
     String incomingNumber = "";
+    String mailboxNumber = "";
+    bool remoteCall = false; // The call goes to or comes from another phone
     unsigned long ringStartTime;
     unsigned long ringDuration;
     unsigned long ringVariation;
     unsigned long actualRingDuration;
 
     std::function<void(PhoneState, PhoneState)> stateChangeCallback;
+    std::function<void(int)> digitCallback;
+    std::function<bool(const String&)> peerCheck;
+    std::function<void(DialMatch&)> peerMatch;
+    int32_t dialPlanState; // Where the digits dialled so far led in the dial plan
 
     void transitionToState(PhoneState newState) {
         if (currentState != newState) {
             lastState = currentState;
             currentState = newState;
+            if (currentState == Idle || currentState == Dialing) {
+                remoteCall = false;
+            }
+            if (currentState == Dialing) {
+                dialPlanState = sdReader->startDialPlan();
+            }
+            if (currentState == Calling) {
+                LATENCY_MARK(Calling);
+            }
 
             if (currentState == Ringing) {
                 // Start the ringing timer
@@ -1227,7 +4586,7 @@ class PhoneController {
                 transitionToState(Calling);
             }
         } else {
-            if (currentState == Calling || currentState == InvalidNumber || currentState == Ringing) {
+            if (currentState == Calling || currentState == InvalidNumber || currentState == Ringing || currentState == Connected) {
                 // Stop the WAV file if still playing
                 wavPlayer->stop();
             }
@@ -1239,13 +4598,27 @@ class PhoneController {
         if (currentState == Dialing) {
             // Proceed with digit processing only if the current state is Dialing
             transitionToState(Dialing);
+            dialPlanState = sdReader->stepDialPlan(dialPlanState, digit);
+            if (digitCallback) {
+                digitCallback(digit);
+            }
+        } else if (currentState == Calling && digitCallback) {
+            // Menu choices of an IVR call
+            digitCallback(digit);
         }
     }
 
     void onNumberDialled(String number) {
         if (currentState == Dialing) {
+            LATENCY_MARK(Dialled);
             lastNumber = number;
-            if (isValidNumber(number)) {
+            // Numbers of this phone come first, another phone cannot take them over
+            if (mailboxNumber.length() > 0 && number == mailboxNumber) {
+                transitionToState(Recording);
+            } else if (isValidNumber(number)) {
+                transitionToState(Calling);
+            } else if (peerCheck && peerCheck(number)) {
+                remoteCall = true;
                 transitionToState(Calling);
             } else {
                 transitionToState(InvalidNumber);
@@ -1259,12 +4632,14 @@ class PhoneController {
         currentState = Idle;
         lastState = Idle;
         stateChangeCallback = nullptr;
+        dialPlanState = DialPlan::DEAD;
 
         // Set the callbacks using lambdas that capture 'this'
         // Ensure these do not access sdReader or wavPlayer in a way that requires SD card access
         dialController.setPhoneHandleCallback([this](bool pickedUp) { this->onPhoneHandleChange(pickedUp); });
         dialController.setDigitCallback([this](int digit) { this->onDigitDialled(digit); });
         dialController.setDialledCallback([this](String number) { this->onNumberDialled(number); });
+        dialController.setCompletionCheck([this](const String& digits) { return this->isCompleteNumber(digits); });
     }
 
 
@@ -1272,6 +4647,10 @@ class PhoneController {
         stateChangeCallback = callback;
     }
 
+    void setDigitCallback(std::function<void(int)> callback) {
+        digitCallback = callback;
+    }
+
     void startCall(String number) {
         if (currentState == Idle && !dialController.isHandlePickedUp()) {
             // Incoming call can only start when the phone is idle and handle is down
@@ -1281,20 +4660,73 @@ class PhoneController {
         }
     }
 
+    // Call from another phone, it rings until answered or the caller gives up
+    bool ringRemote(String number) {
+        if (currentState != Idle || dialController.isHandlePickedUp()) return false;
+        remoteCall = true;
+        startCall(number);
+        return true;
+    }
+
+    // The other phone answered, or this one answered it
+    void connect() {
+        if (currentState == Calling && remoteCall) {
+            transitionToState(Connected);
+        }
+    }
+
+    // The other phone hung up, was busy or unreachable
+    void remoteEnded() {
+        if (!remoteCall) return;
+        if (currentState == Ringing) {
+            transitionToState(Idle);
+        } else if (currentState == Calling || currentState == Connected) {
+            transitionToState(InvalidNumber);
+        }
+    }
+
+    bool isRemoteCall() const {
+        return remoteCall;
+    }
+
+    // Numbers that belong to other phones rather than files
+    void setPeerCheck(std::function<bool(const String&)> check) {
+        peerCheck = check;
+    }
+
+    // Adds the other phones' numbers to the completion check, must not ask the network
+    void setPeerMatch(std::function<void(DialMatch&)> match) {
+        peerMatch = match;
+    }
+
     void stopCall(){
         wavPlayer->stop();
         transitionToState(Idle);
     }
 
+    // True once no further digit can change where the call goes. Every number the phone
+    // answers counts, so a file cannot cut off a longer number that goes elsewhere.
+    bool isCompleteNumber(const String& digits) const {
+        DialMatch match(digits.c_str());
+        sdReader->matchNumber(match, dialPlanState);
+        match.addNumber(mailboxNumber.c_str());
+        if (peerMatch) peerMatch(match);
+        return match.isComplete();
+    }
+
     bool isValidNumber(const String& number) {
         SDReader::NumberInfo info;
-        return sdReader->getNumberInfo(number, info);
+        return sdReader->getNumberInfo(number, info) || sdReader->matchDialPlan(number) != DialPlan::NO_RULE;
     }
 
     String getCurrentNumber() const {
         return lastNumber;
     }
 
+    String getDialledDigits() const {
+        return dialController.getNumberBuffer();
+    }
+
     void setRingDuration(unsigned long duration) {
         ringDuration = duration;
     }
@@ -1303,6 +4735,11 @@ class PhoneController {
         ringVariation = variation;
     }
 
+    // Dialling this number records a message, empty disables the mailbox
+    void setMailboxNumber(const String& number) {
+        mailboxNumber = number;
+    }
+
     PhoneState getCurrentState(){
         return currentState;
     }
@@ -1315,22 +4752,17 @@ class PhoneController {
         dialController.update();
 
         // Check if the call is in the 'Calling' state and the WAV file has finished
-        if (currentState == Calling && !wavPlayer->isPlaying()) {
+        if (currentState == Calling && !remoteCall && !wavPlayer->isPlaying()) {
             transitionToState(Idle);  // Automatically transition to Idle after playback
         }
 
-        // Check for Ringing state timeout
-        if (currentState == Ringing) {
+        // Check for Ringing state timeout, another phone rings until its caller gives up
+        if (currentState == Ringing && !remoteCall) {
             unsigned long elapsedTime = millis() - ringStartTime;
             if (elapsedTime >= actualRingDuration) {
                 transitionToState(Idle); // Transition back to Idle after ringing duration
             }
         }
-
-        // Also check if the InvalidNumber state is ongoing, and loop the audio if necessary
-        if (currentState == InvalidNumber) {
-            wavPlayer->loop();  // Ensure the message keeps playing
-        }
     }
 
 };
@@ -1427,12 +4859,38 @@ SDReader sdReader;  // assuming CS pin is 10
 WebConfig webConfig("CJ_HP", "High1234", &sdReader);
 
 WavPlayer wavPlayer;
+MicRecorder micRecorder;
+PushToTalkServer pushToTalk(PTT_PORT, &wavPlayer);
+CallManager callManager(CALL_PORT, &wavPlayer);
+ConferenceHost conferenceHost(CONFERENCE_PORT);
+RingChannel ringChannel(IPAddress(RING_GROUP), RING_PORT);
+PeerDiscovery peerDiscovery(CALL_PORT);
+PromptCache promptCache;
+DialPrefetcher dialPrefetcher(&sdReader);
 PhoneController phoneController(22, 21, 15, &sdReader, &wavPlayer); // Passing wavPlayer to PhoneController
 
 // Initialize FrontLED on pin 13
 FrontLED frontLED(13);
 ButtonHandler buttonHandler;
 
+// File names can hold quotes and angle brackets, so they only go into the page escaped
+String escapeHtml(const String& text) {
+    String escaped;
+    escaped.reserve(text.length());
+    for (size_t i = 0; i < text.length(); i++) {
+        char c = text[i];
+        switch (c) {
+            case '&': escaped += "&amp;"; break;
+            case '<': escaped += "&lt;"; break;
+            case '>': escaped += "&gt;"; break;
+            case '"': escaped += "&quot;"; break;
+            case '\'': escaped += "&#39;"; break;
+            default: escaped += c; break;
+        }
+    }
+    return escaped;
+}
+
 String generateCustomHtml() {
     String html = "<div class='custom-html'>";
 
@@ -1620,10 +5078,16 @@ String generateCustomHtml() {
     html += "<h2>Numbers</h2>";
     html += "<ul>";
 
-    const std::map<String, SDReader::NumberInfo>& mappings = sdReader.getNumberMappings();
-    for (const auto& pair : mappings) {
-        String number = pair.first;
-        String description = pair.second.description;
+    const NumberTable& numbers = sdReader.getNumbers();
+    for (size_t i = 0; i < numbers.size(); i++) {
+        const NumberTable::Record& record = numbers.at(i);
+        String number = escapeHtml(numbers.getNumber(record));
+        String description = escapeHtml(numbers.getDescription(record));
+        // The scripts read the texts from data- attributes, the browser unescapes them there
+        String data = "data-number='" + number + "' data-description='" + description + "'";
+        uint32_t seconds = (record.format.durationMs() + 500) / 1000;
+        char duration[12];
+        snprintf(duration, sizeof(duration), "%u:%02u", (unsigned)(seconds / 60), (unsigned)(seconds % 60));
 
         html += "<li>";
 
@@ -1634,17 +5098,24 @@ String generateCustomHtml() {
 
         // Buttons Container
         html += "<div class='buttons'>";
-        html += "<span class='description'>" + description + "</span>";
+        html += "<span class='description'>" + description + " (" + String(duration) + ")</span>";
 
         // Call Button with SVG Icon
-        html += "<button class='icon-button call' onclick=\"window.location.href='/button?name=" + number + "'\" aria-label='Call " + number + "'>";
+        html += "<button class='icon-button call' " + data + " onclick=\"window.location.href='/button?name=' + encodeURIComponent(this.dataset.number)\" aria-label='Call " + number + "'>";
         html += "<svg xmlns='http://www.w3.org/2000/svg' viewBox='0 0 24 24' fill='currentColor' stroke='none'>";
         html += "<path d='M6.62 10.79a15.053 15.053 0 006.59 6.59l2.2-2.2a1 1 0 011.11-.21 11.72 11.72 0 003.68.59 1 1 0 011 1v3.5a1 1 0 01-1 1A16 16 0 012 5a1 1 0 011-1h3.5a1 1 0 011 1 11.72 11.72 0 00.59 3.68 1 1 0 01-.21 1.11l-2.2 2.2z'/>";
         html += "</svg>";
         html += "</button>";
 
+        // Rename Button with SVG Icon
+        html += "<button class='icon-button rename' " + data + " onclick=\"promptRename(this.dataset.number, this.dataset.description)\" aria-label='Rename " + number + "'>";
+        html += "<svg xmlns='http://www.w3.org/2000/svg' viewBox='0 0 24 24' fill='currentColor' stroke='none'>";
+        html += "<path d='M3 17.25V21h3.75L17.81 9.94l-3.75-3.75L3 17.25zM20.71 7.04a1 1 0 000-1.41l-2.34-2.34a1 1 0 00-1.41 0l-1.83 1.83 3.75 3.75 1.83-1.83z'/>";
+        html += "</svg>";
+        html += "</button>";
+
         // Delete Button with SVG Icon
-        html += "<button class='icon-button delete' onclick=\"confirmDelete('" + number + "')\" aria-label='Delete " + number + "'>";
+        html += "<button class='icon-button delete' " + data + " onclick=\"confirmDelete(this.dataset.number)\" aria-label='Delete " + number + "'>";
         html += "<svg xmlns='http://www.w3.org/2000/svg' viewBox='0 0 24 24' fill='currentColor' stroke='none'>";
         html += "<path d='M3 6h18v2H3V6zm2 3h14v13a2 2 0 01-2 2H7a2 2 0 01-2-2V9zm5 3v7h2v-7H10zm4 0v7h2v-7h-2z'/>";
         html += "</svg>";
@@ -1659,21 +5130,137 @@ String generateCustomHtml() {
     html += "<script>"
             "function confirmDelete(number) {"
             "  if (confirm('Are you sure you want to delete ' + number + '?')) {"
-            "    window.location.href = '/delete?number=' + number;"
+            "    window.location.href = '/delete?number=' + encodeURIComponent(number);"
+            "  }"
+            "}"
+            "function promptRename(number, description) {"
+            "  var to = prompt('New number_description for ' + number + ':', number + '_' + description);"
+            "  if (to && to.indexOf('_') > 0) {"
+            "    window.location.href = '/rename?number=' + encodeURIComponent(number) + '&to=' + encodeURIComponent(to);"
             "  }"
             "}"
             "</script>";
+    // Changes made on a PC are only picked up by a rescan
+    html += "<button onclick=\"window.location.href='/rescan'\">Rescan SD card</button>";
+
+    // Audio pipeline health, underruns should stay at 0 even during uploads
+    html += "<h2>Audio</h2>";
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Buffer " + String(wavPlayer.getBufferFillPercent()) + "% (min " + String(wavPlayer.getMinBufferFillPercent()) + "%), underruns: " + String(wavPlayer.getUnderrunCount()) + "</p>";
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Mixing cycles/sample:";
+    for (int voices = 1; voices <= MIX_VOICES; voices++) {
+        html += " " + String(voices) + "v=" + String(wavPlayer.getMixCyclesPerSample(voices));
+    }
+    html += "</p>";
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Output " + String(AUDIO_OUTPUT_RATE) + " Hz, resampling cycles/frame: " + String(wavPlayer.getResampleCyclesPerFrame()) + "</p>";
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Mailbox: last message " + String(micRecorder.getRecordedMs() / 1000) + " s, " +
+            String(micRecorder.getDroppedSamples()) + " samples dropped, SD " + String(micRecorder.getThroughputKBps()) + " KB/s (longest write " +
+            String(micRecorder.getMaxWriteUs() / 1000) + " ms), ring peak " + String(micRecorder.getPeakFillPercent()) + "%</p>";
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Call: " + String(CallEngine::getStateName(callManager.getState())) +
+            ", round trip " + String(callManager.getRttMs()) + " ms, jitter " + String(callManager.getJitterMs()) + " ms, buffer " +
+            String(callManager.getBufferMs()) + " ms, mouth to ear about " + String(callManager.getMouthToEarMs()) + " ms, " +
+            String(callManager.getLossPercent()) + "% lost, " + String(callManager.getLateFrames()) + " late, " +
+            String(callManager.getConcealedFrames()) + " concealed, longest frame " + String(callManager.getMaxFrameUs()) + " us</p>";
+    if (conferenceHost.isRunning() && conferenceHost.getCapacity() == 0) {
+        html += "<p style='text-align: center; font-size: 1.5rem;'>Conference: idle, allocated on the first call</p>";
+    } else if (conferenceHost.isRunning()) {
+        html += "<p style='text-align: center; font-size: 1.5rem;'>Conference: " + String(conferenceHost.getParticipantCount()) + " of " +
+                String(conferenceHost.getCapacity()) + " participants, " + String(conferenceHost.getUsPerParticipant()) +
+                " us per participant and frame, load " + String(conferenceHost.getLoadPercent(), 1) + "% (longest frame " +
+                String(conferenceHost.getMaxTickUs()) + " us)</p>";
+    }
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Discovery: " + String(peerDiscovery.getPeerCount()) + " phones found, " +
+            String(peerDiscovery.getLookups()) + " lookups, " + String(peerDiscovery.getMisses()) + " misses, " +
+            String(peerDiscovery.getQueries()) + " queries</p>";
+    if (ringChannel.isListening()) {
+        html += "<p style='text-align: center; font-size: 1.5rem;'>Ring broadcast: " + String(ringChannel.getHandled()) + " received (" +
+                String(ringChannel.getRecovered()) + " through a repeat), " + String(ringChannel.getDuplicates()) + " duplicates, " +
+                String(ringChannel.getSentPackets()) + " packets sent</p>";
+    }
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Number table: " + String((unsigned)numbers.size()) + " numbers in " +
+            String((unsigned)numbers.getHeapBytes()) + " bytes (" + String((unsigned)numbers.getGarbageBytes()) + " unused)</p>";
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Dial prefetch: " + String(dialPrefetcher.getHits()) + " hits, " + String(dialPrefetcher.getMisses()) + " misses</p>";
+    // Load of one voice per decoder, the sum over all playing voices has to stay well below 100%
+    html += "<p style='text-align: center; font-size: 1.5rem;'>Decoding cycles/frame (CPU per voice):";
+    for (int d = 0; d < WavPlayer::DECODER_COUNT; d++) {
+        WavPlayer::Decoder decoder = (WavPlayer::Decoder)d;
+        html += " " + String(WavPlayer::getDecoderName(decoder)) + "=" + String(wavPlayer.getDecodeCyclesPerFrame(decoder)) +
+                " (" + String(wavPlayer.getDecodeLoadPercent(decoder), 1) + "%)";
+    }
+    html += "</p>";
 
-    // Upload WAV Files Section
-    html += "<h2>Upload WAV Files</h2>";
+    // Upload WAV and MP3 Files Section
+    html += "<h2>Upload WAV or MP3 Files</h2>";
     html += "<div class='upload-section'>";
     html += "<form action='/upload' method='POST' enctype='multipart/form-data'>";
-    html += "<label for='file'>Select WAV File:</label>";
-    html += "<input type='file' name='file' accept='.wav' required>";
-    html += "<input type='submit' value='Upload WAV File'>";
+    html += "<label for='file'>Select WAV or MP3 File:</label>";
+    html += "<input type='file' name='file' accept='.wav,.mp3' required>";
+    html += "<input type='submit' value='Upload File'>";
     html += "</form>";
     html += "</div>";
 
+    // Push-to-talk streams the microphone to the phone while the button is held
+    html += "<h2>Push to Talk</h2>";
+    html += "<div class='upload-section'>";
+    html += "<label>Number <input id='pttNumber' type='text' inputmode='numeric' value='99'></label>";
+    html += "<label>Description <input id='pttDescription' type='text' value='Message'></label>";
+    html += "<label>Format <select id='pttCodec'><option value='pcm'>PCM</option><option value='adpcm'>IMA ADPCM</option></select></label>";
+    html += "<label><input id='pttLive' type='checkbox'> Play live on the phone</label>";
+    html += "<input id='pttButton' type='submit' value='Hold to Talk'>";
+    html += "<p id='pttStatus'>Push-to-talk: " + String(pushToTalk.getFrames()) + " frames, " + String(pushToTalk.getBytes() / 1024) + " KB at " +
+            String(pushToTalk.getThroughputKBps()) + " KB/s, " + String(pushToTalk.getLostFrames()) + " lost, longest frame " +
+            String(pushToTalk.getMaxFrameUs() / 1000) + " ms, live underruns " + String(pushToTalk.getLiveUnderruns()) + "</p>";
+    html += "</div>";
+    // The IMA step table comes from ImaAdpcm.h so the browser's encoder matches the decoder
+    html += "<script>var IMA_STEP=[";
+    for (int i = 0; i < 89; i++) {
+        html += String(IMA_STEP_TABLE[i]) + (i < 88 ? "," : "");
+    }
+    html += "];</script>";
+    html += "<script>"
+            "var PTT_RATE=16000,IMA_INDEX=[-1,-1,-1,-1,2,4,6,8];"
+            "var ptt=null,pttEl=function(id){return document.getElementById(id);};"
+            "function pttShow(){var s=(performance.now()-ptt.t0)/1000,l=ptt.rtt.length?ptt.rtt.reduce(function(a,b){return a+b;},0)/ptt.rtt.length:0;"
+            "pttEl('pttStatus').textContent='Sent '+(ptt.bytes/1024).toFixed(1)+' KB at '+(ptt.bytes/1024/Math.max(s,0.001)).toFixed(1)+' KB/s, latency '+l.toFixed(0)+' ms (max '+ptt.maxRtt.toFixed(0)+' ms), in flight '+ptt.inFlight+', dropped '+ptt.dropped+(ptt.note?', '+ptt.note:'');}"
+            // Block of 4 + (n - 1) / 2 bytes for n samples, like imaEncodeBlock()
+            "function pttAdpcm(x){var b=new Uint8Array(4+(x.length-1)/2),st=ptt.ima;st.p=x[0];b[0]=x[0]&255;b[1]=(x[0]>>8)&255;b[2]=st.i;"
+            "for(var k=1;k<x.length;k++){var step=IMA_STEP[st.i],d=x[k]-st.p,n=0;if(d<0){n=8;d=-d;}if(d>=step){n|=4;d-=step;}if(d>=step>>1){n|=2;d-=step>>1;}if(d>=step>>2)n|=1;"
+            "var diff=step>>3;if(n&1)diff+=step>>2;if(n&2)diff+=step>>1;if(n&4)diff+=step;st.p=Math.max(-32768,Math.min(32767,st.p+((n&8)?-diff:diff)));"
+            "st.i=Math.max(0,Math.min(88,st.i+IMA_INDEX[n&7]));var o=4+((k-1)>>1);b[o]|=((k-1)&1)?n<<4:n;}return b;}"
+            // Only PTT_WINDOW_FRAMES may wait for their ack, a backlog beyond one second drops the oldest frames
+            "function pttPump(){while(ptt.ws.readyState==1&&ptt.inFlight<ptt.window&&ptt.queue.length){var p=ptt.queue.shift(),f=new Uint8Array(8+p.length),v=new DataView(f.buffer);"
+            "v.setUint16(0,ptt.seq&65535,true);v.setUint32(4,Math.round(performance.now())>>>0,true);f.set(p,8);ptt.ws.send(f.buffer);ptt.seq++;ptt.inFlight++;ptt.bytes+=p.length;}"
+            "if(ptt.stopping&&!ptt.queue.length&&!ptt.inFlight&&ptt.ws.readyState==1){ptt.ws.send('stop');ptt.stopping=false;}}"
+            "function pttCapture(e){var d=e.inputBuffer.getChannelData(0),r=ptt.ctx.sampleRate/PTT_RATE;"
+            "for(;ptt.pos<d.length;ptt.pos+=r){var i=Math.floor(ptt.pos),a=d[i],b=i+1<d.length?d[i+1]:a,x=a+(b-a)*(ptt.pos-i);"
+            "ptt.frame[ptt.fill++]=Math.max(-32768,Math.min(32767,Math.round(x*32767)));"
+            "if(ptt.fill==ptt.frame.length){ptt.queue.push(ptt.codec=='adpcm'?pttAdpcm(ptt.frame):new Uint8Array(ptt.frame.slice().buffer));ptt.fill=0;"
+            "if(ptt.queue.length>50){ptt.queue.shift();ptt.dropped++;}}}"
+            "ptt.pos-=d.length;pttPump();}"
+            "function pttStart(){if(ptt&&ptt.ws.readyState<2)return;"
+            "if(!navigator.mediaDevices){pttEl('pttStatus').textContent='The browser only allows the microphone on https or localhost pages';return;}"
+            "var codec=pttEl('pttCodec').value;"
+            // 20 ms frames, an ADPCM block holds 1 + 8k samples
+            "ptt={queue:[],inFlight:0,window:0,seq:0,bytes:0,rtt:[],maxRtt:0,dropped:0,t0:performance.now(),codec:codec,ima:{p:0,i:0},pos:0,fill:0,stopping:false,note:'',"
+            "frame:new Int16Array(codec=='adpcm'?321:320),ws:new WebSocket('ws://'+location.hostname+':" + String(PTT_PORT) + "/')};"
+            "ptt.ws.binaryType='arraybuffer';"
+            "ptt.ws.onopen=function(){ptt.ws.send('start '+PTT_RATE+' '+codec+' '+(codec=='adpcm'?164:2)+' '+(pttEl('pttLive').checked?1:0)+' '+pttEl('pttNumber').value+' '+pttEl('pttDescription').value);};"
+            "ptt.ws.onmessage=function(m){var w=m.data.split(' ');"
+            "if(w[0]=='ready'){ptt.window=+w[1];pttMic();}"
+            "else if(w[0]=='ack'){var t=((Math.round(performance.now())>>>0)-(+w[2]))>>>0;ptt.rtt.push(t);if(ptt.rtt.length>100)ptt.rtt.shift();ptt.maxRtt=Math.max(ptt.maxRtt,t);ptt.inFlight--;pttPump();pttShow();}"
+            "else if(w[0]=='saved'){ptt.note='saved '+w[1];pttShow();ptt.ws.close();}"
+            "else{ptt.note=m.data;pttShow();}};}"
+            "function pttMic(){navigator.mediaDevices.getUserMedia({audio:{echoCancellation:true,noiseSuppression:true}}).then(function(stream){"
+            "ptt.stream=stream;ptt.ctx=new AudioContext();ptt.src=ptt.ctx.createMediaStreamSource(stream);ptt.node=ptt.ctx.createScriptProcessor(1024,1,1);"
+            "ptt.node.onaudioprocess=pttCapture;ptt.src.connect(ptt.node);ptt.node.connect(ptt.ctx.destination);"
+            "if(ptt.released)pttStop();}).catch(function(e){ptt.note=e.message;pttShow();ptt.ws.close();});}"
+            "function pttStop(){if(!ptt)return;ptt.released=true;if(!ptt.ctx)return;"
+            "ptt.node.disconnect();ptt.src.disconnect();ptt.stream.getTracks().forEach(function(t){t.stop();});ptt.ctx.close();ptt.ctx=null;"
+            "ptt.stopping=true;pttPump();}"
+            "var pttButton=pttEl('pttButton');"
+            "pttButton.addEventListener('mousedown',pttStart);pttButton.addEventListener('touchstart',function(e){e.preventDefault();pttStart();});"
+            "pttButton.addEventListener('mouseup',pttStop);pttButton.addEventListener('mouseleave',pttStop);pttButton.addEventListener('touchend',pttStop);"
+            "</script>";
+
     html += "</div>"; // End custom-html container
     return html;
 }
@@ -1701,13 +5288,28 @@ void applyCurrentVolume() {
 
 //Button pressed on website
 void handleWebButton(String buttonName) {
+    bool toAll = webConfig.getParamFloat("ring_broadcast") != 0;
     if(buttonName == "cancel_call"){
+        if (toAll) ringChannel.stop();
         phoneController.stopCall();
     } else {
+        if (toAll) ringChannel.ring(buttonName);
         phoneController.startCall(buttonName);
     }
 }
 
+//Ring or stop from another phone or hpring
+void onRingCommand(RingBroadcast::Command command, const char* number) {
+    if (webConfig.getParamFloat("ring_listen") == 0) return;
+    if (command == RingBroadcast::RING) {
+        Serial.printf("Ring broadcast: %s\n", number);
+        phoneController.startCall(number);
+    } else if (phoneController.getCurrentState() == Ringing && !phoneController.isRemoteCall()) {
+        // Only the ringing stops, calls that were answered go on
+        phoneController.stopCall();
+    }
+}
+
 //Properties modified through web
 void onPropertiesModified() {
     // Handle properties modification if needed
@@ -1720,8 +5322,33 @@ void onPropertiesModified() {
     // Update the PhoneController with the new values
     phoneController.setRingDuration((unsigned long)ringDuration);
     phoneController.setRingVariation((unsigned long)ringVariation);
+    phoneController.setMailboxNumber(webConfig.getParamString("mailbox_number"));
+    callManager.setNumber(webConfig.getParamString("call_number"));
+    callManager.setPeers(webConfig.getParamString("call_peers"));
+    String bridgeNumber = webConfig.getParamString("conference_number");
+    if (bridgeNumber.length() > 0 && conferenceHost.start()) {
+        // This phone joins its own bridge over loopback
+        callManager.addPeer(bridgeNumber, IPAddress(127, 0, 0, 1), CONFERENCE_PORT);
+    } else {
+        conferenceHost.stop();
+    }
+    // What the other phones find through mDNS
+    String callNumber = webConfig.getParamString("call_number");
+    String callRange = webConfig.getParamString("call_range");
+    String announced = callNumber;
+    if (callNumber.length() > 0 && callRange.length() > 0) announced += "," + callRange;
+    uint8_t capabilities = PeerTable::PUSH_TO_TALK;
+    if (callNumber.length() > 0) capabilities |= PeerTable::CALL;
+    if (conferenceHost.isRunning()) capabilities |= PeerTable::CONFERENCE;
+    if (webConfig.getParamFloat("ring_listen") != 0) capabilities |= PeerTable::RING;
+    peerDiscovery.setAnnouncement(announced, conferenceHost.isRunning() ? bridgeNumber + ":" + String(CONFERENCE_PORT) : String(""),
+                                  capabilities);
     
     // Apply the current volume based on the speaker mode
+    wavPlayer.setVolumeRamp((uint32_t)webConfig.getParamFloat("volumes_rampMs"));
+#ifdef LATENCY_BENCH
+    wavPlayer.setSimulatedSdDelays((uint32_t)webConfig.getParamFloat("bench_openDelayUs"), (uint32_t)webConfig.getParamFloat("bench_readDelayUs"));
+#endif
     applyCurrentVolume();
 }
 
@@ -1758,12 +5385,90 @@ void updateLEDAnimation(PhoneState state) {
             frontLED.setRate(250);         // Blinking rate
             break;
 
+        case PhoneState::Recording:
+            frontLED.setMode(FrontLED::CONSTANT);
+            frontLED.setColor(CRGB::Red);
+            break;
+
+        case PhoneState::Connected:
+            frontLED.setMode(FrontLED::CONSTANT);
+            frontLED.setColor(CRGB::Green);
+            break;
+
         default:
             frontLED.setMode(FrontLED::OFF);
             break;
     }
 }
 
+// Plays what WebConfig selects for a state: "file" loops the state's WAV file,
+// "none" is silence and anything else names a tone of the configured region
+void playStateSound(const String& paramName, const String& filePath) {
+    String choice = webConfig.getParamString(paramName);
+    if (choice == "none" || (choice == "file" && filePath.length() == 0)) {
+        wavPlayer.stop();
+        return;
+    }
+    if (choice != "file") {
+        String region = webConfig.getParamString("tones_region");
+        const ToneSpec* tone = findTone(region.c_str(), choice.c_str());
+        if (tone) {
+            wavPlayer.playTone(tone);
+            return;
+        }
+        Serial.printf("Unknown tone '%s' for region '%s'\n", choice.c_str(), region.c_str());
+    }
+    if (filePath.length() > 0) {
+        promptCache.acquire(filePath); // Loops from RAM when the heap has room
+        wavPlayer.playAudio(filePath, true);
+    }
+}
+
+String ivrFolder; // Menu of the running IVR call, empty otherwise
+bool mailboxBeepPending = false; // The recording starts once the beep has played
+
+// Next free message file of a mailbox, /mailbox/<number>_<n>.wav
+String nextMailboxPath(const String& number) {
+    if (!SD.exists(MAILBOX_FOLDER)) {
+        SD.mkdir(MAILBOX_FOLDER);
+    }
+    for (int n = 1; ; n++) {
+        String path = String(MAILBOX_FOLDER) + "/" + number + "_" + String(n) + ".wav";
+        if (!SD.exists(path)) return path;
+    }
+}
+
+// Plays what a dial plan rule routes to
+void playRoute(const DialPlan::Rule& rule) {
+    String target = rule.target.c_str();
+    if (rule.action == DialPlan::PLAY) {
+        wavPlayer.playAudio(target);
+    } else if (rule.action == DialPlan::RANDOM) {
+        String filePath = sdReader.pickRandomFile(target);
+        if (filePath.length() > 0) {
+            wavPlayer.playAudio(filePath);
+        }
+    } else if (rule.action == DialPlan::IVR) {
+        // The menu folder holds menu.wav and one file per choice, 0.wav to 9.wav
+        ivrFolder = target;
+        wavPlayer.playAudio(ivrFolder + "/menu.wav");
+    }
+}
+
+// The dial tone ends with the first digit, the digits so far narrow down what to prefetch.
+// During a call the digit picks an IVR menu entry.
+void onDigitDialled(int digit) {
+    if (phoneController.getCurrentState() == PhoneState::Calling) {
+        if (ivrFolder.length() > 0) {
+            wavPlayer.playAudio(ivrFolder + "/" + String(digit) + ".wav");
+        }
+        return;
+    }
+    // Only the dial tone voice, sounds layered on the other voices play on
+    wavPlayer.stopVoice(WavPlayer::PRIMARY_VOICE);
+    dialPrefetcher.setPrefix(phoneController.getDialledDigits());
+}
+
 //Phone State Change
 void onStateChange(PhoneState lastState, PhoneState newState) {
     updateLEDAnimation(newState);  // Update the LED animation based on the new state
@@ -1771,27 +5476,71 @@ void onStateChange(PhoneState lastState, PhoneState newState) {
     // Retrieve volumes from the WebConfig
     float ringVolume = webConfig.getParamFloat("volumes_speaker");
 
+    // Hanging up saves the message
+    if (lastState == PhoneState::Recording) {
+        mailboxBeepPending = false;
+        if (micRecorder.isRecording()) {
+            micRecorder.stop();
+        }
+        wavPlayer.restoreOutput();
+    }
+
     if (newState == PhoneState::Calling) {
         wavPlayer.stop();
         String dialledNumber = phoneController.getCurrentNumber();
         SDReader::NumberInfo info;
-        if (sdReader.getNumberInfo(dialledNumber, info)) {
+        int32_t rule;
+        if (phoneController.isRemoteCall()) {
+            // Picking up answers the other phone, dialling it calls it
+            applyCurrentVolume();
+            if (callManager.getState() == CallEngine::INCOMING) {
+                callManager.answer();
+            } else if (!callManager.call(dialledNumber)) {
+                phoneController.remoteEnded();
+            }
+        } else if (sdReader.getNumberInfo(dialledNumber, info)) {
             // Set the normal volume for the call
             applyCurrentVolume(); //reset volume to currently selected
-            wavPlayer.playAudio(info.filePath);
+            wavPlayer.playAudio(info.filePath, info.format);
+        } else if ((rule = sdReader.matchDialPlan(dialledNumber)) != DialPlan::NO_RULE) {
+            applyCurrentVolume();
+            playRoute(sdReader.getDialPlan().getRule(rule));
         } else {
             Serial.println("Error: Number info not found");
         }
+    } else if (newState == PhoneState::Dialing) {
+        applyCurrentVolume();
+        playStateSound("tones_dialing", "");
+    } else if (newState == PhoneState::InvalidNumber && phoneController.isRemoteCall()) {
+        // The other phone hung up, is busy or cannot be reached
+        applyCurrentVolume();
+        String region = webConfig.getParamString("tones_region");
+        wavPlayer.playTone(findTone(region.c_str(), "busy"));
     } else if (newState == PhoneState::InvalidNumber) {
         // Invalid number, play the notfound.wav in a loop
         applyCurrentVolume();
-        wavPlayer.playAudio("/system/keinAnschluss.wav", true);
+        playStateSound("tones_invalid", "/system/keinAnschluss.wav");
     } else if (newState == PhoneState::Idle) {
         wavPlayer.stop();
+        promptCache.release(); // Nothing plays from it anymore
+        callManager.hangup();
     } else if (newState == PhoneState::Ringing) {
         // Use ring volume for the ringing state
         wavPlayer.setVolume(ringVolume);  // Set the volume to ring volume when ringing
-        wavPlayer.playAudio("/system/ring.wav", true);
+        playStateSound("tones_ringing", "/system/ring.wav");
+    } else if (newState == PhoneState::Recording) {
+        applyCurrentVolume();
+        String region = webConfig.getParamString("tones_region");
+        wavPlayer.playTone(findTone(region.c_str(), "beep"), WavPlayer::PRIMARY_VOICE, false);
+        mailboxBeepPending = true;
+    }
+
+    // Prefetched files are only useful while dialling
+    if (newState != PhoneState::Dialing) {
+        dialPrefetcher.clear();
+    }
+    if (newState != PhoneState::Calling) {
+        ivrFolder = "";
     }
 
     Serial.print("State changed from ");
@@ -1800,6 +5549,33 @@ void onStateChange(PhoneState lastState, PhoneState newState) {
     Serial.println(newState);
 }
 
+// Follows the other phone: it rings, answers or hangs up
+void onCallStateChange(CallEngine::State lastState, CallEngine::State newState) {
+    if (newState == CallEngine::INCOMING) {
+        String caller = callManager.getRemoteNumber();
+        Serial.printf("Call from '%s'\n", caller.c_str());
+        if (!phoneController.ringRemote(caller)) {
+            callManager.reject();
+        }
+    } else if (newState == CallEngine::RINGBACK && phoneController.getCurrentState() == PhoneState::Calling) {
+        String region = webConfig.getParamString("tones_region");
+        wavPlayer.playTone(findTone(region.c_str(), "ringback"));
+    } else if (newState == CallEngine::CONNECTED) {
+        // The call needs the microphone, which shares I2S0 with the DAC
+        wavPlayer.releaseOutput();
+        callManager.startAudio();
+        phoneController.connect();
+    } else if (newState == CallEngine::IDLE) {
+        if (callManager.isAudioRunning()) {
+            callManager.stopAudio();
+        }
+        if (lastState == CallEngine::CONNECTED) {
+            wavPlayer.restoreOutput();
+        }
+        phoneController.remoteEnded();
+    }
+}
+
 //Phone front buttons
 void onButtonStateChanged(String name, bool pressed) {
     if (pressed) {  // Only take action when the button is pressed, not released
@@ -1836,11 +5612,9 @@ void onButtonStateChanged(String name, bool pressed) {
             // Random button logic
             if (phoneController.getCurrentState() == PhoneState::Idle) {
                 Serial.println("Random button pressed.");
-                const auto& mappings = sdReader.getNumberMappings();
-                if (!mappings.empty()) {
-                    auto randomIndex = random(0, mappings.size());
-                    auto it = std::next(mappings.begin(), randomIndex);
-                    String randomNumber = it->first;
+                const NumberTable& numbers = sdReader.getNumbers();
+                if (!numbers.empty()) {
+                    String randomNumber = numbers.getNumber(numbers.at(random(0, numbers.size())));
                     Serial.print("Dialing random number: ");
                     Serial.println(randomNumber);
                     phoneController.startCall(randomNumber);
@@ -1861,6 +5635,7 @@ void setup() {
     randomSeed(analogRead(0));
 
     sdReader.initialize();
+    promptCache.load("/system"); // Keep the system prompts in RAM, see PromptCache
 
     // Initialize the web configuration
     webConfig.begin();
@@ -1868,13 +5643,43 @@ void setup() {
     webConfig.addParamFloat("volumes_normal", 50);
     webConfig.addParamFloat("volumes_silent", 20);
     webConfig.addParamFloat("volumes_speaker", 100);
+    webConfig.addParamFloat("volumes_rampMs", 30);    // Time to glide to a new volume
     webConfig.addParamFloat("ringDuration", 5000);  // Default duration in milliseconds
     webConfig.addParamFloat("ringVariation", 2000); // Default variation in milliseconds
+    webConfig.addParamFloat("upload_transcode", 0);      // Convert PCM uploads to the format below, compressed files are kept
+    webConfig.addParamFloat("upload_sampleRate", 16000);
+    webConfig.addParamFloat("upload_bits", 8);             // 8, 16 or 4 for IMA ADPCM
+    // Sound per state: "file", "none" or a tone (dial, busy, ringback, congestion, sit)
+    webConfig.addParamString("tones_region", "DE");
+    webConfig.addParamString("tones_dialing", "dial");
+    webConfig.addParamString("tones_invalid", "file");
+    webConfig.addParamString("tones_ringing", "file");
+    webConfig.addParamString("mailbox_number", "");        // Dial it to leave a message, empty disables the mailbox
+    webConfig.addParamFloat("mailbox_maxSeconds", 120);
+    // Calls between phones: own number and "<number>=<ip>[:<port>]" per other phone
+    webConfig.addParamString("call_number", "");
+    webConfig.addParamString("call_peers", "");
+    webConfig.addParamString("call_range", "");         // Further numbers this phone answers, e.g. 40-49
+    webConfig.addParamString("conference_number", "");  // Hosts a party line under this number, empty disables it
+    // Phones on the network ring together: listen to the others, send the web buttons to all
+    webConfig.addParamFloat("ring_listen", 1);
+    webConfig.addParamFloat("ring_broadcast", 0);
+    // WiFi the phones share for calls, the configuration access point stays up
+    webConfig.addParamString("network_ssid", "");
+    webConfig.addParamString("network_password", "");
+#ifdef LATENCY_BENCH
+    webConfig.addParamFloat("bench_openDelayUs", 0);  // Simulated SD latency per open()
+    webConfig.addParamFloat("bench_readDelayUs", 0);  // Simulated SD latency per read()
+#endif
 
     // **Set the Upload Complete Callback**
-    webConfig.onUploadComplete([](){
-        sdReader.refreshMappings(); // Refresh number mappings
-        Serial.println("Number mappings refreshed after file upload.");
+    webConfig.onUploadComplete([](const String& filePath){
+        sdReader.addOrUpdate(filePath); // Only the uploaded number changes
+    });
+
+    pushToTalk.begin();
+    pushToTalk.onSaved([](const String& filePath) {
+        sdReader.addOrUpdate(filePath); // The recording is a new number
     });
 
     // Set the dynamic title
@@ -1886,6 +5691,16 @@ void setup() {
     // Set the properties modified callback
     webConfig.onPropertiesModified(onPropertiesModified);
 
+    String ssid = webConfig.getParamString("network_ssid");
+    if (ssid.length() > 0) {
+        WiFi.begin(ssid.c_str(), webConfig.getParamString("network_password").c_str());
+    }
+    callManager.begin();
+    callManager.onStateChanged(onCallStateChange);
+    ringChannel.onCommand(onRingCommand);
+    ringChannel.begin();
+    callManager.setResolver([](const String& number, CallPeer& peer) { return peerDiscovery.resolve(number, peer); });
+
     onPropertiesModified();
 
     buttonHandler.onButtonStateChanged(onButtonStateChanged);
@@ -1895,6 +5710,8 @@ void setup() {
 
     // Initialize wavPlayer after SD card is ready
     wavPlayer.begin();
+    wavPlayer.setPromptCache(&promptCache);
+    wavPlayer.setPrefetcher(&dialPrefetcher);
     wavPlayer.setVolume(50);
     wavPlayer.playAudio("/system/short_ring.wav");
 
@@ -1902,15 +5719,40 @@ void setup() {
 
     // Pass sdReader to PhoneController
     phoneController.setStateChangeCallback(onStateChange);
+    phoneController.setDigitCallback(onDigitDialled);
+    phoneController.setPeerCheck([](const String& number) { return callManager.isPeerNumber(number); });
+    phoneController.setPeerMatch([](DialMatch& match) {
+        callManager.matchNumber(match);
+        peerDiscovery.matchNumber(match);
+    });
 }
 
 void loop() {
     // Continuously update the LED state
     buttonHandler.update();
     webConfig.handleClient();
+    pushToTalk.loop();
+    callManager.loop();
+    ringChannel.loop();
+    peerDiscovery.loop();
     frontLED.update();
     phoneController.update();
-
-    wavPlayer.loop(); // Call this in loop if you want continuous playback updates
+    dialPrefetcher.update();
+    wavPlayer.update();
+    if (phoneController.getCurrentState() == Idle) {
+        sdReader.saveIndexIfDue(); // Not while a call reads from the card
+    }
+    // The microphone needs I2S0, so the player lets go of it once the beep is over
+    if (mailboxBeepPending && !wavPlayer.isPlaying()) {
+        mailboxBeepPending = false;
+        wavPlayer.releaseOutput();
+        if (!micRecorder.start(nextMailboxPath(phoneController.getCurrentNumber()), (uint32_t)webConfig.getParamFloat("mailbox_maxSeconds"))) {
+            wavPlayer.restoreOutput();
+        }
+    }
+    // Audio is decoded and fed to I2S by the WavPlayer tasks
+#ifdef LATENCY_BENCH
+    reportLatency();
+#endif
 }
 
@@ -0,0 +1,108 @@
+// Checks the dial plan parser and DFA: rule syntax, first match wins, stepping digit by digit
+// and the state limit: pio test -e native -f test_dial_plan
+
+#include <unity.h>
+#include <string>
+#include "DialPlan.h"
+
+static int32_t stepAll(const DialPlan& plan, const char* digits) {
+    int32_t state = plan.startState();
+    for (const char* p = digits; *p; p++) state = plan.step(state, *p - '0');
+    return state;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_parses_lines() {
+    DialPlan plan;
+    const char* error;
+    TEST_ASSERT_TRUE(plan.addLine("  # comment only", &error));
+    TEST_ASSERT_TRUE(plan.addLine("", &error));
+    TEST_ASSERT_TRUE(plan.addLine("5[1-3]x play /numbers/a.wav # trailing", &error));
+    TEST_ASSERT_TRUE(plan.addLine("9* random /random\r", &error));
+    TEST_ASSERT_FALSE(plan.addLine("12 play", &error));
+    TEST_ASSERT_NOT_NULL(error);
+    TEST_ASSERT_FALSE(plan.addLine("12 call /x", &error));
+    TEST_ASSERT_FALSE(plan.addLine("1a play /x", &error));
+    TEST_ASSERT_FALSE(plan.addLine("[5-2] play /x", &error));
+    TEST_ASSERT_EQUAL(2, plan.getRuleCount());
+    TEST_ASSERT_EQUAL(DialPlan::RANDOM, plan.getRule(1).action);
+    TEST_ASSERT_EQUAL_STRING("/random", plan.getRule(1).target.c_str());
+}
+
+void test_first_rule_wins() {
+    DialPlan plan;
+    const char* error;
+    plan.addRule("12x", DialPlan::PLAY, "first", &error);
+    plan.addRule("1xx", DialPlan::PLAY, "second", &error);
+    plan.addRule("[13]*", DialPlan::IVR, "third", &error);
+    TEST_ASSERT_TRUE(plan.compile());
+    TEST_ASSERT_EQUAL(0, plan.match("125"));
+    TEST_ASSERT_EQUAL(1, plan.match("135"));
+    TEST_ASSERT_EQUAL(2, plan.match("1"));
+    TEST_ASSERT_EQUAL(2, plan.match("3333"));
+    TEST_ASSERT_EQUAL(DialPlan::NO_RULE, plan.match("2"));
+}
+
+// The state kept per digit ends where a walk of the whole number ends
+void test_stepping_matches_walk() {
+    DialPlan plan;
+    const char* error;
+    plan.addRule("0[2-9]xx*", DialPlan::PLAY, "a", &error);
+    plan.addRule("110", DialPlan::PLAY, "b", &error);
+    plan.addRule("11[0-5]x", DialPlan::PLAY, "c", &error);
+    TEST_ASSERT_TRUE(plan.compile());
+    const char* numbers[] = { "0", "02", "0212345", "11", "110", "1105", "1169", "9" };
+    for (const char* number : numbers) {
+        int32_t state = stepAll(plan, number);
+        TEST_ASSERT_EQUAL(plan.stateFor(number), state);
+        TEST_ASSERT_EQUAL(plan.match(number), plan.ruleAt(state));
+    }
+    TEST_ASSERT_TRUE(plan.canExtend(stepAll(plan, "110")));
+    TEST_ASSERT_FALSE(plan.canExtend(stepAll(plan, "1105")));
+    TEST_ASSERT_EQUAL(DialPlan::DEAD, stepAll(plan, "9"));
+}
+
+// Rules whose wildcards multiply the states are refused instead of filling the heap
+void test_refuses_plans_above_the_state_limit() {
+    DialPlan plan;
+    const char* error;
+    for (int i = 0; i < 40; i++) {
+        std::string pattern = "x" + std::to_string(i) + "x*" + std::to_string(i % 7) + "x";
+        TEST_ASSERT_TRUE(plan.addRule(pattern.c_str(), DialPlan::PLAY, "a", &error));
+    }
+    TEST_ASSERT_TRUE(plan.compile(100000));
+    size_t states = plan.getStateCount();
+    TEST_ASSERT_GREATER_THAN(64, states);
+    TEST_ASSERT_FALSE(plan.compile(64));
+    TEST_ASSERT_EQUAL(0, plan.getStateCount());
+    TEST_ASSERT_EQUAL(DialPlan::DEAD, plan.startState());
+    TEST_ASSERT_EQUAL(DialPlan::NO_RULE, plan.match("10123"));
+    TEST_ASSERT_TRUE(plan.compile(states));
+}
+
+// A state from before the plan was loaded again must not index the new tables
+void test_old_state_after_recompile_is_dead() {
+    DialPlan plan;
+    const char* error;
+    plan.addRule("123456", DialPlan::PLAY, "a", &error);
+    plan.compile();
+    int32_t state = stepAll(plan, "12345");
+    plan.clear();
+    plan.addRule("9", DialPlan::PLAY, "b", &error);
+    plan.compile();
+    TEST_ASSERT_EQUAL(DialPlan::DEAD, plan.step(state, 6));
+    TEST_ASSERT_EQUAL(DialPlan::NO_RULE, plan.ruleAt(state));
+    TEST_ASSERT_FALSE(plan.canExtend(state));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_parses_lines);
+    RUN_TEST(test_first_rule_wins);
+    RUN_TEST(test_stepping_matches_walk);
+    RUN_TEST(test_refuses_plans_above_the_state_limit);
+    RUN_TEST(test_old_state_after_recompile_is_dead);
+    return UNITY_END();
+}
@@ -0,0 +1,193 @@
+// Checks the digit trie and when DialMatch lets a number start before the dial timeout,
+// including numbers that are prefixes of others and the numbers and ranges of other phones:
+// pio test -e native -f test_dial_trie
+
+#include <unity.h>
+#include <string>
+#include "DialMatch.h"
+#include "PeerTable.h"
+
+static bool complete(const DialTrie& trie, const DialPlan* plan, const char* mailbox, const char* digits) {
+    DialMatch match(digits);
+    match.addTrie(trie);
+    if (plan) match.addPlan(*plan, plan->stateFor(digits));
+    match.addNumber(mailbox);
+    return match.isComplete();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_match_kinds() {
+    DialTrie trie;
+    TEST_ASSERT_TRUE(trie.insert("12"));
+    TEST_ASSERT_TRUE(trie.insert("123"));
+    TEST_ASSERT_TRUE(trie.insert("45"));
+    TEST_ASSERT_EQUAL(DialTrie::PREFIX, trie.match("1"));
+    TEST_ASSERT_EQUAL(DialTrie::AMBIGUOUS, trie.match("12"));
+    TEST_ASSERT_EQUAL(DialTrie::UNIQUE, trie.match("123"));
+    TEST_ASSERT_EQUAL(DialTrie::UNIQUE, trie.match("45"));
+    TEST_ASSERT_EQUAL(DialTrie::NO_MATCH, trie.match("46"));
+    TEST_ASSERT_EQUAL(DialTrie::NO_MATCH, trie.match("1234"));
+    TEST_ASSERT_EQUAL(3, trie.size());
+}
+
+void test_rejects_duplicates_and_non_digits() {
+    DialTrie trie;
+    TEST_ASSERT_TRUE(trie.insert("110"));
+    TEST_ASSERT_FALSE(trie.insert("110"));
+    TEST_ASSERT_FALSE(trie.insert("11a"));
+    TEST_ASSERT_FALSE(trie.insert(""));
+    TEST_ASSERT_EQUAL(1, trie.size());
+}
+
+// Removing a number frees its branch for reuse and leaves the others intact
+void test_remove_reuses_nodes() {
+    DialTrie trie;
+    trie.insert("12");
+    trie.insert("1234");
+    uint32_t nodes = trie.getNodeCount();
+    TEST_ASSERT_TRUE(trie.remove("1234"));
+    TEST_ASSERT_FALSE(trie.remove("1234"));
+    TEST_ASSERT_EQUAL(DialTrie::UNIQUE, trie.match("12"));
+    TEST_ASSERT_LESS_THAN(nodes, trie.getNodeCount());
+    trie.insert("1299");
+    TEST_ASSERT_EQUAL(nodes, trie.getNodeCount());
+    TEST_ASSERT_EQUAL(DialTrie::AMBIGUOUS, trie.match("12"));
+}
+
+// Same as the baseline: single digits wait for the timeout even if they are a file
+void test_single_digit_is_never_complete() {
+    DialTrie trie;
+    trie.insert("5");
+    TEST_ASSERT_FALSE(complete(trie, NULL, "", "5"));
+    trie.insert("55");
+    TEST_ASSERT_TRUE(complete(trie, NULL, "", "55"));
+}
+
+void test_unique_file_completes() {
+    DialTrie trie;
+    trie.insert("110");
+    trie.insert("112");
+    TEST_ASSERT_FALSE(complete(trie, NULL, "", "11"));
+    TEST_ASSERT_TRUE(complete(trie, NULL, "", "110"));
+    TEST_ASSERT_FALSE(complete(trie, NULL, "", "111")); // Nobody answers it
+}
+
+// A file that is a prefix of the mailbox waits, so the mailbox stays reachable
+void test_file_prefix_of_mailbox_waits() {
+    DialTrie trie;
+    trie.insert("12");
+    TEST_ASSERT_FALSE(complete(trie, NULL, "123", "12"));
+    TEST_ASSERT_TRUE(complete(trie, NULL, "123", "123"));
+    TEST_ASSERT_TRUE(complete(trie, NULL, "", "12"));
+}
+
+// The same for a dial plan rule that extends a file, and the other way round
+void test_file_and_plan_prefixes_wait_for_each_other() {
+    DialTrie trie;
+    trie.insert("12");
+    trie.insert("7000");
+    DialPlan plan;
+    const char* error;
+    TEST_ASSERT_TRUE(plan.addRule("12x", DialPlan::PLAY, "a.wav", &error));
+    TEST_ASSERT_TRUE(plan.addRule("70", DialPlan::PLAY, "b.wav", &error));
+    plan.compile();
+    TEST_ASSERT_FALSE(complete(trie, &plan, "", "12"));
+    TEST_ASSERT_TRUE(complete(trie, &plan, "", "125"));
+    TEST_ASSERT_FALSE(complete(trie, &plan, "", "70"));
+    TEST_ASSERT_TRUE(complete(trie, &plan, "", "7000"));
+}
+
+void test_plan_alone_completes() {
+    DialTrie trie;
+    DialPlan plan;
+    const char* error;
+    TEST_ASSERT_TRUE(plan.addRule("9xx", DialPlan::RANDOM, "/random", &error));
+    TEST_ASSERT_TRUE(plan.addRule("8*", DialPlan::PLAY, "c.wav", &error));
+    plan.compile();
+    TEST_ASSERT_FALSE(complete(trie, &plan, "", "9"));
+    TEST_ASSERT_FALSE(complete(trie, &plan, "", "91"));
+    TEST_ASSERT_TRUE(complete(trie, &plan, "", "912"));
+    TEST_ASSERT_FALSE(complete(trie, &plan, "", "8123")); // '*' can always take another digit
+}
+
+static void peerList(const char* numbers, const char* digits, bool& accepts, bool& extendable) {
+    accepts = extendable = false;
+    PeerTable::matchesPrefix(numbers, digits, accepts, extendable);
+}
+
+void test_peer_numbers_and_ranges() {
+    bool accepts, extendable;
+    peerList("12,40-49,700-719", "4", accepts, extendable);
+    TEST_ASSERT_FALSE(accepts);
+    TEST_ASSERT_TRUE(extendable);
+    peerList("12,40-49,700-719", "45", accepts, extendable);
+    TEST_ASSERT_TRUE(accepts);
+    TEST_ASSERT_FALSE(extendable);
+    peerList("12,40-49,700-719", "71", accepts, extendable);
+    TEST_ASSERT_FALSE(accepts);
+    TEST_ASSERT_TRUE(extendable);
+    peerList("12,40-49,700-719", "72", accepts, extendable);
+    TEST_ASSERT_FALSE(accepts || extendable);
+    peerList("12,40-49,700-719", "12", accepts, extendable);
+    TEST_ASSERT_TRUE(accepts);
+    TEST_ASSERT_FALSE(extendable);
+    peerList("12,40-49", "123", accepts, extendable);
+    TEST_ASSERT_FALSE(accepts || extendable);
+    peerList("5-123", "5", accepts, extendable); // Ends of different length are not a range
+    TEST_ASSERT_FALSE(accepts || extendable);
+}
+
+// A file that is a prefix of another phone's range waits for the next digit
+void test_file_prefix_of_peer_range_waits() {
+    DialTrie trie;
+    trie.insert("70");
+    PeerTable table(4, 60000);
+    CallPeer peer = { 0x0A000002, 4210 };
+    TEST_ASSERT_TRUE(table.update("other", peer, "700-709", "", "call", 1000, 0));
+    bool accepts = false, extendable = false;
+    DialMatch match("70");
+    match.addTrie(trie);
+    table.matchPrefix("70", 10, accepts, extendable);
+    match.add(accepts, extendable);
+    TEST_ASSERT_FALSE(match.isComplete());
+    TEST_ASSERT_EQUAL(0, table.getLookups()); // Dialling is not a lookup
+
+    // Once the announcement runs out the file completes again
+    DialMatch later("70");
+    later.addTrie(trie);
+    accepts = extendable = false;
+    table.matchPrefix("70", 2000, accepts, extendable);
+    later.add(accepts, extendable);
+    TEST_ASSERT_TRUE(later.isComplete());
+}
+
+// The number of a conference bridge on another phone counts like its call numbers
+void test_peer_conference_number() {
+    PeerTable table(4, 60000);
+    CallPeer peer = { 0x0A000003, 4210 };
+    TEST_ASSERT_TRUE(table.update("host", peer, "", "777:4211", "conference", 1000, 0));
+    bool accepts = false, extendable = false;
+    table.matchPrefix("77", 0, accepts, extendable);
+    TEST_ASSERT_FALSE(accepts);
+    TEST_ASSERT_TRUE(extendable);
+    table.matchPrefix("777", 0, accepts, extendable);
+    TEST_ASSERT_TRUE(accepts);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_match_kinds);
+    RUN_TEST(test_rejects_duplicates_and_non_digits);
+    RUN_TEST(test_remove_reuses_nodes);
+    RUN_TEST(test_single_digit_is_never_complete);
+    RUN_TEST(test_unique_file_completes);
+    RUN_TEST(test_file_prefix_of_mailbox_waits);
+    RUN_TEST(test_file_and_plan_prefixes_wait_for_each_other);
+    RUN_TEST(test_plan_alone_completes);
+    RUN_TEST(test_peer_numbers_and_ranges);
+    RUN_TEST(test_file_prefix_of_peer_range_waits);
+    RUN_TEST(test_peer_conference_number);
+    return UNITY_END();
+}
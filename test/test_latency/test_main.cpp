@@ -0,0 +1,225 @@
+// Host version of the dial-to-first-sample benchmark: starts a number the way WavPlayer does,
+// through a fake SD card with a set latency per open and read, and measures with LatencyProbe
+// against a simulated clock. Catches changes that add trips to the card before the first
+// sample without a device: pio test -e native -f test_latency
+
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+#include "LatencyProbe.h"
+#include "DelayedSource.h"
+#include "WavDataReader.h"
+
+static uint32_t nowUs = 0; // Simulated clock, only the fake card's delays advance it
+
+// A file on the fake card
+struct MemoryFile {
+    std::vector<uint8_t> bytes;
+    uint32_t position;
+    bool opened;
+
+    bool open(const char*) {
+        position = 0;
+        opened = true;
+        return true;
+    }
+
+    uint32_t read(void* data, uint32_t len) {
+        uint32_t count = std::min(len, (uint32_t)bytes.size() - position);
+        memcpy(data, bytes.data() + position, count);
+        position += count;
+        return count;
+    }
+
+    bool seek(int32_t pos, int dir) {
+        int64_t target = dir == SEEK_CUR ? (int64_t)position + pos : pos;
+        if (target < 0 || target > (int64_t)bytes.size()) return false;
+        position = (uint32_t)target;
+        return true;
+    }
+
+    bool close() {
+        opened = false;
+        return true;
+    }
+
+    bool isOpen() { return opened; }
+    uint32_t getSize() { return bytes.size(); }
+    uint32_t getPos() { return position; }
+};
+
+typedef DelayedSource<MemoryFile> SlowCard;
+
+// The reader interface parseWavHeader() and WavDataReader need, like AudioSourceReader
+struct CardReader {
+    SlowCard* card;
+
+    uint32_t read(void* dest, uint32_t len) { return card->read(dest, len); }
+    bool skip(uint32_t len) { return card->seek(len, SEEK_CUR); }
+    bool seek(uint32_t position) { return card->seek(position, SEEK_SET); }
+};
+
+// 16 kHz 16 bit mono, 10 ms of silence and then a tone, with a LIST chunk before the data
+static MemoryFile makeNumberFile() {
+    MemoryFile file = { std::vector<uint8_t>(), 0, false };
+    const uint32_t frames = 16000;
+    std::vector<uint8_t>& b = file.bytes;
+    b.resize(12 + 24 + 8 + 200 + 8 + frames * 2);
+    memcpy(&b[0], "RIFF", 4);
+    wavWrite32(&b[4], b.size() - 8);
+    memcpy(&b[8], "WAVEfmt ", 8);
+    wavWrite32(&b[16], 16);
+    wavWrite16(&b[20], WavFormat::FORMAT_PCM);
+    wavWrite16(&b[22], 1);
+    wavWrite32(&b[24], 16000);
+    wavWrite32(&b[28], 32000);
+    wavWrite16(&b[32], 2);
+    wavWrite16(&b[34], 16);
+    memcpy(&b[36], "LIST", 4);
+    wavWrite32(&b[40], 200);
+    memcpy(&b[244], "data", 4);
+    wavWrite32(&b[248], frames * 2);
+    for (uint32_t i = 0; i < frames; i++) {
+        wavWrite16(&b[252 + i * 2], i < 160 ? 0 : (uint16_t)(i % 32 < 16 ? 8000 : -8000));
+    }
+    return file;
+}
+
+// Dial, open and start decoding like WavPlayer, feed frames to the probe until one is audible.
+// Without a known format the header is parsed, with one the decoder seeks straight to the data.
+static uint32_t dialOnce(LatencyProbe& probe, SlowCard& card, const WavFormat* known) {
+    probe.mark(LatencyProbe::Dialled, nowUs);
+    probe.mark(LatencyProbe::Calling, nowUs);
+    card.resetCounts();
+    TEST_ASSERT_TRUE(card.open("/numbers/110_test.wav"));
+    probe.mark(LatencyProbe::Opened, nowUs);
+    CardReader reader = { &card };
+    WavFormat format;
+    if (known) {
+        format = *known;
+        TEST_ASSERT_TRUE(reader.seek(format.dataOffset));
+    } else {
+        TEST_ASSERT_TRUE(parseWavHeader(reader, format));
+    }
+    WavDataReader<CardReader> frames;
+    TEST_ASSERT_TRUE(frames.start(&reader, format, false, 0, 0));
+    probe.mark(LatencyProbe::Begun, nowUs);
+    int16_t frame[2];
+    while (!probe.collect()) {
+        TEST_ASSERT_TRUE(frames.next(frame));
+        probe.onFrame(frame[0], frame[1], nowUs);
+    }
+    card.close();
+    return card.getReads();
+}
+
+static WavFormat indexedFormat(MemoryFile& file) {
+    struct {
+        MemoryFile* file;
+        uint32_t read(void* dest, uint32_t len) { return file->read(dest, len); }
+        bool skip(uint32_t len) { return file->seek(len, SEEK_CUR); }
+    } reader = { &file };
+    WavFormat format;
+    file.open("");
+    parseWavHeader(reader, format);
+    file.close();
+    return format;
+}
+
+void setUp() {
+    nowUs = 0;
+}
+
+void tearDown() {}
+
+// An indexed number needs one open and one read before its first sample
+void test_indexed_start_costs_one_read() {
+    MemoryFile file = makeNumberFile();
+    WavFormat format = indexedFormat(file);
+    SlowCard card(&file, [](uint32_t us) { nowUs += us; });
+    card.setDelays(5000, 1000);
+    LatencyProbe probe;
+    uint32_t reads = dialOnce(probe, card, &format);
+    TEST_ASSERT_EQUAL(1, card.getOpens());
+    TEST_ASSERT_EQUAL(1, reads);
+    TEST_ASSERT_EQUAL(5000, probe.getStageUs(LatencyProbe::Opened));
+    TEST_ASSERT_EQUAL(1000, probe.getStageUs(LatencyProbe::FirstSample));
+    TEST_ASSERT_EQUAL(6000, probe.getStageUs(LatencyProbe::Dialled));
+}
+
+// Parsing the header costs a read per chunk header, the index saves them
+void test_header_walk_costs_more_than_the_index() {
+    MemoryFile file = makeNumberFile();
+    WavFormat format = indexedFormat(file);
+    SlowCard card(&file, [](uint32_t us) { nowUs += us; });
+    card.setDelays(5000, 1000);
+    LatencyProbe probe;
+    uint32_t parsedReads = dialOnce(probe, card, NULL);
+    uint32_t parsedUs = probe.getStageUs(LatencyProbe::Dialled);
+    uint32_t indexedReads = dialOnce(probe, card, &format);
+    uint32_t indexedUs = probe.getStageUs(LatencyProbe::Dialled);
+    TEST_ASSERT_GREATER_THAN(indexedReads, parsedReads);
+    TEST_ASSERT_EQUAL(5000 + parsedReads * 1000, parsedUs);
+    TEST_ASSERT_LESS_THAN(parsedUs, indexedUs);
+}
+
+void test_histogram_counts_every_call() {
+    MemoryFile file = makeNumberFile();
+    WavFormat format = indexedFormat(file);
+    SlowCard card(&file, [](uint32_t us) { nowUs += us; });
+    LatencyProbe probe;
+    const uint32_t openDelays[] = { 0, 1500, 15000, 150000 };
+    for (uint32_t delay : openDelays) {
+        card.setDelays(delay, 0);
+        dialOnce(probe, card, &format);
+    }
+    uint32_t total = 0;
+    for (int b = 0; b < LatencyProbe::BUCKET_COUNT; b++) total += probe.getCount(LatencyProbe::Dialled, b);
+    TEST_ASSERT_EQUAL(4, total);
+    TEST_ASSERT_EQUAL(1, probe.getCount(LatencyProbe::Dialled, 0)); // < 1 ms
+    TEST_ASSERT_EQUAL(1, probe.getCount(LatencyProbe::Dialled, 1)); // < 2 ms
+    TEST_ASSERT_EQUAL(1, probe.getCount(LatencyProbe::Dialled, 4)); // < 20 ms
+    TEST_ASSERT_EQUAL(1, probe.getCount(LatencyProbe::Dialled, 7)); // < 200 ms
+}
+
+// Stages that come out of order are not a measurement
+void test_marks_out_of_order_are_ignored() {
+    LatencyProbe probe;
+    probe.mark(LatencyProbe::Opened, 10);
+    probe.onFrame(10000, 10000, 20);
+    TEST_ASSERT_FALSE(probe.collect());
+    probe.mark(LatencyProbe::Dialled, 100);
+    probe.mark(LatencyProbe::Opened, 110);
+    probe.mark(LatencyProbe::Begun, 120);
+    probe.onFrame(10000, 10000, 130);
+    TEST_ASSERT_FALSE(probe.collect());
+}
+
+// Not a pass/fail check: the latency for some card speeds, to compare changes with
+void test_report_latency_per_card_speed() {
+    MemoryFile file = makeNumberFile();
+    WavFormat format = indexedFormat(file);
+    SlowCard card(&file, [](uint32_t us) { nowUs += us; });
+    const uint32_t delays[][2] = { { 2000, 500 }, { 10000, 2000 }, { 40000, 8000 } };
+    for (const uint32_t* delay : delays) {
+        card.setDelays(delay[0], delay[1]);
+        LatencyProbe probe;
+        dialOnce(probe, card, NULL);
+        uint32_t parsedUs = probe.getStageUs(LatencyProbe::Dialled);
+        dialOnce(probe, card, &format);
+        char message[120];
+        snprintf(message, sizeof(message), "open %u us, read %u us: %u us with the header walk, %u us indexed", (unsigned)delay[0],
+                 (unsigned)delay[1], (unsigned)parsedUs, (unsigned)probe.getStageUs(LatencyProbe::Dialled));
+        TEST_MESSAGE(message);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_indexed_start_costs_one_read);
+    RUN_TEST(test_header_walk_costs_more_than_the_index);
+    RUN_TEST(test_histogram_counts_every_call);
+    RUN_TEST(test_marks_out_of_order_are_ignored);
+    RUN_TEST(test_report_latency_per_card_speed);
+    return UNITY_END();
+}
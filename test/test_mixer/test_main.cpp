@@ -0,0 +1,108 @@
+// Checks the fixed-point mixer against a floating point reference and reports what mixing
+// 1, 2 and 4 voices costs per output sample on this host: pio test -e native -f test_mixer
+
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "AudioMixer.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static const uint32_t BLOCK_SAMPLES = 256 * 2; // MIX_BLOCK_FRAMES stereo frames, as in WavPlayer
+
+static std::vector<int16_t> noise(uint32_t samples, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::vector<int16_t> block(samples);
+    for (int16_t& sample : block) sample = (int16_t)(random() % 65536 - 32768);
+    return block;
+}
+
+static void mix(const std::vector<std::vector<int16_t>>& voices, const int32_t* gains, int16_t* out) {
+    int32_t accumulator[BLOCK_SAMPLES];
+    AudioMixer::clear(accumulator, BLOCK_SAMPLES);
+    for (size_t v = 0; v < voices.size(); v++) {
+        AudioMixer::accumulate(accumulator, voices[v].data(), BLOCK_SAMPLES, gains[v]);
+    }
+    AudioMixer::saturate(out, accumulator, BLOCK_SAMPLES);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_matches_float_reference() {
+    const int32_t gains[4] = { AudioMixer::UNITY_GAIN, AudioMixer::gainToQ15(0.5f), AudioMixer::gainToQ15(0.1f), 0 };
+    std::vector<std::vector<int16_t>> voices;
+    for (uint32_t v = 0; v < 4; v++) voices.push_back(noise(BLOCK_SAMPLES, v + 1));
+    int16_t out[BLOCK_SAMPLES];
+    mix(voices, gains, out);
+    for (uint32_t i = 0; i < BLOCK_SAMPLES; i++) {
+        double sum = 0;
+        for (uint32_t v = 0; v < 4; v++) sum += voices[v][i] * (gains[v] / 32768.0);
+        double expected = sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum;
+        TEST_ASSERT_DOUBLE_WITHIN(2.0, expected, out[i]); // One LSB of rounding per scaled voice
+    }
+}
+
+// Full scale voices of the same sign clip instead of wrapping around
+void test_saturates_instead_of_wrapping() {
+    const int32_t gains[4] = { AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN };
+    std::vector<std::vector<int16_t>> voices(4, std::vector<int16_t>(BLOCK_SAMPLES));
+    for (uint32_t i = 0; i < BLOCK_SAMPLES; i++) {
+        for (uint32_t v = 0; v < 4; v++) voices[v][i] = i % 2 ? 32767 : -32768;
+    }
+    int16_t out[BLOCK_SAMPLES];
+    mix(voices, gains, out);
+    for (uint32_t i = 0; i < BLOCK_SAMPLES; i++) TEST_ASSERT_EQUAL(i % 2 ? 32767 : -32768, out[i]);
+}
+
+void test_single_unity_voice_is_bit_exact() {
+    const int32_t gains[1] = { AudioMixer::UNITY_GAIN };
+    std::vector<std::vector<int16_t>> voices(1, noise(BLOCK_SAMPLES, 7));
+    int16_t out[BLOCK_SAMPLES];
+    mix(voices, gains, out);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(voices[0].data(), out, BLOCK_SAMPLES);
+}
+
+// Not a pass/fail check, the numbers are for comparing changes to the mixer
+void test_report_cost_per_mixed_sample() {
+    const int32_t gains[4] = { AudioMixer::UNITY_GAIN, AudioMixer::gainToQ15(0.7f), AudioMixer::gainToQ15(0.5f), AudioMixer::gainToQ15(0.3f) };
+    const uint32_t blocks = 20000;
+    int16_t out[BLOCK_SAMPLES];
+    int64_t checksum = 0;
+    for (uint32_t count = 1; count <= 4; count *= 2) {
+        std::vector<std::vector<int16_t>> voices;
+        for (uint32_t v = 0; v < count; v++) voices.push_back(noise(BLOCK_SAMPLES, v + 11));
+        auto start = std::chrono::steady_clock::now();
+#if defined(__x86_64__) || defined(__i386__)
+        uint64_t startCycles = __rdtsc();
+#endif
+        for (uint32_t b = 0; b < blocks; b++) {
+            voices[0][b % BLOCK_SAMPLES] ^= 1; // Keeps the compiler from hoisting the mix out of the loop
+            mix(voices, gains, out);
+            checksum += out[b % BLOCK_SAMPLES];
+        }
+        double samples = (double)blocks * BLOCK_SAMPLES;
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        char message[120];
+#if defined(__x86_64__) || defined(__i386__)
+        snprintf(message, sizeof(message), "%u voice(s): %.2f ns, %.2f TSC cycles per mixed sample", (unsigned)count, ns / samples,
+                 (__rdtsc() - startCycles) / samples);
+#else
+        snprintf(message, sizeof(message), "%u voice(s): %.2f ns per mixed sample", (unsigned)count, ns / samples);
+#endif
+        TEST_MESSAGE(message);
+    }
+    TEST_ASSERT_NOT_EQUAL(INT64_MIN, checksum);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_matches_float_reference);
+    RUN_TEST(test_saturates_instead_of_wrapping);
+    RUN_TEST(test_single_unity_voice_is_bit_exact);
+    RUN_TEST(test_report_cost_per_mixed_sample);
+    return UNITY_END();
+}
@@ -0,0 +1,278 @@
+// Saves a NumberTable through NumberIndex and loads it back the way SDReader does at boot: the
+// round trip, a stale or damaged index, the directory signature and the table's own upkeep.
+// pio test -e native -f test_number_index
+
+#include <unity.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "NumberIndex.h"
+#include "NumberTable.h"
+
+struct MemoryWriter {
+    std::vector<uint8_t> bytes;
+
+    uint32_t write(const void* data, uint32_t len) {
+        bytes.insert(bytes.end(), (const uint8_t*)data, (const uint8_t*)data + len);
+        return len;
+    }
+};
+
+// Hands out the file in small pieces, like reads that end at a sector
+struct MemoryReader {
+    const std::vector<uint8_t>* bytes;
+    uint32_t position;
+
+    uint32_t read(void* dest, uint32_t len) {
+        uint32_t count = std::min(std::min(len, (uint32_t)100), (uint32_t)bytes->size() - position);
+        if (count == 0) return 0;
+        memcpy(dest, bytes->data() + position, count);
+        position += count;
+        return count;
+    }
+};
+
+static WavFormat formatOf(uint32_t sampleRate, uint32_t dataLength) {
+    WavFormat format;
+    format.formatTag = WavFormat::FORMAT_PCM;
+    format.channels = 1;
+    format.sampleRate = sampleRate;
+    format.bitsPerSample = 16;
+    format.blockAlign = 2;
+    format.dataOffset = 44;
+    format.dataLength = dataLength;
+    return format;
+}
+
+// Numbers 100 to 100 + count - 1, each with a file "<number>_number <n>.wav"
+static void fillTable(NumberTable& table, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        char number[12], description[20], fileName[40];
+        snprintf(number, sizeof(number), "%u", (unsigned)(100 + i));
+        snprintf(description, sizeof(description), "number %u", (unsigned)i);
+        snprintf(fileName, sizeof(fileName), "%s_%s.wav", number, description);
+        TEST_ASSERT_TRUE(table.append(number, description, fileName, 44 + i * 2, formatOf(8000 + i, i * 2)));
+    }
+    table.sort();
+}
+
+// Builds an index like SDReader::saveIndex()
+static std::vector<uint8_t> save(const NumberTable& table, uint32_t signature) {
+    MemoryWriter writer;
+    NumberIndex::Builder<MemoryWriter> builder(writer, signature);
+    char fileName[NumberTable::MAX_FILE_NAME + 1];
+    for (size_t i = 0; i < table.size(); i++) {
+        const NumberTable::Record& record = table.at(i);
+        NumberIndex::Entry entry;
+        entry.number = table.getNumber(record);
+        entry.description = table.getDescription(record);
+        entry.fileName = table.getFileName(record, fileName);
+        entry.fileSize = record.fileSize;
+        entry.format = record.format;
+        TEST_ASSERT_TRUE(builder.add(entry));
+    }
+    TEST_ASSERT_TRUE(builder.finish());
+    return writer.bytes;
+}
+
+// Loads an index like SDReader::loadIndex(), an entry the table refuses makes it corrupt
+static NumberIndex::LoadResult load(const std::vector<uint8_t>& bytes, uint32_t signature, NumberTable& table) {
+    MemoryReader reader = { &bytes, 0 };
+    bool appended = true;
+    NumberIndex::LoadResult result = NumberIndex::load(reader, signature, [&table, &appended](const NumberIndex::Entry& entry) {
+        appended = table.append(entry.number, entry.description, entry.fileName, entry.fileSize, entry.format) && appended;
+    });
+    table.sort();
+    if (result == NumberIndex::LOADED && !appended) return NumberIndex::CORRUPT;
+    return result;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_index_round_trip() {
+    NumberTable saved;
+    fillTable(saved, 300);
+    std::vector<uint8_t> bytes = save(saved, 1234);
+    NumberTable loaded;
+    TEST_ASSERT_EQUAL(NumberIndex::LOADED, load(bytes, 1234, loaded));
+    TEST_ASSERT_EQUAL(saved.size(), loaded.size());
+    char savedName[NumberTable::MAX_FILE_NAME + 1], loadedName[NumberTable::MAX_FILE_NAME + 1];
+    for (size_t i = 0; i < saved.size(); i++) {
+        const NumberTable::Record& before = saved.at(i);
+        const NumberTable::Record& after = loaded.at(i);
+        TEST_ASSERT_EQUAL_STRING(saved.getFileName(before, savedName), loaded.getFileName(after, loadedName));
+        TEST_ASSERT_EQUAL(before.fileSize, after.fileSize);
+        TEST_ASSERT_EQUAL(before.format.sampleRate, after.format.sampleRate);
+        TEST_ASSERT_EQUAL(before.format.dataOffset, after.format.dataOffset);
+        TEST_ASSERT_EQUAL(before.format.dataLength, after.format.dataLength);
+    }
+}
+
+void test_empty_index_loads() {
+    NumberTable saved, loaded;
+    std::vector<uint8_t> bytes = save(saved, 7);
+    TEST_ASSERT_EQUAL(NumberIndex::HEADER_SIZE + NumberIndex::TRAILER_SIZE, bytes.size());
+    TEST_ASSERT_EQUAL(NumberIndex::LOADED, load(bytes, 7, loaded));
+    TEST_ASSERT_TRUE(loaded.empty());
+}
+
+// Built from other files, the caller scans instead
+void test_other_signature_is_stale() {
+    NumberTable saved, loaded;
+    fillTable(saved, 10);
+    std::vector<uint8_t> bytes = save(saved, 1234);
+    TEST_ASSERT_EQUAL(NumberIndex::STALE, load(bytes, 1235, loaded));
+}
+
+// Every length a torn write can leave, and a flipped bit anywhere after the header
+void test_torn_or_damaged_index_is_corrupt() {
+    NumberTable saved;
+    fillTable(saved, 20);
+    std::vector<uint8_t> bytes = save(saved, 1);
+    for (size_t length = 0; length < bytes.size(); length++) {
+        std::vector<uint8_t> torn(bytes.begin(), bytes.begin() + length);
+        NumberTable loaded;
+        TEST_ASSERT_EQUAL(NumberIndex::CORRUPT, load(torn, 1, loaded));
+    }
+    for (size_t i = NumberIndex::HEADER_SIZE; i < bytes.size(); i += 7) {
+        std::vector<uint8_t> damaged = bytes;
+        damaged[i] ^= 0x10;
+        NumberTable loaded;
+        TEST_ASSERT_NOT_EQUAL(NumberIndex::LOADED, load(damaged, 1, loaded));
+    }
+}
+
+void test_other_version_is_corrupt() {
+    NumberTable saved, loaded;
+    std::vector<uint8_t> bytes = save(saved, 1);
+    wavWrite32(&bytes[4], NumberIndex::VERSION - 1);
+    TEST_ASSERT_EQUAL(NumberIndex::CORRUPT, load(bytes, 1, loaded));
+}
+
+// Checksummed fine but not a file name of the number, the phone scans instead
+void test_entry_the_table_refuses_is_corrupt() {
+    MemoryWriter writer;
+    NumberIndex::Builder<MemoryWriter> builder(writer, 1);
+    NumberIndex::Entry entry = { "12", "twelve", "13_twelve.wav", 44, formatOf(8000, 0) };
+    TEST_ASSERT_TRUE(builder.add(entry));
+    TEST_ASSERT_TRUE(builder.finish());
+    NumberTable loaded;
+    TEST_ASSERT_EQUAL(NumberIndex::CORRUPT, load(writer.bytes, 1, loaded));
+}
+
+// SDReader follows its own changes with add() and remove() in any order
+void test_signature_ignores_order() {
+    NumberIndex::Signature listed, followed;
+    listed.add("1_a.wav", 100, 5);
+    listed.add("2_b.wav", 200, 6);
+    listed.add("3_c.mp3", 300, 7);
+    followed.add("3_c.mp3", 300, 7);
+    followed.add("9_gone.wav", 50, 1);
+    followed.add("1_a.wav", 100, 5);
+    followed.remove("9_gone.wav", 50, 1);
+    followed.add("2_b.wav", 200, 6);
+    TEST_ASSERT_EQUAL(listed.value(), followed.value());
+    TEST_ASSERT_EQUAL(3, followed.getCount());
+}
+
+// A file replaced under its own name must not keep the cached format
+void test_signature_sees_a_replaced_file() {
+    NumberIndex::Signature before, resized, touched, renamed;
+    before.add("1_a.wav", 100, 5);
+    resized.add("1_a.wav", 101, 5);
+    touched.add("1_a.wav", 100, 6);
+    renamed.add("1_b.wav", 100, 5);
+    TEST_ASSERT_NOT_EQUAL(before.value(), resized.value());
+    TEST_ASSERT_NOT_EQUAL(before.value(), touched.value());
+    TEST_ASSERT_NOT_EQUAL(before.value(), renamed.value());
+    TEST_ASSERT_NOT_EQUAL(NumberIndex::Signature().value(), before.value());
+}
+
+void test_table_put_find_erase() {
+    NumberTable table;
+    TEST_ASSERT_TRUE(table.put("20", "twenty", "20_twenty.wav", 1, formatOf(8000, 0)));
+    TEST_ASSERT_TRUE(table.put("1", "one", "1_one.mp3", 2, formatOf(16000, 0)));
+    TEST_ASSERT_TRUE(table.put("3", "three", "3_three.wav", 3, formatOf(22050, 0)));
+    TEST_ASSERT_EQUAL_STRING("1", table.getNumber(table.at(0)));
+    TEST_ASSERT_EQUAL_STRING("20", table.getNumber(table.at(1)));
+    TEST_ASSERT_EQUAL_STRING("3", table.getNumber(table.at(2)));
+    TEST_ASSERT_EQUAL(1, table.lowerBound("2")); // Numbers starting with "2" follow it
+
+    char fileName[NumberTable::MAX_FILE_NAME + 1];
+    const NumberTable::Record* record = table.find("1");
+    TEST_ASSERT_NOT_NULL(record);
+    TEST_ASSERT_EQUAL_STRING("1_one.mp3", table.getFileName(*record, fileName));
+    TEST_ASSERT_EQUAL_STRING("one", table.getDescription(*record));
+    TEST_ASSERT_NULL(table.find("2"));
+
+    // Replacing keeps one record and takes the new file's size and format
+    TEST_ASSERT_TRUE(table.put("1", "uno", "1_uno.wav", 9, formatOf(44100, 0)));
+    TEST_ASSERT_EQUAL(3, table.size());
+    record = table.find("1");
+    TEST_ASSERT_EQUAL_STRING("1_uno.wav", table.getFileName(*record, fileName));
+    TEST_ASSERT_EQUAL(9, record->fileSize);
+    TEST_ASSERT_EQUAL(44100, record->format.sampleRate);
+
+    TEST_ASSERT_TRUE(table.erase("20"));
+    TEST_ASSERT_FALSE(table.erase("20"));
+    TEST_ASSERT_EQUAL(2, table.size());
+    TEST_ASSERT_NULL(table.find("20"));
+}
+
+void test_table_refuses_names_that_do_not_match() {
+    NumberTable table;
+    TEST_ASSERT_FALSE(table.put("1", "one", "1_two.wav", 0, WavFormat()));
+    TEST_ASSERT_FALSE(table.put("1", "one", "1-one.wav", 0, WavFormat()));
+    TEST_ASSERT_FALSE(table.put("1", "one", "1_one.ogg", 0, WavFormat()));
+    std::string longText(NumberTable::MAX_TEXT + 1, 'x');
+    std::string longName = "1_" + longText + ".wav";
+    TEST_ASSERT_FALSE(table.append("1", longText.c_str(), longName.c_str(), 0, WavFormat()));
+    TEST_ASSERT_TRUE(table.empty());
+}
+
+// Of a number appended twice the later file wins, like the last file of a scan
+void test_table_sort_keeps_the_last_duplicate() {
+    NumberTable table;
+    table.append("5", "first", "5_first.wav", 1, WavFormat());
+    table.append("4", "four", "4_four.wav", 2, WavFormat());
+    table.append("5", "second", "5_second.wav", 3, WavFormat());
+    TEST_ASSERT_EQUAL(1, table.sort());
+    TEST_ASSERT_EQUAL(2, table.size());
+    TEST_ASSERT_EQUAL_STRING("second", table.getDescription(*table.find("5")));
+}
+
+// Replaced texts are garbage until they make up half the arena, then the arena is rebuilt
+void test_table_compacts_its_arena() {
+    NumberTable table;
+    fillTable(table, 50);
+    const size_t liveBytes = 50 * sizeof("1xx\0number xx"); // Texts of every number
+    for (int round = 0; round < 200; round++) {
+        char number[12], description[20], fileName[40];
+        snprintf(number, sizeof(number), "%u", (unsigned)(100 + round % 50));
+        snprintf(description, sizeof(description), "number %u", (unsigned)(round % 50));
+        snprintf(fileName, sizeof(fileName), "%s_%s.wav", number, description);
+        TEST_ASSERT_TRUE(table.put(number, description, fileName, 0, WavFormat()));
+        TEST_ASSERT_LESS_OR_EQUAL(1024 + liveBytes, table.getGarbageBytes());
+    }
+    TEST_ASSERT_EQUAL(50, table.size());
+    TEST_ASSERT_EQUAL_STRING("number 7", table.getDescription(*table.find("107")));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_index_round_trip);
+    RUN_TEST(test_empty_index_loads);
+    RUN_TEST(test_other_signature_is_stale);
+    RUN_TEST(test_torn_or_damaged_index_is_corrupt);
+    RUN_TEST(test_other_version_is_corrupt);
+    RUN_TEST(test_entry_the_table_refuses_is_corrupt);
+    RUN_TEST(test_signature_ignores_order);
+    RUN_TEST(test_signature_sees_a_replaced_file);
+    RUN_TEST(test_table_put_find_erase);
+    RUN_TEST(test_table_refuses_names_that_do_not_match);
+    RUN_TEST(test_table_sort_keeps_the_last_duplicate);
+    RUN_TEST(test_table_compacts_its_arena);
+    return UNITY_END();
+}
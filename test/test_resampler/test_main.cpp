@@ -0,0 +1,135 @@
+// Measures the resampler's signal-to-noise ratio for sine waves at the rates the phone plays,
+// checks that block and frame-by-frame conversion agree, and reports what a converted frame
+// costs per block size on this host: pio test -e native -f test_resampler
+
+#include <unity.h>
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "Resampler.h"
+
+static const uint32_t OUTPUT_RATE = 32000; // AUDIO_OUTPUT_RATE in main.cpp
+
+static std::vector<int16_t> sine(uint32_t rate, double hz, uint32_t frames) {
+    std::vector<int16_t> samples(frames * 2);
+    for (uint32_t i = 0; i < frames; i++) {
+        int16_t value = (int16_t)lround(16000 * sin(2 * M_PI * hz * i / rate));
+        samples[i * 2] = value;
+        samples[i * 2 + 1] = (int16_t)-value;
+    }
+    return samples;
+}
+
+// Converts in blocks of up to blockFrames input frames, the way AudioOutputVoice does
+static std::vector<int16_t> convert(Resampler& resampler, const std::vector<int16_t>& input, uint32_t blockFrames) {
+    std::vector<int16_t> output;
+    int16_t out[256 * 2];
+    uint32_t frames = input.size() / 2;
+    uint32_t position = 0;
+    while (position < frames) {
+        uint32_t used;
+        uint32_t count = std::min(blockFrames, frames - position);
+        uint32_t produced = resampler.process(&input[position * 2], count, &used, out, 256);
+        output.insert(output.end(), out, out + produced * 2);
+        position += used;
+    }
+    return output;
+}
+
+// Fits a sine of the known frequency to the left channel after the filter settled, everything
+// that does not fit is noise and distortion
+static double snrDb(const std::vector<int16_t>& output, double hz) {
+    uint32_t first = 64;
+    uint32_t last = output.size() / 2 - 64;
+    double ss = 0, sc = 0;
+    for (uint32_t i = first; i < last; i++) {
+        double angle = 2 * M_PI * hz * i / OUTPUT_RATE;
+        ss += output[i * 2] * sin(angle);
+        sc += output[i * 2] * cos(angle);
+    }
+    double n = last - first;
+    double a = 2 * ss / n, b = 2 * sc / n;
+    double signal = 0, noise = 0;
+    for (uint32_t i = first; i < last; i++) {
+        double angle = 2 * M_PI * hz * i / OUTPUT_RATE;
+        double fitted = a * sin(angle) + b * cos(angle);
+        signal += fitted * fitted;
+        noise += (output[i * 2] - fitted) * (output[i * 2] - fitted);
+    }
+    return 10 * log10(signal / noise);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_sine_snr_per_rate() {
+    const uint32_t rates[] = { 8000, 11025, 16000, 22050, 44100, 48000 };
+    const double tones[] = { 440, 1000, 3000 };
+    for (uint32_t rate : rates) {
+        for (double hz : tones) {
+            Resampler resampler;
+            resampler.setRates(rate, OUTPUT_RATE);
+            std::vector<int16_t> output = convert(resampler, sine(rate, hz, rate / 4), 64);
+            // Short by the input frames still held in the filter
+            TEST_ASSERT_INT_WITHIN(Resampler::TAPS / 2 * OUTPUT_RATE / rate + 1, OUTPUT_RATE / 4, output.size() / 2);
+            double snr = snrDb(output, hz);
+            char message[80];
+            snprintf(message, sizeof(message), "%u Hz -> %u Hz, %.0f Hz tone: %.1f dB", (unsigned)rate, (unsigned)OUTPUT_RATE, hz, snr);
+            TEST_MESSAGE(message);
+            TEST_ASSERT_GREATER_THAN(55, (int)snr);
+        }
+    }
+}
+
+// A block converts to the same samples as the same input handed over one frame at a time
+void test_block_matches_frame_by_frame() {
+    std::vector<int16_t> input = sine(22050, 1000, 5000);
+    Resampler blocks, frames;
+    blocks.setRates(22050, OUTPUT_RATE);
+    frames.setRates(22050, OUTPUT_RATE);
+    std::vector<int16_t> a = convert(blocks, input, 64);
+    std::vector<int16_t> b = convert(frames, input, 1);
+    TEST_ASSERT_EQUAL(b.size(), a.size());
+    TEST_ASSERT_EQUAL_INT16_ARRAY(b.data(), a.data(), a.size());
+}
+
+// Above the lower Nyquist frequency the filter removes the tone instead of folding it back
+void test_rejects_tones_above_output_nyquist() {
+    Resampler resampler;
+    resampler.setRates(48000, OUTPUT_RATE);
+    std::vector<int16_t> output = convert(resampler, sine(48000, 20000, 12000), 64);
+    double energy = 0;
+    for (uint32_t i = 64; i < output.size() / 2; i++) energy += (double)output[i * 2] * output[i * 2];
+    double rms = sqrt(energy / (output.size() / 2 - 64));
+    TEST_ASSERT_LESS_THAN(16000 * 0.707 / 10, (int)rms); // At least 20 dB down
+}
+
+// Not a pass/fail check: the cost per output frame for one frame and for a block per call
+void test_report_cost_per_block_size() {
+    std::vector<int16_t> input = sine(16000, 1000, 160000);
+    const uint32_t blockSizes[] = { 1, 16, 64 };
+    int64_t checksum = 0;
+    for (uint32_t blockFrames : blockSizes) {
+        Resampler resampler;
+        resampler.setRates(16000, OUTPUT_RATE);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<int16_t> output = convert(resampler, input, blockFrames);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        checksum += output[output.size() / 2];
+        char message[100];
+        snprintf(message, sizeof(message), "%u input frame(s) per call: %.2f ns per output frame", (unsigned)blockFrames,
+                 ns / (output.size() / 2));
+        TEST_MESSAGE(message);
+    }
+    TEST_ASSERT_NOT_EQUAL(INT64_MIN, checksum);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_sine_snr_per_rate);
+    RUN_TEST(test_block_matches_frame_by_frame);
+    RUN_TEST(test_rejects_tones_above_output_nyquist);
+    RUN_TEST(test_report_cost_per_block_size);
+    return UNITY_END();
+}
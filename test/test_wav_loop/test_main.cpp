@@ -0,0 +1,153 @@
+// Loops WAV data through WavDataReader and checks the looped stream runs on without a gap or
+// jump at the loop point: pio test -e native -f test_wav_loop
+
+#include <unity.h>
+#include <math.h>
+#include <vector>
+#include "WavDataReader.h"
+
+// A WAV file in memory
+struct MemorySource {
+    std::vector<uint8_t> bytes;
+    uint32_t position;
+    uint32_t seeks;
+
+    uint32_t read(void* dest, uint32_t len) {
+        uint32_t count = std::min(len, (uint32_t)bytes.size() - position);
+        memcpy(dest, bytes.data() + position, count);
+        position += count;
+        return count;
+    }
+
+    bool skip(uint32_t len) {
+        return seek(position + len);
+    }
+
+    bool seek(uint32_t newPosition) {
+        if (newPosition > bytes.size()) return false;
+        position = newPosition;
+        seeks++;
+        return true;
+    }
+};
+
+// Header with a LIST chunk before the data, so the data does not start at 44
+static MemorySource makeWav(uint16_t formatTag, uint16_t channels, uint32_t rate, uint16_t bits, uint16_t blockAlign,
+                            const std::vector<uint8_t>& data) {
+    MemorySource source = { std::vector<uint8_t>(58), 0, 0 };
+    uint8_t* h = source.bytes.data();
+    memcpy(h, "RIFF", 4);
+    wavWrite32(h + 4, 50 + data.size());
+    memcpy(h + 8, "WAVEfmt ", 8);
+    wavWrite32(h + 16, 16);
+    wavWrite16(h + 20, formatTag);
+    wavWrite16(h + 22, channels);
+    wavWrite32(h + 24, rate);
+    wavWrite32(h + 28, rate * blockAlign);
+    wavWrite16(h + 32, blockAlign);
+    wavWrite16(h + 34, bits);
+    memcpy(h + 36, "LIST", 4);
+    wavWrite32(h + 40, 6);
+    memcpy(h + 44, "INFOab", 6);
+    memcpy(h + 50, "data", 4);
+    wavWrite32(h + 54, data.size());
+    source.bytes.insert(source.bytes.end(), data.begin(), data.end());
+    return source;
+}
+
+static bool startReader(WavDataReader<MemorySource>& reader, MemorySource& source, bool loop, uint32_t startMs, uint32_t endMs) {
+    WavFormat format;
+    if (!parseWavHeader(source, format)) return false;
+    return reader.start(&source, format, loop, startMs, endMs);
+}
+
+void setUp() {}
+void tearDown() {}
+
+// 16 bit mono ramp, every sample is its index, looped as a whole
+void test_pcm16_wraps_to_first_sample() {
+    std::vector<uint8_t> data(1000 * 2);
+    for (int i = 0; i < 1000; i++) wavWrite16(&data[i * 2], (uint16_t)i);
+    MemorySource source = makeWav(WavFormat::FORMAT_PCM, 1, 8000, 16, 2, data);
+    WavDataReader<MemorySource> reader;
+    TEST_ASSERT_TRUE(startReader(reader, source, true, 0, 0));
+    source.seeks = 0;
+    for (int i = 0; i < 3500; i++) {
+        int16_t frame[2];
+        TEST_ASSERT_TRUE(reader.next(frame));
+        TEST_ASSERT_EQUAL(i % 1000, frame[0]);
+        TEST_ASSERT_EQUAL(frame[0], frame[1]);
+    }
+    TEST_ASSERT_EQUAL(3, source.seeks); // One seek per wrap, the header is not parsed again
+}
+
+// Loop points in milliseconds: 8000 Hz, loop from 25 ms (frame 200) to 100 ms (frame 800)
+void test_pcm16_loops_the_tail_only() {
+    std::vector<uint8_t> data(1000 * 2);
+    for (int i = 0; i < 1000; i++) wavWrite16(&data[i * 2], (uint16_t)i);
+    MemorySource source = makeWav(WavFormat::FORMAT_PCM, 1, 8000, 16, 2, data);
+    WavDataReader<MemorySource> reader;
+    TEST_ASSERT_TRUE(startReader(reader, source, true, 25, 100));
+    for (int i = 0; i < 3000; i++) {
+        int16_t frame[2];
+        TEST_ASSERT_TRUE(reader.next(frame));
+        int expected = i < 800 ? i : 200 + (i - 800) % 600;
+        TEST_ASSERT_EQUAL(expected, frame[0]);
+    }
+}
+
+// 8 bit stereo, the buffer holds 256 frames so wraps also fall inside a buffer refill
+void test_pcm8_stereo_without_loop_ends() {
+    std::vector<uint8_t> data(301 * 2);
+    for (int i = 0; i < 301; i++) {
+        data[i * 2] = (uint8_t)(i % 256);
+        data[i * 2 + 1] = (uint8_t)(255 - i % 256);
+    }
+    MemorySource source = makeWav(WavFormat::FORMAT_PCM, 2, 8000, 8, 2, data);
+    WavDataReader<MemorySource> reader;
+    TEST_ASSERT_TRUE(startReader(reader, source, false, 0, 0));
+    int16_t frame[2];
+    for (int i = 0; i < 301; i++) {
+        TEST_ASSERT_TRUE(reader.next(frame));
+        TEST_ASSERT_EQUAL((i % 256 - 128) * 256, frame[0]);
+        TEST_ASSERT_EQUAL((127 - i % 256) * 256, frame[1]);
+    }
+    TEST_ASSERT_FALSE(reader.next(frame));
+}
+
+// A 500 Hz sine whose period divides the loop, encoded as ADPCM: no step at the loop point is
+// larger than the steepest step of the sine itself plus the ADPCM error
+void test_adpcm_sine_loop_is_continuous() {
+    const uint16_t blockAlign = 256;
+    const uint32_t perBlock = imaSamplesPerBlock(blockAlign, 1); // 505 frames
+    const uint32_t rate = 8080;                                  // 16 sine periods per block
+    const uint32_t blocks = 8;
+    std::vector<int16_t> sine(perBlock * blocks);
+    for (size_t i = 0; i < sine.size(); i++) sine[i] = (int16_t)(12000 * sin(2 * M_PI * 500 * i / rate));
+    std::vector<uint8_t> data(blockAlign * blocks);
+    ImaAdpcmState state = {};
+    for (uint32_t b = 0; b < blocks; b++) imaEncodeBlock(state, &sine[b * perBlock], blockAlign, &data[b * blockAlign]);
+    MemorySource source = makeWav(WavFormat::FORMAT_IMA_ADPCM, 1, rate, 4, blockAlign, data);
+    WavDataReader<MemorySource> reader;
+    TEST_ASSERT_TRUE(startReader(reader, source, true, 0, 0));
+
+    int maxStep = 0;
+    int16_t previous[2] = { 0, 0 };
+    for (uint32_t i = 0; i < sine.size() * 3; i++) {
+        int16_t frame[2];
+        TEST_ASSERT_TRUE(reader.next(frame));
+        if (i > 0) maxStep = std::max(maxStep, abs(frame[0] - previous[0]));
+        previous[0] = frame[0];
+    }
+    int sineStep = (int)(12000 * 2 * M_PI * 500 / rate) + 1;
+    TEST_ASSERT_LESS_THAN(sineStep + 1500, maxStep);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_pcm16_wraps_to_first_sample);
+    RUN_TEST(test_pcm16_loops_the_tail_only);
+    RUN_TEST(test_pcm8_stereo_without_loop_ends);
+    RUN_TEST(test_adpcm_sine_loop_is_continuous);
+    return UNITY_END();
+}
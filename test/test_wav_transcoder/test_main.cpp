@@ -0,0 +1,169 @@
+// Feeds WAV files through WavTranscoder in small pieces and parses what comes out:
+// pio test -e native -f test_wav_transcoder
+
+#include <unity.h>
+#include <vector>
+#include "WavTranscoder.h"
+
+struct Output {
+    std::vector<uint8_t> bytes;
+};
+
+// Reads the transcoded file back through parseWavHeader()
+struct Reader {
+    const std::vector<uint8_t>* bytes;
+    uint32_t position;
+
+    uint32_t read(void* dest, uint32_t len) {
+        uint32_t count = std::min(len, (uint32_t)bytes->size() - position);
+        memcpy(dest, bytes->data() + position, count);
+        position += count;
+        return count;
+    }
+
+    bool skip(uint32_t len) {
+        position += len;
+        return position <= bytes->size();
+    }
+};
+
+static std::vector<uint8_t> makeWav(uint16_t formatTag, uint16_t channels, uint32_t rate, uint16_t bits, uint16_t blockAlign,
+                                    const std::vector<uint8_t>& data, bool withList) {
+    std::vector<uint8_t> file(36);
+    uint8_t* h = file.data();
+    memcpy(h, "RIFF", 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    wavWrite32(h + 16, 16);
+    wavWrite16(h + 20, formatTag);
+    wavWrite16(h + 22, channels);
+    wavWrite32(h + 24, rate);
+    wavWrite32(h + 28, rate * blockAlign);
+    wavWrite16(h + 32, blockAlign);
+    wavWrite16(h + 34, bits);
+    if (withList) {
+        const uint8_t list[] = { 'L', 'I', 'S', 'T', 5, 0, 0, 0, 'I', 'N', 'F', 'O', 'x', 0 };
+        file.insert(file.end(), list, list + sizeof(list));
+    }
+    const uint8_t chunk[] = { 'd', 'a', 't', 'a', 0, 0, 0, 0 };
+    file.insert(file.end(), chunk, chunk + sizeof(chunk));
+    wavWrite32(&file[file.size() - 4], data.size());
+    file.insert(file.end(), data.begin(), data.end());
+    wavWrite32(&file[4], file.size() - 8);
+    return file;
+}
+
+// Writes the input in odd sized pieces and patches the final header in like the upload does
+static bool transcode(const std::vector<uint8_t>& input, uint32_t rate, uint16_t bits, Output& output, bool* passthrough = NULL) {
+    WavTranscoder transcoder(rate, bits, [&output](const uint8_t* data, size_t len) {
+        output.bytes.insert(output.bytes.end(), data, data + len);
+        return true;
+    });
+    if (!transcoder.begin()) return false;
+    for (size_t i = 0; i < input.size(); i += 37) {
+        if (!transcoder.write(input.data() + i, std::min((size_t)37, input.size() - i))) return false;
+    }
+    uint8_t header[WavTranscoder::MAX_HEADER_SIZE];
+    if (!transcoder.finish(header)) return false;
+    TEST_ASSERT_LESS_OR_EQUAL(output.bytes.size(), transcoder.headerSize());
+    memcpy(output.bytes.data(), header, transcoder.headerSize());
+    if (passthrough) *passthrough = transcoder.isPassthrough();
+    return true;
+}
+
+static WavFormat parse(const Output& output) {
+    Reader reader = { &output.bytes, 0 };
+    WavFormat format;
+    TEST_ASSERT_TRUE(parseWavHeader(reader, format));
+    TEST_ASSERT_EQUAL(output.bytes.size(), format.dataOffset + format.dataLength + (format.dataLength & 1));
+    return format;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// Full scale square wave from 44.1 kHz stereo down to 16 kHz 16 bit, steps of 65535 between
+// neighbouring samples overflowed the interpolation in 32 bits
+void test_full_scale_square_wave() {
+    std::vector<uint8_t> data(4800 * 4);
+    for (int i = 0; i < 4800; i++) {
+        uint16_t value = (i / 7) % 2 ? 0x8000 : 0x7FFF;
+        wavWrite16(&data[i * 4], value);
+        wavWrite16(&data[i * 4 + 2], value);
+    }
+    Output output;
+    bool passthrough = true;
+    TEST_ASSERT_TRUE(transcode(makeWav(WavFormat::FORMAT_PCM, 2, 44100, 16, 4, data, true), 16000, 16, output, &passthrough));
+    TEST_ASSERT_FALSE(passthrough);
+    WavFormat format = parse(output);
+    TEST_ASSERT_EQUAL(WavFormat::FORMAT_PCM, format.formatTag);
+    TEST_ASSERT_EQUAL(1, format.channels);
+    TEST_ASSERT_EQUAL(16000, format.sampleRate);
+    TEST_ASSERT_EQUAL(16, format.bitsPerSample);
+    TEST_ASSERT_INT_WITHIN(4, 4800 * 16000 / 44100 * 2, format.dataLength);
+    for (uint32_t i = 0; i < format.dataLength; i += 2) {
+        int16_t sample = (int16_t)wavRead16(&output.bytes[format.dataOffset + i]);
+        TEST_ASSERT_TRUE(sample >= -32768 && sample <= 32767);
+    }
+}
+
+// IMA ADPCM from wavprep is stored as it is, with its fact chunk
+void test_adpcm_is_passed_through() {
+    std::vector<uint8_t> file = makeWav(WavFormat::FORMAT_IMA_ADPCM, 1, 16000, 4, 256, std::vector<uint8_t>(256 * 3, 0x17), false);
+    // fmt chunk with the two extra bytes and a fact chunk, as tools write it
+    std::vector<uint8_t> extended(file.begin(), file.begin() + 36);
+    wavWrite32(&extended[16], 20);
+    const uint8_t extra[] = { 2, 0, 0xF9, 1, 'f', 'a', 'c', 't', 4, 0, 0, 0, 0xDB, 5, 0, 0 };
+    extended.insert(extended.end(), extra, extra + sizeof(extra));
+    extended.insert(extended.end(), file.begin() + 36, file.end());
+    wavWrite32(&extended[4], extended.size() - 8);
+
+    Output output;
+    bool passthrough = false;
+    TEST_ASSERT_TRUE(transcode(extended, 16000, 8, output, &passthrough));
+    TEST_ASSERT_TRUE(passthrough);
+    TEST_ASSERT_EQUAL(extended.size(), output.bytes.size());
+    TEST_ASSERT_TRUE(output.bytes == extended);
+    WavFormat format = parse(output);
+    TEST_ASSERT_TRUE(format.isImaAdpcm());
+}
+
+// Mono at the target rate and bits only loses its extra chunks
+void test_compliant_pcm_is_passed_through() {
+    std::vector<uint8_t> data(1001);
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 7);
+    Output output;
+    bool passthrough = false;
+    TEST_ASSERT_TRUE(transcode(makeWav(WavFormat::FORMAT_PCM, 1, 16000, 8, 1, data, true), 16000, 8, output, &passthrough));
+    TEST_ASSERT_TRUE(passthrough);
+    WavFormat format = parse(output);
+    TEST_ASSERT_EQUAL(44, format.dataOffset);
+    TEST_ASSERT_EQUAL(1001, format.dataLength);
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), &output.bytes[44], data.size());
+    TEST_ASSERT_EQUAL(0, output.bytes.back()); // Pad byte
+}
+
+void test_pcm_to_adpcm() {
+    std::vector<uint8_t> data(8000 * 2);
+    for (int i = 0; i < 8000; i++) wavWrite16(&data[i * 2], (uint16_t)(int16_t)(i * 37 % 20000 - 10000));
+    Output output;
+    TEST_ASSERT_TRUE(transcode(makeWav(WavFormat::FORMAT_PCM, 1, 8000, 16, 2, data, false), 16000, 4, output));
+    WavFormat format = parse(output);
+    TEST_ASSERT_TRUE(format.isImaAdpcm());
+    TEST_ASSERT_EQUAL(0, format.dataLength % WavTranscoder::ADPCM_BLOCK_ALIGN);
+}
+
+void test_not_a_wav_file() {
+    std::vector<uint8_t> input(100, 'x');
+    Output output;
+    TEST_ASSERT_FALSE(transcode(input, 16000, 8, output));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_full_scale_square_wave);
+    RUN_TEST(test_adpcm_is_passed_through);
+    RUN_TEST(test_compliant_pcm_is_passed_through);
+    RUN_TEST(test_pcm_to_adpcm);
+    RUN_TEST(test_not_a_wav_file);
+    return UNITY_END();
+}
@@ -0,0 +1,141 @@
+// Records into a fake SD card through WavWriter and reads the result back with parseWavHeader():
+// sector alignment, the final header, ADPCM blocks and a card that fails mid-recording.
+// pio test -e native -f test_wav_writer
+
+#include <unity.h>
+#include <vector>
+#include "WavWriter.h"
+
+// The file as the card stores it, each sink call is one write
+struct Card {
+    std::vector<uint8_t> bytes;
+    std::vector<size_t> writes;
+    size_t failAfter; // Writes that succeed before the card fails
+};
+
+struct Reader {
+    const std::vector<uint8_t>* bytes;
+    uint32_t position;
+
+    uint32_t read(void* dest, uint32_t len) {
+        uint32_t count = std::min(len, (uint32_t)bytes->size() - position);
+        memcpy(dest, bytes->data() + position, count);
+        position += count;
+        return count;
+    }
+
+    bool skip(uint32_t len) {
+        position += len;
+        return position <= bytes->size();
+    }
+};
+
+static WavWriter::Sink sinkFor(Card& card) {
+    return [&card](const uint8_t* data, size_t len) {
+        if (card.writes.size() >= card.failAfter) return false;
+        card.bytes.insert(card.bytes.end(), data, data + len);
+        card.writes.push_back(len);
+        return true;
+    };
+}
+
+// Writes the final header back at offset 0 like MicRecorder::stop()
+static WavFormat finish(WavWriter& writer, Card& card, bool expectSaved) {
+    uint8_t header[WavWriter::HEADER_SIZE];
+    TEST_ASSERT_EQUAL(expectSaved, writer.finish(header));
+    memcpy(card.bytes.data(), header, sizeof(header));
+    Reader reader = { &card.bytes, 0 };
+    WavFormat format;
+    TEST_ASSERT_TRUE(parseWavHeader(reader, format));
+    return format;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_pcm_starts_on_a_sector_and_writes_whole_sectors() {
+    Card card = { {}, {}, SIZE_MAX };
+    WavWriter writer(1000, sinkFor(card)); // Rounded up to 1024
+    TEST_ASSERT_EQUAL(1024, writer.getBlockSize());
+    TEST_ASSERT_TRUE(writer.begin(16000, 1));
+    std::vector<int16_t> samples(1500);
+    for (size_t i = 0; i < samples.size(); i++) samples[i] = (int16_t)(i * 41 - 30000);
+    for (size_t i = 0; i < samples.size(); i += 77) {
+        TEST_ASSERT_TRUE(writer.write(&samples[i], std::min((size_t)77, samples.size() - i)));
+    }
+    // Header, then two full blocks while recording
+    TEST_ASSERT_EQUAL(3, card.writes.size());
+    for (size_t len : card.writes) TEST_ASSERT_EQUAL(0, len % WavWriter::SECTOR_SIZE);
+
+    WavFormat format = finish(writer, card, true);
+    TEST_ASSERT_EQUAL(WavWriter::HEADER_SIZE, format.dataOffset);
+    TEST_ASSERT_EQUAL(samples.size() * 2, format.dataLength);
+    TEST_ASSERT_TRUE(format.isPcm());
+    TEST_ASSERT_EQUAL(1, format.channels);
+    TEST_ASSERT_EQUAL(16000, format.sampleRate);
+    TEST_ASSERT_EQUAL(16, format.bitsPerSample);
+    TEST_ASSERT_EQUAL(samples.size() * 2 + WavWriter::HEADER_SIZE - 8, wavRead32(&card.bytes[4]));
+    TEST_ASSERT_EQUAL_MEMORY(samples.data(), &card.bytes[format.dataOffset], format.dataLength);
+}
+
+void test_adpcm_header_counts_the_samples() {
+    Card card = { {}, {}, SIZE_MAX };
+    WavWriter writer(512, sinkFor(card));
+    const uint16_t blockAlign = 256;
+    TEST_ASSERT_TRUE(writer.beginAdpcm(16000, blockAlign));
+    std::vector<int16_t> samples(imaSamplesPerBlock(blockAlign, 1));
+    for (size_t i = 0; i < samples.size(); i++) samples[i] = (int16_t)(i % 50 * 400 - 10000);
+    ImaAdpcmState state;
+    uint8_t block[blockAlign];
+    for (int b = 0; b < 5; b++) {
+        imaEncodeBlock(state, samples.data(), blockAlign, block);
+        TEST_ASSERT_TRUE(writer.writeBytes(block, blockAlign));
+    }
+    WavFormat format = finish(writer, card, true);
+    TEST_ASSERT_TRUE(format.isImaAdpcm());
+    TEST_ASSERT_EQUAL(WavWriter::HEADER_SIZE, format.dataOffset);
+    TEST_ASSERT_EQUAL(5 * blockAlign, format.dataLength);
+    TEST_ASSERT_EQUAL(5 * samples.size(), format.frameCount());
+    TEST_ASSERT_EQUAL(5 * samples.size(), wavRead32(&card.bytes[48])); // fact chunk
+}
+
+// A full card ends the recording, the header still describes what was stored
+void test_failed_write_keeps_a_valid_header() {
+    Card card = { {}, {}, 3 }; // Header and two blocks
+    WavWriter writer(512, sinkFor(card));
+    TEST_ASSERT_TRUE(writer.begin(8000, 1));
+    std::vector<int16_t> samples(256 * 4, 1000);
+    TEST_ASSERT_FALSE(writer.write(samples.data(), samples.size()));
+    TEST_ASSERT_TRUE(writer.hasFailed());
+    TEST_ASSERT_FALSE(writer.write(samples.data(), 10));
+    WavFormat format = finish(writer, card, false);
+    TEST_ASSERT_EQUAL(2 * 512, format.dataLength);
+    TEST_ASSERT_EQUAL(2, writer.getBlockWrites());
+}
+
+// begin() starts a new file, nothing of the previous recording is left
+void test_begin_resets_the_counts() {
+    Card card = { {}, {}, SIZE_MAX };
+    WavWriter writer(512, sinkFor(card));
+    std::vector<int16_t> samples(300, -5);
+    TEST_ASSERT_TRUE(writer.begin(16000, 1));
+    writer.write(samples.data(), samples.size());
+    uint8_t header[WavWriter::HEADER_SIZE];
+    writer.finish(header);
+    card = { {}, {}, SIZE_MAX };
+    TEST_ASSERT_TRUE(writer.begin(16000, 2));
+    writer.write(samples.data(), 100);
+    WavFormat format = finish(writer, card, true);
+    TEST_ASSERT_EQUAL(200, format.dataLength);
+    TEST_ASSERT_EQUAL(2, format.channels);
+    TEST_ASSERT_EQUAL(1, writer.getBlockWrites());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_pcm_starts_on_a_sector_and_writes_whole_sectors);
+    RUN_TEST(test_adpcm_header_counts_the_samples);
+    RUN_TEST(test_failed_write_keeps_a_valid_header);
+    RUN_TEST(test_begin_resets_the_counts);
+    return UNITY_END();
+}
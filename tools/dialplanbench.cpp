@@ -0,0 +1,129 @@
+// Compiles dial plans of random rules the way SDReader loads /dialplan.txt and reports the
+// DFA's states, table bytes, compile time and the cost per digit, with and without the
+// DialPlan::MAX_STATES limit the phone compiles with. Checks the DFA against a direct match of
+// every pattern on random numbers.
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/dialplanbench.cpp -o dialplanbench
+// Usage: dialplanbench [rule counts...]       default 10 100 1000 10000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "DialPlan.h"
+
+static double nowUs() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+// Mostly fixed digits like a real plan, some 'x', sets and trailing '*'
+static std::string randomPattern(std::mt19937& random) {
+    std::string pattern;
+    uint32_t length = 2 + random() % 6;
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t kind = random() % 20;
+        if (kind < 14) {
+            pattern += (char)('0' + random() % 10);
+        } else if (kind < 17) {
+            pattern += 'x';
+        } else {
+            int from = random() % 9;
+            int to = from + 1 + random() % (9 - from);
+            pattern += "[" + std::to_string(from) + "-" + std::to_string(to) + "]";
+        }
+    }
+    if (random() % 20 == 0) pattern += '*';
+    return pattern;
+}
+
+// Straight recursive match of one pattern, the reference for the DFA
+static bool matches(const char* pattern, const char* digits) {
+    if (!*pattern) return !*digits;
+    if (*pattern == '*') return matches(pattern + 1, digits) || (*digits && matches(pattern, digits + 1));
+    if (!*digits) return false;
+    if (*pattern == 'x') return matches(pattern + 1, digits + 1);
+    if (*pattern == '[') {
+        bool in = *digits >= pattern[1] && *digits <= pattern[3];
+        return in && matches(pattern + 5, digits + 1);
+    }
+    return *pattern == *digits && matches(pattern + 1, digits + 1);
+}
+
+static std::string randomNumber(std::mt19937& random) {
+    std::string number;
+    uint32_t length = 2 + random() % 7;
+    for (uint32_t i = 0; i < length; i++) number += (char)('0' + random() % 10);
+    return number;
+}
+
+int main(int argc, char** argv) {
+    std::vector<uint32_t> counts;
+    for (int i = 1; i < argc; i++) {
+        counts.push_back((uint32_t)atoi(argv[i]));
+    }
+    if (counts.empty()) counts = { 10, 100, 1000, 10000 };
+    std::mt19937 random(1);
+    bool ok = true;
+
+    printf("%8s %10s %12s %10s %10s %14s\n", "rules", "states", "bytes", "compile", "ns/digit", "phone limit");
+    for (uint32_t count : counts) {
+        std::vector<std::string> patterns;
+        DialPlan plan;
+        const char* error;
+        for (uint32_t i = 0; i < count; i++) {
+            patterns.push_back(randomPattern(random));
+            plan.addRule(patterns.back().c_str(), DialPlan::PLAY, "x.wav", &error);
+        }
+
+        double start = nowUs();
+        plan.compile(SIZE_MAX);
+        double compileMs = (nowUs() - start) / 1000;
+
+        // Lookups with the state kept per digit, as PhoneController does while dialling
+        std::vector<std::string> numbers;
+        for (uint32_t i = 0; i < 100000; i++) numbers.push_back(randomNumber(random));
+        uint64_t digits = 0;
+        int64_t checksum = 0;
+        start = nowUs();
+        for (const std::string& number : numbers) {
+            int32_t state = plan.startState();
+            for (char c : number) state = plan.step(state, c - '0');
+            checksum += plan.ruleAt(state) + plan.canExtend(state);
+            digits += number.size();
+        }
+        double digitNs = (nowUs() - start) * 1000 / digits;
+
+        uint32_t wrong = 0;
+        for (uint32_t i = 0; i < 2000; i++) {
+            const std::string& number = numbers[i];
+            int32_t expected = DialPlan::NO_RULE;
+            for (uint32_t r = 0; r < count && expected == DialPlan::NO_RULE; r++) {
+                if (matches(patterns[r].c_str(), number.c_str())) expected = (int32_t)r;
+            }
+            if (plan.match(number.c_str()) != expected) wrong++;
+        }
+        if (wrong > 0) {
+            printf("%u of 2000 numbers matched the wrong rule with %u rules\n", (unsigned)wrong, (unsigned)count);
+            ok = false;
+        }
+        size_t states = plan.getStateCount();
+        size_t bytes = plan.getTableBytes();
+
+        start = nowUs();
+        bool accepted = plan.compile();
+        double limitedMs = (nowUs() - start) / 1000;
+        if (accepted != (states <= DialPlan::MAX_STATES)) {
+            printf("The state limit decided wrongly for %u states\n", (unsigned)states);
+            ok = false;
+        }
+        char limit[40];
+        snprintf(limit, sizeof(limit), accepted ? "fits" : "refused %.1f ms", limitedMs);
+        printf("%8u %10u %12u %8.1f ms %10.2f %14s\n", (unsigned)count, (unsigned)states, (unsigned)bytes, compileMs, digitNs, limit);
+        if (checksum == INT64_MIN) printf("\n");
+    }
+    return ok ? 0 : 1;
+}
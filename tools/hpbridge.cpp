@@ -0,0 +1,196 @@
+// Runs the phones' conference bridge on a PC, phones (or hpcall) call it like any other phone.
+// Every 5 seconds it prints the participants and the CPU time the mixing takes per participant.
+// --bench mixes 1 to N simulated participants in-process, without sockets, and checks that
+// nobody hears themselves.
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/hpbridge.cpp -o hpbridge
+// Usage: hpbridge [-n max participants] <local port>
+//        hpbridge --bench <participants>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <vector>
+#include "ConferenceBridge.h"
+
+static const uint32_t RATE = 16000;
+static const uint16_t FRAME = 320; // 20 ms, like the phone
+static const uint32_t FRAME_US = FRAME * 1000000ull / RATE;
+static const uint16_t JITTER_SLOTS = 8;
+
+static void usage() {
+    fprintf(stderr, "Usage: hpbridge [-n max participants] <local port>\n");
+    fprintf(stderr, "       hpbridge --bench <participants>\n");
+}
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t nowUs() {
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Participant i sends the constant (i + 1) * 100, so every mix has a known value
+static bool bench(uint16_t count, uint32_t rounds) {
+    uint32_t now = 0;
+    std::vector<CallEngine*> clients;
+    std::vector<int32_t> heard(count, 0);
+    CallPeer bridgePeer;
+    bridgePeer.port = 1;
+    ConferenceBridge* bridgePointer = nullptr;
+    ConferenceBridge bridge(count, FRAME, RATE, JITTER_SLOTS, 1, [&](const CallPeer& to, const uint8_t* data, size_t len) {
+        clients[to.port - 100]->receive(bridgePeer, data, len, now);
+        return true;
+    });
+    bridgePointer = &bridge;
+    for (uint16_t i = 0; i < count; i++) {
+        CallPeer self;
+        self.port = 100 + i;
+        clients.push_back(new CallEngine(FRAME, 1000 + i, [bridgePointer, self, &now](const CallPeer&, const uint8_t* data, size_t len) {
+            bridgePointer->receive(self, data, len, now);
+            return true;
+        }));
+        clients[i]->onAudio([&heard, i](uint16_t, uint32_t, const int16_t* samples, uint32_t) { heard[i] = samples[FRAME / 2]; });
+        clients[i]->call(bridgePeer, "99", now);
+    }
+    if (bridge.getParticipantCount() != count) {
+        printf("%u participants: only %u joined\n", count, bridge.getParticipantCount());
+        return false;
+    }
+
+    int16_t frame[FRAME];
+    uint64_t tickUs = 0;
+    for (uint32_t round = 0; round < rounds; round++) {
+        now += FRAME_US / 1000;
+        for (uint16_t i = 0; i < count; i++) {
+            for (uint16_t s = 0; s < FRAME; s++) frame[s] = (int16_t)((i + 1) * 100);
+            clients[i]->sendAudio(frame, now);
+        }
+        uint64_t start = nowUs();
+        bridge.tick(now);
+        tickUs += nowUs() - start;
+    }
+
+    bool ok = true;
+    int32_t total = count * (count + 1) / 2 * 100;
+    for (uint16_t i = 0; i < count; i++) {
+        if (heard[i] != total - (i + 1) * 100) ok = false;
+        delete clients[i];
+    }
+    double perTick = (double)tickUs / rounds;
+    printf("%u participants: %.1f us per frame, %.1f us per participant, %.2f%% of one core, mixes %s\n", count, perTick,
+           perTick / count, perTick * 100 / FRAME_US, ok ? "correct" : "WRONG");
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int benchParticipants = 0;
+    uint16_t maxParticipants = 8;
+    int localPort = 0;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--bench") == 0 && hasValue) {
+            benchParticipants = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && hasValue) {
+            maxParticipants = (uint16_t)atoi(argv[++i]);
+        } else if (argv[i][0] == '-' || localPort != 0) {
+            usage();
+            return 1;
+        } else {
+            localPort = atoi(argv[i]);
+        }
+    }
+
+    if (benchParticipants > 0) {
+        bool ok = true;
+        for (int count = 1; count <= benchParticipants; count++) {
+            ok = bench((uint16_t)count, 5000) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+    if (localPort <= 0 || maxParticipants == 0) {
+        usage();
+        return 1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons((uint16_t)localPort);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 || bind(fd, (sockaddr*)&local, sizeof(local)) != 0) {
+        perror("bind");
+        return 1;
+    }
+    ConferenceBridge bridge(maxParticipants, FRAME, RATE, JITTER_SLOTS, (uint32_t)nowUs(),
+                            [fd](const CallPeer& to, const uint8_t* data, size_t len) {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = to.address;
+        address.sin_port = htons(to.port);
+        return sendto(fd, data, len, 0, (sockaddr*)&address, sizeof(address)) == (ssize_t)len;
+    });
+    bridge.onMember([&bridge](uint16_t participant, bool joined) {
+        const CallEngine& engine = bridge.getEngine(participant);
+        in_addr address;
+        address.s_addr = engine.getPeer().address;
+        printf("%s:%u %s, %u on the bridge\n", inet_ntoa(address), engine.getPeer().port, joined ? "joined" : "left",
+               bridge.getParticipantCount());
+    });
+    setvbuf(stdout, NULL, _IOLBF, 0); // Reports show up while it runs, also in a pipe
+    printf("Bridge for %u participants on port %d\n", maxParticipants, localPort);
+
+    uint64_t nextTickUs = nowUs() + FRAME_US;
+    uint64_t busyUs = 0, maxTickUs = 0, participantFrames = 0;
+    uint32_t ticks = 0;
+    uint32_t reportMs = nowMs() + 5000;
+    while (true) {
+        uint64_t us = nowUs();
+        while (us >= nextTickUs) {
+            uint64_t start = nowUs();
+            uint16_t mixed = bridge.tick(nowMs());
+            uint64_t elapsed = nowUs() - start;
+            if (mixed > 0) {
+                busyUs += elapsed;
+                if (elapsed > maxTickUs) maxTickUs = elapsed;
+                participantFrames += mixed;
+                ticks++;
+            }
+            nextTickUs += FRAME_US;
+        }
+        if ((int32_t)(nowMs() - reportMs) >= 0) {
+            if (ticks > 0) {
+                printf("%u participants, %.1f us per frame (max %u), %.1f us per participant, %.2f%% CPU, %u concealed\n",
+                       bridge.getParticipantCount(), (double)busyUs / ticks, (unsigned)maxTickUs, (double)busyUs / participantFrames,
+                       (double)busyUs * 100 / ticks / FRAME_US, bridge.getConcealedFrames());
+            }
+            busyUs = maxTickUs = participantFrames = 0;
+            ticks = 0;
+            reportMs += 5000;
+        }
+
+        pollfd p = { fd, POLLIN, 0 };
+        if (poll(&p, 1, 1) > 0) {
+            uint8_t packet[2048];
+            sockaddr_in from = {};
+            socklen_t fromLen = sizeof(from);
+            ssize_t len = recvfrom(fd, packet, sizeof(packet), 0, (sockaddr*)&from, &fromLen);
+            if (len > 0) {
+                CallPeer peer;
+                peer.address = from.sin_addr.s_addr;
+                peer.port = ntohs(from.sin_port);
+                bridge.receive(peer, packet, (size_t)len, nowMs());
+            }
+        }
+        bridge.poll(nowMs());
+    }
+}
@@ -0,0 +1,340 @@
+// Talks to a phone, or to a second hpcall, with the phone's call engine and jitter buffer.
+// Two instances on one PC make a loopback call: both share the monotonic clock, so the
+// mouth-to-ear latency of every frame is measured exactly. Outgoing audio can be impaired
+// with random loss and delay (which also reorders), the playout clock can be skewed.
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/hpcall.cpp -o hpcall
+// Usage: hpcall [options] <local port>
+//   hpcall 7002 --out received.wav                 answers the first call
+//   hpcall 7001 --call 127.0.0.1:7002 --seconds 10 --loss 5 --jitter 40
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "CallEngine.h"
+#include "JitterBuffer.h"
+#include "WavTranscoder.h"
+#include "WavWriter.h"
+
+static const uint32_t RATE = 16000;
+static const uint16_t FRAME = 320; // 20 ms, like the phone
+static const uint32_t FRAME_MS = FRAME * 1000 / RATE;
+static const uint16_t JITTER_SLOTS = 32;
+
+static void usage() {
+    fprintf(stderr, "Usage: hpcall [options] <local port>\n");
+    fprintf(stderr, "  --call host:port   call instead of waiting for a call\n");
+    fprintf(stderr, "  --number n         own number sent with the call (default 99)\n");
+    fprintf(stderr, "  --seconds s        hang up after s seconds of talking (default: wait for the other side)\n");
+    fprintf(stderr, "  --answer-after ms  ring this long before answering (default 500)\n");
+    fprintf(stderr, "  --loss percent     drop outgoing audio packets at random\n");
+    fprintf(stderr, "  --jitter ms        delay outgoing audio packets by a random 0..ms\n");
+    fprintf(stderr, "  --skew ppm         playout clock runs this much fast (negative: slow)\n");
+    fprintf(stderr, "  --in file.wav     audio to send (default: a 440 Hz tone in bursts)\n");
+    fprintf(stderr, "  --out file.wav    writes what was played out\n");
+}
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t nowUs() {
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static bool parsePeer(const char* text, CallPeer& peer) {
+    std::string host = text;
+    size_t colon = host.rfind(':');
+    if (colon == std::string::npos) return false;
+    in_addr address;
+    if (inet_pton(AF_INET, host.substr(0, colon).c_str(), &address) != 1) return false;
+    peer.address = address.s_addr;
+    peer.port = (uint16_t)atoi(host.c_str() + colon + 1);
+    return peer.port != 0;
+}
+
+// Converts the input to 16 bit mono at RATE with the web upload's transcoder
+static bool loadSamples(const char* path, std::vector<int16_t>& samples) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+    std::vector<uint8_t> converted;
+    WavTranscoder transcoder(RATE, 16, [&converted](const uint8_t* data, size_t len) {
+        converted.insert(converted.end(), data, data + len);
+        return true;
+    });
+    bool ok = transcoder.begin();
+    uint8_t buffer[16 * 1024];
+    size_t len;
+    while (ok && (len = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        ok = transcoder.write(buffer, len);
+    }
+    fclose(in);
+    uint8_t header[WavTranscoder::MAX_HEADER_SIZE];
+    if (!ok || !transcoder.finish(header)) {
+        fprintf(stderr, "%s: %s\n", path, transcoder.getError() ? transcoder.getError() : "conversion failed");
+        return false;
+    }
+    size_t headerSize = transcoder.headerSize();
+    samples.resize((converted.size() - headerSize) / 2);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = (int16_t)wavRead16(&converted[headerSize + i * 2]);
+    }
+    return true;
+}
+
+// Half a second of tone, half a second of silence, so gaps are easy to hear in the output
+static void makeTone(std::vector<int16_t>& samples) {
+    samples.resize(RATE);
+    for (uint32_t i = 0; i < RATE; i++) {
+        samples[i] = i < RATE / 2 ? (int16_t)(8000 * sin(2 * M_PI * 440 * i / RATE)) : 0;
+    }
+}
+
+// Outgoing packets wait here for their simulated network delay
+struct DelayedPacket {
+    uint32_t dueMs;
+    CallPeer to;
+    std::vector<uint8_t> data;
+};
+
+static uint32_t percentile(std::vector<uint32_t> values, uint32_t percent) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * percent / 100)];
+}
+
+int main(int argc, char** argv) {
+    const char* callTo = nullptr;
+    const char* number = "99";
+    const char* inPath = nullptr;
+    const char* outPath = nullptr;
+    double seconds = 0;
+    uint32_t answerAfterMs = 500;
+    double lossPercent = 0;
+    uint32_t jitterMs = 0;
+    double skewPpm = 0;
+    int localPort = 0;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--call") == 0 && hasValue) {
+            callTo = argv[++i];
+        } else if (strcmp(argv[i], "--number") == 0 && hasValue) {
+            number = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--answer-after") == 0 && hasValue) {
+            answerAfterMs = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loss") == 0 && hasValue) {
+            lossPercent = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--jitter") == 0 && hasValue) {
+            jitterMs = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--skew") == 0 && hasValue) {
+            skewPpm = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--in") == 0 && hasValue) {
+            inPath = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && hasValue) {
+            outPath = argv[++i];
+        } else if (argv[i][0] == '-' || localPort != 0) {
+            usage();
+            return 1;
+        } else {
+            localPort = atoi(argv[i]);
+        }
+    }
+    CallPeer target;
+    if (localPort <= 0 || (callTo && !parsePeer(callTo, target))) {
+        usage();
+        return 1;
+    }
+
+    std::vector<int16_t> source;
+    if (inPath) {
+        if (!loadSamples(inPath, source) || source.size() < FRAME) return 1;
+    } else {
+        makeTone(source);
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons((uint16_t)localPort);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 || bind(fd, (sockaddr*)&local, sizeof(local)) != 0) {
+        perror("bind");
+        return 1;
+    }
+
+    std::mt19937 random((uint32_t)nowUs());
+    std::uniform_real_distribution<double> chance(0, 100);
+    std::vector<DelayedPacket> delayed;
+    uint32_t droppedByImpairment = 0;
+
+    auto sendNow = [fd](const CallPeer& to, const uint8_t* data, size_t len) {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = to.address;
+        address.sin_port = htons(to.port);
+        return sendto(fd, data, len, 0, (sockaddr*)&address, sizeof(address)) == (ssize_t)len;
+    };
+    // Only audio is impaired, the signaling has its own retransmissions
+    CallEngine engine(FRAME, (uint32_t)nowUs(), [&](const CallPeer& to, const uint8_t* data, size_t len) {
+        if (len <= CallEngine::HEADER_SIZE || data[3] != CallEngine::AUDIO) return sendNow(to, data, len);
+        if (chance(random) < lossPercent) {
+            droppedByImpairment++;
+            return true;
+        }
+        uint32_t delay = jitterMs ? (uint32_t)(chance(random) * (jitterMs + 1) / 100) : 0;
+        if (delay == 0) return sendNow(to, data, len);
+        delayed.push_back({ nowMs() + delay, to, std::vector<uint8_t>(data, data + len) });
+        return true;
+    });
+
+    JitterBuffer jitter(FRAME, JITTER_SLOTS, RATE);
+    engine.onAudio([&jitter](uint16_t seq, uint32_t timestamp, const int16_t* samples, uint32_t sentMs) {
+        jitter.push(seq, timestamp, samples, nowMs(), sentMs);
+    });
+    bool finished = false;
+    uint32_t connectedMs = 0;
+    uint32_t ringingSinceMs = 0;
+    engine.onStateChanged([&](CallEngine::State oldState, CallEngine::State newState) {
+        printf("%s -> %s", CallEngine::getStateName(oldState), CallEngine::getStateName(newState));
+        if (newState == CallEngine::IDLE) printf(" (%s)", CallEngine::getEndReasonName(engine.getEndReason()));
+        if (newState == CallEngine::INCOMING) printf(", call from %s", engine.getRemoteNumber());
+        printf("\n");
+        if (newState == CallEngine::INCOMING) ringingSinceMs = nowMs();
+        if (newState == CallEngine::CONNECTED) {
+            connectedMs = nowMs();
+            jitter.reset();
+        }
+        if (newState == CallEngine::IDLE) finished = true;
+    });
+
+    FILE* out = nullptr;
+    WavWriter* writer = nullptr;
+    if (outPath) {
+        out = fopen(outPath, "wb");
+        if (!out) {
+            fprintf(stderr, "%s: cannot create\n", outPath);
+            return 1;
+        }
+        writer = new WavWriter(8192, [out](const uint8_t* data, size_t len) { return fwrite(data, 1, len, out) == len; });
+        writer->begin(RATE, 1);
+    }
+
+    if (callTo) {
+        engine.call(target, number, nowMs());
+    } else {
+        printf("Waiting for a call on port %d\n", localPort);
+    }
+
+    // Capture and playout both tick once per frame, the playout tick can be skewed
+    double playPeriodUs = FRAME_MS * 1000.0 / (1 + skewPpm / 1e6);
+    uint64_t nextCaptureUs = 0;
+    double nextPlayUs = 0;
+    size_t sourcePos = 0;
+    std::vector<uint32_t> mouthToEar;
+    uint32_t played = 0, concealed = 0, silent = 0;
+    int16_t frame[FRAME];
+
+    while (!finished) {
+        uint32_t now = nowMs();
+        uint64_t us = nowUs();
+        if (engine.getState() == CallEngine::CONNECTED) {
+            if (nextCaptureUs == 0) {
+                nextCaptureUs = us + FRAME_MS * 1000;
+                nextPlayUs = (double)us + playPeriodUs;
+            }
+            // A frame is sent once all of its samples have been "captured"
+            while (us >= nextCaptureUs) {
+                for (uint16_t i = 0; i < FRAME; i++) {
+                    frame[i] = source[sourcePos];
+                    sourcePos = (sourcePos + 1) % source.size();
+                }
+                engine.sendAudio(frame, now);
+                nextCaptureUs += FRAME_MS * 1000;
+            }
+            while ((double)us >= nextPlayUs) {
+                uint32_t sentMs = 0;
+                JitterBuffer::Result result = jitter.pop(frame, &sentMs);
+                if (result == JitterBuffer::PLAYED) {
+                    // The first sample was captured one frame before the packet was sent
+                    mouthToEar.push_back(now - sentMs + FRAME_MS);
+                    played++;
+                } else if (result == JitterBuffer::CONCEALED) {
+                    concealed++;
+                } else {
+                    silent++;
+                }
+                if (writer) writer->write(frame, FRAME);
+                nextPlayUs += playPeriodUs;
+            }
+            if (seconds > 0 && now - connectedMs >= seconds * 1000) {
+                engine.hangup(now);
+            }
+        } else if (engine.getState() == CallEngine::INCOMING && now - ringingSinceMs >= answerAfterMs) {
+            engine.answer(now);
+        }
+
+        for (size_t i = 0; i < delayed.size();) {
+            if ((int32_t)(now - delayed[i].dueMs) >= 0) {
+                sendNow(delayed[i].to, delayed[i].data.data(), delayed[i].data.size());
+                delayed.erase(delayed.begin() + i);
+            } else {
+                i++;
+            }
+        }
+
+        pollfd p = { fd, POLLIN, 0 };
+        if (poll(&p, 1, 1) > 0) {
+            uint8_t packet[2048];
+            sockaddr_in from = {};
+            socklen_t fromLen = sizeof(from);
+            ssize_t len = recvfrom(fd, packet, sizeof(packet), 0, (sockaddr*)&from, &fromLen);
+            if (len > 0) {
+                CallPeer peer;
+                peer.address = from.sin_addr.s_addr;
+                peer.port = ntohs(from.sin_port);
+                engine.receive(peer, packet, (size_t)len, nowMs());
+            }
+        }
+        engine.poll(nowMs());
+    }
+
+    if (writer) {
+        uint8_t header[WavWriter::HEADER_SIZE];
+        writer->finish(header);
+        fseek(out, 0, SEEK_SET);
+        fwrite(header, 1, sizeof(header), out);
+        fclose(out);
+        delete writer;
+    }
+    close(fd);
+
+    const JitterBuffer::Stats& stats = jitter.getStats();
+    uint32_t expected = stats.received + stats.lost;
+    printf("Sent %u packets (%u dropped on purpose), received %u\n", engine.getSentPackets(), droppedByImpairment, engine.getReceivedPackets());
+    printf("Audio: %u frames played, %u concealed, %u silent\n", played, concealed, silent);
+    printf("Jitter buffer: %u received, %u lost (%.1f%%), %u late, %u duplicates, %u underruns, %u skipped, %u resyncs\n",
+           stats.received, stats.lost, expected ? 100.0 * stats.lost / expected : 0.0, stats.late, stats.duplicates,
+           stats.underruns, stats.skipped, stats.resyncs);
+    printf("Jitter %u ms, target %u frames, round trip %u ms\n", jitter.getJitterMs(), jitter.getTargetFrames(), engine.getRttMs());
+    printf("Mouth to ear: median %u ms, 95%% %u ms, max %u ms\n", percentile(mouthToEar, 50), percentile(mouthToEar, 95),
+           percentile(mouthToEar, 100));
+    return 0;
+}
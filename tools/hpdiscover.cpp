@@ -0,0 +1,339 @@
+// Simulates a venue of phones that find each other with the phone's PeerTable. mDNS is
+// replaced by a stand-in on loopback multicast that carries the same TXT keys: phones announce
+// themselves when they start, answer queries to the group, say goodbye when they leave and
+// query when their table asks for it. The run checks that every phone resolves every other
+// one, that lookups do not send queries, that goodbyes and silent departures are noticed, and
+// compares a table lookup with asking the network on every lookup.
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/hpdiscover.cpp -o hpdiscover
+// Usage: hpdiscover [--phones n] [--ttl ms]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "PeerTable.h"
+
+static const char* GROUP = "239.255.42.2";
+static const uint16_t PORT = 4213;
+static const uint16_t CALL_PORT_BASE = 5000;
+static const uint8_t VERSION = 1;
+enum PacketType { QUERY = 1, ANSWER };
+
+static void usage() {
+    fprintf(stderr, "Usage: hpdiscover [--phones n] [--ttl ms]\n");
+}
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t nowNs() {
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Stand-in packet: 'H' 'D' version type, ttl (32 bit, ms), port (16 bit), then TXT data like
+// DNS: strings of key=value, each after a length byte
+static size_t buildPacket(uint8_t* packet, uint8_t type, uint32_t ttlMs, uint16_t port, const std::vector<std::string>& txt) {
+    packet[0] = 'H';
+    packet[1] = 'D';
+    packet[2] = VERSION;
+    packet[3] = type;
+    wavWrite32(packet + 4, ttlMs);
+    wavWrite16(packet + 8, port);
+    size_t len = 10;
+    for (const std::string& item : txt) {
+        packet[len++] = (uint8_t)item.size();
+        memcpy(packet + len, item.data(), item.size());
+        len += item.size();
+    }
+    return len;
+}
+
+static std::string findTxt(const uint8_t* packet, size_t len, const char* key) {
+    size_t keyLen = strlen(key);
+    size_t pos = 10;
+    while (pos < len && pos + 1 + packet[pos] <= len) {
+        const char* item = (const char*)packet + pos + 1;
+        uint8_t itemLen = packet[pos];
+        if (itemLen > keyLen && memcmp(item, key, keyLen) == 0 && item[keyLen] == '=') {
+            return std::string(item + keyLen + 1, itemLen - keyLen - 1);
+        }
+        pos += 1 + itemLen;
+    }
+    return "";
+}
+
+struct Phone {
+    std::string name;
+    std::string numbers;
+    std::string conf;
+    std::string caps;
+    uint16_t callPort;
+    int fd = -1;
+    bool online = false;
+    bool silent = false; // Gone without a goodbye
+    uint32_t ttlMs;
+    std::unique_ptr<PeerTable> table;
+    uint32_t queriesSent = 0;
+
+    void send(uint8_t type, uint32_t ttl) {
+        uint8_t packet[256];
+        size_t len = buildPacket(packet, type, ttl, callPort,
+                                 type == QUERY ? std::vector<std::string>{ "name=" + name }
+                                               : std::vector<std::string>{ "name=" + name, "num=" + numbers, "conf=" + conf, "caps=" + caps });
+        sockaddr_in group = {};
+        group.sin_family = AF_INET;
+        group.sin_addr.s_addr = inet_addr(GROUP);
+        group.sin_port = htons(PORT);
+        sendto(fd, packet, len, 0, (sockaddr*)&group, sizeof(group));
+        if (type == QUERY) queriesSent++;
+    }
+
+    void receive(const uint8_t* packet, size_t len, uint32_t address) {
+        if (len < 10 || packet[0] != 'H' || packet[1] != 'D' || packet[2] != VERSION) return;
+        std::string from = findTxt(packet, len, "name");
+        if (from == name) return;
+        if (packet[3] == QUERY) {
+            send(ANSWER, ttlMs);
+            return;
+        }
+        CallPeer peer;
+        peer.address = address;
+        peer.port = wavRead16(packet + 8);
+        table->update(from.c_str(), peer, findTxt(packet, len, "num").c_str(), findTxt(packet, len, "conf").c_str(),
+                      findTxt(packet, len, "caps").c_str(), wavRead32(packet + 4), nowMs());
+    }
+
+    void timers() {
+        uint32_t now = nowMs();
+        table->expire(now);
+        if (table->needsQuery(now)) {
+            table->markQueried(now);
+            send(QUERY, 0);
+        }
+    }
+};
+
+static std::vector<Phone> phones;
+
+static int openSocket() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(PORT);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    ip_mreq membership;
+    membership.imr_multiaddr.s_addr = inet_addr(GROUP);
+    membership.imr_interface.s_addr = inet_addr("127.0.0.1");
+    in_addr loopback;
+    loopback.s_addr = inet_addr("127.0.0.1");
+    unsigned char loop = 1;
+    if (fd < 0 || bind(fd, (sockaddr*)&local, sizeof(local)) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+        perror("socket");
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    return fd;
+}
+
+// Delivers packets and runs the phones' timers for a while
+static void pump(uint32_t ms) {
+    uint32_t until = nowMs() + ms;
+    do {
+        std::vector<pollfd> fds;
+        std::vector<Phone*> owners;
+        for (Phone& phone : phones) {
+            if (!phone.online) continue;
+            fds.push_back({ phone.fd, POLLIN, 0 });
+            owners.push_back(&phone);
+        }
+        poll(fds.data(), fds.size(), 1);
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & POLLIN)) continue;
+            uint8_t packet[512];
+            sockaddr_in from = {};
+            socklen_t fromLen = sizeof(from);
+            ssize_t len = recvfrom(fds[i].fd, packet, sizeof(packet), 0, (sockaddr*)&from, &fromLen);
+            if (len > 0 && !owners[i]->silent) owners[i]->receive(packet, (size_t)len, from.sin_addr.s_addr);
+        }
+        for (Phone* phone : owners) {
+            if (!phone->silent) phone->timers();
+        }
+    } while ((int32_t)(nowMs() - until) < 0);
+}
+
+// Every online phone resolves the first number of every other online phone
+static bool allResolved() {
+    for (Phone& phone : phones) {
+        if (!phone.online || phone.silent) continue;
+        for (Phone& other : phones) {
+            if (&other == &phone || !other.online || other.silent) continue;
+            CallPeer peer;
+            std::string first = other.numbers.substr(0, other.numbers.find('-'));
+            if (!phone.table->resolve(first.c_str(), nowMs(), peer) || peer.port != other.callPort) return false;
+        }
+    }
+    return true;
+}
+
+static uint8_t knownBy(const Phone& phone, const std::string& name) {
+    for (uint8_t i = 0; i < phone.table->getCapacity(); i++) {
+        const PeerTable::Entry& entry = phone.table->getEntry(i);
+        if (entry.used && name == entry.name) return 1;
+    }
+    return 0;
+}
+
+static uint32_t countKnowing(const std::string& name) {
+    uint32_t count = 0;
+    for (Phone& phone : phones) {
+        if (phone.online && !phone.silent && phone.name != name) count += knownBy(phone, name);
+    }
+    return count;
+}
+
+int main(int argc, char** argv) {
+    int phoneCount = 8;
+    uint32_t ttlMs = 3000;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--phones") == 0 && hasValue) {
+            phoneCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ttl") == 0 && hasValue) {
+            ttlMs = (uint32_t)atoi(argv[++i]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (phoneCount < 3 || phoneCount > 50 || ttlMs < 1000) {
+        fprintf(stderr, "Needs 3 to 50 phones and a ttl of at least 1000 ms\n");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    bool ok = true;
+
+    // Phone i answers 1i00-1i99, phone 0 also hosts the conference bridge on 77
+    phones.resize(phoneCount);
+    for (int i = 0; i < phoneCount; i++) {
+        Phone& phone = phones[i];
+        phone.name = "highphone-" + std::to_string(i);
+        phone.numbers = std::to_string(1000 + i * 100) + "-" + std::to_string(1099 + i * 100);
+        phone.conf = i == 0 ? "77:" + std::to_string(CALL_PORT_BASE + 999) : "";
+        phone.caps = i == 0 ? "call,conference,ring,ptt" : "call,ring,ptt";
+        phone.callPort = (uint16_t)(CALL_PORT_BASE + i);
+        // Refresh at a third of the TTL, one lost answer does not drop a phone
+        phone.ttlMs = ttlMs;
+        phone.table.reset(new PeerTable(64, ttlMs / 3));
+        phone.fd = openSocket();
+    }
+
+    uint32_t start = nowMs();
+    for (Phone& phone : phones) {
+        phone.online = true;
+        phone.send(ANSWER, phone.ttlMs); // Announce on start
+        pump(10);
+    }
+    while (!allResolved() && nowMs() - start < 10000) pump(5);
+    uint32_t converged = nowMs() - start;
+    bool resolvedAll = allResolved();
+    printf("%d phones: every phone resolves every other after %u ms %s\n", phoneCount, converged, resolvedAll ? "" : "FAILED");
+    ok = ok && resolvedAll;
+
+    // Lookups only read the tables
+    std::mt19937 random(1);
+    uint32_t queriesBefore = 0, lookups = 0, wrong = 0;
+    for (Phone& phone : phones) queriesBefore += phone.queriesSent;
+    uint64_t lookupNs = 0;
+    for (int round = 0; round < 2000; round++) {
+        Phone& phone = phones[random() % phoneCount];
+        int target = random() % phoneCount;
+        if (&phones[target] == &phone) continue;
+        std::string number = std::to_string(1000 + target * 100 + random() % 100);
+        CallPeer peer;
+        uint64_t begin = nowNs();
+        bool found = phone.table->resolve(number.c_str(), nowMs(), peer);
+        lookupNs += nowNs() - begin;
+        lookups++;
+        if (!found || peer.port != phones[target].callPort) wrong++;
+    }
+    CallPeer bridge;
+    if (!phones[1].table->resolve("77", nowMs(), bridge) || bridge.port != CALL_PORT_BASE + 999) wrong++;
+    uint32_t queriesAfter = 0;
+    for (Phone& phone : phones) queriesAfter += phone.queriesSent;
+    printf("%u lookups: %.0f ns each, %u wrong, %u queries sent meanwhile\n", lookups, (double)lookupNs / lookups, wrong,
+           queriesAfter - queriesBefore);
+    ok = ok && wrong == 0;
+
+    // The alternative: a query to the group for every lookup, timed until the answer is in
+    Phone& asker = phones[1];
+    uint64_t roundTripNs = 0;
+    const int askRounds = 50;
+    for (int round = 0; round < askRounds; round++) {
+        asker.table->remove(phones[2].name.c_str());
+        uint64_t begin = nowNs();
+        asker.send(QUERY, 0);
+        CallPeer peer;
+        while (!asker.table->resolve(phones[2].numbers.substr(0, 4).c_str(), nowMs(), peer) && nowNs() - begin < 1000000000ull) pump(0);
+        roundTripNs += nowNs() - begin;
+    }
+    printf("Query on every lookup: %.0f us each and %d answers to the group per lookup\n", (double)roundTripNs / askRounds / 1000,
+           phoneCount - 1);
+
+    // Unknown numbers ask the network early, but at most every MIN_QUERY_GAP_MS
+    asker.table->markQueried(nowMs());
+    uint32_t queriesBeforeMiss = asker.queriesSent;
+    uint32_t missStart = nowMs();
+    for (int round = 0; round < 100; round++) {
+        CallPeer peer;
+        asker.table->resolve("9999", nowMs(), peer);
+        pump(1);
+    }
+    uint32_t missQueries = asker.queriesSent - queriesBeforeMiss;
+    bool asksLater = asker.table->needsQuery(nowMs() + PeerTable::MIN_QUERY_GAP_MS);
+    printf("100 lookups of an unknown number in %u ms: %u queries, %s\n", nowMs() - missStart, missQueries,
+           asksLater ? "the next one is due after the gap" : "no query due FAILED");
+    ok = ok && missQueries == 0 && asksLater;
+
+    // A phone that says goodbye is gone at once
+    Phone& leaving = phones[phoneCount - 1];
+    leaving.send(ANSWER, 0);
+    leaving.online = false;
+    pump(50);
+    uint32_t stillKnown = countKnowing(leaving.name);
+    printf("Goodbye: %u phones still know %s after 50 ms\n", stillKnown, leaving.name.c_str());
+    ok = ok && stillKnown == 0;
+
+    // A phone that loses power is dropped when its announcement runs out
+    Phone& lost = phones[phoneCount - 2];
+    lost.silent = true;
+    uint32_t lostAt = nowMs();
+    while (countKnowing(lost.name) > 0 && nowMs() - lostAt < ttlMs * 3) pump(10);
+    uint32_t forgotten = nowMs() - lostAt;
+    bool dropped = countKnowing(lost.name) == 0;
+    printf("Silent departure: forgotten after %u ms (ttl %u ms) %s\n", forgotten, ttlMs, dropped ? "" : "FAILED");
+    ok = ok && dropped && forgotten <= ttlMs + 100;
+
+    // The rest still find each other
+    bool stillResolved = allResolved();
+    printf("Remaining phones resolve each other: %s\n", stillResolved ? "yes" : "FAILED");
+    ok = ok && stillResolved;
+    return ok ? 0 : 1;
+}
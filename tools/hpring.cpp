@@ -0,0 +1,286 @@
+// Rings or stops every phone listening on the ring multicast group, or listens like a phone.
+// --skew starts simulated phones on loopback multicast, broadcasts events and reports how far
+// apart the phones handle each event, and checks that every phone handles every event once.
+//
+// Build: g++ -std=c++17 -O2 -pthread -Iinclude tools/hpring.cpp -o hpring
+// Usage: hpring [options] ring <number> | stop | listen
+//        hpring [options] --skew <phones> [--events n] [--loss percent]
+// Options: --group 239.255.42.1 --port 4212 --interface <local ip>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RingBroadcast.h"
+
+static const char* group = "239.255.42.1";
+static uint16_t port = 4212;
+static const char* interfaceAddress = "0.0.0.0";
+
+static void usage() {
+    fprintf(stderr, "Usage: hpring [options] ring <number> | stop | listen\n");
+    fprintf(stderr, "       hpring [options] --skew <phones> [--events n] [--loss percent]\n");
+    fprintf(stderr, "Options: --group 239.255.42.1 --port 4212 --interface <local ip>\n");
+}
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t nowUs() {
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static int openSender() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    in_addr local;
+    local.s_addr = inet_addr(interfaceAddress);
+    unsigned char loop = 1, ttl = 1;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &local, sizeof(local));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    return fd;
+}
+
+// Several listeners share the port like phones on one network
+static int openListener() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    ip_mreq membership;
+    membership.imr_multiaddr.s_addr = inet_addr(group);
+    membership.imr_interface.s_addr = inet_addr(interfaceAddress);
+    if (fd < 0 || bind(fd, (sockaddr*)&local, sizeof(local)) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+        perror("listen");
+        exit(1);
+    }
+    return fd;
+}
+
+// Listeners never send
+static bool discard(const uint8_t*, size_t) {
+    return true;
+}
+
+static RingBroadcast::Send sendTo(int fd) {
+    return [fd](const uint8_t* data, size_t len) {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = inet_addr(group);
+        address.sin_port = htons(port);
+        return sendto(fd, data, len, 0, (sockaddr*)&address, sizeof(address)) == (ssize_t)len;
+    };
+}
+
+// Sends the event and its repeats
+static int broadcast(bool ring, const char* number) {
+    int fd = openSender();
+    std::random_device seed;
+    RingBroadcast sender(seed(), sendTo(fd));
+    if (ring ? !sender.ring(number, nowMs()) : !sender.stop(nowMs())) {
+        fprintf(stderr, "Could not send, numbers have 1 to %u digits\n", RingBroadcast::MAX_NUMBER);
+        return 1;
+    }
+    for (uint32_t i = 0; i < RingBroadcast::COPIES * RingBroadcast::REPEAT_MS + 5; i++) {
+        usleep(1000);
+        sender.poll(nowMs());
+    }
+    printf("Sent %s in %u packets\n", ring ? "ring" : "stop", sender.getSentPackets());
+    return 0;
+}
+
+static int listen() {
+    int fd = openListener();
+    std::random_device seed;
+    RingBroadcast receiver(seed(), discard);
+    receiver.onCommand([](RingBroadcast::Command command, const char* number) {
+        if (command == RingBroadcast::RING) {
+            printf("%u ms: ring %s\n", nowMs(), number);
+        } else {
+            printf("%u ms: stop\n", nowMs());
+        }
+    });
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("Listening on %s:%u\n", group, port);
+    while (true) {
+        uint8_t packet[256];
+        ssize_t len = recv(fd, packet, sizeof(packet), 0);
+        if (len > 0) receiver.receive(packet, (size_t)len);
+    }
+}
+
+struct Phone {
+    std::vector<uint64_t> handledUs; // Per event, 0 until handled
+    uint32_t handledTwice = 0;
+    uint32_t dropped = 0;
+    uint32_t recovered = 0;
+    uint32_t duplicates = 0;
+};
+
+static uint64_t percentile(std::vector<uint64_t> values, double fraction) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))];
+}
+
+// Every event is a RING whose number is the event index, every other one is followed by a STOP
+static int skew(int phoneCount, int events, double lossPercent) {
+    std::vector<Phone> phones(phoneCount);
+    std::vector<int> sockets;
+    for (int p = 0; p < phoneCount; p++) {
+        sockets.push_back(openListener());
+        phones[p].handledUs.assign(events, 0);
+    }
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < phoneCount; p++) {
+        threads.emplace_back([&, p]() {
+            Phone& phone = phones[p];
+            std::mt19937 random(p + 1);
+            std::uniform_real_distribution<double> chance(0, 100);
+            RingBroadcast receiver(1000 + p, discard);
+            receiver.onCommand([&](RingBroadcast::Command command, const char* number) {
+                if (command != RingBroadcast::RING) return;
+                uint64_t& at = phone.handledUs[atoi(number)];
+                if (at != 0) phone.handledTwice++;
+                at = nowUs();
+            });
+            timeval timeout = { 0, 100000 };
+            setsockopt(sockets[p], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            while (!done) {
+                uint8_t packet[256];
+                ssize_t len = recv(sockets[p], packet, sizeof(packet), 0);
+                if (len <= 0) continue;
+                if (chance(random) < lossPercent) {
+                    phone.dropped++;
+                    continue;
+                }
+                receiver.receive(packet, (size_t)len);
+            }
+            phone.recovered = receiver.getRecovered();
+            phone.duplicates = receiver.getDuplicates();
+        });
+    }
+    usleep(100000);
+
+    int fd = openSender();
+    RingBroadcast sender(1, sendTo(fd));
+    std::vector<uint64_t> sentUs(events);
+    uint8_t replay[RingBroadcast::MAX_PACKET];
+    size_t replayLen = 0;
+    RingBroadcast copier(1, [&](const uint8_t* data, size_t len) {
+        memcpy(replay, data, len);
+        replayLen = len;
+        return true;
+    });
+    copier.ring("0", 0);
+    for (int e = 0; e < events; e++) {
+        sentUs[e] = nowUs();
+        sender.ring(std::to_string(e).c_str(), nowMs());
+        uint32_t until = nowMs() + 50;
+        bool stopped = e % 2 != 0;
+        while ((int32_t)(nowMs() - until) < 0) {
+            usleep(1000);
+            sender.poll(nowMs());
+            if (!stopped && (int32_t)(nowMs() - until) >= -20) {
+                sender.stop(nowMs());
+                stopped = true;
+            }
+        }
+    }
+    // The very first event again, every phone must ignore it
+    sendTo(fd)(replay, replayLen);
+    usleep(200000);
+    done = true;
+    for (std::thread& thread : threads) thread.join();
+
+    std::vector<uint64_t> latencies, skews;
+    uint32_t missed = 0, twice = 0, dropped = 0, recovered = 0, duplicates = 0;
+    for (int e = 0; e < events; e++) {
+        uint64_t first = UINT64_MAX, last = 0;
+        for (Phone& phone : phones) {
+            uint64_t at = phone.handledUs[e];
+            if (at == 0) {
+                missed++;
+                continue;
+            }
+            latencies.push_back(at - sentUs[e]);
+            first = std::min(first, at);
+            last = std::max(last, at);
+        }
+        if (last != 0) skews.push_back(last - first);
+    }
+    for (Phone& phone : phones) {
+        twice += phone.handledTwice;
+        dropped += phone.dropped;
+        recovered += phone.recovered;
+        duplicates += phone.duplicates;
+    }
+    printf("%d phones, %d events, %.1f%% loss: %u packets dropped, %u events heard only through a repeat\n", phoneCount, events,
+           lossPercent, dropped, recovered);
+    printf("Latency: median %llu us, 95%% %llu us, max %llu us\n", (unsigned long long)percentile(latencies, 0.5),
+           (unsigned long long)percentile(latencies, 0.95), (unsigned long long)percentile(latencies, 1));
+    printf("Skew between phones: median %llu us, 95%% %llu us, max %llu us\n", (unsigned long long)percentile(skews, 0.5),
+           (unsigned long long)percentile(skews, 0.95), (unsigned long long)percentile(skews, 1));
+    printf("%u duplicates dropped, %u events missed, %u handled twice\n", duplicates, missed, twice);
+    // With loss an event can lose all its copies
+    return twice == 0 && (missed == 0 || lossPercent > 0) ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    int phones = 0;
+    int events = 200;
+    double loss = 0;
+    std::vector<const char*> words;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--group") == 0 && hasValue) {
+            group = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && hasValue) {
+            port = (uint16_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--interface") == 0 && hasValue) {
+            interfaceAddress = argv[++i];
+        } else if (strcmp(argv[i], "--skew") == 0 && hasValue) {
+            phones = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--events") == 0 && hasValue) {
+            events = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loss") == 0 && hasValue) {
+            loss = atof(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 1;
+        } else {
+            words.push_back(argv[i]);
+        }
+    }
+
+    if (phones > 0) {
+        // Loopback unless told otherwise
+        if (strcmp(interfaceAddress, "0.0.0.0") == 0) interfaceAddress = "127.0.0.1";
+        return skew(phones, std::max(events, 1), loss);
+    }
+    if (words.size() == 2 && strcmp(words[0], "ring") == 0) return broadcast(true, words[1]);
+    if (words.size() == 1 && strcmp(words[0], "stop") == 0) return broadcast(false, "");
+    if (words.size() == 1 && strcmp(words[0], "listen") == 0) return listen();
+    usage();
+    return 1;
+}
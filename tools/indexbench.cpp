@@ -0,0 +1,260 @@
+// Compares the phone's two ways to learn the numbers on the SD card: a scan that opens every
+// file in /numbers and reads its header, and loading /numbers/.index after listing the names,
+// sizes and times for the signature. Builds a folder of WAV files for each size, counts the
+// file system calls and times both. The page cache is dropped before each cold run when running as root.
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/indexbench.cpp -o indexbench
+// Usage: indexbench [folder] [file counts...]       default /tmp/hpindex 100 1000 10000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "AudioFileType.h"
+#include "NumberIndex.h"
+
+struct Info {
+    std::string filePath;
+    std::string description;
+    uint32_t fileSize;
+    WavFormat format;
+};
+
+struct Counters {
+    uint32_t opens = 0;
+    uint32_t reads = 0;
+    uint64_t bytes = 0;
+};
+
+static Counters counters;
+
+struct FileReader {
+    FILE* file;
+
+    uint32_t read(void* dest, uint32_t len) {
+        counters.reads++;
+        uint32_t got = (uint32_t)fread(dest, 1, len, file);
+        counters.bytes += got;
+        return got;
+    }
+
+    bool skip(uint32_t len) {
+        return fseek(file, len, SEEK_CUR) == 0;
+    }
+};
+
+struct FileWriter {
+    FILE* file;
+
+    uint32_t write(const void* data, uint32_t len) {
+        return (uint32_t)fwrite(data, 1, len, file);
+    }
+};
+
+static double nowMs() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static bool isAudioName(const std::string& name) {
+    return name.size() > 4 && (name.compare(name.size() - 4, 4, ".wav") == 0 || name.compare(name.size() - 4, 4, ".mp3") == 0);
+}
+
+static void dropCaches() {
+    sync();
+    FILE* control = fopen("/proc/sys/vm/drop_caches", "w");
+    if (control) {
+        fputs("3", control);
+        fclose(control);
+    }
+}
+
+static bool canDropCaches() {
+    return access("/proc/sys/vm/drop_caches", W_OK) == 0;
+}
+
+// A short 16 kHz 8 bit WAV per number, descriptions of typical length
+static void createFolder(const std::string& folder, uint32_t count) {
+    std::string command = "rm -rf '" + folder + "' && mkdir -p '" + folder + "'";
+    if (system(command.c_str()) != 0) exit(1);
+    uint8_t wav[44 + 256] = {};
+    memcpy(wav, "RIFF", 4);
+    wavWrite32(wav + 4, sizeof(wav) - 8);
+    memcpy(wav + 8, "WAVEfmt ", 8);
+    wavWrite32(wav + 16, 16);
+    wavWrite16(wav + 20, WavFormat::FORMAT_PCM);
+    wavWrite16(wav + 22, 1);
+    wavWrite32(wav + 24, 16000);
+    wavWrite32(wav + 28, 16000);
+    wavWrite16(wav + 32, 1);
+    wavWrite16(wav + 34, 8);
+    memcpy(wav + 36, "data", 4);
+    wavWrite32(wav + 40, 256);
+    for (uint32_t i = 0; i < count; i++) {
+        std::string path = folder + "/" + std::to_string(10000 + i) + "_announcement number " + std::to_string(i) + ".wav";
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(wav, 1, sizeof(wav), file);
+        fclose(file);
+    }
+}
+
+// What SDReader::scanNumbers does: open every file, read its header, split the name
+static void scan(const std::string& folder, std::map<std::string, Info>& numbers) {
+    DIR* dir = opendir(folder.c_str());
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (!isAudioName(name)) continue;
+        std::string path = folder + "/" + name;
+        FILE* file = fopen(path.c_str(), "rb");
+        counters.opens++;
+        if (!file) continue;
+        Info info;
+        info.filePath = path;
+        FileReader reader = { file };
+        uint8_t head[AUDIO_FILE_SIGNATURE_SIZE];
+        uint32_t headLen = reader.read(head, sizeof(head));
+        fseek(file, 0, SEEK_SET);
+        if (detectAudioFileType(head, headLen) == AUDIO_FILE_MP3) {
+            parseMp3Header(reader, info.format);
+        } else {
+            parseWavHeader(reader, info.format);
+        }
+        fseek(file, 0, SEEK_END);
+        info.fileSize = (uint32_t)ftell(file);
+        fclose(file);
+        std::string base = name.substr(0, name.size() - 4);
+        size_t underscore = base.find('_');
+        if (underscore == std::string::npos) continue;
+        info.description = base.substr(underscore + 1);
+        numbers[base.substr(0, underscore)] = info;
+    }
+    closedir(dir);
+}
+
+static uint32_t listSignature(const std::string& folder) {
+    NumberIndex::Signature signature;
+    DIR* dir = opendir(folder.c_str());
+    while (dirent* entry = readdir(dir)) {
+        struct stat status;
+        if (isAudioName(entry->d_name) && stat((folder + "/" + entry->d_name).c_str(), &status) == 0) {
+            signature.add(entry->d_name, (uint32_t)status.st_size, (uint32_t)status.st_mtime); // FAT has these in the entry
+        }
+    }
+    closedir(dir);
+    return signature.value();
+}
+
+static bool save(const std::string& folder, const std::map<std::string, Info>& numbers, uint32_t signature) {
+    std::string path = folder + "/.index";
+    FILE* file = fopen(path.c_str(), "wb");
+    FileWriter writer = { file };
+    NumberIndex::Builder<FileWriter> builder(writer, signature);
+    for (const auto& number : numbers) {
+        const Info& info = number.second;
+        NumberIndex::Entry entry;
+        entry.number = number.first.c_str();
+        entry.description = info.description.c_str();
+        entry.fileName = info.filePath.c_str() + folder.size() + 1;
+        entry.fileSize = info.fileSize;
+        entry.format = info.format;
+        builder.add(entry);
+    }
+    bool ok = builder.finish();
+    fclose(file);
+    return ok;
+}
+
+static NumberIndex::LoadResult load(const std::string& folder, std::map<std::string, Info>& numbers) {
+    uint32_t signature = listSignature(folder);
+    std::string path = folder + "/.index";
+    FILE* file = fopen(path.c_str(), "rb");
+    counters.opens++;
+    if (!file) return NumberIndex::CORRUPT;
+    setvbuf(file, NULL, _IONBF, 0); // Count the reads the loader asks for
+    FileReader reader = { file };
+    NumberIndex::LoadResult result = NumberIndex::load(reader, signature, [&](const NumberIndex::Entry& entry) {
+        Info info;
+        info.filePath = folder + "/" + entry.fileName;
+        info.description = entry.description;
+        info.fileSize = entry.fileSize;
+        info.format = entry.format;
+        numbers[entry.number] = info;
+    });
+    fclose(file);
+    return result;
+}
+
+static bool sameNumbers(const std::map<std::string, Info>& a, const std::map<std::string, Info>& b) {
+    if (a.size() != b.size()) return false;
+    for (auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+        if (i->first != j->first || i->second.filePath != j->second.filePath || i->second.description != j->second.description ||
+            i->second.fileSize != j->second.fileSize || memcmp(&i->second.format, &j->second.format, sizeof(WavFormat)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string folder = "/tmp/hpindex";
+    std::vector<uint32_t> counts;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] >= '0' && argv[i][0] <= '9') {
+            counts.push_back((uint32_t)atoi(argv[i]));
+        } else {
+            folder = argv[i];
+        }
+    }
+    if (counts.empty()) counts = { 100, 1000, 10000 };
+    bool cold = canDropCaches();
+    printf("%s runs\n", cold ? "Cold (page cache dropped)" : "Warm (not root, page cache kept)");
+
+    bool ok = true;
+    for (uint32_t count : counts) {
+        createFolder(folder, count);
+
+        std::map<std::string, Info> scanned;
+        if (cold) dropCaches();
+        counters = Counters();
+        double start = nowMs();
+        scan(folder, scanned);
+        double scanMs = nowMs() - start;
+        Counters scanCounters = counters;
+
+        start = nowMs();
+        save(folder, scanned, listSignature(folder));
+        double saveMs = nowMs() - start;
+        struct stat indexStat;
+        stat((folder + "/.index").c_str(), &indexStat);
+
+        std::map<std::string, Info> loaded;
+        if (cold) dropCaches();
+        counters = Counters();
+        start = nowMs();
+        NumberIndex::LoadResult result = load(folder, loaded);
+        double loadMs = nowMs() - start;
+        Counters loadCounters = counters;
+        bool same = result == NumberIndex::LOADED && sameNumbers(scanned, loaded);
+
+        // A new file makes the index stale
+        std::string extra = folder + "/99999_new.wav";
+        FILE* file = fopen(extra.c_str(), "wb");
+        fclose(file);
+        std::map<std::string, Info> ignored;
+        bool stale = load(folder, ignored) == NumberIndex::STALE;
+
+        printf("%u files: scan %.1f ms (%u opens, %u reads), index %.1f ms (%u opens, %u reads, %ld bytes), %.1fx faster, "
+               "save %.1f ms, %s, %s\n",
+               count, scanMs, scanCounters.opens, scanCounters.reads, loadMs, loadCounters.opens, loadCounters.reads, (long)indexStat.st_size,
+               loadMs > 0 ? scanMs / loadMs : 0, saveMs, same ? "same numbers" : "DIFFERENT numbers",
+               stale ? "new file detected" : "new file MISSED");
+        ok = ok && same && stale;
+    }
+    return ok ? 0 : 1;
+}
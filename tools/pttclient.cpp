@@ -0,0 +1,313 @@
+// Streams a WAV file to the phone's push-to-talk WebSocket like the website does and
+// reports throughput and the latency until each frame was acknowledged (stored on SD).
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/pttclient.cpp -o pttclient
+// Usage: pttclient [--adpcm] [--live] [--fast] [-p port] [-n number] [-d description] <host> <input.wav>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "WavTranscoder.h"
+#include "ImaAdpcm.h"
+
+static const uint32_t RATE = 16000;
+static const uint32_t PCM_FRAME = 320;         // 20 ms
+static const uint16_t ADPCM_BLOCK_ALIGN = 164; // 321 samples, like the website
+
+static void usage() {
+    fprintf(stderr, "Usage: pttclient [--adpcm] [--live] [--fast] [-p port] [-n number] [-d description] <host> <input.wav>\n");
+    fprintf(stderr, "Sends 20 ms frames in real time (--fast: as fast as the acknowledgements allow).\n");
+}
+
+static uint32_t nowMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Converts the input to 16 bit mono at RATE with the web upload's transcoder
+static bool loadSamples(const char* path, std::vector<int16_t>& samples) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+    std::vector<uint8_t> converted;
+    WavTranscoder transcoder(RATE, 16, [&converted](const uint8_t* data, size_t len) {
+        converted.insert(converted.end(), data, data + len);
+        return true;
+    });
+    bool ok = transcoder.begin();
+    uint8_t buffer[16 * 1024];
+    size_t len;
+    while (ok && (len = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        ok = transcoder.write(buffer, len);
+    }
+    fclose(in);
+    uint8_t header[WavTranscoder::MAX_HEADER_SIZE];
+    if (!ok || !transcoder.finish(header)) {
+        fprintf(stderr, "%s: %s\n", path, transcoder.getError() ? transcoder.getError() : "conversion failed");
+        return false;
+    }
+    size_t headerSize = transcoder.headerSize();
+    samples.resize((converted.size() - headerSize) / 2);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = (int16_t)wavRead16(&converted[headerSize + i * 2]);
+    }
+    return true;
+}
+
+// Just enough of RFC 6455 for this protocol: masked frames out, unfragmented frames in
+class WebSocketClient {
+public:
+    ~WebSocketClient() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool connect(const char* host, const char* port) {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result;
+        if (getaddrinfo(host, port, &hints, &result) != 0) return false;
+        for (addrinfo* a = result; a && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(result);
+        if (fd < 0) return false;
+
+        std::string request = std::string("GET / HTTP/1.1\r\nHost: ") + host + ":" + port + "\r\n"
+                              "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        if (!sendAll((const uint8_t*)request.data(), request.size())) return false;
+        std::string response;
+        char c;
+        while (response.find("\r\n\r\n") == std::string::npos) {
+            if (recv(fd, &c, 1, 0) != 1) return false;
+            response += c;
+        }
+        return response.compare(0, 12, "HTTP/1.1 101") == 0;
+    }
+
+    bool sendText(const std::string& text) {
+        return sendFrame(0x1, (const uint8_t*)text.data(), text.size());
+    }
+
+    bool sendBinary(const uint8_t* data, size_t len) {
+        return sendFrame(0x2, data, len);
+    }
+
+    // Waits up to timeoutMs for a text message, false on timeout or when the connection closed
+    bool receiveText(std::string& text, int timeoutMs) {
+        while (true) {
+            pollfd p = { fd, POLLIN, 0 };
+            if (pending.size() < 2 && poll(&p, 1, timeoutMs) <= 0) return false;
+            if (pending.size() < 2 && !fill()) return false;
+            if (pending.size() < 2) continue;
+            uint8_t opcode = pending[0] & 0x0F;
+            size_t headerLen = 2;
+            uint64_t len = pending[1] & 0x7F;
+            if (len == 126) headerLen = 4;
+            if (len == 127) headerLen = 10;
+            while (pending.size() < headerLen) {
+                if (!fill()) return false;
+            }
+            if (headerLen == 4) len = ((uint64_t)pending[2] << 8) | pending[3];
+            if (headerLen == 10) {
+                len = 0;
+                for (int i = 2; i < 10; i++) len = (len << 8) | pending[i];
+            }
+            while (pending.size() < headerLen + len) {
+                if (!fill()) return false;
+            }
+            std::string payload(pending.begin() + headerLen, pending.begin() + headerLen + len);
+            pending.erase(pending.begin(), pending.begin() + headerLen + len);
+            if (opcode == 0x8) return false;
+            if (opcode == 0x9) {
+                sendFrame(0xA, (const uint8_t*)payload.data(), payload.size());
+                continue;
+            }
+            if (opcode == 0x1) {
+                text = payload;
+                return true;
+            }
+        }
+    }
+
+private:
+    int fd = -1;
+    std::vector<uint8_t> pending;
+
+    bool fill() {
+        uint8_t buffer[4096];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) return false;
+        pending.insert(pending.end(), buffer, buffer + n);
+        return true;
+    }
+
+    bool sendAll(const uint8_t* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = send(fd, data, len, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    bool sendFrame(uint8_t opcode, const uint8_t* data, size_t len) {
+        std::vector<uint8_t> frame;
+        frame.push_back(0x80 | opcode);
+        if (len < 126) {
+            frame.push_back(0x80 | (uint8_t)len);
+        } else {
+            frame.push_back(0x80 | 126);
+            frame.push_back((uint8_t)(len >> 8));
+            frame.push_back((uint8_t)len);
+        }
+        uint8_t mask[4] = { (uint8_t)rand(), (uint8_t)rand(), (uint8_t)rand(), (uint8_t)rand() };
+        frame.insert(frame.end(), mask, mask + 4);
+        for (size_t i = 0; i < len; i++) frame.push_back(data[i] ^ mask[i & 3]);
+        return sendAll(frame.data(), frame.size());
+    }
+};
+
+static uint32_t percentile(std::vector<uint32_t> values, uint32_t p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * p / 100)];
+}
+
+int main(int argc, char** argv) {
+    bool adpcm = false;
+    bool live = false;
+    bool fast = false;
+    std::string port = "81";
+    std::string number = "99";
+    std::string description = "pttclient";
+    std::vector<const char*> args;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--adpcm") == 0) {
+            adpcm = true;
+        } else if (strcmp(argv[i], "--live") == 0) {
+            live = true;
+        } else if (strcmp(argv[i], "--fast") == 0) {
+            fast = true;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            number = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            description = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 2;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 2) {
+        usage();
+        return 2;
+    }
+
+    std::vector<int16_t> samples;
+    if (!loadSamples(args[1], samples)) return 1;
+    WebSocketClient ws;
+    if (!ws.connect(args[0], port.c_str())) {
+        fprintf(stderr, "%s:%s: WebSocket connection failed\n", args[0], port.c_str());
+        return 1;
+    }
+
+    uint32_t frameSamples = adpcm ? imaSamplesPerBlock(ADPCM_BLOCK_ALIGN, 1) : PCM_FRAME;
+    std::string start = "start " + std::to_string(RATE) + (adpcm ? " adpcm " : " pcm ") + std::to_string(adpcm ? ADPCM_BLOCK_ALIGN : 2) +
+                        (live ? " 1 " : " 0 ") + number + " " + description;
+    std::string message;
+    if (!ws.sendText(start) || !ws.receiveText(message, 5000) || message.compare(0, 6, "ready ") != 0) {
+        fprintf(stderr, "Phone refused the stream: %s\n", message.c_str());
+        return 1;
+    }
+    uint32_t window = (uint32_t)atoi(message.c_str() + 6);
+
+    std::vector<uint32_t> latencies;
+    uint32_t inFlight = 0;
+    uint32_t windowWaits = 0; // Times a frame was due while the window was full
+    uint32_t bytes = 0;
+    uint16_t seq = 0;
+    ImaAdpcmState adpcmState;
+    std::vector<uint8_t> frame(8 + std::max<uint32_t>(ADPCM_BLOCK_ALIGN, PCM_FRAME * 2));
+    uint32_t frameMs = frameSamples * 1000 / RATE;
+    uint32_t begin = nowMs();
+    uint32_t nextDue = begin;
+
+    size_t offset = 0;
+    while (offset + frameSamples <= samples.size() || inFlight > 0) {
+        bool due = offset + frameSamples <= samples.size() && (fast || (int32_t)(nowMs() - nextDue) >= 0);
+        if (due && inFlight >= window) {
+            windowWaits++;
+            due = false;
+        }
+        if (due) {
+            uint32_t len;
+            if (adpcm) {
+                imaEncodeBlock(adpcmState, &samples[offset], ADPCM_BLOCK_ALIGN, &frame[8]);
+                len = ADPCM_BLOCK_ALIGN;
+            } else {
+                for (uint32_t i = 0; i < frameSamples; i++) wavWrite16(&frame[8 + i * 2], (uint16_t)samples[offset + i]);
+                len = frameSamples * 2;
+            }
+            wavWrite16(&frame[0], seq++);
+            wavWrite16(&frame[2], 0);
+            wavWrite32(&frame[4], nowMs());
+            if (!ws.sendBinary(frame.data(), 8 + len)) {
+                fprintf(stderr, "Connection lost\n");
+                return 1;
+            }
+            offset += frameSamples;
+            nextDue += frameMs;
+            inFlight++;
+            bytes += len;
+            continue;
+        }
+        int wait = fast || inFlight >= window ? 2000 : std::max<int>(0, (int32_t)(nextDue - nowMs()));
+        if (!ws.receiveText(message, wait)) {
+            if (wait == 2000) {
+                fprintf(stderr, "No acknowledgement within 2 s\n");
+                return 1;
+            }
+            continue;
+        }
+        if (message.compare(0, 4, "ack ") == 0) {
+            const char* timestamp = strchr(message.c_str() + 4, ' ');
+            if (timestamp) latencies.push_back(nowMs() - (uint32_t)strtoul(timestamp + 1, NULL, 10));
+            inFlight--;
+        } else {
+            fprintf(stderr, "Phone: %s\n", message.c_str());
+        }
+    }
+    uint32_t elapsed = nowMs() - begin;
+
+    ws.sendText("stop");
+    bool saved = ws.receiveText(message, 5000) && message.compare(0, 6, "saved ") == 0;
+    printf("%s\n", saved ? message.c_str() : "Not saved");
+    printf("%u frames, %u bytes in %u ms: %.1f KB/s (audio needs %.1f KB/s)\n", (unsigned)latencies.size(), (unsigned)bytes, (unsigned)elapsed,
+           elapsed ? bytes / 1.024 / elapsed : 0.0, (adpcm ? ADPCM_BLOCK_ALIGN : PCM_FRAME * 2) * 1000.0 / frameMs / 1024);
+    printf("Ack latency: median %u ms, 95%% %u ms, max %u ms, window full %u times\n", (unsigned)percentile(latencies, 50),
+           (unsigned)percentile(latencies, 95), (unsigned)percentile(latencies, 100), (unsigned)windowWaits);
+    return saved ? 0 : 1;
+}
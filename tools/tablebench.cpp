@@ -0,0 +1,191 @@
+// Compares the number table SDReader used to keep, a std::map from number to file path,
+// description and format, with NumberTable. For each size it counts the heap bytes and blocks
+// both take, times lookups and random picks, and checks the two agree after random puts and
+// erases. std::string stands in for the Arduino String, both keep short texts inline. The heap
+// is counted as the host allocator rounds it, blocks cost the ESP32 heap a header each on top.
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/tablebench.cpp -o tablebench
+// Usage: tablebench [entry counts...]       default 1000 10000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include "NumberTable.h"
+
+static size_t heapBytes = 0;
+static size_t heapBlocks = 0;
+
+// Counts what the allocator hands out, rounding included
+__attribute__((noinline)) void* operator new(size_t size) {
+    void* block = malloc(size);
+    if (!block) throw std::bad_alloc();
+    heapBytes += malloc_usable_size(block);
+    heapBlocks++;
+    return block;
+}
+
+__attribute__((noinline)) void operator delete(void* block) noexcept {
+    if (!block) return;
+    heapBytes -= malloc_usable_size(block);
+    heapBlocks--;
+    free(block);
+}
+
+void operator delete(void* data, size_t) noexcept {
+    operator delete(data);
+}
+
+struct Info {
+    std::string filePath;
+    std::string description;
+    WavFormat format;
+    uint32_t fileSize;
+};
+
+static double nowUs() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static std::string numberOf(uint32_t i) {
+    return std::to_string(10000 + i);
+}
+
+static std::string descriptionOf(uint32_t i) {
+    return "announcement number " + std::to_string(i);
+}
+
+static std::string fileNameOf(uint32_t i) {
+    return numberOf(i) + "_" + descriptionOf(i) + ".wav";
+}
+
+static WavFormat formatOf(uint32_t i) {
+    WavFormat format;
+    format.formatTag = WavFormat::FORMAT_PCM;
+    format.channels = 1;
+    format.sampleRate = 16000;
+    format.bitsPerSample = 8;
+    format.blockAlign = 1;
+    format.dataOffset = 44;
+    format.dataLength = i;
+    return format;
+}
+
+static bool same(const std::map<std::string, Info>& map, const NumberTable& table) {
+    if (map.size() != table.size()) return false;
+    size_t i = 0;
+    char fileName[NumberTable::MAX_FILE_NAME + 1];
+    for (const auto& entry : map) {
+        const NumberTable::Record& record = table.at(i++);
+        if (entry.first != table.getNumber(record) || entry.second.description != table.getDescription(record) ||
+            entry.second.filePath != "/numbers/" + std::string(table.getFileName(record, fileName)) || entry.second.fileSize != record.fileSize ||
+            entry.second.format.dataLength != record.format.dataLength) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Random puts, replacements and erases on both, the sorted contents must stay equal
+static bool churn(uint32_t count, std::mt19937& random) {
+    std::map<std::string, Info> map;
+    NumberTable table;
+    for (uint32_t step = 0; step < count * 4; step++) {
+        uint32_t i = random() % (count * 2);
+        std::string number = numberOf(i);
+        if (random() % 3 == 0) {
+            map.erase(number);
+            table.erase(number.c_str());
+        } else {
+            std::string description = descriptionOf(step);
+            std::string fileName = number + "_" + description + ".wav";
+            map[number] = { "/numbers/" + fileName, description, formatOf(step), step };
+            table.put(number.c_str(), description.c_str(), fileName.c_str(), step, formatOf(step));
+        }
+    }
+    bool ok = same(map, table);
+    // A bulk load with duplicates keeps the last copy of each number
+    NumberTable bulk;
+    for (const auto& entry : map) {
+        bulk.append(entry.first.c_str(), "old", (entry.first + "_old.mp3").c_str(), 0, WavFormat());
+    }
+    for (auto it = map.rbegin(); it != map.rend(); ++it) {
+        const Info& info = it->second;
+        bulk.append(it->first.c_str(), info.description.c_str(), info.filePath.c_str() + strlen("/numbers/"), info.fileSize, info.format);
+    }
+    ok = bulk.sort() == map.size() && ok;
+    bulk.shrink();
+    return same(map, bulk) && ok;
+}
+
+int main(int argc, char** argv) {
+    std::vector<uint32_t> counts;
+    for (int i = 1; i < argc; i++) {
+        counts.push_back((uint32_t)atoi(argv[i]));
+    }
+    if (counts.empty()) counts = { 1000, 10000 };
+    std::mt19937 random(1);
+    const uint32_t lookups = 200000;
+    bool ok = true;
+
+    for (uint32_t count : counts) {
+        // Scan order is directory order, not sorted
+        std::vector<uint32_t> order(count);
+        for (uint32_t i = 0; i < count; i++) order[i] = i;
+        std::shuffle(order.begin(), order.end(), random);
+        std::vector<std::string> keys;
+        for (uint32_t i = 0; i < lookups; i++) keys.push_back(numberOf(random() % count));
+
+        size_t bytesBefore = heapBytes, blocksBefore = heapBlocks;
+        std::map<std::string, Info>* map = new std::map<std::string, Info>();
+        for (uint32_t i : order) {
+            (*map)[numberOf(i)] = { "/numbers/" + fileNameOf(i), descriptionOf(i), formatOf(i), i };
+        }
+        size_t mapBytes = heapBytes - bytesBefore, mapBlocks = heapBlocks - blocksBefore;
+
+        bytesBefore = heapBytes;
+        blocksBefore = heapBlocks;
+        NumberTable* table = new NumberTable();
+        for (uint32_t i : order) {
+            table->append(numberOf(i).c_str(), descriptionOf(i).c_str(), fileNameOf(i).c_str(), i, formatOf(i));
+        }
+        table->sort();
+        table->shrink();
+        size_t tableBytes = heapBytes - bytesBefore, tableBlocks = heapBlocks - blocksBefore;
+
+        uint32_t found = 0;
+        double start = nowUs();
+        for (const std::string& key : keys) found += map->find(key) != map->end();
+        double mapNs = (nowUs() - start) * 1000 / lookups;
+        start = nowUs();
+        for (const std::string& key : keys) found += table->find(key.c_str()) != nullptr;
+        double tableNs = (nowUs() - start) * 1000 / lookups;
+
+        const uint32_t picks = 2000;
+        size_t checksum = 0;
+        start = nowUs();
+        for (uint32_t i = 0; i < picks; i++) checksum += std::next(map->begin(), random() % count)->first.size();
+        double mapPickNs = (nowUs() - start) * 1000 / picks;
+        start = nowUs();
+        for (uint32_t i = 0; i < picks; i++) checksum += strlen(table->getNumber(table->at(random() % count)));
+        double tablePickNs = (nowUs() - start) * 1000 / picks;
+
+        bool agree = same(*map, *table) && found == 2 * lookups && checksum > 0 && churn(count, random);
+        printf("%u entries: map %zu bytes in %zu blocks, table %zu bytes in %zu blocks (%.1fx less), lookup %.0f ns vs %.0f ns, "
+               "random pick %.0f ns vs %.0f ns, %s\n",
+               count, mapBytes, mapBlocks, tableBytes, tableBlocks, (double)mapBytes / tableBytes, mapNs, tableNs, mapPickNs, tablePickNs,
+               agree ? "same contents" : "DIFFERENT contents");
+        ok = ok && agree;
+        delete map;
+        delete table;
+    }
+    return ok ? 0 : 1;
+}
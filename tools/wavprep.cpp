@@ -0,0 +1,108 @@
+// Batch-converts WAV files on a PC into the compact format the phone plays best,
+// using the same conversion as the transcoding web upload.
+//
+// Build: g++ -std=c++17 -O2 -Iinclude tools/wavprep.cpp -o wavprep
+// Usage: wavprep [-r rate] [-b bits] [--adpcm] -o <output dir> <input.wav>...
+// Compressed files and files that have the target format already are copied unchanged.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "WavTranscoder.h"
+
+static void usage() {
+    fprintf(stderr, "Usage: wavprep [-r rate] [-b 4|8|16] [--adpcm] -o <output dir> <input.wav>...\n");
+    fprintf(stderr, "Defaults match the transcoding web upload: 16000 Hz, 8 bit, mono. -b 4 or --adpcm writes IMA ADPCM.\n");
+}
+
+static std::string baseName(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static bool convertFile(const std::string& inPath, const std::string& outPath, uint32_t rate, uint16_t bits) {
+    FILE* in = fopen(inPath.c_str(), "rb");
+    if (!in) {
+        fprintf(stderr, "%s: cannot open\n", inPath.c_str());
+        return false;
+    }
+    FILE* out = fopen(outPath.c_str(), "wb");
+    if (!out) {
+        fprintf(stderr, "%s: cannot create\n", outPath.c_str());
+        fclose(in);
+        return false;
+    }
+
+    WavTranscoder transcoder(rate, bits, [out](const uint8_t* data, size_t len) {
+        return fwrite(data, 1, len, out) == len;
+    });
+
+    bool ok = transcoder.begin();
+    std::vector<uint8_t> buffer(16 * 1024);
+    size_t len;
+    uint32_t inputBytes = 0;
+    while (ok && (len = fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+        inputBytes += len;
+        ok = transcoder.write(buffer.data(), len);
+    }
+
+    uint8_t header[WavTranscoder::MAX_HEADER_SIZE];
+    ok = ok && transcoder.finish(header);
+    size_t headerSize = transcoder.headerSize();
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(header, 1, headerSize, out) == headerSize;
+    fclose(in);
+    fclose(out);
+
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", inPath.c_str(), transcoder.getError() ? transcoder.getError() : "write failed");
+        remove(outPath.c_str());
+        return false;
+    }
+    const WavFormat& src = transcoder.getSourceFormat();
+    uint32_t outputBytes = transcoder.getOutputBytes() + (uint32_t)headerSize;
+    if (transcoder.isPassthrough()) {
+        printf("%s: format %#x %u Hz %u bit %u ch kept, samples copied, %u -> %u bytes\n", inPath.c_str(), src.formatTag,
+               src.sampleRate, src.bitsPerSample, src.channels, inputBytes, outputBytes);
+        return true;
+    }
+    printf("%s: %u Hz %u bit %u ch -> %u Hz %u bit mono%s, %u -> %u bytes (%.1fx smaller)\n",
+           inPath.c_str(), src.sampleRate, src.bitsPerSample, src.channels, rate, bits, bits == 4 ? " IMA ADPCM" : "",
+           inputBytes, outputBytes, outputBytes ? (double)inputBytes / outputBytes : 0.0);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    uint32_t rate = 16000;
+    uint16_t bits = 8;
+    std::string outDir;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rate = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            bits = (uint16_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--adpcm") == 0) {
+            bits = 4;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outDir = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 2;
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+    if (outDir.empty() || inputs.empty() || rate < 4000 || rate > 48000 || (bits != 4 && bits != 8 && bits != 16)) {
+        usage();
+        return 2;
+    }
+
+    int failed = 0;
+    for (const std::string& input : inputs) {
+        if (!convertFile(input, outDir + "/" + baseName(input), rate, bits)) failed++;
+    }
+    return failed ? 1 : 0;
+}